@@ -0,0 +1,290 @@
+#include "AudioPlayer.h"
+#include "Dma.h"
+#include "Trace.h"
+
+// SPI is SERCOM4 on the Feather M0
+#define AUDIO_SERCOM        SERCOM4
+#define AUDIO_DMA_TRIGGER   SERCOM4_DMAC_ID_TX
+#define AUDIO_SPI_SETTINGS  SPISettings(8000000, MSBFIRST, SPI_MODE0)
+#define AUDIO_CHUNK_SIZE    32 // bytes the VS1053 always accepts when DREQ is high
+#define AUDIO_MASK          (AUDIO_BUFFER_SIZE - 1)
+
+static_assert((AUDIO_BUFFER_SIZE & AUDIO_MASK) == 0, "AUDIO_BUFFER_SIZE must be a power of 2");
+static_assert(AUDIO_BUFFER_SIZE % AUDIO_BLOCK_SIZE == 0, "AUDIO_BUFFER_SIZE must be a multiple of AUDIO_BLOCK_SIZE");
+
+AudioPlayer *AudioPlayer::instance = nullptr;
+
+AudioPlayer::AudioPlayer(int8_t reset, int8_t cs, int8_t dcs, int8_t dreq)
+  : Adafruit_VS1053(reset, cs, dcs, dreq), dcsPin(dcs), dreqPin(dreq) {
+}
+
+bool AudioPlayer::begin() {
+  instance = this;
+  if (Adafruit_VS1053::begin() != 4) { // VS1053 version
+    return false;
+  }
+  dmaBegin();
+  dmaOnComplete(DMA_CHANNEL_AUDIO, onChunkSent);
+  spiArbiter.onRelease(onSpiRelease);
+  attachInterrupt(digitalPinToInterrupt(dreqPin), onDreq, RISING);
+  return true;
+}
+
+void AudioPlayer::setVolume(uint8_t left, uint8_t right) {
+  volumeLeft = left;
+  volumeRight = right;
+  if (asleep) { // applied on wake up
+    return;
+  }
+  spiArbiter.acquire();
+  Adafruit_VS1053::setVolume(left, right);
+  spiArbiter.release();
+}
+
+void AudioPlayer::sleep() {
+  if (asleep) {
+    return;
+  }
+  stopPlaying();
+  spiArbiter.acquire();
+  sciWrite(VS1053_REG_CLOCKF, 0x0000);
+  sciWrite(VS1053_REG_VOLUME, 0xFFFF); // analog powerdown
+  spiArbiter.release();
+  asleep = true;
+}
+
+void AudioPlayer::wake() {
+  if (!asleep) {
+    return;
+  }
+  asleep = false;
+  spiArbiter.acquire();
+  sciWrite(VS1053_REG_CLOCKF, 0x6000); // as Adafruit_VS1053::begin()
+  spiArbiter.release();
+  setVolume(volumeLeft, volumeRight);
+}
+
+bool AudioPlayer::startPlayingFile(const char *path) {
+  return prepareFile(path) && start();
+}
+
+bool AudioPlayer::prepareFile(const char *path, uint8_t blocks) {
+  if (playing || prepared) {
+    stopPlaying();
+  }
+  wake();
+  spiArbiter.acquire();
+  // reset playback and resync, as the Adafruit file player does
+  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_LAYER12);
+  sciWrite(VS1053_REG_WRAMADDR, 0x1e29);
+  sciWrite(VS1053_REG_WRAM, 0);
+  track = SD.open(path);
+  if (!track) {
+    spiArbiter.release();
+    trace.record(TRACE_SD_ERROR, 0);
+    return false;
+  }
+  // set twice to reset the decode time (datasheet)
+  sciWrite(VS1053_REG_DECODETIME, 0x00);
+  sciWrite(VS1053_REG_DECODETIME, 0x00);
+  spiArbiter.release();
+
+  readIndex = writeIndex = 0;
+  endOfFile = false;
+  starving = false;
+  blocks = min(blocks, (uint8_t) (AUDIO_BUFFER_SIZE / AUDIO_BLOCK_SIZE));
+  for (uint8_t i = 0; i < blocks && !endOfFile; i++) {
+    readBlock();
+  }
+  prepared = true;
+  return true;
+}
+
+bool AudioPlayer::prefill() {
+  if (!prepared || endOfFile || (uint16_t) (writeIndex - readIndex) >= AUDIO_PREFILL_BLOCKS * AUDIO_BLOCK_SIZE) {
+    return false;
+  }
+  readBlock();
+  return true;
+}
+
+bool AudioPlayer::start() {
+  if (!prepared) {
+    return false;
+  }
+  prepared = false;
+  playing = true;
+  noInterrupts();
+  feed();
+  interrupts();
+  return true;
+}
+
+void AudioPlayer::startTone(uint16_t ms) {
+  stopPlaying();
+  wake();
+  spiArbiter.acquire();
+  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_TESTS);
+  spiArbiter.release();
+  tone = true;
+  toneStart = millis();
+  toneLength = ms;
+  serviceTone();
+}
+
+bool AudioPlayer::toning() {
+  return tone;
+}
+
+// beeps from the main loop, nothing to feed meanwhile
+void AudioPlayer::serviceTone() {
+  unsigned long elapsed = millis() - toneStart;
+  if (elapsed >= toneLength) {
+    stopPlaying();
+    return;
+  }
+  bool on = elapsed / AUDIO_TONE_BEEP % 2 == 0;
+  if (on != toneOn) {
+    spiArbiter.acquire();
+    sineTest(on);
+    spiArbiter.release();
+  }
+}
+
+// start and exit sequences on SDI, SM_TESTS set (datasheet 9.12.4)
+void AudioPlayer::sineTest(bool on) {
+  uint8_t start[8] = { 0x53, 0xEF, 0x6E, AUDIO_TONE_SINE, 0, 0, 0, 0 };
+  uint8_t stop[8] = { 0x45, 0x78, 0x69, 0x74, 0, 0, 0, 0 };
+  playData(on ? start : stop, sizeof(start));
+  toneOn = on;
+}
+
+void AudioPlayer::stopPlaying() {
+  // no chunk in flight once we own the bus, and none will start
+  spiArbiter.acquire();
+  if (toneOn) {
+    sineTest(false);
+  }
+  tone = false;
+  playing = false;
+  prepared = false;
+  sciWrite(VS1053_REG_MODE, VS1053_MODE_SM_LINE1 | VS1053_MODE_SM_SDINEW | VS1053_MODE_SM_CANCEL);
+  track.close();
+  readIndex = writeIndex = 0;
+  endOfFile = true;
+  spiArbiter.release();
+}
+
+bool AudioPlayer::stopped() {
+  return !playing && !tone;
+}
+
+bool AudioPlayer::readFailed() {
+  bool failed = readError;
+  readError = false;
+  return failed;
+}
+
+void AudioPlayer::readBlock() {
+  spiArbiter.acquire();
+  int length = track.read(buffer + (writeIndex & AUDIO_MASK), AUDIO_BLOCK_SIZE);
+  spiArbiter.release();
+  if (length > 0) {
+    writeIndex += length;
+  }
+  else if (length < 0) {
+    trace.record(TRACE_SD_ERROR, 1);
+    readError = true;
+  }
+  if (length < AUDIO_BLOCK_SIZE) {
+    endOfFile = true;
+  }
+}
+
+void AudioPlayer::service() {
+  if (tone) {
+    serviceTone();
+  }
+  if (!playing) {
+    return;
+  }
+  for (uint8_t i = 0; i < AUDIO_BLOCKS_PER_SERVICE; i++) {
+    uint16_t space = AUDIO_BUFFER_SIZE - (uint16_t) (writeIndex - readIndex);
+    if (endOfFile || space < AUDIO_BLOCK_SIZE) {
+      break;
+    }
+    readBlock();
+  }
+
+  noInterrupts();
+  if (endOfFile && writeIndex == readIndex && !transferring) {
+    playing = false;
+  }
+  // in case a DREQ edge came while the buffer was empty
+  feed();
+  interrupts();
+
+  if (!playing) {
+    spiArbiter.acquire();
+    track.close();
+    spiArbiter.release();
+  }
+}
+
+// interrupts disabled or from an interrupt
+void AudioPlayer::feed() {
+  if (!playing || transferring || !digitalRead(dreqPin)) {
+    return;
+  }
+  uint16_t available = writeIndex - readIndex;
+  if (available < AUDIO_CHUNK_SIZE && !endOfFile) {
+    if (!starving) {
+      underruns++;
+    }
+    starving = true;
+    return;
+  }
+  starving = false;
+  if (available == 0 || !spiArbiter.tryAcquireFromIsr()) {
+    return;
+  }
+  // chunks never wrap: the buffer size is a multiple of the chunk size and
+  // only the last chunk of a file may be shorter
+  chunkLength = min(available, (uint16_t) AUDIO_CHUNK_SIZE);
+  transferring = true;
+  SPI.beginTransaction(AUDIO_SPI_SETTINGS);
+  digitalWrite(dcsPin, LOW);
+  dmaStart(DMA_CHANNEL_AUDIO, AUDIO_DMA_TRIGGER, buffer + (readIndex & AUDIO_MASK), true,
+           &AUDIO_SERCOM->SPI.DATA.reg, false, chunkLength);
+}
+
+void AudioPlayer::onDreq() {
+  unsigned long start = micros();
+  instance->feed();
+  instance->isrTime += micros() - start;
+}
+
+void AudioPlayer::onChunkSent() {
+  unsigned long start = micros();
+  Sercom *sercom = AUDIO_SERCOM;
+  // DMA is done when the last byte is written, not shifted out
+  while (!sercom->SPI.INTFLAG.bit.TXC);
+  // drop what was received meanwhile, SPI.transfer expects an empty receiver
+  while (sercom->SPI.INTFLAG.bit.RXC) {
+    (void) sercom->SPI.DATA.reg;
+  }
+  sercom->SPI.STATUS.reg = SERCOM_SPI_STATUS_BUFOVF;
+  digitalWrite(instance->dcsPin, HIGH);
+  SPI.endTransaction();
+  instance->readIndex += instance->chunkLength;
+  instance->transferring = false;
+  spiArbiter.releaseFromIsr();
+  instance->feed();
+  instance->isrTime += micros() - start;
+}
+
+void AudioPlayer::onSpiRelease() {
+  if (instance) {
+    instance->feed();
+  }
+}
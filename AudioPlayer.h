@@ -0,0 +1,87 @@
+#ifndef AudioPlayer_h
+#define AudioPlayer_h
+
+#include <SPI.h>
+#include <SD.h>
+#include <Adafruit_VS1053.h>
+#include "constants.h"
+#include "SpiArbiter.h"
+
+// VS1053 file player replacing Adafruit_VS1053_FilePlayer's feeding, which
+// reads the SD card from the DREQ interrupt one SPI byte at a time.
+// Here the main loop reads whole blocks from the card into a RAM ring buffer
+// (service()), and the DREQ interrupt only pushes 32 byte chunks from RAM to
+// the VS1053 with DMA, chaining chunks from the DMA completion interrupt
+// while DREQ stays high.
+class AudioPlayer : public Adafruit_VS1053 {
+  public:
+    AudioPlayer(int8_t reset, int8_t cs, int8_t dcs, int8_t dreq);
+    bool begin();
+    void setVolume(uint8_t left, uint8_t right);
+    bool startPlayingFile(const char *path);
+    // startPlayingFile in two steps: open the file and fill the buffer with
+    // its first blocks, then start feeding the decoder. start() fails if no
+    // file is prepared (stopped or replaced in between).
+    bool prepareFile(const char *path, uint8_t blocks = AUDIO_PREFILL_BLOCKS);
+    // one more block of a prepared file, false once AUDIO_PREFILL_BLOCKS are
+    // buffered or the file ended
+    bool prefill();
+    bool start();
+    // The VS1053 sine test, beeping for ms, where there is no track to play.
+    // Counts as playing until then, stopPlaying() ends it.
+    void startTone(uint16_t ms);
+    bool toning();
+    void stopPlaying();
+    bool stopped();
+    // a card read failed since the last call, the track ended there
+    bool readFailed();
+    // refill the buffer from the card, call every loop
+    void service();
+    // Low power: internal clock multiplier off and analog powered down.
+    // Starting a file wakes the VS1053 up.
+    void sleep();
+    void wake();
+
+    // times DREQ asked for data while the buffer was empty before the end of
+    // the file
+    volatile uint16_t underruns = 0;
+    // us spent in the DREQ and DMA interrupts, reset by the reader
+    volatile uint32_t isrTime = 0;
+
+  private:
+    uint8_t dcsPin;
+    uint8_t dreqPin;
+    File track;
+    volatile bool playing = false;
+    bool endOfFile = true;
+    bool starving = false;
+    bool asleep = false;
+    bool prepared = false;
+    uint8_t volumeLeft = 0;
+    uint8_t volumeRight = 0;
+    bool readError = false;
+
+    bool tone = false;
+    bool toneOn = false; // the sine, between beeps
+    unsigned long toneStart; // millis()
+    uint16_t toneLength;
+    void serviceTone();
+    void sineTest(bool on);
+
+    // ring buffer, free running indices
+    uint8_t buffer[AUDIO_BUFFER_SIZE];
+    volatile uint16_t readIndex = 0; // next byte sent to the VS1053
+    volatile uint16_t writeIndex = 0; // next byte read from the card
+    volatile bool transferring = false;
+    uint8_t chunkLength;
+
+    void readBlock();
+    void feed();
+
+    static AudioPlayer *instance;
+    static void onDreq();
+    static void onChunkSent();
+    static void onSpiRelease();
+};
+
+#endif
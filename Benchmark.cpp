@@ -0,0 +1,49 @@
+#include "Benchmark.h"
+
+#if FEATURE_BENCHMARK
+Benchmark benchmark;
+
+// indices of each kind, in order
+static const uint8_t KIND_SIZES[BENCHMARK_KINDS] = { STATE_COUNT, 1, 1, ALARM_TRACK_MAX, 1, 1, 1 };
+
+void Timing::add(uint32_t us) {
+  minUs = runs == 0 ? us : min(minUs, us);
+  maxUs = max(maxUs, us);
+  totalUs += us;
+  runs++;
+}
+
+uint32_t Timing::averageUs() {
+  return runs > 0 ? totalUs / runs : 0;
+}
+
+void Benchmark::reset() {
+  memset(timings, 0, sizeof(timings));
+}
+
+Timing &Benchmark::timing(BenchmarkKind kind, uint8_t index) {
+  uint16_t i = index;
+  for (uint8_t k = 0; k < kind; k++) {
+    i += KIND_SIZES[k];
+  }
+  return timings[i];
+}
+
+Timing &Benchmark::timing(uint16_t i, uint8_t &kind, uint8_t &index) {
+  kind = 0;
+  index = i;
+  while (index >= KIND_SIZES[kind]) {
+    index -= KIND_SIZES[kind];
+    kind++;
+  }
+  return timings[i];
+}
+
+uint32_t Benchmark::summary(BenchmarkKind kind) {
+  uint32_t worst = 0;
+  for (uint8_t i = 0; i < KIND_SIZES[kind]; i++) {
+    worst = max(worst, timing(kind, i).averageUs());
+  }
+  return worst;
+}
+#endif
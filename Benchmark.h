@@ -0,0 +1,50 @@
+#ifndef Benchmark_h
+#define Benchmark_h
+
+#include <Arduino.h>
+#include "constants.h"
+#include "State.h"
+
+// What the self-benchmark times (Clock::benchmarkStep), render() by state and
+// the track start by track
+typedef enum {
+  BENCHMARK_RENDER,      // render() of every state, its flush() queued
+  BENCHMARK_FLUSH,       // a full frame flushed and on the display
+  BENCHMARK_RTC_READ,    // the 7 time registers, queued and waited for
+  BENCHMARK_PLAY_START,  // playAlarm() of every track to the decoder started
+  BENCHMARK_FLASH_ERASE, // the settings row
+  BENCHMARK_FLASH_WRITE, // the settings
+  BENCHMARK_INPUT,       // Input::update()
+  BENCHMARK_KINDS
+} BenchmarkKind;
+
+class Timing {
+  public:
+    uint16_t runs;
+    uint32_t minUs;
+    uint32_t maxUs;
+    uint32_t totalUs;
+    void add(uint32_t us);
+    uint32_t averageUs();
+};
+
+// Results of the last run, kept until the next one
+class Benchmark {
+  public:
+    void reset();
+    Timing &timing(BenchmarkKind kind, uint8_t index = 0);
+
+    // flattened for export, in kind order
+    static const uint16_t TIMING_COUNT = STATE_COUNT + ALARM_TRACK_MAX + 5;
+    Timing &timing(uint16_t i, uint8_t &kind, uint8_t &index);
+
+    // the figure shown for a kind: its worst average over indices, in us
+    uint32_t summary(BenchmarkKind kind);
+
+  private:
+    Timing timings[TIMING_COUNT];
+};
+
+extern Benchmark benchmark;
+
+#endif
@@ -2,112 +2,374 @@
 
 static const uint8_t daysInMonth [] = { 31,28,31,30,31,30,31,31,30,31,30,31 };
 
-FlashStorage(flash_settings, Settings);
+// scrolled on the display by die(), indexed by error code
+static const char *const ERROR_TEXTS[] = {
+  "",
+  "Err 1 rtc",
+  "Err 2 PLAYEr"
+};
 
+// As FlashStorage(), but erased and written in separate steps by flashTask
+__attribute__((__aligned__(256))) static const uint8_t settingsFlashData[(sizeof(Settings) + 255) / 256 * 256] = { };
+FlashClass settingsFlash(settingsFlashData, sizeof(Settings));
+FlashStorage(flash_sd_profile, SdProfile);
+
+#if FEATURE_BENCHMARK
+// summary pages, by kind: the label, then the figure in us (ms for PLAY)
+static const char *const BENCHMARK_LABELS[BENCHMARK_KINDS] = { "rEnd", "dISP", "rtc", "PLAY", "ErAS", "Prog", "InPt" };
+#endif
+
+static bool ringing(State s) {
+  return s == RINGING_ALARM_1 || s == RINGING_ALARM_2 || s == RINGING_NAP;
+}
+
+// nothing to pick from (no track on the card) leaves n as it is
 uint8_t incr(uint8_t n, uint8_t modulo) {
-  return (n + 1) % modulo;
+  return modulo ? (n + 1) % modulo : n;
 }
 
 uint8_t decr(uint8_t n, uint8_t modulo) {
-  return (n + modulo - 1) % modulo;
+  return modulo ? (n + modulo - 1) % modulo : n;
 }
 
-void Clock::die(char* msg, uint8_t errCode) {
-   Serial.println(msg);
-   display.printErr(errCode);
-   display.flush();
-   while (1);
+// Show the error, then reboot: the trace ring is dumped on the next boot.
+// Consecutive crashes keep the error longer before trying again.
+void Clock::die(LogMessage msg, uint8_t errCode) {
+   snapshot.invalidate();
+   trace.record(TRACE_DIE, errCode);
+   LOG_ERROR(msg);
+   serialLink.flushAll();
+   display.setBlinking(0);
+   display.setScroll(ERROR_TEXTS[errCode]);
+   unsigned long delay = min((unsigned long) DIE_REBOOT_DELAY * (trace.crashes + 1), (unsigned long) DIE_MAX_REBOOT_DELAY);
+   unsigned long start = millis();
+   while (millis() - start < delay) {
+     display.printScroll();
+     display.flush();
+     i2cBus.poll();
+     watchdog.reset();
+   }
+   trace.crash(CRASH_DIE, errCode);
 }
 
 void Clock::init() {
+  warmBoot = isWarmReset() && snapshot.valid();
   Serial.begin(9600);
+  if (trace.begin()) {
+    traceCursor = 0; // report the crash
+  }
   // while (!Serial);
-  Serial.println("Boot");
+  LOG_INFO(warmBoot ? LOG_WARM_BOOT : LOG_BOOT);
+  // armed before initDisplay, which may hang
+  watchdog.enable(WATCHDOG_TIMEOUT);
   initFlashSettings();
-  Serial.println("Init Flash OK");
+  LOG_INFO(LOG_INIT_FLASH);
   initInput();
-  Serial.println("Init input OK");
+  LOG_INFO(LOG_INIT_INPUT);
   initDisplay();
-  Serial.println("Init display OK");
+  LOG_INFO(LOG_INIT_DISPLAY);
   initRTC();
-  Serial.println("Init RTC OK");
-  initSD();
-  Serial.println("Init SD OK");
+  LOG_INFO(LOG_INIT_RTC);
+#if FEATURE_HISTORY
+  history.begin();
+  history.record(HISTORY_BOOT, currentTime.unixtime(), PM->RCAUSE.reg);
+#endif
+  if (warmBoot) {
+    // show the countdown/alarm right away, sound follows once the player is up
+    restoreSnapshot();
+    render();
+    i2cBus.drain();
+  }
+  // needs the time, and the last rings on warm boots
+  scheduleAlarms();
+  pinMode(ALT_CARD_DETECT, INPUT_PULLUP);
+  cardDetected = digitalRead(ALT_CARD_DETECT);
+  tasks.add(&bootTask);
+  tasks.add(&flashTask);
+  tasks.add(&rtcTask);
+  tasks.add(&playTask);
+  tasks.add(&syncTask);
+  tasks.add(&cardTask);
+  tasks.add(&trackIndex.indexTask);
+#if FEATURE_BENCHMARK
+  tasks.add(&benchmarkTask);
+#endif
+#if FEATURE_HISTORY
+  tasks.add(&history.flushTask);
+#endif
+  bootTask.start();
+  if (warmBoot) {
+    // the track waits for the player, the alarm or nap keeps going meanwhile
+    resumePlayback();
+  }
+}
+
+// The card and the player take up to a second: the time is shown and input
+// works meanwhile. Sounds wait for soundReady. Without a card the clock
+// comes up all the same, cardTask mounts one when it shows up.
+bool Clock::bootStep(Task &task) {
+  TASK_BEGIN(task);
+  cardTask.start();
+  TASK_WAIT_UNTIL(task, !cardTask.running());
   initSound();
-  Serial.println("Init Sound OK");
+  LOG_INFO(LOG_INIT_SOUND);
+  sleep.begin(BUTTON_PINS, BUTTON_COUNT); // after the player's DREQ interrupt
   // disable the power led if everything went well
   pinMode(POWER_LED, OUTPUT);
   digitalWrite(POWER_LED, LOW);
-  Serial.println("Full init OK");
+  LOG_INFO(LOG_INIT_DONE);
+  TASK_END(task);
 }
 
 void Clock::initDisplay() {
-  display.begin(0x70); // Sometimes code hangs here after a reset. The Display is not resetted correctly
-  display.setBrightness(0); // 0-15
+  i2cBus.begin();
+  display.begin(DISPLAY_I2C_ADDRESS); // Sometimes code hangs here after a reset. The Display is not resetted correctly, the watchdog will reset us
+  display.setDimming(settings.brightness);
   display.printBoot();
   display.flush();
+  i2cBus.drain();
 }
 
 void Clock::initRTC() {
    if (!rtc.begin()) {
-    die("Failed to init RTC", 1);
+    die(LOG_RTC_FAILED, 1);
    }
 
   if (rtc.lostPower()) {
     rtc.adjust(DateTime(F(__DATE__), F(__TIME__)));
+    // the last sync went with the time
+    uint8_t none[4] = {};
+    writeRtcRegisters(0x07, none, sizeof(none));
   }
+  // display.begin and rtc.begin both reset Wire to 100kHz
+  Wire.setClock(I2C_CLOCK);
+  currentTime = rtc.now();
+  uint8_t raw[4];
+  readRtcRegisters(0x07, raw, sizeof(raw)); // alarm 1
+  lastSync = readU32(raw);
+  readRtcRegisters(0x10, raw, 1); // aging offset
+  rtcAging = raw[0];
 }
 
 void Clock::initFlashSettings() {
-  settings = flash_settings.read();
+  settingsFlash.read(&settings);
 
-  if (!settings.valid) {
-    // settings have never been written to flash, initialize settings
+  if (settings.version != SETTINGS_VERSION) {
+    // never written, or by another version: initialize settings
     settings = Settings();
     settings.alarm1.enabled = true;
     settings.alarm1.hour = 7;
     settings.alarm1.minute = 0;
-    settings.alarm1.weekend = false;
-    flash_settings.write(settings);
+    settings.alarm1.days = WORK_DAYS;
+    settingsFlash.erase();
+    settingsFlash.write(&settings);
   }
 }
 
 void Clock::initSound() {
-  player = Adafruit_VS1053_FilePlayer(VS1053_RESET, VS1053_CS, VS1053_DCS, VS1053_DREQ, sdPin);
   if (! player.begin()) {
-    die("Failed to init player", 2);
+    die(LOG_PLAYER_FAILED, 2);
   }
-
-  // If DREQ is on an interrupt pin we can do background audio playing
-  player.useInterrupt(VS1053_FILEPLAYER_PIN_INT);  // DREQ int
+  soundReady = true;
 
   applyVolume();
-  player.startPlayingFile(TRACK_BOOT);
+  if (!warmBoot) {
+    playFile(TRACK_BOOT);
+  }
 }
 
-void Clock::initSD() {
-  sdPin = CARD_CS;
-  pinMode(ALT_CARD_DETECT, INPUT_PULLUP);
-  if (digitalRead(ALT_CARD_DETECT)) {
-    sdPin = ALT_CARD_CS;
+// the alternate slot when its switch says it holds a card, false if no card
+// answers
+bool Clock::initSD() {
+  sdPin = cardDetected ? ALT_CARD_CS : CARD_CS;
+  if (!SdProbe::present(sdPin, false)) {
+    return false;
   }
-  if (!SD.begin(sdPin)) {
-    die("Failed to init SD card", 3);
+  SD.end(); // a card mounted before
+  return initSDClock();
+}
+
+// The SPI clock comes from a probe of the card, run once per card on boot: it
+// takes seconds, in a single step. A new card plugged in later runs at the
+// default clock until the next boot probes it.
+bool Clock::initSDClock() {
+  SdProbe probe; // its block buffer only lives during init
+  uint8_t cid[16] = {};
+  sdProfile = flash_sd_profile.read();
+  newCard = !probe.matches(sdPin, sdProfile, cid);
+  if (newCard && !bootTask.running()) {
+    LOG_INFO(LOG_SD_PROBE_DEFERRED);
+    sdProfile = SdProfile();
+    memcpy(sdProfile.cid, cid, sizeof(cid));
   }
-  // Check files existence
-  if (!SD.exists(TRACK_BUTTON_PRESS)) {
-    Serial.println("Couldn't find " TRACK_BUTTON_PRESS);
+  else if (newCard) {
+    watchdog.reset();
+    if (probe.run(sdPin, sdProfile)) {
+      flash_sd_profile.write(sdProfile);
+    }
+    else {
+      LOG_WARN(LOG_SD_PROBE_FAILED);
+      sdProfile = SdProfile();
+    }
+    watchdog.reset();
   }
-  if (!SD.exists(TRACK_NAP)) {
-    Serial.println("Couldn't find " TRACK_NAP);
-    die("Missing " TRACK_NAP, 4);
+  bool ready = sdProfile.clock ? SD.begin(sdProfile.clock, sdPin) : SD.begin(sdPin);
+  if (!ready) {
+    return false;
+  }
+  LOG_INFO(LOG_SD_CLOCK, sdProfile.clock / 1000);
+  LOG_INFO(LOG_SD_SEQUENTIAL_READ, sdProfile.sequentialUs);
+  LOG_INFO(LOG_SD_RANDOM_READ, sdProfile.randomUs);
+  return true;
+}
+
+// The alternate slot's switch is debounced, then the card is mounted again.
+// The main slot has none, it's asked whether a card is there every
+// CARD_POLL_DELAY: a CMD0 when none is mounted, a CMD13 otherwise.
+void Clock::checkCard() {
+  bool detected = digitalRead(ALT_CARD_DETECT);
+  if (detected != cardDetected) {
+    cardDetected = detected;
+    cardChanged = millis();
+    cardPending = true;
+  }
+  if (bootTask.running() || cardTask.running()) {
+    return;
+  }
+  if (cardPending) {
+    if (millis() - cardChanged >= CARD_DETECT_DEBOUNCE) {
+      cardPending = false;
+      cardTask.start();
+    }
+    return;
+  }
+  if (millis() - lastCardPoll < CARD_POLL_DELAY) {
+    return;
+  }
+  lastCardPoll = millis();
+  if (cardDetected) {
+    // in the slot but not mounted, try again
+    if (!cardReady) {
+      cardTask.start();
+    }
+    return;
+  }
+  spiArbiter.acquire();
+  bool present = SdProbe::present(CARD_CS, cardReady);
+  spiArbiter.release();
+  if (present != cardReady) {
+    if (cardReady) {
+      cardLost();
+    }
+    cardTask.start();
+  }
+}
+
+// A read failed or the card is gone: a track playing from it goes on as the
+// tone if it's a ring, a track being armed is dropped
+void Clock::cardLost() {
+  LOG_WARN(LOG_CARD_LOST);
+  cardReady = false;
+  trackIndex.stop();
+  if (armed) {
+    armed = false;
+    player.stopPlaying();
+  }
+  if (!soundStopped() && !player.toning()) {
+    stopSound();
+    if (ringing(state)) {
+      setPlayGain(0);
+      player.startTone(AUDIO_TONE_TIME);
+    }
+  }
+}
+
+// Mounted first, then the tracks are counted one file per step, as on boot:
+// a warm boot keeps the count of the snapshot if the card is the same. A
+// track still playing from a mounted card finishes first. Once ready, the
+// tracks are indexed in the background.
+bool Clock::cardStep(Task &task) {
+  TASK_BEGIN(task);
+  TASK_WAIT_UNTIL(task, !cardReady || (soundStopped() && !armed));
+  cardReady = false;
+  trackIndex.stop();
+  lastCardPoll = millis();
+  if (!initSD()) {
+    LOG_WARN(LOG_SD_FAILED);
+    return false;
+  }
+  LOG_INFO(LOG_INIT_SD);
+  if (!(bootTask.running() && tracksCounted && !newCard)) {
+    tracksCounted = false;
+    TASK_YIELD(task);
+    if (!SD.exists(TRACK_BUTTON_PRESS)) {
+      LOG_WARN(LOG_NO_BUTTON_TRACK);
+    }
+#if FEATURE_NAP
+    TASK_YIELD(task);
+    if (!SD.exists(TRACK_NAP)) {
+      LOG_WARN(LOG_NO_NAP_TRACK); // naps ring with the tone
+    }
+#endif
+    // consecutive alarm track files
+    scanTrack = 0;
+    while (scanTrack < ALARM_TRACK_MAX) {
+      TASK_YIELD(task);
+      if (!checkAlarmFile(scanTrack)) {
+        break;
+      }
+      scanTrack++;
+    }
+    // pulled meanwhile, the count may be short
+    if (cardPending || !SdProbe::present(sdPin, true)) {
+      return false;
+    }
+    alarmTrackCount = scanTrack;
+    tracksCounted = true;
+    LOG_INFO(LOG_ALARM_TRACKS, alarmTrackCount);
+  }
+#if FEATURE_CONFIG_FILE
+  // a chunk per step into a copy, applied and saved once all read if it
+  // changed anything. A read failure leaves the settings alone, the card is
+  // going and cardTask reads the file again once it's back.
+  spiArbiter.acquire();
+  configFile = SD.open(CONFIG_FILE);
+  spiArbiter.release();
+  if (configFile) {
+    configSettings = settings;
+    config.begin(&configSettings);
+    while ((configStatus = config.read(configFile)) == CONFIG_READING) {
+      TASK_YIELD(task);
+    }
+    spiArbiter.acquire();
+    configFile.close();
+    spiArbiter.release();
+    if (configStatus == CONFIG_FAILED) {
+      return false;
+    }
+    if (config.changed) {
+      settings = configSettings;
+      writeSettings();
+      applyVolume();
+      display.setDimming(settings.brightness);
+    }
+  }
+#endif
+  // settings read back from flash may predate the clamp, on a warm boot
+  clampTracks();
+  cardReady = true;
+  trackIndex.start(sdProfile.cid, alarmTrackCount);
+  TASK_END(task);
+}
+
+// alarms set past the tracks of a new card take its last one
+void Clock::clampTracks() {
+  uint8_t last = alarmTrackCount > 0 ? alarmTrackCount - 1 : 0;
+  if (settings.alarm1.track > last || settings.alarm2.track > last) {
+    settings.alarm1.track = min(settings.alarm1.track, last);
+    settings.alarm2.track = min(settings.alarm2.track, last);
+    writeSettings();
   }
-  // Check consecutive alarm track files
-  uint8_t i = 0;
-  while (checkAlarmFile(i) && i < 8) i++;
-  alarmTrackCount = i;
-  Serial.print("Alarm tracks found: ");
-  Serial.println(alarmTrackCount);
 }
 
 void Clock::initInput() {
@@ -115,115 +377,1165 @@ void Clock::initInput() {
 }
 
 void Clock::applyVolume() {
-  // convert [0-99] to [0x80 - 0x00]
-  // 0xFE = theoretical min
-  // 0x80 = actual usable min
-  uint8_t volume = 0x80 - ((uint8_t) (settings.volume * 1.3));
-  player.setVolume(volume, volume);
+  uint8_t volume = VOLUME_ATTENUATION[min(settings.volume, (uint8_t) 99)];
+  volume = muted ? VOLUME_MUTE : min(volume + playGain, VOLUME_MUTE);
+  if (soundReady) { // initSound applies it
+    player.setVolume(volume, volume);
+  }
 }
 
-void Clock::playButtonBeep() {
-  if (player.stopped()) {
-    player.startPlayingFile(TRACK_BUTTON_PRESS);
+// a register write when it changes
+void Clock::setPlayGain(uint8_t gain) {
+  if (gain != playGain) {
+    playGain = gain;
+    applyVolume();
   }
 }
 
-String Clock::getAlarmFileName(uint8_t track) {
-  char filename[] = TRACK_ALARM_PATTERN;
-  char *c = strchr(filename, '?');
-  if (c) {
-    *c = '1' + track;
+// direct rather than through playTask: it's short and its latency shows
+void Clock::playButtonBeep() {
+  if (soundReady && cardReady && soundStopped() && !armed) {
+    setPlayGain(0);
+    if (player.startPlayingFile(TRACK_BUTTON_PRESS)) {
+#if FEATURE_LATENCY_TRACE
+      latencyTrace.soundStarted();
+#endif
+    }
   }
-  return String(filename);
 }
 
 void Clock::playAlarm(uint8_t track) {
-  String file = getAlarmFileName(track);
-  player.stopPlaying();
-  player.startPlayingFile(file.c_str());
+  bool wasArmed = armed;
+  armed = false;
+  setPlayGain(trackIndex.gain(track));
+  if (wasArmed && armedTrack == track && player.start()) {
+    return;
+  }
+  playFile(TrackIndex::fileName(track), true);
 }
 
+bool Clock::loopTrack(uint8_t track) {
+  uint16_t seconds = trackIndex.seconds(track);
+  return seconds != 0 && seconds < ALARM_LOOP_TIME && millis() - ringStarted < ALARM_LOOP_TIME * 1000ul;
+}
+
+#if FEATURE_NAP
 void Clock::playNap() {
-  player.stopPlaying();
-  player.startPlayingFile(TRACK_NAP);
+  setPlayGain(0);
+  playFile(TRACK_NAP, true);
+}
+#endif
+
+void Clock::playFile(const String &path, bool tone) {
+  stopSound();
+  playPath = path;
+  playTone = tone;
+  playTask.start();
+}
+
+// opening a file walks the FAT directory, then each block is a card read
+bool Clock::playStep(Task &task) {
+  TASK_BEGIN(task);
+  TASK_WAIT_UNTIL(task, soundReady);
+  if (!cardReady || !player.prepareFile(playPath.c_str(), 0)) {
+    if (playTone) {
+      LOG_WARN(LOG_TONE);
+      setPlayGain(0);
+      player.startTone(AUDIO_TONE_TIME);
+    }
+    return false;
+  }
+  while (player.prefill()) {
+    TASK_YIELD(task);
+  }
+  player.start();
+  TASK_END(task);
+}
+
+void Clock::stopSound() {
+  playTask.cancel();
+  if (soundReady) {
+    player.stopPlaying();
+  }
+}
+
+// a track being opened counts as playing
+bool Clock::soundStopped() {
+  return player.stopped() && !playTask.running();
 }
 
 bool Clock::checkAlarmFile(uint8_t track) {
-  return SD.exists(getAlarmFileName(track));
+  return SD.exists(TrackIndex::fileName(track).c_str());
 }
 
 void Clock::run() {
+  unsigned long loopStart = micros();
+  i2cBus.poll();
+#if FEATURE_LATENCY_TRACE
+  if (display.frameSent()) {
+    latencyTrace.frameSent();
+  }
+#endif
+  updateTime();
+  player.service();
+  if (player.readFailed() && cardReady) {
+    cardLost();
+  }
+  checkCard();
+  serveLink();
   input.update();
   Command c = input.getCommand();
+#if FEATURE_LATENCY_TRACE
+  if (c != NONE) {
+    latencyTrace.press(c, state, input.event.edge);
+  }
+#endif
+  State previous = state;
   alarmTransition(); // pre-emptive state change
   state = transition(state, c);
   if (c != NONE) {
+    trace.record(TRACE_COMMAND, c, previous);
     playButtonBeep();
   }
+  if (state != previous) {
+    trace.record(TRACE_STATE, previous, state);
+#if FEATURE_HISTORY
+    recordHistory(previous, c);
+#endif
+  }
   render();
+  i2cBus.poll();
+#if FEATURE_HISTORY
+  history.service();
+#endif
+  tasks.run(TASK_BUDGET);
+  saveSnapshot();
+  serialLink.flush();
+  watchdog.reset();
+
+  uint32_t loopTime = micros() - loopStart;
+  loopCount++;
+  loopTotalTime += loopTime;
+  loopMaxTime = max(loopMaxTime, loopTime);
+  if (loopTime > TRACE_SLOW_LOOP_TIME) {
+    trace.record(TRACE_SLOW_LOOP, 0, min(loopTime / 1000, (uint32_t) UINT16_MAX));
+  }
+  if (trace.crashes > 0 && millis() > TRACE_STABLE_TIME) {
+    trace.crashes = 0;
+  }
+
+  if (state == DARK_MODE) {
+    sleepInDarkMode();
+  }
+}
+
+void Clock::sleepInDarkMode() {
+  // The RTC only ticks seconds: to start an alarm on time, stay awake
+  // polling it for the last seconds before its minute.
+  uint32_t seconds = 60 - currentTime.second();
+  if (alarmDueNextMinute()) {
+    if (seconds <= DARK_MODE_WAKE_MARGIN) {
+      return;
+    }
+    seconds -= DARK_MODE_WAKE_MARGIN;
+  }
+  // also keeps a warm boot into dark mode awake until the player is up, a
+  // press made while awake is debounced here, a host syncing the time sees
+  // the seconds start, and exports go out
+  if (!tasks.idle() || input.busy() || millis() - lastSyncPing < SYNC_AWAKE_TIME || exporting()) {
+    return;
+  }
+  player.sleep();
+  i2cBus.drain(); // display standby
+  serialLink.flushAll();
+
+  watchdog.disable();
+  bool button = sleep.until(seconds * 1000);
+  unsigned long wakeStart = micros();
+
+  // the read queued before sleeping is stale
+  rtcRead.status = I2C_IDLE;
+  currentTime = rtc.now();
+  if (button) {
+    // show the time now rather than after the debounced click, which would
+    // only come on release
+    state = DISPLAY_TIME;
+    trace.record(TRACE_STATE, DARK_MODE, DISPLAY_TIME);
+    input.ignoreUntilReleased();
+    render();
+    i2cBus.drain();
+    uint32_t latency = micros() - wakeStart;
+    if (latency > DARK_MODE_MAX_WAKE_LATENCY * 1000UL) {
+      LOG_WARN(LOG_SLOW_WAKE, latency);
+    }
+  }
+  // last, its register synchronization takes a few ms
+  watchdog.enable(WATCHDOG_TIMEOUT);
+}
+
+bool Clock::alarmDueNextMinute() {
+  uint32_t next = currentTime.unixtime() + 60 - currentTime.second();
+#if FEATURE_ALARM_2
+  if (alarmDue(schedule2, next)) {
+    return true;
+  }
+#endif
+  return alarmDue(schedule1, next);
+}
+
+void Clock::serveLink() {
+  if (serialLink.receive()) {
+    handleFrame();
+  }
+  if (telemetryPeriod > 0 && millis() - lastTelemetry >= telemetryPeriod) {
+    sendTelemetry();
+  }
+#if FEATURE_LATENCY_TRACE
+  if (latencyCursor >= 0) {
+    sendLatency();
+  }
+#endif
+#if FEATURE_BENCHMARK
+  if (benchmarkCursor >= 0) {
+    sendBenchmark();
+  }
+#endif
+#if FEATURE_HISTORY
+  if (historyCursor >= 0) {
+    sendHistory();
+  }
+#endif
+  if (traceCursor >= 0) {
+    sendTrace();
+  }
+}
+
+// an export streams over several loops
+bool Clock::exporting() {
+#if FEATURE_LATENCY_TRACE
+  if (latencyCursor >= 0) {
+    return true;
+  }
+#endif
+#if FEATURE_HISTORY
+  if (historyCursor >= 0) {
+    return true;
+  }
+#endif
+  return traceCursor >= 0;
+}
+
+// Crash header (reason, argument, consecutive crashes, record count), then
+// one frame per record, oldest first, as the link queue allows
+void Clock::sendTrace() {
+  uint8_t payload[8];
+  if (traceCursor == 0) {
+    payload[0] = trace.reason;
+    writeU32(payload + 1, trace.reasonArg);
+    payload[5] = trace.crashes;
+    payload[6] = trace.count();
+    if (!serialLink.send(FRAME_CRASH, payload, 7)) {
+      return;
+    }
+    traceCursor++;
+  }
+  while (traceCursor <= trace.count()) {
+    const TraceEntry &e = trace.entry(traceCursor - 1);
+    writeU32(payload, e.time);
+    payload[4] = e.type;
+    payload[5] = e.a;
+    writeU16(payload + 6, e.b);
+    if (!serialLink.send(FRAME_TRACE, payload, sizeof(payload))) {
+      return;
+    }
+    traceCursor++;
+  }
+  trace.reason = CRASH_NONE;
+  traceCursor = -1;
+}
+
+void Clock::handleFrame() {
+  uint8_t *payload = serialLink.rxPayload;
+  uint8_t length = serialLink.rxLength;
+  switch (serialLink.rxType) {
+    case FRAME_GET_SETTINGS:
+      sendSettings();
+      break;
+    case FRAME_SET_SETTINGS: {
+      // the whole settings at once, committed to flash once
+      if (length != SETTINGS_PACKED_SIZE) {
+        ack(FRAME_SET_SETTINGS, ACK_BAD_FRAME);
+        break;
+      }
+      Settings s = settings;
+      if (!s.unpack(payload) || s.alarm1.track >= alarmTrackCount || s.alarm2.track >= alarmTrackCount) {
+        ack(FRAME_SET_SETTINGS, ACK_BAD_VALUE);
+        break;
+      }
+      settings = s;
+      writeSettings();
+      applyVolume();
+      ack(FRAME_SET_SETTINGS, ACK_OK);
+      break;
+    }
+    case FRAME_SET_TIME:
+      // local unixtime
+      if (length != 4) {
+        ack(FRAME_SET_TIME, ACK_BAD_FRAME);
+        break;
+      }
+      // the DS3231 only counts years 2000 to 2099
+      if (readU32(payload) < SECONDS_FROM_1970_TO_2000 || DateTime(readU32(payload)).year() > 2099) {
+        ack(FRAME_SET_TIME, ACK_BAD_VALUE);
+        break;
+      }
+      adjustTime(DateTime(readU32(payload)));
+      ack(FRAME_SET_TIME, ACK_OK);
+      break;
+    case FRAME_SET_TELEMETRY:
+      // period in ms, 0 to stop
+      if (length != 2) {
+        ack(FRAME_SET_TELEMETRY, ACK_BAD_FRAME);
+        break;
+      }
+      telemetryPeriod = readU16(payload);
+      resetTelemetry(); // counted while it was off, or over another period
+      ack(FRAME_SET_TELEMETRY, ACK_OK);
+      break;
+    case FRAME_GET_TRACE:
+      traceCursor = 0;
+      ack(FRAME_GET_TRACE, ACK_OK);
+      break;
+    case FRAME_SYNC_PING:
+      // sequence number, echoed
+      if (length != 1) {
+        ack(FRAME_SYNC_PING, ACK_BAD_FRAME);
+        break;
+      }
+      sendTimeSync(payload[0], micros());
+      lastSyncPing = millis();
+      break;
+    case FRAME_SYNC_TIME: {
+      // local unixtime, micros() when its second starts, aging offset
+      if (length != 9) {
+        ack(FRAME_SYNC_TIME, ACK_BAD_FRAME);
+        break;
+      }
+      uint32_t t = readU32(payload);
+      int32_t lead = readU32(payload + 4) - micros();
+      if (t < SECONDS_FROM_1970_TO_2000 || DateTime(t).year() > 2099 || lead < 0 || lead > SYNC_MAX_LEAD) {
+        ack(FRAME_SYNC_TIME, ACK_BAD_VALUE);
+        break;
+      }
+      syncTime = DateTime(t);
+      syncAt = readU32(payload + 4);
+      syncAging = payload[8];
+      // a time write still queued goes first, and is overwritten
+      rtcTask.cancel();
+      syncTask.start();
+      ack(FRAME_SYNC_TIME, ACK_OK);
+      break;
+    }
+#if FEATURE_LATENCY_TRACE
+    case FRAME_GET_LATENCY:
+      // reset flag: clear the histograms once exported
+      if (length != 1) {
+        ack(FRAME_GET_LATENCY, ACK_BAD_FRAME);
+        break;
+      }
+      latencyCursor = 0;
+      latencyReset = payload[0];
+      ack(FRAME_GET_LATENCY, ACK_OK);
+      break;
+#endif
+#if FEATURE_BENCHMARK
+    case FRAME_RUN_BENCHMARK:
+      // from the clock only, as with the button
+      if (state != DISPLAY_TIME && state != DARK_MODE) {
+        ack(FRAME_RUN_BENCHMARK, ACK_BAD_VALUE);
+        break;
+      }
+      trace.record(TRACE_STATE, state, DISPLAY_BENCHMARK);
+      state = DISPLAY_BENCHMARK;
+      startBenchmark();
+      ack(FRAME_RUN_BENCHMARK, ACK_OK);
+      break;
+#endif
+#if FEATURE_HISTORY
+    case FRAME_GET_HISTORY:
+      historyCursor = 0;
+      ack(FRAME_GET_HISTORY, ACK_OK);
+      break;
+#endif
+    default:
+      ack(serialLink.rxType, ACK_UNKNOWN);
+  }
+}
+
+#if FEATURE_LATENCY_TRACE
+// one frame per non-empty histogram (kind, group, command or state, counts
+// as u16 LE), as many per loop as the link queue takes, then an empty frame
+void Clock::sendLatency() {
+  uint8_t payload[3 + 2 * LATENCY_BUCKETS];
+  while (latencyCursor < LatencyTrace::HISTOGRAM_COUNT) {
+    Histogram *h = latencyTrace.histogram(latencyCursor, payload[0], payload[1], payload[2]);
+    if (!h->empty()) {
+      for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+        writeU16(payload + 3 + 2 * i, h->counts[i]);
+      }
+      if (!serialLink.send(FRAME_LATENCY, payload, sizeof(payload))) {
+        return;
+      }
+    }
+    latencyCursor++;
+  }
+  if (serialLink.send(FRAME_LATENCY, payload, 0)) {
+    if (latencyReset) {
+      latencyTrace.reset();
+    }
+    latencyCursor = -1;
+  }
+}
+#endif
+
+#if FEATURE_BENCHMARK
+// one frame per timing that ran (kind, index, runs as u16, then min, average
+// and max in us as u32, LE), as the link queue allows, then an empty frame
+void Clock::sendBenchmark() {
+  uint8_t payload[16];
+  while (benchmarkCursor < Benchmark::TIMING_COUNT) {
+    Timing &t = benchmark.timing(benchmarkCursor, payload[0], payload[1]);
+    if (t.runs > 0) {
+      writeU16(payload + 2, t.runs);
+      writeU32(payload + 4, t.minUs);
+      writeU32(payload + 8, t.averageUs());
+      writeU32(payload + 12, t.maxUs);
+      if (!serialLink.send(FRAME_BENCHMARK, payload, sizeof(payload))) {
+        return;
+      }
+    }
+    benchmarkCursor++;
+  }
+  if (serialLink.send(FRAME_BENCHMARK, payload, 0)) {
+    benchmarkCursor = -1;
+  }
+}
+#endif
+
+#if FEATURE_HISTORY
+// records oldest first (unixtime as u32, type, a, b as u16, LE), 4 to a frame
+// as the link queue allows, then an empty frame. Records added meanwhile go
+// out too.
+void Clock::sendHistory() {
+  uint8_t payload[4 * sizeof(HistoryRecord)];
+  while (historyCursor < history.count()) {
+    uint8_t n = 0;
+    while (n < 4 && historyCursor + n < history.count()) {
+      HistoryRecord r;
+      history.read(historyCursor + n, r);
+      uint8_t *p = payload + n * sizeof(HistoryRecord);
+      writeU32(p, r.time);
+      p[4] = r.type;
+      p[5] = r.a;
+      writeU16(p + 6, r.b);
+      n++;
+    }
+    if (!serialLink.send(FRAME_HISTORY, payload, n * sizeof(HistoryRecord))) {
+      return;
+    }
+    historyCursor += n;
+  }
+  if (serialLink.send(FRAME_HISTORY, payload, 0)) {
+    historyCursor = -1;
+  }
+}
+#endif
+
+// Ping answer: sequence number, micros() when the ping was received and when
+// the answer is sent, the last second edge (unixtime, micros()), the aging
+// offset and the last sync
+void Clock::sendTimeSync(uint8_t seq, uint32_t received) {
+  uint8_t payload[22];
+  payload[0] = seq;
+  writeU32(payload + 1, received);
+  writeU32(payload + 9, secondEdgeTime);
+  writeU32(payload + 13, secondEdge);
+  payload[17] = rtcAging;
+  writeU32(payload + 18, lastSync);
+  writeU32(payload + 5, micros());
+  serialLink.send(FRAME_TIME_SYNC, payload, sizeof(payload));
+  // right away, the time it would wait counts as delay
+  serialLink.flush();
+}
+
+void Clock::ack(uint8_t type, AckStatus status) {
+  uint8_t payload[] = { type, status };
+  serialLink.send(FRAME_ACK, payload, sizeof(payload));
+}
+
+void Clock::sendSettings() {
+  uint8_t payload[SETTINGS_PACKED_SIZE];
+  settings.pack(payload);
+  serialLink.send(FRAME_SETTINGS, payload, sizeof(payload));
+}
+
+// state, local unixtime, loop count/average/max since the last telemetry
+// frame, player status, total audio underruns, time spent in audio
+// interrupts since the last frame
+void Clock::sendTelemetry() {
+  uint8_t payload[28];
+  payload[0] = state;
+  writeU32(payload + 1, currentTime.unixtime());
+  writeU16(payload + 5, min(loopCount, (uint32_t) UINT16_MAX));
+  writeU16(payload + 7, loopCount > 0 ? loopTotalTime / loopCount : 0);
+  writeU32(payload + 9, loopMaxTime);
+  payload[13] = !player.stopped();
+  writeU16(payload + 14, player.underruns);
+  writeU32(payload + 16, player.isrTime);
+  writeU16(payload + 20, sdProfile.clock / 1000);
+  writeU16(payload + 22, sdProfile.sequentialUs);
+  writeU16(payload + 24, sdProfile.randomUs);
+  writeU16(payload + 26, sdProfile.randomMaxUs);
+  // stats are only reset if the frame was queued, otherwise retry next loop
+  if (serialLink.send(FRAME_TELEMETRY, payload, sizeof(payload))) {
+    resetTelemetry();
+  }
+}
+
+void Clock::resetTelemetry() {
+  lastTelemetry = millis();
+  loopCount = 0;
+  loopTotalTime = 0;
+  loopMaxTime = 0;
+  noInterrupts();
+  player.isrTime = 0;
+  interrupts();
+}
+
+void Alarm::pack(uint8_t *out) {
+  out[0] = enabled;
+  out[1] = hour;
+  out[2] = minute;
+  out[3] = days;
+  out[4] = track;
+  out[5] = oneShot | skipNext << 1;
+  out[6] = everyWeeks;
+  out[7] = weekPhase;
+}
+
+bool Alarm::unpack(const uint8_t *in) {
+  if (
+    in[1] >= 24 || in[2] >= 60 || in[3] > ALL_DAYS ||
+    in[6] == 0 || in[6] > ALARM_MAX_EVERY_WEEKS || in[7] >= in[6]
+  ) {
+    return false;
+  }
+  enabled = in[0];
+  hour = in[1];
+  minute = in[2];
+  days = in[3];
+  track = in[4];
+  oneShot = in[5] & 1;
+  skipNext = in[5] & 2;
+  everyWeeks = in[6];
+  weekPhase = in[7];
+  return true;
+}
+
+void Settings::pack(uint8_t *out) {
+  alarm1.pack(out);
+  alarm2.pack(out + ALARM_PACKED_SIZE);
+  out[2 * ALARM_PACKED_SIZE] = volume;
+}
+
+bool Settings::unpack(const uint8_t *in) {
+  uint8_t v = in[2 * ALARM_PACKED_SIZE];
+  if (v >= 100) {
+    return false;
+  }
+  volume = v;
+  return alarm1.unpack(in) && alarm2.unpack(in + ALARM_PACKED_SIZE);
+}
+
+void Clock::saveSnapshot() {
+  snapshot.state = state;
+  snapshot.lastRing1 = schedule1.lastRing;
+#if FEATURE_ALARM_2
+  snapshot.lastRing2 = schedule2.lastRing;
+#endif
+  snapshot.alarmTrackCount = alarmTrackCount;
+  snapshot.tracksCounted = tracksCounted;
+#if FEATURE_NAP
+  snapshot.napTime = napTime.unixtime();
+  snapshot.napping = napping;
+#endif
+  snapshot.seal();
+}
+
+void Clock::restoreSnapshot() {
+  schedule1.lastRing = snapshot.lastRing1;
+#if FEATURE_ALARM_2
+  schedule2.lastRing = snapshot.lastRing2;
+#endif
+  alarmTrackCount = snapshot.alarmTrackCount;
+  tracksCounted = snapshot.tracksCounted;
+#if FEATURE_NAP
+  napTime = DateTime(snapshot.napTime);
+#endif
+  switch (snapshot.state) {
+#if FEATURE_NAP
+    case DISPLAY_NAP:
+    case RINGING_NAP:
+#endif
+#if FEATURE_ALARM_2
+    case RINGING_ALARM_2:
+#endif
+    case RINGING_ALARM_1:
+    case DARK_MODE:
+      state = (State) snapshot.state;
+      break;
+    default:
+      // menus work on local copies which are lost, go back to the clock
+      state = DISPLAY_TIME;
+  }
+#if FEATURE_NAP
+  napping = snapshot.napping || state == DISPLAY_NAP;
+  // over while resetting, rendered before checkNap() runs
+  if (state == DISPLAY_NAP && (napTime - currentTime).totalseconds() <= 0) {
+    state = RINGING_NAP;
+    napping = false;
+  }
+#endif
+  // the rings that were queued are lost, the one playing goes on
+  if (ringing(state)) {
+    currentRing.state = state;
+    currentRing.track = state == RINGING_ALARM_1 ? settings.alarm1.track
+#if FEATURE_ALARM_2
+      : state == RINGING_ALARM_2 ? settings.alarm2.track
+#endif
+      : RING_TRACK_NAP;
+    currentRing.due = currentTime.unixtime() - currentTime.second();
+  }
+}
+
+// restart the track that was playing, checkAlarm/checkNap would otherwise see
+// a stopped player and end the alarm
+void Clock::resumePlayback() {
+  if (!ringing(state)) {
+    return;
+  }
+#if FEATURE_NAP
+  if (currentRing.track == RING_TRACK_NAP) {
+    playNap();
+    return;
+  }
+#endif
+  playAlarm(currentRing.track);
+}
+
+#if FEATURE_HISTORY
+// On a state change: a ring starting, how the one before ended, a nap set
+void Clock::recordHistory(State previous, Command c) {
+  uint32_t now = currentTime.unixtime();
+  if (ringing(previous)) {
+    uint16_t rang = ringStart != 0 ? min(now - ringStart, (uint32_t) UINT16_MAX) : 0;
+    history.record(c == STOP_ADD_5 ? HISTORY_RING_STOPPED : HISTORY_RING_ENDED, now, previous, rang);
+  }
+  if (ringing(state)) {
+    ringStart = now;
+    history.record(HISTORY_RING, now, state, currentRing.track == RING_TRACK_NAP ? 0 : currentRing.track);
+  }
+#if FEATURE_NAP
+  if (previous == SET_NAP && state == DISPLAY_NAP) {
+    history.record(HISTORY_NAP_SET, now, 0, napTS.totalseconds());
+  }
+#endif
 }
+#endif
 
 void Clock::alarmTransition() {
-  checkAlarm(settings.alarm1, RINGING_ALARM_1, alarm1Stopped);
-  checkAlarm(settings.alarm2, RINGING_ALARM_2, alarm2Stopped);
+  prewarmAlarm();
+  if (currentTime.day() != scheduleDay) {
+    scheduleAlarms();
+  }
+  checkAlarm(settings.alarm1, schedule1, RINGING_ALARM_1);
+#if FEATURE_ALARM_2
+  checkAlarm(settings.alarm2, schedule2, RINGING_ALARM_2);
+#endif
+#if FEATURE_NAP
   checkNap();
+#endif
+  arbitrateRings();
 }
 
+#if FEATURE_NAP
 void Clock::checkNap() {
-  if (state == RINGING_NAP && player.stopped()) {
+  if (state == RINGING_NAP && soundStopped()) {
     // track stopped, auto exit
-    state = DISPLAY_TIME;
+    state = afterRing();
+  }
+  // counts down under an alarm too
+  if (napping && (napTime - currentTime).totalseconds() <= 0) {
+    napping = false;
+    rings.push({ RINGING_NAP, RING_TRACK_NAP, napTime.unixtime() });
   }
-  // only check nap in nap mode
-  if (state == DISPLAY_NAP) {
-    int32_t remaining = (napTime - rtc.now()).totalseconds();
-    if (remaining <= 0) {
-      state = RINGING_NAP;
-      playNap();
+}
+#endif
+
+void Clock::checkAlarm(Alarm &a, AlarmSchedule &schedule, State ALARM_X) {
+  // When reaching the next ring of an alarm, we switch to ALARM_X and
+  // schedule the following one right away: stopping the alarm within the
+  // same minute doesn't make it ring again.
+  uint32_t now = currentTime.unixtime();
+
+  // If the song stopped itself
+  if (state == ALARM_X && soundStopped()) {
+    if (loopTrack(a.track)) {
+      playAlarm(a.track);
+    }
+    else {
+      LOG_INFO(LOG_TRACK_ENDED);
+      state = afterRing();
     }
   }
+  if (schedule.skipped != 0 && now >= schedule.skipped) {
+    // the skipped ring is past, back to the usual rules
+    schedule.lastRing = schedule.skipped;
+    a.skipNext = false;
+    writeSettings();
+  }
+  if (schedule.next == 0 || now < schedule.next) {
+    return;
+  }
+  // more than a minute late (powered off), don't ring
+  bool ring = alarmDue(schedule, now) && state != ALARM_X;
+#if FEATURE_HISTORY
+  if (!alarmDue(schedule, now)) {
+    history.record(HISTORY_RING_MISSED, now, ALARM_X, min((now - schedule.next) / 60, (uint32_t) UINT16_MAX));
+  }
+#endif
+  schedule.lastRing = schedule.next;
+  if (a.oneShot) {
+    a.enabled = false;
+  }
+  // reschedules, and a menu left for the alarm keeps what was set in it
+  writeSettings();
+  if (ring) {
+    rings.push({ ALARM_X, a.track, schedule.lastRing });
+  }
 }
 
-void Clock::checkAlarm(Alarm a, State ALARM_X, bool &stoppedFlag) {
-  // When reaching the time of an alarm, we emit the ALARM_X command. When the
-  // alarm is stopped by the user, if it's still the same time, we mustn't play
-  // it again. We set an alarmXStopped flag, which will be removed 1 min before
-  // ringing the next day.
-  DateTime now = rtc.now();
-  uint8_t hour = now.hour();
-  uint8_t minute = now.minute();
-  uint8_t dow = now.dayOfTheWeek();
-  bool isWeekEnd = dow == 0 || dow == 6;
+// does the alarm ring during the minute of t
+bool Clock::alarmDue(const AlarmSchedule &schedule, uint32_t t) {
+  return schedule.next != 0 && schedule.next <= t && t < schedule.next + 60;
+}
 
-  // If the song stopped itself, set the flag
-  if (state == ALARM_X && !stoppedFlag && player.stopped()) {
-    Serial.println("Track ended, stopping alarm");
-    stoppedFlag = true;
-    state = DISPLAY_TIME;
+// Nothing ringing, the first ring queued starts. A ring due within the
+// minute of the one playing, or with the same track, rings with it: it's
+// merged without touching the player. Any other waits for the one playing
+// to end, by itself or stopped.
+void Clock::arbitrateRings() {
+  uint8_t i = 0;
+  while (i < rings.size()) {
+    if (!ringing(state)) {
+      startRing(rings.at(0));
+      rings.remove(0);
+    }
+    else if (ringsWith(rings.at(i))) {
+      mergeRing(i);
+    }
+    else {
+      i++;
+    }
   }
-  if (
-    stoppedFlag &&
-    a.hour * 60 + a.minute == hour * 60 + minute + 1
-  ) {
-    stoppedFlag = false;
+}
+
+void Clock::startRing(const RingEvent &e) {
+  state = e.state;
+  currentRing = e;
+  ringStarted = millis();
+#if FEATURE_NAP
+  if (e.state == RINGING_NAP) {
+    armed = false; // playFile() drops the track prepared
+    playNap();
+    return;
   }
-  if (
-    a.enabled &&                 // is the alarm enabled
-    (a.weekend || !isWeekEnd) && // is it a week day or is the alarm enabled on week-ends
-    !stoppedFlag &&              // has the alarm been stopped today
-    state != ALARM_X &&          // is it not already ringing
-    a.hour == hour &&            // does it matches the current time
-    a.minute == minute
-  ) {
-    state = ALARM_X;
-    Serial.println("Starting alarm");
-    playAlarm(a.track);
+#endif
+  LOG_INFO(LOG_ALARM_START, e.track + 1);
+  playAlarm(e.track);
+}
+
+bool Clock::ringsWith(const RingEvent &e) {
+  return e.due < currentRing.due + 60 || e.track == currentRing.track;
+}
+
+void Clock::mergeRing(uint8_t i) {
+#if FEATURE_HISTORY
+  history.record(HISTORY_RING_MERGED, currentTime.unixtime(), rings.at(i).state, currentRing.state);
+#endif
+  rings.remove(i);
+}
+
+// STOP_ADD_5 while ringing: a single stop for the ring and the ones that
+// ring with it. The others stay queued, the next loop starts them.
+State Clock::stopRings() {
+  stopSound();
+  uint8_t i = 0;
+  while (i < rings.size()) {
+    if (ringsWith(rings.at(i))) {
+      mergeRing(i);
+    }
+    else {
+      i++;
+    }
+  }
+  return afterRing();
+}
+
+// a nap set before the ring is still counting down
+State Clock::afterRing() {
+#if FEATURE_NAP
+  if (napping) {
+    return DISPLAY_NAP;
+  }
+#endif
+  return DISPLAY_TIME;
+}
+
+void Clock::scheduleAlarms() {
+  scheduleDay = currentTime.day();
+  scheduleAlarm(settings.alarm1, schedule1);
+#if FEATURE_ALARM_2
+  scheduleAlarm(settings.alarm2, schedule2);
+#endif
+}
+
+void Clock::scheduleAlarm(const Alarm &a, AlarmSchedule &schedule) {
+  // from the current minute on, so that an alarm set for now rings, but
+  // never a ring that already happened
+  uint32_t minuteStart = currentTime.unixtime() - currentTime.second();
+  uint32_t after = max(minuteStart - 1, schedule.lastRing);
+  schedule.next = a.nextRing(after);
+  schedule.skipped = 0;
+  if (a.skipNext && schedule.next != 0) {
+    schedule.skipped = schedule.next;
+    schedule.next = a.nextRing(schedule.skipped);
+  }
+}
+
+uint16_t weekNumber(uint32_t unixtime) {
+  return (unixtime / 86400 + 4) / 7; // 1970-01-01 was a Thursday
+}
+
+uint32_t Alarm::nextRing(uint32_t after) const {
+  if (!enabled || !(days & ALL_DAYS) || everyWeeks == 0) {
+    return 0;
+  }
+  DateTime from(after);
+  uint32_t first = DateTime(from.year(), from.month(), from.day(), hour, minute, 0).unixtime();
+  // a whole period of days is enough to find a match
+  for (uint16_t i = 0; i <= 7 * everyWeeks; i++) {
+    uint32_t t = first + i * 86400UL;
+    uint8_t dow = (t / 86400 + 4) % 7;
+    if (t > after && (days >> dow & 1) && weekNumber(t) % everyWeeks == weekPhase) {
+      return t;
+    }
+  }
+  return 0;
+}
+
+void Alarm::toggleWeekend() {
+  if (days & WEEKEND_DAYS) {
+    days &= ~WEEKEND_DAYS;
+  }
+  else {
+    days |= WEEKEND_DAYS;
+  }
+  if (!days) {
+    days = WORK_DAYS;
+  }
+}
+
+void Clock::prewarmAlarm() {
+  uint8_t second = currentTime.second();
+  if (!armed) {
+    if (second < 60 - ALARM_PREWARM_TIME || !soundReady || !cardReady || !soundStopped()) {
+      return;
+    }
+    uint32_t next = currentTime.unixtime() + 60 - second;
+    if (state != RINGING_ALARM_1 && alarmDue(schedule1, next)) {
+      armedState = RINGING_ALARM_1;
+      armedTrack = settings.alarm1.track;
+    }
+#if FEATURE_ALARM_2
+    else if (state != RINGING_ALARM_2 && alarmDue(schedule2, next)) {
+      armedState = RINGING_ALARM_2;
+      armedTrack = settings.alarm2.track;
+    }
+#endif
+    else {
+      return;
+    }
+    // as many blocks as the buffer holds
+    armed = player.prepareFile(TrackIndex::fileName(armedTrack).c_str(), AUDIO_BUFFER_SIZE / AUDIO_BLOCK_SIZE);
+    lastSecondSeen = 0;
+    return;
+  }
+
+  if (second < 60 - ALARM_PREWARM_TIME) {
+    // the minute came without us (loop stalled): checkAlarm plays the
+    // prepared track. Past that, the alarm isn't due anymore.
+    if (second > 0) {
+      armed = false;
+      player.stopPlaying();
+    }
+    return;
+  }
+  // settings changed since it was prepared, and it doesn't ring anymore
+#if FEATURE_ALARM_2
+  const AlarmSchedule &schedule = armedState == RINGING_ALARM_1 ? schedule1 : schedule2;
+#else
+  const AlarmSchedule &schedule = schedule1;
+#endif
+  if (!alarmDue(schedule, currentTime.unixtime() + 60 - second)) {
+    armed = false;
+    player.stopPlaying();
+    return;
+  }
+  if (second != 59) {
+    return;
+  }
+  if (lastSecondSeen == 0) {
+    lastSecondSeen = millis();
+  }
+  // the minute starts at most 1s after second 59 was seen
+  if (millis() - lastSecondSeen >= 1000 - ALARM_PREWARM_SPIN) {
+    startArmedAlarm();
+  }
+}
+
+// Spin on the seconds register and start the track as soon as it wraps. The
+// minute started between the last read still at 59 and the one that wasn't.
+void Clock::startArmedAlarm() {
+  i2cBus.drain();
+  unsigned long spinStart = millis();
+  uint32_t lastRead59 = 0;
+  uint32_t readStart;
+  while (true) {
+    readStart = micros();
+    if (readSeconds() != 59) {
+      break;
+    }
+    lastRead59 = readStart;
+    if (millis() - spinStart > 1000) {
+      // RTC not ticking, give up
+      armed = false;
+      player.stopPlaying();
+      return;
+    }
+  }
+
+  // currentTime is still the last second 59
+  startRing({ armedState, armedTrack, currentTime.unixtime() + 1 });
+  // if the first read was already past the minute, we're late by at least
+  // the time since the minute was expected
+  uint32_t jitter = lastRead59 != 0
+    ? micros() - lastRead59
+    : (millis() - lastSecondSeen - 1000) * 1000 + (micros() - readStart);
+  LOG_INFO(LOG_ALARM_JITTER, jitter);
+  (void) jitter; // without the serial log
+
+  // the read queued before spinning is stale
+  rtcRead.status = I2C_IDLE;
+  currentTime = rtc.now();
+}
+
+static uint8_t bcd2bin(uint8_t v) {
+  return v - 6 * (v >> 4);
+}
+
+static uint8_t bin2bcd(uint8_t v) {
+  return v + 6 * (v / 10);
+}
+
+// 7 time registers from seconds, 24h mode
+static void packRtcTime(const DateTime &t, uint8_t *out) {
+  out[0] = bin2bcd(t.second());
+  out[1] = bin2bcd(t.minute());
+  out[2] = bin2bcd(t.hour());
+  out[3] = t.dayOfTheWeek() == 0 ? 7 : t.dayOfTheWeek(); // [1-7], Sunday is 7
+  out[4] = bin2bcd(t.day());
+  out[5] = bin2bcd(t.month());
+  out[6] = bin2bcd(t.year() - 2000);
+}
+
+// blocking, the I2C bus must be idle
+uint8_t Clock::readSeconds() {
+  uint8_t seconds;
+  readRtcRegisters(0, &seconds, 1);
+  return bcd2bin(seconds & 0x7F);
+}
+
+void Clock::readRtcRegisters(uint8_t reg, uint8_t *data, uint8_t length) {
+  Wire.beginTransmission(RTC_I2C_ADDRESS);
+  Wire.write(reg);
+  Wire.endTransmission();
+  Wire.requestFrom(RTC_I2C_ADDRESS, length);
+  for (uint8_t i = 0; i < length; i++) {
+    data[i] = Wire.read();
+  }
+}
+
+void Clock::writeRtcRegisters(uint8_t reg, const uint8_t *data, uint8_t length) {
+  Wire.beginTransmission(RTC_I2C_ADDRESS);
+  Wire.write(reg);
+  Wire.write(data, length);
+  Wire.endTransmission();
+}
+
+// The time read on the previous loop is consumed and a new read is queued, it
+// completes in the background while this loop runs
+void Clock::updateTime() {
+  if (rtcTask.running()) {
+    // currentTime is already the time being written
+    return;
+  }
+  if (rtcRead.status == I2C_DONE) {
+    currentTime = DateTime(
+      2000 + bcd2bin(rtcRaw[6]),
+      bcd2bin(rtcRaw[5] & 0x7F),
+      bcd2bin(rtcRaw[4]),
+      bcd2bin(rtcRaw[2] & 0x3F), // 24h mode
+      bcd2bin(rtcRaw[1]),
+      bcd2bin(rtcRaw[0] & 0x7F)
+    );
+    // the second started between the previous read and this one
+    if (currentTime.unixtime() != secondEdgeTime) {
+      secondEdgeTime = currentTime.unixtime();
+      secondEdge = rtcReadStart;
+    }
+  }
+  if (!rtcRead.busy()) {
+    rtcRead.address = RTC_I2C_ADDRESS;
+    rtcRead.txData = &rtcRegister;
+    rtcRead.txLength = 1;
+    rtcRead.rxData = rtcRaw;
+    rtcRead.rxLength = sizeof(rtcRaw);
+    rtcReadStart = micros();
+    i2cBus.submit(&rtcRead);
+  }
+}
+
+void Clock::adjustTime(const DateTime &t) {
+  rtcPending = t;
+  rtcTask.start();
+  lastSync = 0;
+  timeChanged(t);
+}
+
+void Clock::timeChanged(const DateTime &t) {
+#if FEATURE_NAP
+  // a nap runs for its duration, whatever the clock says
+  napTime = t + (napTime - currentTime);
+#endif
+  currentTime = t;
+  // rings "already done" in the future when going back in time
+  if (schedule1.lastRing > t.unixtime()) {
+    schedule1.lastRing = 0;
+  }
+#if FEATURE_ALARM_2
+  if (schedule2.lastRing > t.unixtime()) {
+    schedule2.lastRing = 0;
+  }
+#endif
+  scheduleAlarms();
+}
+
+// What rtc.adjust() does, without waiting on the bus
+bool Clock::rtcStep(Task &task) {
+  TASK_BEGIN(task);
+  rtcWriteData[0] = 0; // seconds, first of the 7 time registers
+  packRtcTime(rtcPending, rtcWriteData + 1);
+  rtcWrite.address = RTC_I2C_ADDRESS;
+  rtcWrite.txData = rtcWriteData;
+  rtcWrite.txLength = sizeof(rtcWriteData);
+  rtcWrite.rxLength = 0;
+  TASK_WAIT_UNTIL(task, i2cBus.submit(&rtcWrite));
+  TASK_WAIT_UNTIL(task, !rtcWrite.busy());
+
+  // clear the oscillator stop flag, lostPower() is false from now on
+  rtcWriteData[0] = 0x0F; // status
+  rtcWrite.txLength = 1;
+  rtcWrite.rxData = &rtcStatus;
+  rtcWrite.rxLength = 1;
+  TASK_WAIT_UNTIL(task, i2cBus.submit(&rtcWrite));
+  TASK_WAIT_UNTIL(task, !rtcWrite.busy());
+  rtcWriteData[1] = rtcStatus & ~0x80;
+  rtcWrite.txLength = 2;
+  rtcWrite.rxLength = 0;
+  TASK_WAIT_UNTIL(task, i2cBus.submit(&rtcWrite));
+  TASK_WAIT_UNTIL(task, !rtcWrite.busy());
+
+  // no drift can be measured against the last sync anymore
+  rtcWriteData[0] = 0x07; // alarm 1
+  memset(rtcWriteData + 1, 0, 4);
+  rtcWrite.txLength = 5;
+  TASK_WAIT_UNTIL(task, i2cBus.submit(&rtcWrite));
+  TASK_WAIT_UNTIL(task, !rtcWrite.busy());
+
+  // transactions run in order: a read queued before the write is over, and
+  // stale
+  rtcRead.status = I2C_IDLE;
+  TASK_END(task);
+}
+
+// The DS3231 restarts its second when the seconds register is written: the
+// time is written at syncAt, spinning for the last SYNC_SPIN_TIME
+bool Clock::syncStep(Task &task) {
+  TASK_BEGIN(task);
+  TASK_WAIT_UNTIL(task, (int32_t) (micros() - syncAt) >= -SYNC_SPIN_TIME);
+  i2cBus.drain();
+  while ((int32_t) (micros() - syncAt) < 0) {
+    // spin to the microsecond the second starts at
   }
+  {
+    int32_t late = micros() - syncAt;
+    if (late > SYNC_MAX_LATE) {
+      LOG_WARN(LOG_SYNC_LATE, late);
+      return false;
+    }
+    uint8_t data[7];
+    packRtcTime(syncTime, data);
+    writeRtcRegisters(0, data, sizeof(data));
+    secondEdge = syncAt;
+    secondEdgeTime = syncTime.unixtime();
+
+    lastSync = syncTime.unixtime();
+    writeU32(data, lastSync);
+    writeRtcRegisters(0x07, data, 4); // alarm 1
+    rtcAging = syncAging;
+    writeRtcRegisters(0x10, (const uint8_t *) &rtcAging, 1);
+    // the aging offset applies from the next temperature conversion, started
+    // now unless one is running (BSY)
+    readRtcRegisters(0x0E, data, 2); // control, status
+    if (!(data[1] & 0x04)) {
+      data[0] |= 0x20; // CONV
+      writeRtcRegisters(0x0E, data, 1);
+    }
+    // lostPower() is false from now on, as after rtcStep
+    data[1] &= ~0x80;
+    writeRtcRegisters(0x0F, data + 1, 1);
+  }
+  // the read queued before is stale
+  rtcRead.status = I2C_IDLE;
+  timeChanged(syncTime);
+  LOG_INFO(LOG_TIME_SYNCED, rtcAging);
+  TASK_END(task);
 }
 
 // copy time locally when editing it so that the RTC doesn't modify it too
 void Clock::copyTime() {
-  DateTime now = rtc.now();
+  DateTime now = currentTime;
   year = now.year() - 2000; // keep between [0-99], easier for modulo
   month = now.month() - 1; // keep between [0-11], easier for modulo
   day = now.day() - 1; // keep between [0-30], easier for modulo
@@ -234,13 +1546,13 @@ void Clock::copyTime() {
 
 void Clock::writeTime() {
 // correct day/month offset, year is ok (supported by lib)
-  rtc.adjust(DateTime(year, month + 1, day + 1, hour, minute, second));
+  adjustTime(DateTime(year, month + 1, day + 1, hour, minute, second));
 }
 
 // copy date locally when editing it so that the RTC doesn't modify it too
 // we don't copy time so that it's not modified when editing only the date
 void Clock::copyDate() {
-  DateTime now = rtc.now();
+  DateTime now = currentTime;
   year = now.year() - 2000; // keep between [0-99], easier for modulo
   month = now.month() - 1; // keep between [0-11], easier for modulo
   day = now.day() - 1; // keep between [0-30], easier for modulo
@@ -255,31 +1567,183 @@ void Clock::writeDate() {
   }
   day = min(day + 1, daysInCurrentMonth) - 1; // add & subtract 1 because we shifted it to [0, 30] before
 
-  DateTime now = rtc.now();
+  DateTime now = currentTime;
   // correct day/month offset, year is ok (supported by lib)
-  rtc.adjust(DateTime(year, month + 1, day + 1, now.hour(), now.minute(), now.second()));
+  adjustTime(DateTime(year, month + 1, day + 1, now.hour(), now.minute(), now.second()));
 }
 
 void Clock::writeSettings() {
-  flash_settings.write(settings);
+  flashTask.start();
+  scheduleAlarms();
 }
 
+// The row erase and the page write each stall the CPU for a few ms, they run
+// in different loops
+bool Clock::flashStep(Task &task) {
+  TASK_BEGIN(task);
+  {
+    // a flash write is slow and wears the flash, skip it when nothing changed
+    Settings stored;
+    settingsFlash.read(&stored);
+    if (memcmp(&stored, &settings, sizeof(Settings)) == 0) {
+      return false;
+    }
+  }
+  TASK_YIELD(task);
+  settingsFlash.erase();
+  TASK_YIELD(task);
+  // settings as they are now, writeSettings() restarts the task anyway
+  settingsFlash.write(&settings);
+  TASK_END(task);
+}
+
+#if FEATURE_BENCHMARK
+void Clock::startBenchmark() {
+  benchmark.reset();
+  benchmarkCursor = -1;
+  benchmarkTask.start();
+}
+
+// leaving before the end, a muted track may be playing
+void Clock::stopBenchmark() {
+  if (benchmarkTask.running()) {
+    benchmarkTask.cancel();
+    stopSound();
+    muted = false;
+    applyVolume();
+  }
+}
+
+// Each part in its own steps, the loop keeps running in between: a button
+// leaves and an alarm takes over
+bool Clock::benchmarkStep(Task &task) {
+  if (state != DISPLAY_BENCHMARK) {
+    muted = false;
+    applyVolume();
+    return false;
+  }
+  TASK_BEGIN(task);
+  // one state per step, its frame queued as usual when the bus is free. Dark
+  // mode would put the display to sleep. Menus and the nap show what they
+  // would on entry.
+  copyTime();
+#if FEATURE_NAP
+  napTS = TimeSpan(NAP_INCREMENT);
+#endif
+  for (benchmarkIndex = 0; benchmarkIndex < STATE_COUNT; benchmarkIndex++) {
+    if (benchmarkIndex == DARK_MODE || benchmarkIndex == DISPLAY_BENCHMARK) {
+      continue;
+    }
+    state = (State) benchmarkIndex;
+#if FEATURE_NAP
+    // the time may have moved since the last step
+    napTime = currentTime + napTS;
+#endif
+    for (benchmarkRun = 0; benchmarkRun < BENCHMARK_RUNS; benchmarkRun++) {
+      uint32_t start = micros();
+      render();
+      benchmark.timing(BENCHMARK_RENDER, benchmarkIndex).add(micros() - start);
+    }
+    state = DISPLAY_BENCHMARK;
+    TASK_YIELD(task);
+  }
+
+  // a whole frame until it's on the display, what every change costs
+  for (benchmarkRun = 0; benchmarkRun < BENCHMARK_RUNS; benchmarkRun++) {
+    i2cBus.drain();
+    benchmarkStart = micros();
+    display.invalidate();
+    display.flush();
+    i2cBus.drain();
+    benchmark.timing(BENCHMARK_FLUSH).add(micros() - benchmarkStart);
+  }
+  TASK_YIELD(task);
+
+  // the time registers, as updateTime() reads them
+  for (benchmarkRun = 0; benchmarkRun < BENCHMARK_RUNS; benchmarkRun++) {
+    i2cBus.drain();
+    benchmarkStart = micros();
+    benchmarkRead.address = RTC_I2C_ADDRESS;
+    benchmarkRead.txData = &rtcRegister;
+    benchmarkRead.txLength = 1;
+    benchmarkRead.rxData = benchmarkRaw;
+    benchmarkRead.rxLength = sizeof(benchmarkRaw);
+    i2cBus.submit(&benchmarkRead);
+    i2cBus.drain();
+    benchmark.timing(BENCHMARK_RTC_READ).add(micros() - benchmarkStart);
+  }
+  TASK_YIELD(task);
+
+  {
+    // on a copy, the events of the real one would be lost
+    Input copy = input;
+    for (benchmarkRun = 0; benchmarkRun < BENCHMARK_INPUT_RUNS; benchmarkRun++) {
+      uint32_t start = micros();
+      copy.update();
+      benchmark.timing(BENCHMARK_INPUT).add(micros() - start);
+    }
+  }
+  TASK_YIELD(task);
+
+  // the settings rewritten as they are, in one step: flashTask can't come in
+  // between the erase and the write
+  TASK_WAIT_UNTIL(task, !flashTask.running());
+  benchmarkStart = micros();
+  settingsFlash.erase();
+  benchmark.timing(BENCHMARK_FLASH_ERASE).add(micros() - benchmarkStart);
+  benchmarkStart = micros();
+  settingsFlash.write(&settings);
+  benchmark.timing(BENCHMARK_FLASH_WRITE).add(micros() - benchmarkStart);
+  TASK_YIELD(task);
+
+  // playAlarm() until the decoder is fed, loops in between included, muted.
+  // Left out once an alarm is armed, which the next loop would stop.
+  muted = true;
+  applyVolume();
+  for (benchmarkIndex = 0; benchmarkIndex < alarmTrackCount && soundReady && cardReady && !armed; benchmarkIndex++) {
+    benchmarkStart = micros();
+    playAlarm(benchmarkIndex);
+    TASK_WAIT_UNTIL(task, !playTask.running());
+    if (!player.stopped()) {
+      benchmark.timing(BENCHMARK_PLAY_START, benchmarkIndex).add(micros() - benchmarkStart);
+    }
+    stopSound();
+  }
+  muted = false;
+  applyVolume();
+
+  benchmarkDone = millis();
+  benchmarkCursor = 0;
+  TASK_END(task);
+}
+#endif
+
 void Clock::render() {
-  DateTime now = rtc.now();
+  if (state == DARK_MODE) {
+    display.sleep();
+    return;
+  }
+  display.wake();
+
+  DateTime now = currentTime;
   // reset the display
   display.setBlinking(0);
   display.clear();
 
   switch (state) {
     // Display modes
+#if FEATURE_VOLUME_MENU
     case DISPLAY_VOLUME:
-      display.print(settings.volume, DEC);
+      display.printVolume(settings.volume);
       break;
+#endif
     case DISPLAY_TIME:
       display.setDots(
         CENTER_COLON |
-        (settings.alarm1.enabled ? LEFT_COLON_UPPER : 0) |
-        (settings.alarm2.enabled ? LEFT_COLON_LOWER : 0)
+        (settings.alarm1.enabled ? LEFT_COLON_UPPER : 0)
+#if FEATURE_ALARM_2
+        | (settings.alarm2.enabled ? LEFT_COLON_LOWER : 0)
+#endif
       );
       display.printTime(now.hour(), now.minute());
       break;
@@ -290,10 +1754,12 @@ void Clock::render() {
       display.setDots(LEFT_COLON_UPPER);
       display.printAlarmEnabled(1, settings.alarm1.enabled);
       break;
+#if FEATURE_ALARM_2
     case DISPLAY_ALARM_2:
       display.setDots(LEFT_COLON_LOWER);
       display.printAlarmEnabled(2, settings.alarm2.enabled);
       break;
+#endif
 
     // Set time
     case SET_HOURS:
@@ -318,7 +1784,7 @@ void Clock::render() {
       break;
     case SET_YEAR:
       display.setBlinking(BLINK_DIGIT_1 | BLINK_DIGIT_2 | BLINK_DIGIT_3 | BLINK_DIGIT_4);
-      display.print(year + 2000);
+      display.printYear(year);
       break;
 
     // Set alarm 1
@@ -340,7 +1806,7 @@ void Clock::render() {
     case SET_WEEKEND_1:
       display.setDots(LEFT_COLON_UPPER);
       display.setBlinking(BLINK_DIGIT_3 | BLINK_DIGIT_4);
-      display.printAlarmWeekEnd(1, settings.alarm1.weekend);
+      display.printAlarmWeekEnd(1, settings.alarm1.days & WEEKEND_DAYS);
       break;
     case SET_TRACK_1:
       display.setDots(LEFT_COLON_UPPER);
@@ -348,6 +1814,7 @@ void Clock::render() {
       display.printAlarmTrack(1, settings.alarm1.track + 1);
       break;
 
+#if FEATURE_ALARM_2
     // Set alarm 2
     case SET_ENABLED_2:
       display.setDots(LEFT_COLON_UPPER);
@@ -367,13 +1834,14 @@ void Clock::render() {
     case SET_WEEKEND_2:
       display.setDots(LEFT_COLON_UPPER);
       display.setBlinking(BLINK_DIGIT_3 | BLINK_DIGIT_4);
-      display.printAlarmWeekEnd(2, settings.alarm2.weekend);
+      display.printAlarmWeekEnd(2, settings.alarm2.days & WEEKEND_DAYS);
       break;
     case SET_TRACK_2:
       display.setDots(LEFT_COLON_UPPER);
       display.setBlinking(BLINK_DIGIT_4);
       display.printAlarmTrack(2, settings.alarm2.track + 1);
       break;
+#endif
 
     // Ringing alarms
     case RINGING_ALARM_1:
@@ -381,12 +1849,15 @@ void Clock::render() {
       display.setDots(LEFT_COLON_UPPER | CENTER_COLON);
       display.printTime(now.hour(), now.minute());
       break;
+#if FEATURE_ALARM_2
     case RINGING_ALARM_2:
       display.setBlinking(BLINK_DOTS);
       display.setDots(LEFT_COLON_LOWER | CENTER_COLON);
       display.printTime(now.hour(), now.minute());
       break;
+#endif
 
+#if FEATURE_NAP
     // Nap
     case DISPLAY_NAP_INTRO:
       display.printNapIntro();
@@ -412,12 +1883,40 @@ void Clock::render() {
       display.setBlinking(BLINK_DOTS | BLINK_DIGIT_1 | BLINK_DIGIT_2 | BLINK_DIGIT_3 | BLINK_DIGIT_4);
       display.printTime(0, 0);
       break;
+#endif
     case DARK_MODE:
-      // print nothing
+      // display asleep, see above
+      break;
+#if FEATURE_BENCHMARK
+    case DISPLAY_BENCHMARK: {
+      if (benchmarkTask.running()) {
+        display.printText("bEnc");
+        break;
+      }
+      uint8_t page = (millis() - benchmarkDone) / BENCHMARK_PAGE_DELAY % (2 * BENCHMARK_KINDS);
+      BenchmarkKind kind = (BenchmarkKind) (page / 2);
+      if (page % 2 == 0) {
+        display.printText(BENCHMARK_LABELS[kind]);
+        break;
+      }
+      uint32_t figure = benchmark.summary(kind);
+      if (kind == BENCHMARK_PLAY_START) {
+        figure /= 1000;
+      }
+      display.printNumber(min(figure, (uint32_t) 9999));
+      break;
+    }
+#endif
+    default:
+      // states of disabled features
       break;
   }
 
-  display.flush();
+  if (display.flush()) {
+#if FEATURE_LATENCY_TRACE
+    latencyTrace.frameQueued();
+#endif
+  }
 }
 
 bool Clock::noInputDuringMS(unsigned long delay) {
@@ -427,13 +1926,14 @@ bool Clock::noInputDuringMS(unsigned long delay) {
 State Clock::transition(State s, Command c) {
   State next = s;
   switch (s) {
+#if FEATURE_VOLUME_MENU
     case DISPLAY_VOLUME:
       if (c == SET || c == MODE) {
         writeSettings();
         next = DISPLAY_TIME;
       }
       // auto exit after delay without any button press
-      if (noInputDuringMS(EXIT_VOLUME_DELAY)) {
+      if (noInputDuringMS(settings.exitVolumeDelay * 100ul)) {
         writeSettings();
         next = DISPLAY_TIME;
       }
@@ -446,6 +1946,7 @@ State Clock::transition(State s, Command c) {
         applyVolume();
       }
       break;
+#endif
     case DISPLAY_TIME:
       if (c == MODE) {
         next = DISPLAY_DATE;
@@ -454,13 +1955,23 @@ State Clock::transition(State s, Command c) {
         next = SET_HOURS;
         copyTime();
       }
+#if FEATURE_VOLUME_MENU
       if (c == UP | c == DOWN) {
         next = DISPLAY_VOLUME;
       }
+#endif
+#if FEATURE_NAP
       if (c == NAP) {
         next = DISPLAY_NAP_INTRO;
         napTS = TimeSpan(NAP_INCREMENT);
       }
+#endif
+#if FEATURE_BENCHMARK
+      if (c == BENCHMARK) {
+        next = DISPLAY_BENCHMARK;
+        startBenchmark();
+      }
+#endif
       if (noInputDuringMS(DARK_MODE_DELAY)) {
         next = DARK_MODE;
       }
@@ -498,7 +2009,7 @@ State Clock::transition(State s, Command c) {
       break;
     case DISPLAY_DATE:
       // auto exit after delay without any button press
-      if (noInputDuringMS(EXIT_MENU_DELAY)) {
+      if (noInputDuringMS(settings.exitMenuDelay * 100ul)) {
         next = DISPLAY_TIME;
       }
       if (c == MODE) {
@@ -563,11 +2074,15 @@ State Clock::transition(State s, Command c) {
       break;
     case DISPLAY_ALARM_1:
       // auto exit after delay without any button press
-      if (noInputDuringMS(EXIT_MENU_DELAY)) {
+      if (noInputDuringMS(settings.exitMenuDelay * 100ul)) {
         next = DISPLAY_TIME;
       }
       if (c == MODE) {
+#if FEATURE_ALARM_2
         next = DISPLAY_ALARM_2;
+#else
+        next = DISPLAY_TIME;
+#endif
       }
       if (c == SET) {
         next = SET_ENABLED_1;
@@ -624,17 +2139,17 @@ State Clock::transition(State s, Command c) {
         next = SET_TRACK_1;
       }
       if (c == UP || c == DOWN) {
-        settings.alarm1.weekend = !settings.alarm1.weekend;
+        settings.alarm1.toggleWeekend();
       }
       break;
     case SET_TRACK_1:
       if (c == MODE) {
-        player.stopPlaying(); // in case we were previewing the track
+        stopSound(); // in case we were previewing the track
         writeSettings();
         next = DISPLAY_ALARM_1;
       }
       if (c == SET) {
-        player.stopPlaying(); // in case we were previewing the track
+        stopSound(); // in case we were previewing the track
         writeSettings();
         next = DISPLAY_ALARM_1;
       }
@@ -649,9 +2164,10 @@ State Clock::transition(State s, Command c) {
         playAlarm(settings.alarm1.track);
       }
       break;
+#if FEATURE_ALARM_2
     case DISPLAY_ALARM_2:
       // auto exit after delay without any button press
-      if (noInputDuringMS(EXIT_MENU_DELAY)) {
+      if (noInputDuringMS(settings.exitMenuDelay * 100ul)) {
         next = DISPLAY_TIME;
       }
       if (c == MODE) {
@@ -712,17 +2228,17 @@ State Clock::transition(State s, Command c) {
         next = SET_TRACK_2;
       }
       if (c == UP || c == DOWN) {
-        settings.alarm2.weekend = !settings.alarm2.weekend;
+        settings.alarm2.toggleWeekend();
       }
       break;
     case SET_TRACK_2:
       if (c == MODE) {
-        player.stopPlaying(); // in case we were previewing the track
+        stopSound(); // in case we were previewing the track
         writeSettings();
         next = DISPLAY_ALARM_2;
       }
       if (c == SET) {
-        player.stopPlaying(); // in case we were previewing the track
+        stopSound(); // in case we were previewing the track
         writeSettings();
         next = DISPLAY_ALARM_2;
       }
@@ -737,24 +2253,23 @@ State Clock::transition(State s, Command c) {
         playAlarm(settings.alarm2.track);
       }
       break;
+#endif
     case RINGING_ALARM_1:
       if (c == STOP_ADD_5) {
-        player.stopPlaying();
-        alarm1Stopped = true;
-        next = DISPLAY_TIME;
+        next = stopRings();
       }
       break;
+#if FEATURE_ALARM_2
     case RINGING_ALARM_2:
       if (c == STOP_ADD_5) {
-        player.stopPlaying();
-        alarm2Stopped = true;
-        next = DISPLAY_TIME;
+        next = stopRings();
       }
       break;
+#endif
+#if FEATURE_NAP
     case RINGING_NAP:
       if (c == STOP_ADD_5) {
-        player.stopPlaying();
-        next = DISPLAY_TIME;
+        next = stopRings();
       }
       break;
     case DISPLAY_NAP_INTRO:
@@ -774,26 +2289,41 @@ State Clock::transition(State s, Command c) {
       }
       if (noInputDuringMS(NAP_SET_DELAY)) {
         next = DISPLAY_NAP;
-        napTime = rtc.now() + napTS;
+        napTime = currentTime + napTS;
+        napping = true;
       }
       break;
     case DISPLAY_NAP:
       if (c == NAP) {
         next = DISPLAY_TIME;
+        napping = false;
       }
       if (c == STOP_ADD_5) {
-        DateTime now = rtc.now();
+        DateTime now = currentTime;
         napTime = napTime + TimeSpan(NAP_INCREMENT);
         if ((napTime - now).totalseconds() >= 100 * 60) {
           napTime = now + TimeSpan(99 * 60 + 59);
         }
+#if FEATURE_HISTORY
+        history.record(HISTORY_NAP_EXTENDED, now.unixtime(), 0, (napTime - now).totalseconds());
+#endif
       }
       break;
+#endif
     case DARK_MODE:
       if (c != NONE) {
         next = DISPLAY_TIME;
       }
       break;
+#if FEATURE_BENCHMARK
+    case DISPLAY_BENCHMARK:
+      // any button leaves, the summary stays a while without one
+      if (c != NONE || (!benchmarkTask.running() && millis() - benchmarkDone > BENCHMARK_SHOW_TIME)) {
+        stopBenchmark();
+        next = DISPLAY_TIME;
+      }
+      break;
+#endif
     default:
       next = s;
   }
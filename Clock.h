@@ -6,27 +6,89 @@
 #include <SPI.h>
 #include <SD.h>
 #include <FlashStorage.h>
-#include <Adafruit_VS1053.h>
 #include <RTClib.h>
 #include "Display.h"
 #include "Input.h"
-#include "State.h";
+#include "AudioPlayer.h"
+#include "I2CBus.h"
+#include "Log.h"
+#include "Snapshot.h"
+#include "Watchdog.h"
+#include "Sleep.h"
+#include "Latency.h"
+#include "Benchmark.h"
+#include "History.h"
+#include "Trace.h"
+#include "SdProbe.h"
+#include "TrackIndex.h"
+#include "Config.h"
+#include "RingQueue.h"
+#include "Volume.h"
+#include "Task.h"
+#include "State.h"
 
+// Alarm days, bit n is DateTime::dayOfTheWeek() n, Sunday is 0
+#define ALL_DAYS     0x7F
+#define WEEKEND_DAYS 0x41
+#define WORK_DAYS    0x3E
+#define ALARM_MAX_EVERY_WEEKS 8
+
+// Only bytes, no padding: settings are compared with memcmp
 class Alarm {
   public:
     bool enabled = false;
     uint8_t hour = 0;
     uint8_t minute = 0;
-    bool weekend = true;
+    uint8_t days = ALL_DAYS;
     uint8_t track = 0; // [0-8], displayed as [1-9]
+    bool oneShot = false; // disabled once it rang
+    bool skipNext = false; // the next ring is skipped, then this is cleared
+    // rings on weeks where weekNumber % everyWeeks == weekPhase
+    uint8_t everyWeeks = 1;
+    uint8_t weekPhase = 0;
+
+    // first ring strictly after the given unixtime, 0 if it never rings
+    uint32_t nextRing(uint32_t after) const;
+    void toggleWeekend();
+
+    // serial protocol encoding, see protocol.js
+    void pack(uint8_t *out);
+    bool unpack(const uint8_t *in);
 };
 
+#define ALARM_PACKED_SIZE 8
+#define SETTINGS_PACKED_SIZE (2 * ALARM_PACKED_SIZE + 1)
+
+// weeks since 1970, starting on Sundays
+uint16_t weekNumber(uint32_t unixtime);
+
+// Alarm rules compiled into the next ring, recomputed at midnight and when
+// settings or time change, so checking an alarm is a comparison
+class AlarmSchedule {
+  public:
+    uint32_t next = 0; // unixtime, 0 if it never rings
+    uint32_t skipped = 0; // ring skipped by skipNext, until it's past
+    uint32_t lastRing = 0; // never scheduled again
+};
+
+#define SETTINGS_VERSION 3
+
 class Settings {
   public:
-    bool valid = true; // will be false if read from empty flash
+    // 1 was a bool valid flag, before alarm rules, 2 before brightness and
+    // delays. The settings are in the program image, which an upload
+    // programs with zeros: another version gets the defaults.
+    uint8_t version = SETTINGS_VERSION;
     Alarm alarm1;
     Alarm alarm2;
     uint8_t volume = 60; // [0-99]
+    uint8_t brightness = 0; // [0-15]
+    // auto exit delays, in 100 ms steps [10-255]
+    uint8_t exitVolumeDelay = EXIT_VOLUME_DELAY / 100;
+    uint8_t exitMenuDelay = EXIT_MENU_DELAY / 100;
+
+    void pack(uint8_t *out);
+    bool unpack(const uint8_t *in);
 };
 
 class Clock {
@@ -38,8 +100,48 @@ class Clock {
     // Input/output
     Display display;
     RTC_DS3231 rtc;
-    Adafruit_VS1053_FilePlayer player = Adafruit_VS1053_FilePlayer(0, 0, 0, 0, 0); // reinstantiated after SD init
+    AudioPlayer player = AudioPlayer(VS1053_RESET, VS1053_CS, VS1053_DCS, VS1053_DREQ);
     Input input;
+    Watchdog watchdog;
+    Sleep sleep;
+
+    // Time, read asynchronously once per loop
+    DateTime currentTime;
+    uint8_t rtcRegister = 0; // seconds, first of the 7 time registers
+    uint8_t rtcRaw[7];
+    I2CTransaction rtcRead;
+    uint32_t rtcReadStart; // micros() the read was queued
+    // micros() of the read that first saw the current second, within a loop
+    // of its start
+    uint32_t secondEdge = 0;
+    uint32_t secondEdgeTime = 0; // unixtime
+    void updateTime();
+    void adjustTime(const DateTime &t);
+    void timeChanged(const DateTime &t);
+
+    // RTC writes go through the async bus, reads are held meanwhile
+    DateTime rtcPending;
+    uint8_t rtcWriteData[8]; // first register, then values
+    uint8_t rtcStatus;
+    I2CTransaction rtcWrite;
+    bool rtcStep(Task &task);
+    // blocking, the I2C bus must be idle
+    void readRtcRegisters(uint8_t reg, uint8_t *data, uint8_t length);
+    void writeRtcRegisters(uint8_t reg, const uint8_t *data, uint8_t length);
+
+    // Host time sync: the host places the second edges on its clock through
+    // pings, then has the time written at the micros() its next second
+    // starts. The last sync (unixtime) is kept in the alarm 1 registers,
+    // unused, battery backed with the time, and cleared by any other time
+    // write: the host measures the drift since then and sets the aging offset.
+    uint32_t lastSync = 0;
+    int8_t rtcAging = 0;
+    unsigned long lastSyncPing = 0; // millis()
+    DateTime syncTime;
+    uint32_t syncAt; // micros()
+    int8_t syncAging;
+    void sendTimeSync(uint8_t seq, uint32_t received);
+    bool syncStep(Task &task);
 
     // Time settings
     // we work on local copies when settings the time or date
@@ -57,40 +159,191 @@ class Clock {
 
     // Alarms/Settings
     Settings settings;
-    uint8_t alarmTrackCount;
-    bool alarm1Stopped = false;
-    bool alarm2Stopped = false;
+    // any until a card's tracks are counted, then clamped (clampTracks())
+    uint8_t alarmTrackCount = ALARM_TRACK_MAX;
     void writeSettings();
+    bool flashStep(Task &task);
+    // settings.volume through the perceptual curve (Volume.h), plus the gain
+    // of the track playing so that alarm tracks all sound as loud
+    uint8_t playGain = 0; // 0.5 dB steps
+    bool muted = false; // the benchmark plays its tracks silently
     void applyVolume();
+    void setPlayGain(uint8_t gain);
     void playButtonBeep();
-    String getAlarmFileName(uint8_t track);
+    // tracks are opened and prefilled by playTask, the button beep is direct
+    String playPath;
+    bool playTone = false; // the built-in tone if the track can't be played
+    void playFile(const String &path, bool tone = false);
+    bool playStep(Task &task);
+    void stopSound();
+    bool soundStopped();
     bool checkAlarmFile(uint8_t track);
     void playAlarm(uint8_t track);
-    void checkAlarm(Alarm a, State ALARM_X, bool &stoppedFlag);
+    // a track shorter than ALARM_LOOP_TIME plays again until the alarm has
+    // rung that long
+    unsigned long ringStarted = 0; // millis()
+    bool loopTrack(uint8_t track);
+    void checkAlarm(Alarm &a, AlarmSchedule &schedule, State ALARM_X);
+    bool alarmDue(const AlarmSchedule &schedule, uint32_t t);
+
+    // Ring arbitration: checkAlarm/checkNap queue the rings that come due,
+    // arbitrateRings() plays them one at a time. A ring is never cut off, the
+    // ones due with it merge into it, the others wait for it to end.
+    RingQueue rings;
+    RingEvent currentRing; // while ringing, then the one that rang last
+    void arbitrateRings();
+    void startRing(const RingEvent &e);
+    bool ringsWith(const RingEvent &e); // merged into currentRing
+    void mergeRing(uint8_t i);
+    State stopRings();
+    State afterRing();
+
+    AlarmSchedule schedule1;
+#if FEATURE_ALARM_2
+    AlarmSchedule schedule2;
+#endif
+    uint8_t scheduleDay = 0;
+    void scheduleAlarms();
+    void scheduleAlarm(const Alarm &a, AlarmSchedule &schedule);
+
+    // Alarm pre-warm: a few seconds before the minute the track is opened and
+    // buffered, then started as soon as the RTC seconds register wraps
+    bool armed = false;
+    State armedState;
+    uint8_t armedTrack;
+    unsigned long lastSecondSeen = 0; // millis() when second 59 was first seen
+    void prewarmAlarm();
+    void startArmedAlarm();
+    uint8_t readSeconds();
     bool noInputDuringMS(unsigned long delay);
 
+#if FEATURE_NAP
     // Nap
     TimeSpan napTS;
     DateTime napTime;
+    bool napping = false; // napTime is set, in DISPLAY_NAP or under a ring
     void playNap();
     void checkNap();
+#endif
 
-    // Init
+    // Init, the card and the player come up in bootTask
     uint8_t sdPin;
-    void die(char* msg, uint8_t errCode);
+    SdProfile sdProfile; // clock 0 if the probe failed
+    bool newCard; // not the one profiled, probed on this mount
+    bool warmBoot = false;
+    bool soundReady = false;
+    bool bootStep(Task &task);
+    void die(LogMessage msg, uint8_t errCode);
     void initDisplay();
     void initRTC();
     void initSound();
-    void initSD();
+    bool initSD();
+    bool initSDClock();
     void initInput();
     void initFlashSettings();
 
+    // Serial control and telemetry
+    uint16_t telemetryPeriod = 0; // ms, 0 = disabled
+    unsigned long lastTelemetry = 0;
+    uint32_t loopCount = 0; // 16 bits in the frame, saturated
+    uint32_t loopTotalTime = 0; // us
+    uint32_t loopMaxTime = 0; // us
+    void serveLink();
+    bool exporting();
+    void handleFrame();
+    void ack(uint8_t type, AckStatus status);
+    void sendSettings();
+    void sendTelemetry();
+    void resetTelemetry();
+    int16_t traceCursor = -1; // 0 crash header, then records, -1 when idle
+    void sendTrace();
+#if FEATURE_LATENCY_TRACE
+    int16_t latencyCursor = -1; // next histogram to export, -1 when idle
+    bool latencyReset = false;
+    void sendLatency();
+#endif
+#if FEATURE_BENCHMARK
+    int16_t benchmarkCursor = -1; // next timing to export, -1 when idle
+    void sendBenchmark();
+#endif
+#if FEATURE_HISTORY
+    int16_t historyCursor = -1; // next record to export, -1 when idle
+    void sendHistory();
+#endif
+
+    // Slow operations split into steps, run after each loop (see Task.h)
+    Scheduler tasks;
+    MethodTask<Clock> bootTask = MethodTask<Clock>(this, &Clock::bootStep);
+    MethodTask<Clock> flashTask = MethodTask<Clock>(this, &Clock::flashStep);
+    MethodTask<Clock> rtcTask = MethodTask<Clock>(this, &Clock::rtcStep);
+    MethodTask<Clock> playTask = MethodTask<Clock>(this, &Clock::playStep);
+    MethodTask<Clock> syncTask = MethodTask<Clock>(this, &Clock::syncStep);
+    MethodTask<Clock> cardTask = MethodTask<Clock>(this, &Clock::cardStep);
+#if FEATURE_BENCHMARK
+    MethodTask<Clock> benchmarkTask = MethodTask<Clock>(this, &Clock::benchmarkStep);
+#endif
+
+    // Card hot-plug: cardTask mounts the card, counts its tracks and reads its
+    // config file, at boot and whenever checkCard() sees one come or go.
+    // Meanwhile sounds from the card are skipped, and alarms and naps ring
+    // with the built-in tone.
+    bool cardReady = false;
+    bool cardDetected = false; // the alternate slot's switch
+    bool cardPending = false; // a switch edge, waiting to be stable
+    unsigned long cardChanged = 0; // millis() of the last edge
+    unsigned long lastCardPoll = 0; // millis()
+    bool tracksCounted = false; // alarmTrackCount is from the card
+    uint8_t scanTrack;
+#if FEATURE_CONFIG_FILE
+    Config config;
+    File configFile;
+    ConfigStatus configStatus;
+    Settings configSettings; // the settings with the file applied
+#endif
+    void checkCard();
+    void cardLost();
+    bool cardStep(Task &task);
+    void clampTracks();
+
+#if FEATURE_HISTORY
+    // Event history: rings and how they ended, naps
+    uint32_t ringStart = 0; // unixtime, 0 if rung before a warm boot
+    void recordHistory(State previous, Command c);
+#endif
+
+    // Warm restart
+    void saveSnapshot();
+    void restoreSnapshot();
+    void resumePlayback();
+
+    // Dark mode: render() puts the display and the player to sleep, the MCU
+    // sleeps until the next minute or a button
+    void sleepInDarkMode();
+    bool alarmDueNextMinute();
+
+#if FEATURE_BENCHMARK
+    // Self-benchmark: timed in steps of benchmarkTask while DISPLAY_BENCHMARK
+    // shows it, then the summary is shown and the results streamed
+    uint8_t benchmarkIndex; // state or track being timed
+    uint8_t benchmarkRun;
+    uint32_t benchmarkStart; // micros()
+    unsigned long benchmarkDone = 0; // millis() when finished
+    uint8_t benchmarkRaw[7];
+    I2CTransaction benchmarkRead;
+    void startBenchmark();
+    void stopBenchmark();
+    bool benchmarkStep(Task &task);
+#endif
+
     // State management
     State state = DISPLAY_TIME;
 
     void render();
     State transition(State s, Command c);
     void alarmTransition();
+
+    // the host simulation (sim/) checks invariants on the private state
+    friend class ClockProbe;
 };
 
 #endif
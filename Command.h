@@ -8,7 +8,10 @@ typedef enum {
   UP,
   DOWN,
   STOP_ADD_5,
-  NAP
+  NAP,
+  BENCHMARK
 } Command;
 
+#define COMMAND_COUNT (BENCHMARK + 1)
+
 #endif
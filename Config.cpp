@@ -0,0 +1,229 @@
+#include "Config.h"
+#include "Clock.h"
+#include "SpiArbiter.h"
+#include "Log.h"
+
+#if FEATURE_CONFIG_FILE
+
+// by ConfigKey, from CONFIG_KEY_VOLUME
+static const char *const KEYS[] = { "volume", "brightness", "exit_volume_delay", "exit_menu_delay", "alarm1", "alarm2" };
+// bit n of the days mask
+static const char *const DAYS[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+// n decimal digits, up to 5
+static bool parseNumber(const char *s, uint8_t n, int32_t &value) {
+  value = 0;
+  for (uint8_t i = 0; i < n; i++) {
+    if (s[i] < '0' || s[i] > '9' || i == 5) {
+      return false;
+    }
+    value = value * 10 + s[i] - '0';
+  }
+  return n > 0;
+}
+
+// H:MM or HH:MM
+static bool parseTime(const char *s, int8_t &hour, int8_t &minute) {
+  const char *colon = strchr(s, ':');
+  int32_t h, m;
+  if (!colon || colon - s > 2 || strlen(colon + 1) != 2 ||
+      !parseNumber(s, colon - s, h) || !parseNumber(colon + 1, 2, m) || h >= 24 || m >= 60) {
+    return false;
+  }
+  hour = h;
+  minute = m;
+  return true;
+}
+
+void Config::begin(Settings *target) {
+  settings = target;
+  skipped = 0;
+  changed = false;
+  tokenLength = 0;
+  line = 1;
+  startLine();
+}
+
+ConfigStatus Config::read(File &file) {
+  spiArbiter.acquire();
+  int16_t length = file.read(chunk, sizeof(chunk));
+  spiArbiter.release();
+  if (length < 0) {
+    LOG_WARN(LOG_CONFIG_FAILED);
+    return CONFIG_FAILED;
+  }
+  for (int16_t i = 0; i < length; i++) {
+    feed(chunk[i]);
+  }
+  if (length < (int16_t) sizeof(chunk)) {
+    feed('\n'); // the last line may not have one
+    LOG_INFO(LOG_CONFIG_LOADED, skipped);
+    return CONFIG_DONE;
+  }
+  return CONFIG_READING;
+}
+
+void Config::feed(char c) {
+  if (c == '\n') {
+    endToken();
+    endLine();
+  }
+  else if (comment) {
+    return;
+  }
+  else if (c == '#') {
+    endToken();
+    comment = true;
+  }
+  else if (c == ' ' || c == '\t' || c == '\r' || c == '=' || c == ',') {
+    endToken();
+  }
+  else if (tokenLength == CONFIG_TOKEN_MAX) {
+    failed = true;
+  }
+  else {
+    token[tokenLength++] = c >= 'A' && c <= 'Z' ? c - 'A' + 'a' : c;
+  }
+}
+
+void Config::endToken() {
+  if (tokenLength == 0) {
+    return;
+  }
+  token[tokenLength] = '\0';
+  tokenLength = 0;
+  if (failed) {
+    return;
+  }
+  if (values++ == 0) {
+    keyToken();
+  }
+  else if (key >= CONFIG_KEY_ALARM_1) {
+    alarmToken();
+  }
+  else if (values > 2 || !parseNumber(token, strlen(token), number)) {
+    failed = true;
+  }
+}
+
+void Config::keyToken() {
+  for (uint8_t i = 0; i < sizeof(KEYS) / sizeof(KEYS[0]); i++) {
+    if (strcmp(token, KEYS[i]) == 0) {
+      key = CONFIG_KEY_VOLUME + i;
+      return;
+    }
+  }
+  failed = true;
+}
+
+void Config::alarmToken() {
+  int32_t n;
+  if (trackNext) {
+    trackNext = false;
+    if (!parseNumber(token, strlen(token), n) || n < 1 || n > 9) {
+      failed = true;
+    }
+    track = n - 1;
+    return;
+  }
+  if (strcmp(token, "on") == 0 || strcmp(token, "off") == 0) {
+    enabled = token[1] == 'n';
+  }
+  else if (strcmp(token, "once") == 0 || strcmp(token, "repeat") == 0) {
+    oneShot = token[0] == 'o';
+  }
+  else if (strcmp(token, "track") == 0) {
+    trackNext = true;
+  }
+  else if (strcmp(token, "all") == 0) {
+    days |= ALL_DAYS;
+  }
+  else if (strcmp(token, "weekdays") == 0) {
+    days |= WORK_DAYS;
+  }
+  else if (strcmp(token, "weekend") == 0) {
+    days |= WEEKEND_DAYS;
+  }
+  else if (strchr(token, ':')) {
+    failed = !parseTime(token, hour, minute);
+  }
+  else {
+    for (uint8_t i = 0; i < 7; i++) {
+      if (strcmp(token, DAYS[i]) == 0) {
+        days |= 1 << i;
+        return;
+      }
+    }
+    failed = true;
+  }
+}
+
+void Config::startLine() {
+  comment = false;
+  key = CONFIG_KEY_NONE;
+  values = 0;
+  failed = false;
+  number = -1;
+  enabled = hour = minute = track = oneShot = -1;
+  days = 0;
+  trackNext = false;
+}
+
+// applies the line if it made sense
+void Config::endLine() {
+  if (key == CONFIG_KEY_VOLUME && number > 99) {
+    failed = true;
+  }
+  if (key == CONFIG_KEY_BRIGHTNESS && number > 15) {
+    failed = true;
+  }
+  if ((key == CONFIG_KEY_EXIT_VOLUME_DELAY || key == CONFIG_KEY_EXIT_MENU_DELAY) && (number < 1000 || number > 25500)) {
+    failed = true;
+  }
+  if ((key != CONFIG_KEY_NONE && key < CONFIG_KEY_ALARM_1 && number < 0) || trackNext) {
+    failed = true; // a key and no value
+  }
+
+  Settings before = *settings;
+  if (failed) {
+    skipped++;
+    LOG_WARN(LOG_CONFIG_LINE, line);
+  }
+  else if (key == CONFIG_KEY_VOLUME) {
+    settings->volume = number;
+  }
+  else if (key == CONFIG_KEY_BRIGHTNESS) {
+    settings->brightness = number;
+  }
+  else if (key == CONFIG_KEY_EXIT_VOLUME_DELAY) {
+    settings->exitVolumeDelay = number / 100;
+  }
+  else if (key == CONFIG_KEY_EXIT_MENU_DELAY) {
+    settings->exitMenuDelay = number / 100;
+  }
+  else if (key >= CONFIG_KEY_ALARM_1) {
+    Alarm &alarm = key == CONFIG_KEY_ALARM_1 ? settings->alarm1 : settings->alarm2;
+    if (enabled >= 0) {
+      alarm.enabled = enabled;
+    }
+    if (hour >= 0) {
+      alarm.hour = hour;
+      alarm.minute = minute;
+    }
+    if (days != 0) {
+      alarm.days = days;
+    }
+    if (track >= 0) {
+      alarm.track = track;
+    }
+    if (oneShot >= 0) {
+      alarm.oneShot = oneShot;
+    }
+  }
+  changed |= memcmp(&before, settings, sizeof(Settings)) != 0;
+
+  line++;
+  startLine();
+}
+
+#endif
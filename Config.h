@@ -0,0 +1,83 @@
+#ifndef Config_h
+#define Config_h
+
+#include <Arduino.h>
+#include <SD.h>
+#include "constants.h"
+
+class Settings;
+
+typedef enum {
+  CONFIG_KEY_NONE,
+  CONFIG_KEY_VOLUME,
+  CONFIG_KEY_BRIGHTNESS,
+  CONFIG_KEY_EXIT_VOLUME_DELAY,
+  CONFIG_KEY_EXIT_MENU_DELAY,
+  CONFIG_KEY_ALARM_1,
+  CONFIG_KEY_ALARM_2,
+} ConfigKey;
+
+typedef enum {
+  CONFIG_READING, // more to read
+  CONFIG_DONE, // the whole file was read
+  CONFIG_FAILED, // the card failed
+} ConfigStatus;
+
+// Settings from CONFIG_FILE on the card, to set up clocks by copying a
+// file: read on every mount and applied over the settings, what the file
+// doesn't mention is left as it is. One setting per line:
+//
+//   # comment
+//   volume = 60                 [0-99]
+//   brightness = 8              [0-15]
+//   exit_volume_delay = 3000    ms [1000-25500], in 100 ms steps
+//   exit_menu_delay = 10000     same
+//   alarm1 = on 7:00 weekdays track 2
+//   alarm2 = off 9:30 sat sun once
+//
+// An alarm line sets what it has: on or off, the time, the days (sun to
+// sat, weekdays, weekend, all), track [1-9], once or repeat. A line with
+// anything else is skipped as a whole, and logged.
+//
+// Streamed CONFIG_CHUNK_SIZE bytes at a time through a token buffer, no
+// allocation, into a copy of the settings: only a file read to its end is
+// applied.
+class Config {
+  public:
+    void begin(Settings *target);
+    // the next chunk
+    ConfigStatus read(File &file);
+    uint8_t skipped; // lines
+    bool changed; // settings differ from what they were
+
+  private:
+    Settings *settings;
+    uint8_t chunk[CONFIG_CHUNK_SIZE];
+    char token[CONFIG_TOKEN_MAX + 1];
+    uint8_t tokenLength;
+    bool comment;
+
+    // the line being read, applied at its end if it made sense
+    uint16_t line;
+    uint8_t key;
+    uint8_t values;
+    bool failed;
+    int32_t number; // a number key's value
+    // alarm line fields, -1 or 0 if not given
+    int8_t enabled;
+    int8_t hour;
+    int8_t minute;
+    uint8_t days;
+    int8_t track;
+    int8_t oneShot;
+    bool trackNext; // "track" was the last token
+
+    void feed(char c);
+    void endToken();
+    void startLine();
+    void endLine();
+    void keyToken();
+    void alarmToken();
+};
+
+#endif
@@ -1,98 +1,231 @@
 #include "Display.h"
 
+static const uint8_t DIGIT_POSITIONS[] = { 0, 1, 3, 4 };
+
+void Display::writeGlyph(uint8_t digit, uint8_t g) {
+  writeDigitRaw(digit, g);
+}
+
+// firstDigit is 0 for the left pair, 3 for the right pair
+void Display::printPair(uint8_t firstDigit, uint8_t n) {
+  uint16_t pair = DIGIT_PAIRS[n];
+  writeGlyph(firstDigit, pair >> 8);
+  writeGlyph(firstDigit + 1, pair & 0xFF);
+}
+
+// up to 4 characters, left aligned
+void Display::printText(const char *text) {
+  for (uint8_t i = 0; i < 4 && text[i]; i++) {
+    writeGlyph(DIGIT_POSITIONS[i], glyph(text[i]));
+  }
+}
+
 void Display::printBoot() {
-  writeDigitRaw(0, LETTER_b);
-  writeDigitRaw(1, LETTER_o);
-  writeDigitRaw(3, LETTER_o);
-  writeDigitRaw(4, LETTER_t);
+  printText("boot");
 }
 
+#if FEATURE_NAP
 void Display::printNapIntro() {
-  writeDigitRaw(0, LETTER_n);
-  writeDigitRaw(1, LETTER_A);
-  writeDigitRaw(3, LETTER_P);
+  printText("nAP");
 }
+#endif
 
 // Print without the first leading zero 01:23 => 1:23, 00:00 => 0:00
 void Display::printTime(uint8_t hour, uint8_t minute) {
-  uint8_t digits[] = {};
-  digits[0] = hour / 10;
-  digits[1] = hour - 10 * digits[0];
-  digits[2] = minute / 10;
-  digits[3] = minute - 10 * digits[2];
+  printPair(0, hour);
   // don't print first digit if zeros
-  if (digits[0] > 0) {
-    writeDigitNum(0, digits[0]);
-  }
-  else {
-    writeDigitRaw(0, 0); // empty char
+  if (hour < 10) {
+    writeGlyph(0, 0); // empty char
   }
-  writeDigitNum(1, digits[1]);
-  writeDigitNum(3, digits[2]);
-  writeDigitNum(4, digits[3]);
+  printPair(3, minute);
 }
 
 // print 4 digits
 void Display::printDate(uint8_t day, uint8_t month) {
-  uint8_t digits[] = {};
-  digits[0] = day / 10;
-  digits[1] = day - 10 * digits[0];
-  digits[2] = month / 10;
-  digits[3] = month - 10 * digits[2];
-  writeDigitNum(0, digits[0]);
-  writeDigitNum(1, digits[1]);
-  writeDigitNum(3, digits[2]);
-  writeDigitNum(4, digits[3]);
+  printPair(0, day);
+  printPair(3, month);
+}
+
+// [0-99], right aligned without leading zero
+#if FEATURE_VOLUME_MENU
+void Display::printVolume(uint8_t volume) {
+  printPair(3, volume);
+  if (volume < 10) {
+    writeGlyph(3, 0);
+  }
+}
+#endif
+
+// [0-99] => 20YY
+void Display::printYear(uint8_t year) {
+  printPair(0, 20);
+  printPair(3, year);
 }
 
+#if FEATURE_BENCHMARK
+// [0-9999], right aligned without leading zeros
+void Display::printNumber(uint16_t n) {
+  printPair(0, n / 100);
+  printPair(3, n % 100);
+  if (n < 1000) {
+    writeGlyph(0, 0);
+  }
+  if (n < 100) {
+    writeGlyph(1, 0);
+  }
+  if (n < 10) {
+    writeGlyph(3, 0);
+  }
+}
+#endif
+
 void Display::printAlarmEnabled(uint8_t number, boolean enabled) {
-  writeDigitRaw(0, LETTER_A);
-  writeDigitNum(1, number);
-  writeDigitRaw(3, LETTER_o);
-  writeDigitRaw(4, enabled ? LETTER_n : LETTER_f);
+  writeGlyph(0, glyph('A'));
+  writeGlyph(1, glyph('0' + number));
+  writeGlyph(3, glyph('o'));
+  writeGlyph(4, glyph(enabled ? 'n' : 'f'));
 }
 
 // toggle between SA(turday) and SU(nday)
 void Display::printAlarmWeekEnd(uint8_t number, boolean weekend) {
-  writeDigitRaw(0, LETTER_S);
-  if (millis() % (2 * BLINK_DELAY) < BLINK_DELAY) {
-    writeDigitRaw(1, LETTER_A);
-  }
-  else {
-    writeDigitRaw(1, LETTER_U);
-  }
-  writeDigitRaw(3, LETTER_o);
-  writeDigitRaw(4, weekend ? LETTER_n : LETTER_f);
+  printText(updateBlink() ? "SUo" : "SAo");
+  writeGlyph(4, glyph(weekend ? 'n' : 'f'));
 }
 
 void Display::printAlarmTrack(uint8_t number, uint8_t track) {
-  writeDigitRaw(0, LETTER_A);
-  writeDigitNum(1, number);
-  writeDigitRaw(3, 0);
-  writeDigitNum(4, track);
+  writeGlyph(0, glyph('A'));
+  writeGlyph(1, glyph('0' + number));
+  writeGlyph(3, 0);
+  writeGlyph(4, glyph('0' + track));
 }
 
-void Display::printErr(uint8_t errorCode) {
-  writeDigitRaw(0, LETTER_E);
-  writeDigitRaw(1, LETTER_r);
-  writeDigitRaw(3, LETTER_r);
-  writeDigitNum(4, errorCode);
+void Display::setScroll(const char *text) {
+  uint8_t length = 0;
+  memset(scrollGlyphs, 0, sizeof(scrollGlyphs));
+  while (length < SCROLL_MAX_LENGTH && text[length]) {
+    scrollGlyphs[4 + length] = glyph(text[length]);
+    length++;
+  }
+  scrollFrameCount = length + 4;
+  scrollFrame = 0;
+  lastScrollStep = millis();
 }
 
-void Display::flush() {
+// text enters from the right and leaves on the left, then starts over
+void Display::printScroll() {
+  if (millis() - lastScrollStep >= SCROLL_DELAY) {
+    lastScrollStep = millis();
+    scrollFrame++;
+    if (scrollFrame >= scrollFrameCount) {
+      scrollFrame = 0;
+    }
+  }
+  const uint8_t *frame = scrollGlyphs + scrollFrame + 1;
+  for (uint8_t i = 0; i < 4; i++) {
+    writeGlyph(DIGIT_POSITIONS[i], frame[i]);
+  }
+}
+
+// true during the "off" half of the blinking period
+bool Display::updateBlink() {
+  if (millis() - lastBlinkToggle >= BLINK_DELAY) {
+    lastBlinkToggle = millis();
+    blinkOn = !blinkOn;
+  }
+  return blinkOn;
+}
+
+bool Display::flush() {
   // blinking
-  if (millis() % (2 * BLINK_DELAY) < BLINK_DELAY) {
+  if (updateBlink()) {
     for (uint8_t i = 0; i <= 4; i++) {
-      if ((blinking >> i) & 1 == 1) {
+      if ((blinking >> i) & 1) {
         writeDigitRaw(i, 0);
       }
     }
   }
 
-  if (changed()) {
-    writeDisplay();
-    memcpy(lastDisplayBuffer, displaybuffer, sizeof(lastDisplayBuffer));
+  // dimming command, once changed or failed
+  if (dimmingWrite.status == I2C_FAILED) {
+    dimmingWrite.status = I2C_IDLE;
+    sentDimming = 0xFF;
+  }
+  if (dimming != sentDimming && !dimmingWrite.busy()) {
+    dimmingCommand = 0xE0 | dimming;
+    dimmingWrite.address = DISPLAY_I2C_ADDRESS;
+    dimmingWrite.txData = &dimmingCommand;
+    dimmingWrite.txLength = 1;
+    if (i2cBus.submit(&dimmingWrite)) {
+      sentDimming = dimming;
+    }
+  }
+
+  // the last frame didn't make it, send it again
+  if (frameWrite.status == I2C_FAILED) {
+    frameWrite.status = I2C_IDLE;
+    memset(lastDisplayBuffer, 0xFF, sizeof(lastDisplayBuffer));
+  }
+
+  // same bytes as writeDisplay(), but queued. If the previous frame is still
+  // being sent, this one waits for the next flush
+  if (changed() && !frameWrite.busy()) {
+    frame[0] = 0x00;
+    for (uint8_t i = 0; i < 8; i++) {
+      frame[1 + 2 * i] = displaybuffer[i] & 0xFF;
+      frame[2 + 2 * i] = displaybuffer[i] >> 8;
+    }
+    frameWrite.address = DISPLAY_I2C_ADDRESS;
+    frameWrite.txData = frame;
+    frameWrite.txLength = sizeof(frame);
+    if (i2cBus.submit(&frameWrite)) {
+      memcpy(lastDisplayBuffer, displaybuffer, sizeof(lastDisplayBuffer));
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Display::frameSent() {
+  return frameWrite.status == I2C_DONE;
+}
+
+void Display::invalidate() {
+  memset(lastDisplayBuffer, 0xFF, sizeof(lastDisplayBuffer));
+}
+
+void Display::sleep() {
+  if (!asleep && setPower(false)) {
+    asleep = true;
+  }
+}
+
+void Display::wake() {
+  if (asleep && setPower(true)) {
+    asleep = false;
+  }
+}
+
+void Display::setDimming(uint8_t level) {
+  dimming = min(level, (uint8_t) 15);
+}
+
+// one command byte per transaction: display setup (on/off, no blinking)
+// and system setup (oscillator on/off), oscillator first when waking up
+bool Display::setPower(bool on) {
+  if (powerWrites[0].busy() || powerWrites[1].busy()) {
+    return false;
+  }
+  powerCommands[0] = on ? 0x21 : 0x80;
+  powerCommands[1] = on ? 0x81 : 0x20;
+  for (uint8_t i = 0; i < 2; i++) {
+    powerWrites[i].address = DISPLAY_I2C_ADDRESS;
+    powerWrites[i].txData = &powerCommands[i];
+    powerWrites[i].txLength = 1;
+    if (!i2cBus.submit(&powerWrites[i])) {
+      return false;
+    }
   }
+  return true;
 }
 
 bool Display::changed() {
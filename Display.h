@@ -3,6 +3,8 @@
 
 #include "Adafruit_LEDBackpack.h"
 #include "constants.h"
+#include "Glyphs.h"
+#include "I2CBus.h"
 
 class Display : public Adafruit_7segment {
   public:
@@ -10,18 +12,67 @@ class Display : public Adafruit_7segment {
     void printBoot();
     void printTime(uint8_t hour, uint8_t minutes);
     void printDate(uint8_t day, uint8_t month);
+#if FEATURE_VOLUME_MENU
+    void printVolume(uint8_t volume);
+#endif
+    void printYear(uint8_t year);
+#if FEATURE_BENCHMARK
+    void printNumber(uint16_t n);
+#endif
+#if FEATURE_NAP
     void printNapIntro();
+#endif
     void printAlarmEnabled(uint8_t number, boolean enabled);
     void printAlarmWeekEnd(uint8_t number, boolean weekend);
     void printAlarmTrack(uint8_t number, uint8_t track);
-    void printErr(uint8_t errorCode);
+    void printText(const char *text);
+    void setScroll(const char *text);
+    void printScroll();
     void setDots(uint8_t dots);
     void setBlinking(uint8_t digits);
-    void flush();
+    // queue the frame if it changed, true if it did
+    bool flush();
+    bool frameSent();
+    // the next flush() sends the frame even if it didn't change
+    void invalidate();
+    // HT16K33 standby (oscillator off, RAM kept) and back, queued
+    void sleep();
+    void wake();
+    // [0-15], sent by the next flush()
+    void setDimming(uint8_t level);
   private:
     uint16_t lastDisplayBuffer[8];
     bool changed();
+
+    // async display RAM write: address 0 then the 8 rows
+    uint8_t frame[17];
+    I2CTransaction frameWrite;
+
+    bool asleep = false;
+    uint8_t powerCommands[2];
+    I2CTransaction powerWrites[2];
+    bool setPower(bool on);
+    uint8_t dimming = 0;
+    uint8_t sentDimming = 0xFF; // none yet
+    uint8_t dimmingCommand;
+    I2CTransaction dimmingWrite;
     uint8_t blinking = 0;
+
+    // blinking phase, toggled every BLINK_DELAY
+    bool blinkOn = false;
+    unsigned long lastBlinkToggle = 0;
+    bool updateBlink();
+
+    // digits positions, 2 is the colon
+    void writeGlyph(uint8_t digit, uint8_t g);
+    void printPair(uint8_t firstDigit, uint8_t n);
+
+    // scrolling text: glyphs precomputed once, padded with 4 blanks on each
+    // side, frame n is the 4 glyphs window starting at n + 1
+    uint8_t scrollGlyphs[SCROLL_MAX_LENGTH + 8];
+    uint8_t scrollFrameCount = 0;
+    uint8_t scrollFrame = 0;
+    unsigned long lastScrollStep = 0;
 };
 
 #endif
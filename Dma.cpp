@@ -0,0 +1,87 @@
+#include "Dma.h"
+
+__attribute__ ((aligned (16))) static DmacDescriptor descriptors[DMA_CHANNELS];
+__attribute__ ((aligned (16))) static DmacDescriptor writeback[DMA_CHANNELS];
+static void (*callbacks[DMA_CHANNELS])();
+
+// CHID selects the channel the CH* registers refer to, it must not change
+// under our feet
+class ChannelLock {
+  public:
+    ChannelLock(uint8_t channel) {
+      primask = __get_PRIMASK();
+      __disable_irq();
+      DMAC->CHID.reg = DMAC_CHID_ID(channel);
+    }
+    ~ChannelLock() {
+      __set_PRIMASK(primask);
+    }
+  private:
+    uint32_t primask;
+};
+
+void dmaBegin() {
+  if (DMAC->CTRL.bit.DMAENABLE) {
+    return;
+  }
+  PM->AHBMASK.reg |= PM_AHBMASK_DMAC;
+  PM->APBBMASK.reg |= PM_APBBMASK_DMAC;
+  DMAC->CTRL.reg = DMAC_CTRL_SWRST;
+  while (DMAC->CTRL.bit.SWRST);
+  DMAC->BASEADDR.reg = (uint32_t) descriptors;
+  DMAC->WRBADDR.reg = (uint32_t) writeback;
+  DMAC->CTRL.reg = DMAC_CTRL_DMAENABLE | DMAC_CTRL_LVLEN(0xF);
+}
+
+void dmaStart(uint8_t channel, uint8_t trigger, const volatile void *src, bool srcIncrement,
+              volatile void *dst, bool dstIncrement, uint16_t count) {
+  DmacDescriptor &d = descriptors[channel];
+  d.BTCTRL.reg = DMAC_BTCTRL_VALID | DMAC_BTCTRL_BEATSIZE_BYTE |
+    (srcIncrement ? DMAC_BTCTRL_SRCINC : 0) | (dstIncrement ? DMAC_BTCTRL_DSTINC : 0);
+  d.BTCNT.reg = count;
+  // incremented addresses point to the end of the block
+  d.SRCADDR.reg = (uint32_t) src + (srcIncrement ? count : 0);
+  d.DSTADDR.reg = (uint32_t) dst + (dstIncrement ? count : 0);
+  d.DESCADDR.reg = 0;
+
+  ChannelLock lock(channel);
+  DMAC->CHCTRLA.reg = 0;
+  while (DMAC->CHCTRLA.bit.ENABLE);
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_SWRST;
+  while (DMAC->CHCTRLA.bit.SWRST);
+  DMAC->CHCTRLB.reg = DMAC_CHCTRLB_LVL(0) | DMAC_CHCTRLB_TRIGSRC(trigger) | DMAC_CHCTRLB_TRIGACT_BEAT;
+  DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+  DMAC->CHCTRLA.reg = DMAC_CHCTRLA_ENABLE;
+}
+
+// the channel disables itself at the end of the block
+bool dmaDone(uint8_t channel) {
+  ChannelLock lock(channel);
+  return !DMAC->CHCTRLA.bit.ENABLE;
+}
+
+void dmaAbort(uint8_t channel) {
+  ChannelLock lock(channel);
+  DMAC->CHCTRLA.reg = 0;
+  while (DMAC->CHCTRLA.bit.ENABLE);
+}
+
+void dmaOnComplete(uint8_t channel, void (*callback)()) {
+  callbacks[channel] = callback;
+  ChannelLock lock(channel);
+  DMAC->CHINTENSET.reg = DMAC_CHINTENSET_TCMPL;
+  NVIC_EnableIRQ(DMAC_IRQn);
+}
+
+extern "C" void DMAC_Handler(void) {
+  uint32_t pending = DMAC->INTSTATUS.reg;
+  for (uint8_t channel = 0; channel < DMA_CHANNELS; channel++) {
+    if (pending & (1 << channel)) {
+      DMAC->CHID.reg = DMAC_CHID_ID(channel);
+      DMAC->CHINTFLAG.reg = DMAC_CHINTFLAG_MASK;
+      if (callbacks[channel]) {
+        callbacks[channel]();
+      }
+    }
+  }
+}
@@ -0,0 +1,23 @@
+#ifndef Dma_h
+#define Dma_h
+
+#include <Arduino.h>
+
+// Minimal SAMD21 DMAC driver: one single-block descriptor per channel,
+// completion is polled unless a callback is registered. Channels are
+// statically assigned.
+#define DMA_CHANNEL_I2C   0
+#define DMA_CHANNEL_AUDIO 1
+#define DMA_CHANNELS      2
+
+void dmaBegin();
+// byte transfers, count beats from src to dst, triggered by trigger (e.g.
+// SERCOM3_DMAC_ID_TX), addresses are incremented if the matching flag is set
+void dmaStart(uint8_t channel, uint8_t trigger, const volatile void *src, bool srcIncrement,
+              volatile void *dst, bool dstIncrement, uint16_t count);
+bool dmaDone(uint8_t channel);
+void dmaAbort(uint8_t channel);
+// call callback from the DMAC interrupt when a block completes on channel
+void dmaOnComplete(uint8_t channel, void (*callback)());
+
+#endif
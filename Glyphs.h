@@ -0,0 +1,47 @@
+#ifndef Glyphs_h
+#define Glyphs_h
+
+#include <Arduino.h>
+
+// 7-segment glyphs, bit 0 = segment A (top) to bit 6 = segment G (middle),
+// for printable ASCII [0x20-0x7F]. Letters without a decent 7-segment shape
+// (k, m, v, w, x) are approximations, both cases are kept apart when they
+// differ (b/B, o/O, n/N...).
+constexpr uint8_t ASCII_GLYPHS[96] = {
+  // space ! " # $ % & ' ( ) * + , - . /
+  0x00, 0x06, 0x22, 0x00, 0x6D, 0x00, 0x00, 0x02, 0x39, 0x0F, 0x00, 0x00, 0x04, 0x40, 0x00, 0x52,
+  // 0-9 : ; < = > ? @
+  0x3F, 0x06, 0x5B, 0x4F, 0x66, 0x6D, 0x7D, 0x07, 0x7F, 0x6F, 0x00, 0x00, 0x58, 0x48, 0x4C, 0x53, 0x5F,
+  // A-Z
+  0x77, 0x7C, 0x39, 0x5E, 0x79, 0x71, 0x3D, 0x76, 0x30, 0x1E, 0x75, 0x38, 0x15, 0x37, 0x3F, 0x73,
+  0x6B, 0x33, 0x6D, 0x78, 0x3E, 0x3E, 0x2A, 0x76, 0x6E, 0x5B,
+  // [ \ ] ^ _ `
+  0x39, 0x64, 0x0F, 0x23, 0x08, 0x20,
+  // a-z
+  0x5F, 0x7C, 0x58, 0x5E, 0x7B, 0x71, 0x6F, 0x74, 0x10, 0x0C, 0x75, 0x30, 0x14, 0x54, 0x5C, 0x73,
+  0x67, 0x50, 0x6D, 0x78, 0x1C, 0x1C, 0x14, 0x76, 0x6E, 0x5B,
+  // { | } ~ DEL
+  0x46, 0x30, 0x70, 0x01, 0x00
+};
+
+// char may be signed
+constexpr uint8_t glyph(char c) {
+  return (uint8_t) c >= 0x20 && (uint8_t) c < 0x80 ? ASCII_GLYPHS[(uint8_t) c - 0x20] : 0;
+}
+
+// [00-99] as two glyphs, tens in the high byte
+#define GLYPH_PAIR(n) ((uint16_t) (glyph('0' + (n) / 10) << 8 | glyph('0' + (n) % 10)))
+#define GLYPH_PAIR_ROW(t) \
+  GLYPH_PAIR(10 * t + 0), GLYPH_PAIR(10 * t + 1), GLYPH_PAIR(10 * t + 2), GLYPH_PAIR(10 * t + 3), \
+  GLYPH_PAIR(10 * t + 4), GLYPH_PAIR(10 * t + 5), GLYPH_PAIR(10 * t + 6), GLYPH_PAIR(10 * t + 7), \
+  GLYPH_PAIR(10 * t + 8), GLYPH_PAIR(10 * t + 9)
+
+constexpr uint16_t DIGIT_PAIRS[100] = {
+  GLYPH_PAIR_ROW(0), GLYPH_PAIR_ROW(1), GLYPH_PAIR_ROW(2), GLYPH_PAIR_ROW(3), GLYPH_PAIR_ROW(4),
+  GLYPH_PAIR_ROW(5), GLYPH_PAIR_ROW(6), GLYPH_PAIR_ROW(7), GLYPH_PAIR_ROW(8), GLYPH_PAIR_ROW(9)
+};
+
+#undef GLYPH_PAIR_ROW
+#undef GLYPH_PAIR
+
+#endif
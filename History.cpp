@@ -0,0 +1,154 @@
+#include "History.h"
+#include <FlashStorage.h>
+
+#if FEATURE_HISTORY
+History history;
+
+__attribute__((__aligned__(256))) static const uint8_t historyFlashData[HISTORY_ROWS * 256] = { };
+FlashClass historyFlash(historyFlashData, sizeof(historyFlashData));
+
+static bool empty(const HistoryRecord &r) {
+  const uint8_t *bytes = (const uint8_t *) &r;
+  for (uint8_t i = 0; i < sizeof(r); i++) {
+    if (bytes[i] != 0xFF) {
+      return false;
+    }
+  }
+  return true;
+}
+
+static bool valid(const HistoryRecord &r) {
+  return r.time != 0 && r.time != 0xFFFFFFFF && r.type < HISTORY_TYPES;
+}
+
+// Each row is filled from its start, the one filled last is followed by an
+// erased row. Anything else (a zeroed region, an erase cut by a power loss
+// in the middle of the ring) and the log starts over.
+void History::begin() {
+  uint8_t used[HISTORY_ROWS];
+  int16_t last = -1;
+  for (uint8_t row = 0; row < HISTORY_ROWS; row++) {
+    used[row] = 0;
+    HistoryRecord r;
+    for (uint8_t i = 0; i < RECORDS_PER_ROW; i++) {
+      readSlot(row * RECORDS_PER_ROW + i, r);
+      if (empty(r)) {
+        break;
+      }
+      if (!valid(r)) {
+        format();
+        return;
+      }
+      used[row]++;
+    }
+  }
+  for (uint8_t row = 0; row < HISTORY_ROWS; row++) {
+    if (used[row] > 0 && used[(row + 1) % HISTORY_ROWS] == 0) {
+      if (last >= 0) {
+        format();
+        return;
+      }
+      last = row;
+    }
+  }
+  if (last < 0) {
+    // empty, or no erased row: either way nothing to keep
+    format();
+    return;
+  }
+  head = (last * RECORDS_PER_ROW + used[last]) % SLOTS;
+  stored = used[last];
+  for (uint8_t n = 1; n < HISTORY_ROWS - 1; n++) {
+    uint8_t row = (last + HISTORY_ROWS - n) % HISTORY_ROWS;
+    if (used[row] != RECORDS_PER_ROW) {
+      break;
+    }
+    stored += RECORDS_PER_ROW;
+  }
+  // a partly erased row reads as empty from its start
+  eraseRow((last + 1) % HISTORY_ROWS);
+  pendingCount = 0;
+}
+
+void History::format() {
+  historyFlash.erase(historyFlashData, sizeof(historyFlashData));
+  head = 0;
+  stored = 0;
+  pendingCount = 0;
+}
+
+void History::record(HistoryType type, uint32_t time, uint8_t a, uint16_t b) {
+  if (pendingCount == HISTORY_PENDING_MAX) {
+    return; // the flash is behind, newest dropped
+  }
+  if (pendingCount == 0) {
+    firstPending = millis();
+  }
+  HistoryRecord &r = pending[pendingCount++];
+  r.time = time;
+  r.type = type;
+  r.a = a;
+  r.b = b;
+}
+
+void History::service() {
+  if (pendingCount == 0 || flushTask.running()) {
+    return;
+  }
+  bool pageFull = head % RECORDS_PER_PAGE + pendingCount >= RECORDS_PER_PAGE;
+  if (pageFull || millis() - firstPending >= HISTORY_FLUSH_DELAY) {
+    flushTask.start();
+  }
+}
+
+// The row erase and each page write stall the CPU for a few ms, they run in
+// different loops. Records added meanwhile go with the next page.
+bool History::flushStep(Task &task) {
+  TASK_BEGIN(task);
+  while (pendingCount > 0) {
+    if (head % RECORDS_PER_ROW == 0) {
+      eraseRow((head / RECORDS_PER_ROW + 1) % HISTORY_ROWS);
+      TASK_YIELD(task);
+    }
+    {
+      // the page from its start, slots already written are left as they are
+      HistoryRecord page[RECORDS_PER_PAGE];
+      memset(page, 0xFF, sizeof(page));
+      uint8_t first = head % RECORDS_PER_PAGE;
+      uint8_t n = min(pendingCount, (uint8_t) (RECORDS_PER_PAGE - first));
+      memcpy(page + first, pending, n * sizeof(HistoryRecord));
+      historyFlash.write(historyFlashData + (head - first) * sizeof(HistoryRecord), page, sizeof(page));
+      head = (head + n) % SLOTS;
+      stored += n;
+      pendingCount -= n;
+      memmove(pending, pending + n, pendingCount * sizeof(HistoryRecord));
+      firstPending = millis();
+    }
+    TASK_YIELD(task);
+  }
+  TASK_END(task);
+}
+
+// the oldest row goes, and the one being filled is empty
+void History::eraseRow(uint8_t row) {
+  historyFlash.erase(historyFlashData + row * 256, 256);
+  stored = min(stored, (uint16_t) ((HISTORY_ROWS - 2) * RECORDS_PER_ROW + head % RECORDS_PER_ROW));
+}
+
+uint16_t History::count() {
+  return stored + pendingCount;
+}
+
+void History::read(uint16_t i, HistoryRecord &r) {
+  if (i < stored) {
+    readSlot((head + SLOTS - stored + i) % SLOTS, r);
+  }
+  else {
+    r = pending[i - stored];
+  }
+}
+
+void History::readSlot(uint16_t slot, HistoryRecord &r) {
+  historyFlash.read(historyFlashData + slot * sizeof(HistoryRecord), &r, sizeof(r));
+}
+#endif
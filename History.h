@@ -0,0 +1,71 @@
+#ifndef History_h
+#define History_h
+
+#include <Arduino.h>
+#include "constants.h"
+#include "Task.h"
+
+typedef enum {
+  HISTORY_BOOT,          // a: reset cause (PM->RCAUSE)
+  HISTORY_RING,          // a: ringing state, b: track
+  HISTORY_RING_STOPPED,  // a: ringing state, b: s it rang, STOP_ADD_5
+  HISTORY_RING_ENDED,    // a: ringing state, b: s it rang, the track ended
+  HISTORY_RING_MISSED,   // a: ringing state, b: minutes late (off, stalled, time set past it)
+  HISTORY_NAP_SET,       // b: s
+  HISTORY_NAP_EXTENDED,  // b: s left
+  HISTORY_RING_MERGED,   // a: ringing state, b: the one it rang with, or that its stop cleared
+  HISTORY_TYPES
+} HistoryType;
+
+// 8 bytes, 8 to a flash page: clock time and either two bytes or a 16 bit
+// value
+class HistoryRecord {
+  public:
+    uint32_t time; // unixtime
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+};
+
+// Append-only event log in a flash region of HISTORY_ROWS rows, used as a
+// ring: the row after the one being filled is always erased, which is how
+// begin() finds the end again. Records wait in RAM for a page to fill or
+// HISTORY_FLUSH_DELAY, then flushTask writes them a page per step, and
+// erases the oldest row a step before the writes reach a new row. Records
+// still in RAM are lost on a reset.
+//
+// Uploading a sketch programs the region with zeros, begin() erases it then.
+class History {
+  public:
+    // blocking, once at boot
+    void begin();
+    void record(HistoryType type, uint32_t time, uint8_t a = 0, uint16_t b = 0);
+    // starts flushTask when a batch is due
+    void service();
+
+    // oldest first, flash then RAM
+    uint16_t count();
+    void read(uint16_t i, HistoryRecord &r);
+
+    MethodTask<History> flushTask = MethodTask<History>(this, &History::flushStep);
+
+    static const uint8_t RECORDS_PER_PAGE = 64 / sizeof(HistoryRecord);
+    static const uint8_t RECORDS_PER_ROW = 256 / sizeof(HistoryRecord);
+    static const uint16_t SLOTS = HISTORY_ROWS * RECORDS_PER_ROW;
+
+  private:
+    uint16_t head; // next slot written
+    uint16_t stored; // records in flash, up to head
+    HistoryRecord pending[HISTORY_PENDING_MAX];
+    uint8_t pendingCount = 0;
+    unsigned long firstPending; // millis()
+
+    bool flushStep(Task &task);
+    void readSlot(uint16_t slot, HistoryRecord &r);
+    void eraseRow(uint8_t row);
+    void format();
+};
+
+extern History history;
+
+#endif
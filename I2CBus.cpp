@@ -0,0 +1,151 @@
+#include "I2CBus.h"
+#include "Dma.h"
+#include "Trace.h"
+
+// Wire is SERCOM3 on the Feather M0
+#define I2C_SERCOM     SERCOM3
+#define I2C_DMA_TX     SERCOM3_DMAC_ID_TX
+#define I2C_DMA_RX     SERCOM3_DMAC_ID_RX
+#define BUS_STATE_IDLE 1
+#define CMD_STOP       3
+
+I2CBus i2cBus;
+
+void I2CBus::begin() {
+  dmaBegin();
+  recover();
+}
+
+bool I2CBus::submit(I2CTransaction *t) {
+  if (t->busy() || queueCount == I2C_QUEUE_SIZE) {
+    return false;
+  }
+  t->status = I2C_QUEUED;
+  queue[(queueHead + queueCount) % I2C_QUEUE_SIZE] = t;
+  queueCount++;
+  poll(); // start right away if the bus is free
+  return true;
+}
+
+void I2CBus::poll() {
+  Sercom *sercom = I2C_SERCOM;
+
+  if (current != nullptr) {
+    // address or data NACK, the master waits for a command
+    if (sercom->I2CM.INTFLAG.bit.ERROR || (sercom->I2CM.INTFLAG.bit.MB && sercom->I2CM.STATUS.bit.RXNACK)) {
+      finish(I2C_FAILED);
+    }
+    else if (millis() - phaseStart > I2C_TIMEOUT) {
+      finish(I2C_FAILED);
+      trace.record(TRACE_I2C_RECOVER);
+      recover();
+    }
+    // LENEN sends the STOP by itself once all bytes went through
+    else if (dmaDone(DMA_CHANNEL_I2C) && sercom->I2CM.STATUS.bit.BUSSTATE == BUS_STATE_IDLE) {
+      if (current->status == I2C_WRITING && current->rxLength > 0) {
+        startRead();
+      }
+      else {
+        finish(I2C_DONE);
+      }
+    }
+  }
+
+  if (current == nullptr && queueCount > 0) {
+    current = queue[queueHead];
+    queueHead = (queueHead + 1) % I2C_QUEUE_SIZE;
+    queueCount--;
+    if (current->txLength > 0) {
+      startWrite();
+    }
+    else {
+      startRead();
+    }
+  }
+}
+
+void I2CBus::startWrite() {
+  Sercom *sercom = I2C_SERCOM;
+  current->status = I2C_WRITING;
+  phaseStart = millis();
+  dmaStart(DMA_CHANNEL_I2C, I2C_DMA_TX, current->txData, true, &sercom->I2CM.DATA.reg, false, current->txLength);
+  sercom->I2CM.ADDR.reg = SERCOM_I2CM_ADDR_ADDR(current->address << 1) |
+    SERCOM_I2CM_ADDR_LENEN | SERCOM_I2CM_ADDR_LEN(current->txLength);
+  while (sercom->I2CM.SYNCBUSY.bit.SYSOP);
+}
+
+void I2CBus::startRead() {
+  Sercom *sercom = I2C_SERCOM;
+  current->status = I2C_READING;
+  phaseStart = millis();
+  // DMA reads need the automatic ACK of smart mode
+  setSmartMode(true);
+  dmaStart(DMA_CHANNEL_I2C, I2C_DMA_RX, &sercom->I2CM.DATA.reg, false, current->rxData, true, current->rxLength);
+  sercom->I2CM.ADDR.reg = SERCOM_I2CM_ADDR_ADDR((current->address << 1) | 1) |
+    SERCOM_I2CM_ADDR_LENEN | SERCOM_I2CM_ADDR_LEN(current->rxLength);
+  while (sercom->I2CM.SYNCBUSY.bit.SYSOP);
+}
+
+void I2CBus::finish(I2CStatus status) {
+  Sercom *sercom = I2C_SERCOM;
+  if (status == I2C_FAILED) {
+    errors++;
+    trace.record(TRACE_I2C_ERROR, current->address, current->status);
+    dmaAbort(DMA_CHANNEL_I2C);
+    if (sercom->I2CM.STATUS.bit.BUSSTATE != BUS_STATE_IDLE) {
+      sercom->I2CM.CTRLB.reg |= SERCOM_I2CM_CTRLB_CMD(CMD_STOP);
+      while (sercom->I2CM.SYNCBUSY.bit.SYSOP);
+    }
+    sercom->I2CM.INTFLAG.reg = SERCOM_I2CM_INTFLAG_ERROR | SERCOM_I2CM_INTFLAG_MB | SERCOM_I2CM_INTFLAG_SB;
+  }
+  // leave the SERCOM as Wire expects it
+  setSmartMode(false);
+  current->status = status;
+  current = nullptr;
+}
+
+// SMEN is only changed with the SERCOM disabled, re-enabling it forces the
+// bus state back to idle like Wire does
+void I2CBus::setSmartMode(bool enabled) {
+  Sercom *sercom = I2C_SERCOM;
+  if (sercom->I2CM.CTRLB.bit.SMEN == enabled) {
+    return;
+  }
+  sercom->I2CM.CTRLA.bit.ENABLE = 0;
+  while (sercom->I2CM.SYNCBUSY.bit.ENABLE);
+  sercom->I2CM.CTRLB.bit.SMEN = enabled;
+  sercom->I2CM.CTRLA.bit.ENABLE = 1;
+  while (sercom->I2CM.SYNCBUSY.bit.ENABLE);
+  sercom->I2CM.STATUS.bit.BUSSTATE = BUS_STATE_IDLE;
+  while (sercom->I2CM.SYNCBUSY.bit.SYSOP);
+}
+
+void I2CBus::drain() {
+  while (current != nullptr || queueCount > 0) {
+    poll();
+  }
+}
+
+void I2CBus::recover() {
+  // A slave reset while sending (e.g. the display after a reset of the board
+  // only) may hold SDA low forever, clock it out with up to 9 SCL pulses
+  pinMode(PIN_WIRE_SDA, INPUT_PULLUP);
+  pinMode(PIN_WIRE_SCL, OUTPUT);
+  digitalWrite(PIN_WIRE_SCL, HIGH);
+  for (uint8_t i = 0; i < 9 && !digitalRead(PIN_WIRE_SDA); i++) {
+    digitalWrite(PIN_WIRE_SCL, LOW);
+    delayMicroseconds(5);
+    digitalWrite(PIN_WIRE_SCL, HIGH);
+    delayMicroseconds(5);
+  }
+  // then a STOP: SDA rising while SCL is high
+  pinMode(PIN_WIRE_SDA, OUTPUT);
+  digitalWrite(PIN_WIRE_SDA, LOW);
+  delayMicroseconds(5);
+  digitalWrite(PIN_WIRE_SDA, HIGH);
+  delayMicroseconds(5);
+
+  // give the pins back to the SERCOM
+  Wire.begin();
+  Wire.setClock(I2C_CLOCK);
+}
@@ -0,0 +1,66 @@
+#ifndef I2CBus_h
+#define I2CBus_h
+
+#include <Arduino.h>
+#include <Wire.h>
+#include "constants.h"
+
+typedef enum {
+  I2C_IDLE,
+  I2C_QUEUED,
+  I2C_WRITING,
+  I2C_READING,
+  I2C_DONE,
+  I2C_FAILED
+} I2CStatus;
+
+// A write of txLength bytes followed by a read of rxLength bytes (each one
+// optional, separated by a STOP). Buffers must stay valid until the
+// transaction is over.
+class I2CTransaction {
+  public:
+    uint8_t address;
+    const uint8_t *txData = nullptr;
+    uint8_t txLength = 0;
+    uint8_t *rxData = nullptr;
+    uint8_t rxLength = 0;
+    I2CStatus status = I2C_IDLE;
+
+    bool busy() {
+      return status == I2C_QUEUED || status == I2C_WRITING || status == I2C_READING;
+    }
+};
+
+// Asynchronous I2C master on the Wire SERCOM: transactions are queued and
+// transferred by DMA, poll() moves them forward without ever waiting on the
+// bus. Wire (used by RTClib and the LED backpack library for the rare
+// blocking calls) may only be used after drain().
+class I2CBus {
+  public:
+    void begin();
+    // queue a transaction, false if it's already in flight or the queue is full
+    bool submit(I2CTransaction *t);
+    void poll();
+    // block until nothing is in flight
+    void drain();
+    // clock out a slave stuck in the middle of a transfer and reset the bus
+    void recover();
+
+    uint16_t errors = 0;
+
+  private:
+    I2CTransaction *queue[I2C_QUEUE_SIZE];
+    uint8_t queueHead = 0;
+    uint8_t queueCount = 0;
+    I2CTransaction *current = nullptr;
+    unsigned long phaseStart;
+
+    void startWrite();
+    void startRead();
+    void finish(I2CStatus status);
+    void setSmartMode(bool enabled);
+};
+
+extern I2CBus i2cBus;
+
+#endif
@@ -1,6 +1,6 @@
 #include "Input.h"
 
-const uint8_t pins[] = {
+const uint8_t BUTTON_PINS[BUTTON_COUNT] = {
   BUTTON_TOP_PIN,
   BUTTON_UP_PIN,
   BUTTON_DOWN_PIN,
@@ -9,98 +9,133 @@ const uint8_t pins[] = {
 };
 
 void Input::begin() {
-  for (uint8_t pinIndex = 0; pinIndex <= sizeof(pins); pinIndex++) {
-    uint8_t pin = pins[pinIndex];
-    pinMode(pin, INPUT_PULLUP);
-    lastRealState[pin] = debouncedState[pin] = HIGH;
+  for (uint8_t b = 0; b < BUTTON_COUNT; b++) {
+    pinMode(BUTTON_PINS[b], INPUT_PULLUP);
+    portGroup[b] = g_APinDescription[BUTTON_PINS[b]].ulPort;
+    portBit[b] = 1UL << g_APinDescription[BUTTON_PINS[b]].ulPin;
   }
 }
 
-uint8_t Input::debouncedRead(uint8_t pin) {
-  uint8_t realState = digitalRead(pin);
-  // If the switch changed, due to noise or pressing:
-  if (realState != lastRealState[pin]) {
-    // reset the debouncing timer
-    lastDebounceTime[pin] = millis(); // FIXME rollover ?
-  }
-
-  if ((millis() - lastDebounceTime[pin]) > 50) {
-    // whatever the realState is at, it's been there for longer than the debounce
-    // delay, so take it as the actual current state:
-    debouncedState[pin] = realState;
+// Raw pressed mask, one bit per button. The buttons are on PORTA and PORTB,
+// each group is read once through the single cycle IOBUS.
+uint8_t Input::sample() {
+  uint32_t in[2] = { PORT_IOBUS->Group[0].IN.reg, PORT_IOBUS->Group[1].IN.reg };
+  uint8_t mask = 0;
+  for (uint8_t b = 0; b < BUTTON_COUNT; b++) {
+    if (!(in[portGroup[b]] & portBit[b])) { // pullup
+      mask |= 1 << b;
+    }
   }
-
-  // save the realState for next turn
-  lastRealState[pin] = realState;
-  return debouncedState[pin];
+  return mask;
 }
 
-EventType Input::getEventTypeForPin(uint8_t pin) {
-  bool wasLongPressed = longPressed[pin];
-  bool wasPressed = !debouncedState[pin];// pullup
-  bool isPressed = !debouncedRead(pin); // pullup
+void Input::update() {
+  unsigned long now = millis();
+  event.type = NOTHING;
+  event.button = BUTTON_COUNT;
+  event.duration = 0;
+  event.edge = 0;
 
-  if (wasPressed && !isPressed && !wasLongPressed) {
-    return CLICKED;
-  }
-  if (wasPressed && !isPressed && wasLongPressed) {
-    longPressed[pin] = false;
-    return LONG_PRESS_STOP;
-  }
+  uint8_t raw = pressed;
+  uint8_t released = 0;
+  uint8_t justPressed = 0;
+  if (now - lastSampleTime >= DEBOUNCE_SAMPLE_PERIOD) {
+    lastSampleTime = now;
+    // vertical counter: reset where the sample agrees with the debounced
+    // state, count otherwise, flip the state when the counter wraps
+    raw = sample();
+    uint8_t delta = raw ^ pressed;
+    counter1 = (counter1 ^ counter0) & delta;
+    counter0 = ~counter0 & delta;
+    uint8_t toggled = delta & ~(counter0 | counter1);
+    pressed ^= toggled;
+    justPressed = toggled & pressed;
+    released = toggled & ~pressed;
 
-  if (isPressed && (millis() - lastDebounceTime[pin] > LONG_PRESS_DELAY)) {
-    longPressed[pin] = true;
-    if (!wasLongPressed) {
-      return LONG_PRESS_START;
+    uint8_t edges = delta & ~differing;
+    while (edges) {
+      edgeTime[__builtin_ctz(edges)] = micros();
+      edges &= edges - 1;
     }
-    return LONG_PRESS_HOLD;
+    differing = delta & ~toggled;
   }
-  return NOTHING;
-}
 
-void Input::update() {
-  event.type = NOTHING;
-  event.pin = -1;
-  event.duration = 0;
+  while (justPressed) {
+    pressTime[__builtin_ctz(justPressed)] = now;
+    justPressed &= justPressed - 1;
+  }
+
+  // only buttons with something going on, when several have an event the
+  // last one wins
+  // TODO: how to handle multiple inputs at the same time?
+  uint8_t active = pressed | released;
+  while (active) {
+    uint8_t b = __builtin_ctz(active);
+    uint8_t bit = 1 << b;
+    active &= ~bit;
 
-  for (uint8_t pinIndex = 0; pinIndex <= sizeof(pins); pinIndex++) {
-    uint8_t pin = pins[pinIndex];
-    EventType t = getEventTypeForPin(pin);
-    if (t != NOTHING) {
-      event.type = t;
-      event.pin = pin;
+    if (released & bit) {
+      event.type = longPressed & bit ? LONG_PRESS_STOP : CLICKED;
+      event.duration = event.type == LONG_PRESS_STOP ? now - pressTime[b] : 0;
+      event.edge = edgeTime[b];
+      event.button = b;
+      longPressed &= ~bit;
     }
-    if (t == LONG_PRESS_HOLD || t == LONG_PRESS_STOP) {
-      event.duration = millis() - lastDebounceTime[pin];
+    else if (now - pressTime[b] > LONG_PRESS_DELAY) {
+      event.type = longPressed & bit ? LONG_PRESS_HOLD : LONG_PRESS_START;
+      event.duration = event.type == LONG_PRESS_HOLD ? now - pressTime[b] : 0;
+      // the press is only a long press from now on
+      event.edge = micros();
+      event.button = b;
+      longPressed |= bit;
     }
-    // TODO: how to handle multiple inputs at the same time?
+  }
+
+  if (ignoring) {
+    event.type = NOTHING;
+    event.button = BUTTON_COUNT;
+    ignoring = raw || pressed;
   }
 
   if (event.type != NOTHING) {
-    lastEventTime = millis();
+    lastEventTime = now;
   }
 }
 
+void Input::ignoreUntilReleased() {
+  ignoring = true;
+  lastEventTime = millis();
+}
+
+bool Input::busy() {
+  return pressed || counter0 || counter1 || sample();
+}
 
 Command Input::getCommand() {
   switch (event.type) {
     case CLICKED:
-      switch (event.pin) {
-        case BUTTON_LEFT_PIN:
+      switch (event.button) {
+        case BUTTON_LEFT:
           return MODE;
-        case BUTTON_RIGHT_PIN:
+        case BUTTON_RIGHT:
           return SET;
-        case BUTTON_UP_PIN:
+        case BUTTON_UP:
           return UP;
-        case BUTTON_DOWN_PIN:
+        case BUTTON_DOWN:
           return DOWN;
-        case BUTTON_TOP_PIN:
+        case BUTTON_TOP:
           return STOP_ADD_5;
       }
     case LONG_PRESS_START:
-      switch (event.pin) {
-        case BUTTON_TOP_PIN:
+      switch (event.button) {
+#if FEATURE_NAP
+        case BUTTON_TOP:
           return NAP;
+#endif
+#if FEATURE_BENCHMARK
+        case BUTTON_RIGHT:
+          return BENCHMARK;
+#endif
       }
     default:
       return NONE;
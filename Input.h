@@ -2,8 +2,8 @@
 #define Input_h
 
 #include <Arduino.h>
-#include "constants.h";
-#include "Command.h";
+#include "constants.h"
+#include "Command.h"
 
 typedef enum {
   NOTHING,
@@ -13,33 +13,62 @@ typedef enum {
   LONG_PRESS_STOP,
 } EventType;
 
+// Buttons, indices in the button masks
+typedef enum {
+  BUTTON_TOP,
+  BUTTON_UP,
+  BUTTON_DOWN,
+  BUTTON_LEFT,
+  BUTTON_RIGHT,
+  BUTTON_COUNT
+} Button;
+
+// indexed by Button
+extern const uint8_t BUTTON_PINS[BUTTON_COUNT];
+
 class Event {
   public:
     EventType type;
-    uint8_t pin;
+    uint8_t button;
     unsigned long duration;
+    uint32_t edge; // micros() of the button edge, as seen by the sampler
 };
 
 class Input {
   public:
     void begin(void);
-    uint8_t debouncedRead(uint8_t pin);
     void update(void);
     Command getCommand();
+    // Swallow events until every button is released, when a press has
+    // already been acted upon (waking up from dark mode)
+    void ignoreUntilReleased();
+    // a button down or being debounced: its press has already happened, the
+    // wake-up interrupt would only see the next one
+    bool busy();
 
     Event event;
     unsigned long lastEventTime = 0;
 
   private:
-    // Debounced state
-    // Use debounceRead(pin) instead of digitalRead(pin)
-    // If you set a pin as an INPUT_PULLUP, you need to set the corresponding
-    // lastReadState[pin] to HIGH.
-    uint8_t debouncedState[20] = {};
-    uint8_t lastRealState[20] = {};
-    unsigned long lastDebounceTime[20] = {};
-    bool longPressed[20] = {}; // all false
-    EventType getEventTypeForPin(uint8_t pin);
+    // All buttons are sampled at once every DEBOUNCE_SAMPLE_PERIOD and
+    // debounced together: a bit of `pressed` only flips after 4 consecutive
+    // samples that differ from it, counted by the 2-bit vertical counter
+    // (counter1, counter0), one bit per button.
+    uint8_t pressed = 0;
+    uint8_t counter0 = 0;
+    uint8_t counter1 = 0;
+    uint8_t longPressed = 0;
+    unsigned long lastSampleTime = 0;
+    unsigned long pressTime[BUTTON_COUNT] = {};
+    // first sample that differed from the debounced state
+    uint8_t differing = 0;
+    uint32_t edgeTime[BUTTON_COUNT] = {};
+    bool ignoring = false;
+
+    // port group and bit of every button pin
+    uint8_t portGroup[BUTTON_COUNT];
+    uint32_t portBit[BUTTON_COUNT];
+    uint8_t sample();
 };
 
 #endif
@@ -0,0 +1,78 @@
+#include "Latency.h"
+
+#if FEATURE_LATENCY_TRACE
+LatencyTrace latencyTrace;
+
+void Histogram::add(uint32_t us) {
+  uint8_t bucket = 0;
+  for (uint32_t limit = 1000; us >= limit && bucket < LATENCY_BUCKETS - 1; limit <<= 1) {
+    bucket++;
+  }
+  if (counts[bucket] < UINT16_MAX) {
+    counts[bucket]++;
+  }
+}
+
+bool Histogram::empty() {
+  for (uint8_t i = 0; i < LATENCY_BUCKETS; i++) {
+    if (counts[i]) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void LatencyTrace::press(Command c, State s, uint32_t e) {
+  command = c;
+  state = s;
+  edge = e;
+  waitingFrame = true;
+  frameInFlight = false;
+}
+
+void LatencyTrace::frameQueued() {
+  if (waitingFrame) {
+    waitingFrame = false;
+    frameInFlight = true;
+  }
+}
+
+// called every loop while the last frame is sent
+void LatencyTrace::frameSent() {
+  if (frameInFlight) {
+    frameInFlight = false;
+    record(LATENCY_DISPLAY);
+  }
+  else if (waitingFrame && micros() - edge > LATENCY_TIMEOUT) {
+    waitingFrame = false;
+  }
+}
+
+void LatencyTrace::soundStarted() {
+  record(LATENCY_SOUND);
+}
+
+void LatencyTrace::record(LatencyKind kind) {
+  uint32_t latency = micros() - edge;
+  byCommand[kind][command].add(latency);
+  byState[kind][state].add(latency);
+}
+
+void LatencyTrace::reset() {
+  memset(byCommand, 0, sizeof(byCommand));
+  memset(byState, 0, sizeof(byState));
+}
+
+Histogram *LatencyTrace::histogram(uint16_t i, uint8_t &kind, uint8_t &group, uint8_t &index) {
+  kind = i / (COMMAND_COUNT + STATE_COUNT);
+  i %= COMMAND_COUNT + STATE_COUNT;
+  if (i < COMMAND_COUNT) {
+    group = LATENCY_BY_COMMAND;
+    index = i;
+    return &byCommand[kind][index];
+  }
+  group = LATENCY_BY_STATE;
+  index = i - COMMAND_COUNT;
+  return &byState[kind][index];
+}
+#endif
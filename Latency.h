@@ -0,0 +1,61 @@
+#ifndef Latency_h
+#define Latency_h
+
+#include <Arduino.h>
+#include "constants.h"
+#include "Command.h"
+#include "State.h"
+
+// bucket n counts latencies below 1ms << n, the last one everything above
+#define LATENCY_BUCKETS 8
+#define LATENCY_TIMEOUT 1000000 // us, a press that changed nothing on screen
+
+typedef enum {
+  LATENCY_DISPLAY, // button edge to display frame sent
+  LATENCY_SOUND,   // button edge to beep started
+  LATENCY_KINDS
+} LatencyKind;
+
+typedef enum {
+  LATENCY_BY_COMMAND,
+  LATENCY_BY_STATE
+} LatencyGroup;
+
+class Histogram {
+  public:
+    uint16_t counts[LATENCY_BUCKETS];
+    void add(uint32_t us);
+    bool empty();
+};
+
+// Follows one command at a time from the button edge (as seen by the input
+// sampler) through the loop, and records each latency in two histograms: by
+// command and by the state the command was received in.
+class LatencyTrace {
+  public:
+    void press(Command c, State s, uint32_t edge);
+    // the press changed the display and a frame was queued
+    void frameQueued();
+    void frameSent();
+    void soundStarted();
+    void reset();
+
+    // histograms flattened for export: kind, group, then command or state
+    static const uint16_t HISTOGRAM_COUNT = LATENCY_KINDS * (COMMAND_COUNT + STATE_COUNT);
+    Histogram *histogram(uint16_t i, uint8_t &kind, uint8_t &group, uint8_t &index);
+
+  private:
+    Histogram byCommand[LATENCY_KINDS][COMMAND_COUNT];
+    Histogram byState[LATENCY_KINDS][STATE_COUNT];
+
+    Command command;
+    State state;
+    uint32_t edge;
+    bool waitingFrame = false;
+    bool frameInFlight = false;
+    void record(LatencyKind kind);
+};
+
+extern LatencyTrace latencyTrace;
+
+#endif
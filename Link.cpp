@@ -0,0 +1,123 @@
+#include "Link.h"
+
+#define LINK_SYNC 0xA5
+#define TX_MASK   (LINK_TX_BUFFER_SIZE - 1)
+
+static_assert((LINK_TX_BUFFER_SIZE & TX_MASK) == 0, "LINK_TX_BUFFER_SIZE must be a power of 2");
+
+typedef enum {
+  RX_SYNC,
+  RX_TYPE,
+  RX_LENGTH,
+  RX_PAYLOAD,
+  RX_CRC_LOW,
+  RX_CRC_HIGH
+} RxState;
+
+Link serialLink;
+
+uint16_t crc16(uint16_t crc, uint8_t b) {
+  crc ^= (uint16_t) b << 8;
+  for (uint8_t i = 0; i < 8; i++) {
+    crc = crc & 0x8000 ? (crc << 1) ^ 0x1021 : crc << 1;
+  }
+  return crc;
+}
+
+uint16_t Link::txUsed() {
+  return (txHead - txTail) & TX_MASK;
+}
+
+void Link::txPush(uint8_t b) {
+  txBuffer[txHead] = b;
+  txHead = (txHead + 1) & TX_MASK;
+}
+
+bool Link::send(uint8_t type, const uint8_t *payload, uint8_t length) {
+  // keep one byte free to tell a full buffer from an empty one
+  if (LINK_TX_BUFFER_SIZE - 1 - txUsed() < length + 5) {
+    return false;
+  }
+  uint16_t crc = crc16(crc16(0xFFFF, type), length);
+  txPush(LINK_SYNC);
+  txPush(type);
+  txPush(length);
+  for (uint8_t i = 0; i < length; i++) {
+    txPush(payload[i]);
+    crc = crc16(crc, payload[i]);
+  }
+  txPush(crc);
+  txPush(crc >> 8);
+  return true;
+}
+
+// send the contiguous part of the pending bytes, as much as the driver takes
+size_t Link::sendChunk() {
+  size_t length = txHead >= txTail ? txHead - txTail : LINK_TX_BUFFER_SIZE - txTail;
+  size_t room = Serial.availableForWrite();
+  if (length > room) {
+    length = room;
+  }
+  if (length == 0) {
+    return 0;
+  }
+  // returns 0 when USB isn't connected, bytes are kept until it is
+  size_t sent = Serial.write(txBuffer + txTail, length);
+  txTail = (txTail + sent) & TX_MASK;
+  return sent;
+}
+
+void Link::flush() {
+  sendChunk();
+}
+
+void Link::flushAll() {
+  while (txUsed() > 0 && sendChunk() > 0);
+}
+
+bool Link::receive() {
+  for (uint8_t budget = LINK_RX_BUDGET; budget > 0 && Serial.available() > 0; budget--) {
+    uint8_t b = Serial.read();
+    switch (rxState) {
+      case RX_SYNC:
+        if (b == LINK_SYNC) {
+          rxState = RX_TYPE;
+        }
+        break;
+      case RX_TYPE:
+        rxType = b;
+        rxCrc = crc16(0xFFFF, b);
+        rxState = RX_LENGTH;
+        break;
+      case RX_LENGTH:
+        rxLength = b;
+        rxCrc = crc16(rxCrc, b);
+        rxIndex = 0;
+        if (rxLength > LINK_MAX_PAYLOAD) {
+          rxState = RX_SYNC; // garbage, resync
+        }
+        else {
+          rxState = rxLength > 0 ? RX_PAYLOAD : RX_CRC_LOW;
+        }
+        break;
+      case RX_PAYLOAD:
+        rxPayload[rxIndex++] = b;
+        rxCrc = crc16(rxCrc, b);
+        if (rxIndex == rxLength) {
+          rxState = RX_CRC_LOW;
+        }
+        break;
+      case RX_CRC_LOW:
+        rxCrc ^= b;
+        rxState = RX_CRC_HIGH;
+        break;
+      case RX_CRC_HIGH:
+        rxState = RX_SYNC;
+        if ((rxCrc ^ ((uint16_t) b << 8)) == 0) {
+          return true;
+        }
+        break;
+    }
+  }
+  return false;
+}
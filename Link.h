@@ -0,0 +1,97 @@
+#ifndef Link_h
+#define Link_h
+
+#include <Arduino.h>
+#include "constants.h"
+
+// Everything on the USB serial port is framed:
+//   0xA5, type, length, payload[length], crc16 (LE)
+// crc16 is CRC-16/CCITT-FALSE over type, length and payload. See protocol.js
+// for the host side.
+typedef enum {
+  // device -> host
+  FRAME_LOG = 0x01,
+  FRAME_TELEMETRY = 0x02,
+  FRAME_SETTINGS = 0x03,
+  FRAME_ACK = 0x04,
+  FRAME_LATENCY = 0x05,
+  FRAME_CRASH = 0x06,
+  FRAME_TRACE = 0x07,
+  FRAME_BENCHMARK = 0x08,
+  FRAME_TIME_SYNC = 0x09,
+  FRAME_HISTORY = 0x0A,
+  // host -> device
+  FRAME_GET_SETTINGS = 0x10,
+  FRAME_SET_SETTINGS = 0x11,
+  FRAME_SET_TIME = 0x12,
+  FRAME_SET_TELEMETRY = 0x13,
+  FRAME_GET_LATENCY = 0x14,
+  FRAME_GET_TRACE = 0x15,
+  FRAME_RUN_BENCHMARK = 0x16,
+  FRAME_SYNC_PING = 0x17,
+  FRAME_SYNC_TIME = 0x18,
+  FRAME_GET_HISTORY = 0x19
+} FrameType;
+
+typedef enum {
+  ACK_OK,
+  ACK_BAD_FRAME,
+  ACK_BAD_VALUE,
+  ACK_UNKNOWN
+} AckStatus;
+
+class Link {
+  public:
+    // queue a frame, false if it doesn't fit (never blocks)
+    bool send(uint8_t type, const uint8_t *payload, uint8_t length);
+    // send what the serial driver accepts right now without blocking
+    void flush();
+    // send everything, only used when about to die
+    void flushAll();
+    // parse at most LINK_RX_BUDGET incoming bytes, true when a valid frame is
+    // available in rxType/rxPayload/rxLength (until the next call)
+    bool receive();
+
+    uint8_t rxType;
+    uint8_t rxLength;
+    uint8_t rxPayload[LINK_MAX_PAYLOAD];
+
+  private:
+    // tx ring buffer
+    uint8_t txBuffer[LINK_TX_BUFFER_SIZE];
+    uint16_t txHead = 0; // next byte written
+    uint16_t txTail = 0; // next byte sent
+    uint16_t txUsed();
+    void txPush(uint8_t b);
+    size_t sendChunk();
+
+    // rx parser
+    uint8_t rxState = 0;
+    uint8_t rxIndex;
+    uint16_t rxCrc;
+};
+
+uint16_t crc16(uint16_t crc, uint8_t b);
+
+// little endian helpers for payloads
+inline void writeU16(uint8_t *p, uint16_t v) {
+  p[0] = v;
+  p[1] = v >> 8;
+}
+
+inline void writeU32(uint8_t *p, uint32_t v) {
+  writeU16(p, v);
+  writeU16(p + 2, v >> 16);
+}
+
+inline uint16_t readU16(const uint8_t *p) {
+  return p[0] | (uint16_t) p[1] << 8;
+}
+
+inline uint32_t readU32(const uint8_t *p) {
+  return readU16(p) | (uint32_t) readU16(p + 2) << 16;
+}
+
+extern Link serialLink;
+
+#endif
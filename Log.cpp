@@ -0,0 +1,24 @@
+#include "Log.h"
+
+#if FEATURE_SERIAL_LOG
+Logger logger;
+
+// Payload: message id, millis (LE), argument (LE)
+bool Logger::push(LogMessage id, int32_t arg) {
+  uint8_t record[9];
+  record[0] = id;
+  writeU32(record + 1, millis());
+  writeU32(record + 5, arg);
+  return serialLink.send(FRAME_LOG, record, sizeof(record));
+}
+
+void Logger::write(LogMessage id, int32_t arg) {
+  // report drops as soon as there is room again, before the new record
+  if (dropped > 0 && push(LOG_DROPPED, dropped)) {
+    dropped = 0;
+  }
+  if (dropped > 0 || !push(id, arg)) {
+    dropped++;
+  }
+}
+#endif
@@ -0,0 +1,61 @@
+#ifndef Log_h
+#define Log_h
+
+#include <Arduino.h>
+#include "constants.h"
+#include "LogMessages.h"
+#include "Link.h"
+
+#define LOG_LEVEL_DEBUG 0
+#define LOG_LEVEL_INFO  1
+#define LOG_LEVEL_WARN  2
+#define LOG_LEVEL_ERROR 3
+#define LOG_LEVEL_NONE  4
+
+#if !FEATURE_SERIAL_LOG
+#undef LOG_LEVEL
+#define LOG_LEVEL LOG_LEVEL_NONE
+#endif
+
+// Binary log: each record is a message id, a timestamp and one argument,
+// sent as a FRAME_LOG frame through the serial link queue, strings never
+// leave the host (see protocol.js).
+// When the queue is full (e.g. USB not connected), new records are dropped
+// and counted, logging never waits on the serial port.
+// Not interrupt safe, only log from the main loop.
+class Logger {
+  public:
+    void write(LogMessage id, int32_t arg = 0);
+
+  private:
+    uint16_t dropped = 0;
+    bool push(LogMessage id, int32_t arg);
+};
+
+extern Logger logger;
+
+#if LOG_LEVEL <= LOG_LEVEL_DEBUG
+#define LOG_DEBUG(...) logger.write(__VA_ARGS__)
+#else
+#define LOG_DEBUG(...)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_INFO
+#define LOG_INFO(...) logger.write(__VA_ARGS__)
+#else
+#define LOG_INFO(...)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_WARN
+#define LOG_WARN(...) logger.write(__VA_ARGS__)
+#else
+#define LOG_WARN(...)
+#endif
+
+#if LOG_LEVEL <= LOG_LEVEL_ERROR
+#define LOG_ERROR(...) logger.write(__VA_ARGS__)
+#else
+#define LOG_ERROR(...)
+#endif
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef LogMessages_h
+#define LogMessages_h
+
+// Log messages, referenced by id in the binary log records. protocol.js
+// parses this file to print them back on the host: keep one X() per line,
+// plain string literals only, and only append (ids are positional). A %d is
+// replaced by the record argument.
+#define LOG_MESSAGES(X) \
+  X(LOG_DROPPED,           "%d log records dropped") \
+  X(LOG_BOOT,              "Boot") \
+  X(LOG_WARM_BOOT,         "Warm boot") \
+  X(LOG_INIT_FLASH,        "Init Flash OK") \
+  X(LOG_INIT_INPUT,        "Init input OK") \
+  X(LOG_INIT_DISPLAY,      "Init display OK") \
+  X(LOG_INIT_RTC,          "Init RTC OK") \
+  X(LOG_INIT_SD,           "Init SD OK") \
+  X(LOG_INIT_SOUND,        "Init Sound OK") \
+  X(LOG_INIT_DONE,         "Full init OK") \
+  X(LOG_RTC_FAILED,        "Failed to init RTC") \
+  X(LOG_PLAYER_FAILED,     "Failed to init player") \
+  X(LOG_SD_FAILED,         "Failed to init SD card") \
+  X(LOG_NO_BUTTON_TRACK,   "Couldn't find /sounds/button.mp3") \
+  X(LOG_NO_NAP_TRACK,      "Missing /alarms/nap.mp3") \
+  X(LOG_ALARM_TRACKS,      "Alarm tracks found: %d") \
+  X(LOG_TRACK_ENDED,       "Track ended, stopping alarm") \
+  X(LOG_ALARM_START,       "Starting alarm, track %d") \
+  X(LOG_SLOW_WAKE,         "Slow wake up from dark mode: %d us") \
+  X(LOG_ALARM_JITTER,      "Alarm started at most %d us after the minute") \
+  X(LOG_SD_PROBE_FAILED,   "SD probe failed, using the default SPI clock") \
+  X(LOG_SD_CLOCK,          "SD SPI clock: %d kHz") \
+  X(LOG_SD_SEQUENTIAL_READ, "SD sequential read: %d us/block") \
+  X(LOG_SD_RANDOM_READ,    "SD random read: %d us/block") \
+  X(LOG_TIME_SYNCED,       "Time synced, aging offset %d") \
+  X(LOG_SYNC_LATE,         "Time sync given up, %d us late") \
+  X(LOG_CARD_LOST,         "SD card lost") \
+  X(LOG_TONE,              "No track to play, ringing with the tone") \
+  X(LOG_TRACKS_INDEXED,    "Alarm tracks indexed, %d read") \
+  X(LOG_CONFIG_LINE,       "Config file line %d skipped") \
+  X(LOG_CONFIG_LOADED,     "Config file loaded, %d lines skipped") \
+  X(LOG_CONFIG_FAILED,     "Config file read failed, not applied") \
+  X(LOG_SD_PROBE_DEFERRED, "New SD card, probed on the next boot")
+
+typedef enum {
+#define X(id, text) id,
+  LOG_MESSAGES(X)
+#undef X
+  LOG_MESSAGE_COUNT
+} LogMessage;
+
+#endif
@@ -0,0 +1,29 @@
+#include "RingQueue.h"
+
+static bool before(const RingEvent &a, const RingEvent &b) {
+  return a.due < b.due || (a.due == b.due && a.state < b.state);
+}
+
+void RingQueue::push(const RingEvent &e) {
+  for (uint8_t i = 0; i < count; i++) {
+    if (events[i].state == e.state) {
+      remove(i);
+      break;
+    }
+  }
+  if (count == RING_QUEUE_SIZE) {
+    return; // not a ringing state
+  }
+  uint8_t i = count++;
+  for (; i > 0 && before(e, events[i - 1]); i--) {
+    events[i] = events[i - 1];
+  }
+  events[i] = e;
+}
+
+void RingQueue::remove(uint8_t i) {
+  count--;
+  for (; i < count; i++) {
+    events[i] = events[i + 1];
+  }
+}
@@ -0,0 +1,34 @@
+#ifndef RingQueue_h
+#define RingQueue_h
+
+#include <Arduino.h>
+#include "State.h"
+
+#define RING_QUEUE_SIZE 3 // one per alarm and the nap
+#define RING_TRACK_NAP 0xFF
+
+// A ring that came due
+class RingEvent {
+  public:
+    State state; // RINGING_ALARM_1, RINGING_ALARM_2 or RINGING_NAP
+    uint8_t track; // alarm track, RING_TRACK_NAP
+    uint32_t due; // unixtime
+};
+
+// Rings due and not played yet, in the order they play: earliest due first,
+// then alarm 1, alarm 2 and the nap. At most one per ringing state, a newer
+// one replaces it. Kept in RAM only, a reset drops them.
+class RingQueue {
+  public:
+    void push(const RingEvent &e);
+    uint8_t size() const { return count; }
+    const RingEvent &at(uint8_t i) const { return events[i]; }
+    void remove(uint8_t i);
+    void clear() { count = 0; }
+
+  private:
+    RingEvent events[RING_QUEUE_SIZE];
+    uint8_t count = 0;
+};
+
+#endif
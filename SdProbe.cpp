@@ -0,0 +1,119 @@
+#include "SdProbe.h"
+
+// SERCOM SPI divides 48MHz by an even number, cards support up to 25MHz
+static const uint32_t CLOCKS[] = { 24000000, 12000000, 8000000, 4000000 };
+#define CLOCK_COUNT (sizeof(CLOCKS) / sizeof(CLOCKS[0]))
+
+bool SdProbe::matches(uint8_t csPin, const SdProfile &profile, uint8_t *cid) {
+  return readCID(csPin, cid) && profile.version == SD_PROFILE_VERSION
+    && memcmp(cid, profile.cid, sizeof(profile.cid)) == 0;
+}
+
+bool SdProbe::present(uint8_t csPin, bool initialized) {
+  // index, argument, CRC (only checked for CMD0)
+  uint8_t command[6] = { (uint8_t) (0x40 | (initialized ? 13 : 0)), 0, 0, 0, 0, 0x95 };
+  uint8_t r1 = 0xFF;
+  SPI.begin();
+  pinMode(csPin, OUTPUT);
+  digitalWrite(csPin, HIGH);
+  SPI.beginTransaction(SPISettings(250000, MSBFIRST, SPI_MODE0));
+  if (!initialized) {
+    // 74 clocks at least, deselected, before the first command
+    for (uint8_t i = 0; i < 10; i++) {
+      SPI.transfer(0xFF);
+    }
+  }
+  digitalWrite(csPin, LOW);
+  for (uint8_t b : command) {
+    SPI.transfer(b);
+  }
+  for (uint8_t i = 0; i < 8 && r1 == 0xFF; i++) {
+    r1 = SPI.transfer(0xFF);
+  }
+  if (initialized) {
+    SPI.transfer(0xFF); // second byte of R2
+  }
+  digitalWrite(csPin, HIGH);
+  SPI.transfer(0xFF); // the card lets go of MISO
+  SPI.endTransaction();
+  return initialized ? r1 == 0x00 : r1 == 0x01;
+}
+
+bool SdProbe::run(uint8_t csPin, SdProfile &profile) {
+  // nothing plays from the card while it's probed, the bus is ours
+  if (!readCID(csPin, profile.cid)) {
+    return false;
+  }
+  blocks = card.cardSize(); // reads the CSD
+  if (blocks == 0) {
+    return false;
+  }
+  card.setSpiClock(CLOCKS[CLOCK_COUNT - 1]);
+  if (!readAll(true, profile)) {
+    return false;
+  }
+  for (uint8_t i = 0; i < CLOCK_COUNT; i++) {
+    // a failed read may leave the card mid-transfer, start over each time
+    if (!present(csPin, false)) {
+      return false;
+    }
+    if (!card.init(SPI_HALF_SPEED, csPin)) {
+      continue;
+    }
+    card.setSpiClock(CLOCKS[i]);
+    if (readAll(false, profile)) {
+      profile.version = SD_PROFILE_VERSION;
+      profile.clock = CLOCKS[i];
+      return true;
+    }
+  }
+  return false;
+}
+
+bool SdProbe::readCID(uint8_t csPin, uint8_t *cid) {
+  return present(csPin, false) && card.init(SPI_HALF_SPEED, csPin) && card.readCID((cid_t *) cid);
+}
+
+// the first blocks of the card, then blocks spread over it
+uint32_t SdProbe::probeBlock(uint8_t i) {
+  if (i < SD_PROBE_SEQUENTIAL_BLOCKS) {
+    return i;
+  }
+  uint32_t hash = (2166136261UL ^ i) * 16777619UL;
+  return hash % blocks;
+}
+
+bool SdProbe::readAll(bool reference, SdProfile &profile) {
+  uint32_t sequential = 0;
+  uint32_t random = 0;
+  uint32_t randomMax = 0;
+  for (uint8_t i = 0; i < SD_PROBE_SEQUENTIAL_BLOCKS + SD_PROBE_RANDOM_BLOCKS; i++) {
+    uint32_t start = micros();
+    if (!card.readBlock(probeBlock(i), block)) {
+      return false;
+    }
+    uint32_t time = micros() - start;
+    if (i < SD_PROBE_SEQUENTIAL_BLOCKS) {
+      sequential += time;
+    }
+    else {
+      random += time;
+      randomMax = max(randomMax, time);
+    }
+    // FNV-1a, as the snapshot checksum
+    uint32_t sum = 2166136261UL;
+    for (uint16_t j = 0; j < sizeof(block); j++) {
+      sum = (sum ^ block[j]) * 16777619UL;
+    }
+    if (reference) {
+      sums[i] = sum;
+    }
+    else if (sums[i] != sum) {
+      return false;
+    }
+  }
+  profile.sequentialUs = min(sequential / SD_PROBE_SEQUENTIAL_BLOCKS, (uint32_t) UINT16_MAX);
+  profile.randomUs = min(random / SD_PROBE_RANDOM_BLOCKS, (uint32_t) UINT16_MAX);
+  profile.randomMaxUs = min(randomMax, (uint32_t) UINT16_MAX);
+  return true;
+}
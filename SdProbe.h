@@ -0,0 +1,49 @@
+#ifndef SdProbe_h
+#define SdProbe_h
+
+#include <Arduino.h>
+#include <SD.h>
+#include "constants.h"
+
+#define SD_PROFILE_VERSION 1
+
+// Read performance of one card, stored in flash. Erased flash is 0xFF.
+class SdProfile {
+  public:
+    uint8_t version;
+    uint8_t cid[16];
+    uint32_t clock;        // Hz, fastest SPI clock that read reliably
+    uint16_t sequentialUs; // per block, averaged
+    uint16_t randomUs;     // per block, averaged
+    uint16_t randomMaxUs;
+};
+
+// Boot time card probe: reads the same blocks at every candidate SPI clock,
+// fastest first, and keeps the first one that reads them all back as they
+// were at the slowest clock. Uses its own Sd2Card, before SD.begin(). The
+// card is asked whether it's there before each init, a pulled one stops it.
+class SdProbe {
+  public:
+    // true if the card in the slot is the one the profile was measured on,
+    // its CID read into cid
+    bool matches(uint8_t csPin, const SdProfile &profile, uint8_t *cid);
+    bool run(uint8_t csPin, SdProfile &profile);
+    // A card answers in the slot: a command and its R1, where Sd2Card::init
+    // waits 2s for a card that isn't there. CMD0 resets the card into SPI
+    // mode, CMD13 leaves a mounted card (initialized) as it is.
+    static bool present(uint8_t csPin, bool initialized);
+
+  private:
+    Sd2Card card;
+    uint32_t blocks;
+    uint8_t block[512];
+    uint32_t sums[SD_PROBE_SEQUENTIAL_BLOCKS + SD_PROBE_RANDOM_BLOCKS];
+
+    bool readCID(uint8_t csPin, uint8_t *cid);
+    uint32_t probeBlock(uint8_t i);
+    // read the probe blocks, timing them and comparing with sums unless
+    // reference
+    bool readAll(bool reference, SdProfile &profile);
+};
+
+#endif
@@ -0,0 +1,83 @@
+#include "Sleep.h"
+
+volatile bool Sleep::buttonPressed = false;
+volatile bool Sleep::timerExpired = false;
+
+void Sleep::begin(const uint8_t *buttonPins, uint8_t buttonCount) {
+  // 32kHz crystal on generic clock 4, kept running in standby. It clocks the
+  // RTC and the external interrupt controller, whose default GCLK0 stops in
+  // standby.
+  SYSCTRL->XOSC32K.reg |= SYSCTRL_XOSC32K_RUNSTDBY;
+  GCLK->GENDIV.reg = GCLK_GENDIV_ID(4) | GCLK_GENDIV_DIV(1);
+  GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(4) | GCLK_GENCTRL_GENEN | GCLK_GENCTRL_SRC_XOSC32K | GCLK_GENCTRL_RUNSTDBY;
+  while (GCLK->STATUS.bit.SYNCBUSY);
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_RTC | GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK4;
+  while (GCLK->STATUS.bit.SYNCBUSY);
+
+  // 1024Hz free running counter, compare 0 wakes us up
+  PM->APBAMASK.reg |= PM_APBAMASK_RTC;
+  RTC->MODE0.CTRL.reg = 0;
+  while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+  RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_SWRST;
+  while (RTC->MODE0.CTRL.bit.SWRST);
+  RTC->MODE0.CTRL.reg = RTC_MODE0_CTRL_MODE_COUNT32 | RTC_MODE0_CTRL_PRESCALER_DIV32;
+  while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+  RTC->MODE0.CTRL.reg |= RTC_MODE0_CTRL_ENABLE;
+  while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+  NVIC_EnableIRQ(RTC_IRQn);
+
+  for (uint8_t i = 0; i < buttonCount; i++) {
+    attachInterrupt(digitalPinToInterrupt(buttonPins[i]), onButton, FALLING);
+    EIC->WAKEUP.reg |= 1 << g_APinDescription[buttonPins[i]].ulExtInt;
+  }
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_EIC | GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK4;
+  while (GCLK->STATUS.bit.SYNCBUSY);
+}
+
+bool Sleep::until(uint32_t ms) {
+  buttonPressed = false;
+  timerExpired = false;
+
+  RTC->MODE0.READREQ.reg = RTC_READREQ_RREQ;
+  while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+  RTC->MODE0.COMP[0].reg = RTC->MODE0.COUNT.reg + ms * 1024 / 1000;
+  while (RTC->MODE0.STATUS.bit.SYNCBUSY);
+  RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+  RTC->MODE0.INTENSET.reg = RTC_MODE0_INTENSET_CMP0;
+
+  bool standby = !USBDevice.configured();
+  if (standby) {
+    SCB->SCR |= SCB_SCR_SLEEPDEEP_Msk;
+    // a pending SysTick may keep the core from entering standby, and the
+    // flash must stay powered in sleep (errata)
+    SysTick->CTRL &= ~SysTick_CTRL_TICKINT_Msk;
+    NVMCTRL->CTRLB.bit.SLEEPPRM = NVMCTRL_CTRLB_SLEEPPRM_DISABLED_Val;
+  }
+  else {
+    // idle still wakes up on every SysTick, we just go back to sleep
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+    PM->SLEEP.reg = PM_SLEEP_IDLE_APB;
+  }
+
+  // with USB up, a frame from the host wakes us up as well
+  while (!buttonPressed && !timerExpired && (standby || !Serial.available())) {
+    __DSB();
+    __WFI();
+  }
+
+  if (standby) {
+    SysTick->CTRL |= SysTick_CTRL_TICKINT_Msk;
+    SCB->SCR &= ~SCB_SCR_SLEEPDEEP_Msk;
+  }
+  RTC->MODE0.INTENCLR.reg = RTC_MODE0_INTENCLR_CMP0;
+  return buttonPressed;
+}
+
+void Sleep::onButton() {
+  buttonPressed = true;
+}
+
+extern "C" void RTC_Handler(void) {
+  RTC->MODE0.INTFLAG.reg = RTC_MODE0_INTFLAG_CMP0;
+  Sleep::timerExpired = true;
+}
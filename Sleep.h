@@ -0,0 +1,27 @@
+#ifndef Sleep_h
+#define Sleep_h
+
+#include <Arduino.h>
+
+extern "C" void RTC_Handler(void);
+
+// MCU sleep, woken up by a button or a timer (SAMD21 RTC running on the
+// 32kHz crystal). SysTick is stopped in standby: millis() doesn't move while
+// sleeping.
+class Sleep {
+  public:
+    // after every attachInterrupt: the first one resets the EIC clock
+    void begin(const uint8_t *buttonPins, uint8_t buttonCount);
+    // Sleep until a button is pressed (true) or ms elapsed (false).
+    // Standby when USB isn't connected, idle otherwise so that the serial
+    // link stays up.
+    bool until(uint32_t ms);
+
+  private:
+    static volatile bool buttonPressed;
+    static volatile bool timerExpired;
+    static void onButton();
+    friend void RTC_Handler(void);
+};
+
+#endif
@@ -0,0 +1,32 @@
+#include <stddef.h>
+#include "Snapshot.h"
+
+#define SNAPSHOT_MAGIC 0xC10CBEEF
+
+// .noinit is placed after .bss by the linker but is neither zeroed nor
+// initialized by the startup code
+Snapshot snapshot __attribute__ ((section (".noinit")));
+
+bool Snapshot::valid() {
+  return magic == SNAPSHOT_MAGIC && checksum == computeChecksum();
+}
+
+void Snapshot::seal() {
+  magic = SNAPSHOT_MAGIC;
+  checksum = computeChecksum();
+}
+
+void Snapshot::invalidate() {
+  magic = 0;
+}
+
+// FNV-1a over every field but the checksum itself. It also catches anything
+// the bootloader may have written over on its way to the sketch.
+uint32_t Snapshot::computeChecksum() {
+  const uint8_t *bytes = (const uint8_t *) this;
+  uint32_t hash = 2166136261UL;
+  for (size_t i = 0; i < offsetof(Snapshot, checksum); i++) {
+    hash = (hash ^ bytes[i]) * 16777619UL;
+  }
+  return hash;
+}
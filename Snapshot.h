@@ -0,0 +1,31 @@
+#ifndef Snapshot_h
+#define Snapshot_h
+
+#include <Arduino.h>
+
+// Runtime state kept in a RAM section that the startup code doesn't clear, so
+// that it survives a watchdog, brown-out or reset button reset (not a power
+// loss). It's only trusted if its checksum matches.
+class Snapshot {
+  public:
+    uint32_t magic;
+    uint8_t state;
+    uint8_t alarmTrackCount;
+    uint8_t tracksCounted; // alarmTrackCount is from the card
+    uint8_t napping; // a nap counts down under the ring
+    uint32_t lastRing1; // unixtimes
+    uint32_t lastRing2;
+    uint32_t napTime;
+    uint32_t checksum;
+
+    bool valid();
+    void seal();
+    void invalidate();
+
+  private:
+    uint32_t computeChecksum();
+};
+
+extern Snapshot snapshot;
+
+#endif
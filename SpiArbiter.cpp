@@ -0,0 +1,40 @@
+#include "SpiArbiter.h"
+
+SpiArbiter spiArbiter;
+
+void SpiArbiter::acquire() {
+  while (true) {
+    noInterrupts();
+    if (!heldByIsr) {
+      held = true;
+      interrupts();
+      return;
+    }
+    interrupts();
+  }
+}
+
+void SpiArbiter::release() {
+  noInterrupts();
+  held = false;
+  if (releaseCallback) {
+    releaseCallback();
+  }
+  interrupts();
+}
+
+bool SpiArbiter::tryAcquireFromIsr() {
+  if (held || heldByIsr) {
+    return false;
+  }
+  heldByIsr = true;
+  return true;
+}
+
+void SpiArbiter::releaseFromIsr() {
+  heldByIsr = false;
+}
+
+void SpiArbiter::onRelease(void (*callback)()) {
+  releaseCallback = callback;
+}
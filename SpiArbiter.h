@@ -0,0 +1,29 @@
+#ifndef SpiArbiter_h
+#define SpiArbiter_h
+
+#include <Arduino.h>
+
+// The SD card and the VS1053 share SPI. The main loop (SD card, VS1053
+// control registers) takes the bus with acquire()/release(), the audio
+// interrupt only uses it when it's free and never waits: whatever it skipped
+// is resumed by release().
+class SpiArbiter {
+  public:
+    // waits for the audio DMA chunk in flight, if any (< 40us)
+    void acquire();
+    void release();
+    // interrupt side
+    bool tryAcquireFromIsr();
+    void releaseFromIsr();
+    void onRelease(void (*callback)());
+
+    volatile bool held = false;
+
+  private:
+    volatile bool heldByIsr = false;
+    void (*releaseCallback)() = nullptr;
+};
+
+extern SpiArbiter spiArbiter;
+
+#endif
@@ -28,7 +28,10 @@ typedef enum  {
     DISPLAY_NAP_INTRO,
     SET_NAP,
     DISPLAY_NAP,
-    DARK_MODE
+    DARK_MODE,
+    DISPLAY_BENCHMARK
 } State;
 
+#define STATE_COUNT (DISPLAY_BENCHMARK + 1)
+
 #endif
@@ -0,0 +1,38 @@
+#include "Task.h"
+
+void Scheduler::add(Task *task) {
+  if (count < TASK_MAX) {
+    tasks[count++] = task;
+  }
+}
+
+void Scheduler::run(uint32_t budgetUs) {
+  uint32_t start = micros();
+  // a task waiting on something only costs a check per pass, stop once a
+  // whole pass went by without a step moving on
+  uint8_t stalled = 0;
+  while (stalled < count && !idle()) {
+    Task *task = tasks[next];
+    next = (next + 1) % count;
+    if (!task->running()) {
+      continue;
+    }
+    task->waiting = false;
+    if (!task->step()) {
+      task->cancel();
+    }
+    stalled = task->waiting ? stalled + 1 : 0;
+    if (micros() - start >= budgetUs) {
+      return;
+    }
+  }
+}
+
+bool Scheduler::idle() {
+  for (uint8_t i = 0; i < count; i++) {
+    if (tasks[i]->running()) {
+      return false;
+    }
+  }
+  return true;
+}
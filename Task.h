@@ -0,0 +1,74 @@
+#ifndef Task_h
+#define Task_h
+
+#include <Arduino.h>
+#include "constants.h"
+
+// Cooperative task for work too slow for one loop (card and player init,
+// flash and RTC writes, opening a track): the body is split into steps by
+// yields, the scheduler runs steps between loops so input and rendering keep
+// going.
+//
+// Bodies are protothreads: TASK_BEGIN/TASK_END around the body, TASK_YIELD
+// and TASK_WAIT_UNTIL return from it and the next step resumes right after.
+// Locals don't survive a yield and a body can't contain a switch.
+class Task {
+  public:
+    // false once finished
+    virtual bool step() = 0;
+
+    // from the beginning, even if it was running
+    void start() {
+      line = 0;
+      active = true;
+    }
+    void cancel() {
+      active = false;
+    }
+    bool running() {
+      return active;
+    }
+
+    uint16_t line = 0; // where the next step resumes, 0 to begin
+    bool active = false;
+    bool waiting = false; // the last step only checked a condition
+};
+
+#define TASK_BEGIN(task) switch ((task).line) { case 0:
+#define TASK_YIELD(task) do { (task).line = __LINE__; return true; case __LINE__:; } while (0)
+#define TASK_WAIT_UNTIL(task, condition) \
+  do { (task).line = __LINE__; case __LINE__: if (!(condition)) { (task).waiting = true; return true; } } while (0)
+#define TASK_END(task) } return false
+
+// A member function as the body
+template <class T>
+class MethodTask : public Task {
+  public:
+    MethodTask(T *object, bool (T::*body)(Task &)) : object(object), body(body) {}
+
+    bool step() override {
+      return (object->*body)(*this);
+    }
+
+  private:
+    T *object;
+    bool (T::*body)(Task &);
+};
+
+// Round robin over the running tasks. A step is never interrupted, the budget
+// only decides whether to run another one in the same loop.
+class Scheduler {
+  public:
+    // once, at init
+    void add(Task *task);
+    // at least one step, then more while under budgetUs and steps move on
+    void run(uint32_t budgetUs);
+    bool idle();
+
+  private:
+    Task *tasks[TASK_MAX];
+    uint8_t count = 0;
+    uint8_t next = 0;
+};
+
+#endif
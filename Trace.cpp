@@ -0,0 +1,76 @@
+#include "Trace.h"
+
+#define TRACE_MAGIC 0x7EACE001
+
+// see Snapshot.cpp
+Trace trace __attribute__ ((section (".noinit")));
+
+bool Trace::begin() {
+  uint8_t cause = PM->RCAUSE.reg;
+  if (magic != TRACE_MAGIC || head >= TRACE_SIZE || used > TRACE_SIZE || (cause & PM_RCAUSE_POR)) {
+    magic = TRACE_MAGIC;
+    head = 0;
+    used = 0;
+    reason = CRASH_NONE;
+    crashes = 0;
+  }
+  else if (cause & PM_RCAUSE_WDT) {
+    reason = CRASH_WATCHDOG;
+    reasonArg = 0;
+    crashes++;
+  }
+  bool crashed = reason != CRASH_NONE;
+  record(TRACE_BOOT, cause);
+  return crashed;
+}
+
+void Trace::record(TraceType type, uint8_t a, uint16_t b) {
+  TraceEntry &e = entries[head];
+  e.time = millis();
+  e.type = type;
+  e.a = a;
+  e.b = b;
+  head = (head + 1) % TRACE_SIZE;
+  if (used < TRACE_SIZE) {
+    used++;
+  }
+}
+
+void Trace::crash(CrashReason r, uint32_t arg) {
+  reason = r;
+  reasonArg = arg;
+  crashes++;
+  NVIC_SystemReset();
+  while (1);
+}
+
+uint8_t Trace::count() {
+  return used;
+}
+
+const TraceEntry &Trace::entry(uint8_t i) {
+  return entries[(head + TRACE_SIZE - used + i) % TRACE_SIZE];
+}
+
+// The stacked PC is the 7th word of the exception frame, on the main or
+// process stack depending on EXC_RETURN bit 2
+extern "C" __attribute__((used)) void onHardFault(uint32_t *frame) {
+  trace.crash(CRASH_FAULT, frame[6]);
+}
+
+#ifdef __arm__ // not in the host simulation (sim/)
+extern "C" __attribute__((naked)) void HardFault_Handler(void) {
+  __asm volatile(
+    "movs r0, #4      \n"
+    "mov r1, lr       \n"
+    "tst r0, r1       \n"
+    "beq 1f           \n"
+    "mrs r0, psp      \n"
+    "b 2f             \n"
+    "1: mrs r0, msp   \n"
+    "2: ldr r1, =onHardFault \n"
+    "bx r1            \n"
+    ".ltorg           \n"
+  );
+}
+#endif
@@ -0,0 +1,64 @@
+#ifndef Trace_h
+#define Trace_h
+
+#include <Arduino.h>
+#include "constants.h"
+
+typedef enum {
+  TRACE_BOOT,       // a: reset cause (PM->RCAUSE)
+  TRACE_STATE,      // a: from, b: to
+  TRACE_COMMAND,    // a: command, b: state
+  TRACE_I2C_ERROR,  // a: address, b: I2CStatus it failed in
+  TRACE_I2C_RECOVER,
+  TRACE_SD_ERROR,   // a: 0 open, 1 read
+  TRACE_SLOW_LOOP,  // b: ms
+  TRACE_DIE         // a: error code
+} TraceType;
+
+typedef enum {
+  CRASH_NONE,
+  CRASH_DIE,
+  CRASH_FAULT,
+  CRASH_WATCHDOG
+} CrashReason;
+
+// 8 bytes: millis() and either two bytes or a 16 bit value
+class TraceEntry {
+  public:
+    uint32_t time;
+    uint8_t type;
+    uint8_t a;
+    uint16_t b;
+};
+
+// Binary trace ring kept in .noinit RAM: recording is a few stores, and the
+// last TRACE_SIZE records survive die(), a HardFault or a watchdog reset.
+// They are dumped over the serial link on the next boot.
+class Trace {
+  public:
+    // on boot: keep the ring after a crash, clear it otherwise. True if there
+    // is a crash to report.
+    bool begin();
+    void record(TraceType type, uint8_t a = 0, uint16_t b = 0);
+    // record the crash and reset the MCU
+    void crash(CrashReason reason, uint32_t arg) __attribute__((noreturn));
+
+    // until reported, then CRASH_NONE
+    CrashReason reason;
+    uint32_t reasonArg; // die() error code or faulting PC
+    uint8_t crashes;    // consecutive crash reboots, cleared once stable
+
+    // dump, oldest first
+    uint8_t count();
+    const TraceEntry &entry(uint8_t i);
+
+  private:
+    uint32_t magic;
+    uint8_t head;
+    uint8_t used;
+    TraceEntry entries[TRACE_SIZE];
+};
+
+extern Trace trace;
+
+#endif
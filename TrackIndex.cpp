@@ -0,0 +1,258 @@
+#include "TrackIndex.h"
+#include <FlashStorage.h>
+#include "SpiArbiter.h"
+#include "Log.h"
+
+TrackIndex trackIndex;
+
+// As FlashStorage(), but erased and written in separate steps by indexTask
+__attribute__((__aligned__(256))) static const uint8_t trackIndexFlashData[(sizeof(TrackIndexData) + 255) / 256 * 256] = { };
+FlashClass trackIndexFlash(trackIndexFlashData, sizeof(TrackIndexData));
+
+// kbps by bitrate index, layer III
+static const uint16_t BITRATES_MPEG1[16] = { 0, 32, 40, 48, 56, 64, 80, 96, 112, 128, 160, 192, 224, 256, 320, 0 };
+static const uint16_t BITRATES_MPEG2[16] = { 0, 8, 16, 24, 32, 40, 48, 56, 64, 80, 96, 112, 128, 144, 160, 0 };
+// Hz by sample rate index for MPEG 1, halved for MPEG 2, again for 2.5
+static const uint16_t SAMPLE_RATES[3] = { 44100, 48000, 32000 };
+
+// what's read of a frame: header, CRC, the largest side info, then the
+// Xing tag, its flags and frame count
+#define FRAME_HEAD_MAX (6 + 32 + 12)
+
+static bool parseHeader(const uint8_t *p, Mp3Frame &f) {
+  uint8_t version = (p[1] >> 3) & 3; // 3 MPEG 1, 2 MPEG 2, 0 MPEG 2.5
+  uint8_t bitrate = p[2] >> 4;
+  uint8_t rate = (p[2] >> 2) & 3;
+  if (p[0] != 0xFF || (p[1] & 0xE0) != 0xE0 || version == 1 || ((p[1] >> 1) & 3) != 1 ||
+      bitrate == 0 || bitrate == 15 || rate == 3) {
+    return false;
+  }
+  f.mpeg1 = version == 3;
+  f.channels = (p[3] >> 6) == 3 ? 1 : 2;
+  f.sampleRate = SAMPLE_RATES[rate] >> (f.mpeg1 ? 0 : version == 2 ? 1 : 2);
+  f.bitrate = (f.mpeg1 ? BITRATES_MPEG1 : BITRATES_MPEG2)[bitrate];
+  f.samples = f.mpeg1 ? 1152 : 576;
+  f.sideInfo = p[1] & 1 ? 4 : 6; // protection bit clear, a CRC follows
+  f.sideInfoSize = f.mpeg1 ? (f.channels == 1 ? 17 : 32) : (f.channels == 1 ? 9 : 17);
+  return true;
+}
+
+// MPEG and ID3 fields are big endian
+static uint32_t readBE32(const uint8_t *p) {
+  return (uint32_t) p[0] << 24 | (uint32_t) p[1] << 16 | (uint32_t) p[2] << 8 | p[3];
+}
+
+// ID3v2 sizes, 7 bits per byte
+static uint32_t syncsafe(const uint8_t *p) {
+  return (uint32_t) p[0] << 21 | (uint32_t) p[1] << 14 | (uint32_t) p[2] << 7 | p[3];
+}
+
+// n <= 24 bits at bit of p, MSB first
+static uint32_t readBits(const uint8_t *p, uint16_t bit, uint8_t n) {
+  return readBE32(p + bit / 8) << (bit % 8) >> (32 - n);
+}
+
+String TrackIndex::fileName(uint8_t track) {
+  char filename[] = TRACK_ALARM_PATTERN;
+  char *c = strchr(filename, '?');
+  if (c) {
+    *c = '1' + track;
+  }
+  return String(filename);
+}
+
+void TrackIndex::start(const uint8_t *cid, uint8_t count) {
+  stop();
+  this->count = min(count, (uint8_t) ALARM_TRACK_MAX);
+  trackIndexFlash.read(&data);
+  if (data.version != TRACK_INDEX_VERSION || memcmp(data.cid, cid, sizeof(data.cid)) != 0) {
+    data.version = TRACK_INDEX_VERSION;
+    memcpy(data.cid, cid, sizeof(data.cid));
+    for (uint8_t i = 0; i < ALARM_TRACK_MAX; i++) {
+      data.tracks[i] = TrackInfo();
+    }
+  }
+  updateGains();
+  indexTask.start();
+}
+
+void TrackIndex::stop() {
+  indexTask.cancel();
+  closeTrack();
+}
+
+uint8_t TrackIndex::gain(uint8_t track) {
+  return track < count ? gains[track] : 0;
+}
+
+uint16_t TrackIndex::seconds(uint8_t track) {
+  return track < count ? data.tracks[track].seconds : 0;
+}
+
+// A step per block read. Stops at the first card error: the card is going,
+// cardTask starts over once it's back.
+bool TrackIndex::indexStep(Task &task) {
+  TASK_BEGIN(task);
+  read = 0;
+  for (track = 0; track < count; track++) {
+    TASK_YIELD(task);
+    if (!openTrack()) {
+      return false;
+    }
+    if (data.tracks[track].size == size) {
+      closeTrack();
+      continue;
+    }
+    data.tracks[track] = TrackInfo();
+    read++;
+    framed = false;
+    gainSum = 0;
+    granules = 0;
+
+    // the first frame, after the ID3v2 tag if any: its size is 4 times 7
+    // bits, a footer as long as the header follows if flagged
+    position = 0;
+    TASK_YIELD(task);
+    if (!readBlock()) {
+      return false;
+    }
+    if (length >= 10 && memcmp(block, "ID3", 3) == 0) {
+      position = 10 + syncsafe(block + 6) + (block[5] & 0x10 ? 10 : 0);
+    }
+    else {
+      findFrame(nullptr);
+    }
+    for (scan = 0; scan < TRACK_INDEX_SCAN_BLOCKS && !found && !ended; scan++) {
+      TASK_YIELD(task);
+      if (!readBlock()) {
+        return false;
+      }
+      findFrame(nullptr);
+    }
+
+    // then frames spread over the track, in the middle of each part
+    for (sample = 0; sample < TRACK_INDEX_SAMPLES && framed; sample++) {
+      position = audioStart + (size - audioStart) / TRACK_INDEX_SAMPLES * sample + (size - audioStart) / TRACK_INDEX_SAMPLES / 2;
+      found = ended = false;
+      for (scan = 0; scan < TRACK_INDEX_SCAN_BLOCKS && !found && !ended; scan++) {
+        TASK_YIELD(task);
+        if (!readBlock()) {
+          return false;
+        }
+        findFrame(&first);
+      }
+    }
+    finishTrack();
+  }
+  updateGains();
+  LOG_INFO(LOG_TRACKS_INDEXED, read);
+  if (read > 0) {
+    TASK_YIELD(task);
+    trackIndexFlash.erase();
+    TASK_YIELD(task);
+    trackIndexFlash.write(&data);
+  }
+  TASK_END(task);
+}
+
+bool TrackIndex::openTrack() {
+  spiArbiter.acquire();
+  file = SD.open(fileName(track).c_str());
+  spiArbiter.release();
+  size = file ? file.size() : 0;
+  return file;
+}
+
+void TrackIndex::closeTrack() {
+  if (file) {
+    spiArbiter.acquire();
+    file.close();
+    spiArbiter.release();
+  }
+}
+
+// the block at position, false if the card failed
+bool TrackIndex::readBlock() {
+  spiArbiter.acquire();
+  length = file.seek(position) ? file.read(block, sizeof(block)) : 0;
+  spiArbiter.release();
+  if (length < 0) {
+    closeTrack();
+    return false;
+  }
+  found = false;
+  ended = length < (int16_t) sizeof(block);
+  return true;
+}
+
+// A frame header in the block with room for its side info: the first frame
+// if like is null, else one like it (same version, channels and sample rate:
+// any other sync word is in the data). Not found, position moves on to
+// overlap the next block.
+void TrackIndex::findFrame(const Mp3Frame *like) {
+  Mp3Frame f;
+  int16_t i;
+  for (i = 0; i + FRAME_HEAD_MAX <= length; i++) {
+    if (parseHeader(block + i, f) &&
+        (!like || (f.mpeg1 == like->mpeg1 && f.channels == like->channels && f.sampleRate == like->sampleRate))) {
+      found = true;
+      break;
+    }
+  }
+  if (!found) {
+    position += max(length - FRAME_HEAD_MAX, 1);
+    return;
+  }
+  const uint8_t *side = block + i + f.sideInfo;
+  if (!like) {
+    // a Xing/Info frame has the frame count, and no audio
+    first = f;
+    framed = true;
+    audioStart = position + i;
+    const uint8_t *xing = side + f.sideInfoSize;
+    if ((memcmp(xing, "Xing", 4) == 0 || memcmp(xing, "Info", 4) == 0) && (readBE32(xing + 4) & 1)) {
+      data.tracks[track].seconds = min(readBE32(xing + 8) * f.samples / f.sampleRate, (uint32_t) UINT16_MAX);
+    }
+    return;
+  }
+  // granules with data, silence has no part2_3_length. MPEG 1 side info is
+  // main_data_begin (9 bits), private bits (5 mono, 3 stereo) and scfsi (4
+  // per channel), then per granule and channel 59 bits: part2_3_length (12),
+  // big_values (9), global_gain (8)... MPEG 2 has 8 bits, 1 or 2 private
+  // bits and no scfsi, then 63 bits per channel of its one granule.
+  uint16_t bit = f.mpeg1 ? (f.channels == 1 ? 18 : 20) : (f.channels == 1 ? 9 : 10);
+  uint8_t per = f.mpeg1 ? 59 : 63;
+  for (uint8_t g = 0; g < (f.mpeg1 ? 2 : 1) * f.channels; g++, bit += per) {
+    if (readBits(side, bit, 12) != 0) {
+      gainSum += readBits(side, bit + 21, 8);
+      granules++;
+    }
+  }
+}
+
+// not an MP3 as far as its first blocks go, nothing to go by: still indexed
+void TrackIndex::finishTrack() {
+  TrackInfo &info = data.tracks[track];
+  info.size = size;
+  if (granules > 0) {
+    info.loudness = (gainSum * 4 + granules / 2) / granules;
+  }
+  if (info.seconds == 0 && framed) {
+    info.seconds = min((size - audioStart) / ((uint32_t) first.bitrate * 125), (uint32_t) UINT16_MAX);
+  }
+  closeTrack();
+}
+
+// relative to the quietest track: the player can only bring tracks down
+void TrackIndex::updateGains() {
+  uint16_t quietest = UINT16_MAX;
+  for (uint8_t i = 0; i < count; i++) {
+    if (data.tracks[i].loudness != 0) {
+      quietest = min(quietest, data.tracks[i].loudness);
+    }
+  }
+  for (uint8_t i = 0; i < ALARM_TRACK_MAX; i++) {
+    uint16_t loudness = data.tracks[i].loudness;
+    gains[i] = i < count && loudness != 0 ? min((loudness - quietest) * 3 / 4, TRACK_GAIN_MAX) : 0;
+  }
+}
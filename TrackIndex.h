@@ -0,0 +1,98 @@
+#ifndef TrackIndex_h
+#define TrackIndex_h
+
+#include <Arduino.h>
+#include <SD.h>
+#include "constants.h"
+#include "Task.h"
+
+#define TRACK_INDEX_VERSION 1
+
+// What the frame headers of an alarm track tell, 8 bytes
+class TrackInfo {
+  public:
+    uint32_t size = 0; // of the file indexed, 0 if not yet
+    uint16_t seconds = 0; // 0 if unknown
+    uint16_t loudness = 0; // mean global_gain of the granules sampled, Q2, 0 if unknown
+};
+
+// The index of one card, stored in flash. Erased flash is 0xFF.
+class TrackIndexData {
+  public:
+    uint8_t version;
+    uint8_t cid[16];
+    TrackInfo tracks[ALARM_TRACK_MAX];
+};
+
+// MPEG audio layer III frame header, what indexing needs of it
+class Mp3Frame {
+  public:
+    bool mpeg1; // MPEG 2 and 2.5 otherwise, one granule per frame
+    uint8_t channels;
+    uint16_t sampleRate; // Hz
+    uint16_t bitrate; // kbps
+    uint16_t samples; // per frame
+    uint8_t sideInfo; // offset, after the header and its CRC
+    uint8_t sideInfoSize;
+};
+
+// Loudness and duration of the alarm tracks, from their MP3 frame headers:
+// indexTask goes through the tracks once the card's tracks are counted, a
+// block read per step. A frame is sampled at TRACK_INDEX_SAMPLES places in
+// each track, its loudness is the mean global_gain of the granules, the
+// quantizer step the encoder picked (1.5 dB per unit): rough, but read from
+// the side info without decoding anything. The duration is from the
+// Xing/Info frame if there's one, the bit rate otherwise.
+//
+// Indexed tracks are kept in flash for the card they were found on, a track
+// of the same size there isn't read again.
+class TrackIndex {
+  public:
+    static String fileName(uint8_t track);
+    // indexes the first count alarm tracks of the card cid
+    void start(const uint8_t *cid, uint8_t count);
+    // before the card goes away, what was indexed so far is kept
+    void stop();
+    // attenuation bringing a track down to the quietest one, in 0.5 dB steps,
+    // 0 until indexed
+    uint8_t gain(uint8_t track);
+    // 0 until indexed, or if unknown
+    uint16_t seconds(uint8_t track);
+
+    MethodTask<TrackIndex> indexTask = MethodTask<TrackIndex>(this, &TrackIndex::indexStep);
+
+  private:
+    TrackIndexData data;
+    uint8_t count = 0;
+    uint8_t gains[ALARM_TRACK_MAX] = {};
+    uint8_t read; // tracks indexed in this pass, written to flash after
+
+    // the track being indexed
+    uint8_t track;
+    File file;
+    uint32_t size;
+    uint32_t position; // of the next block read
+    bool framed; // the first frame was found
+    uint32_t audioStart; // where
+    Mp3Frame first;
+    uint8_t sample;
+    uint8_t scan;
+    bool found; // the frame looked for
+    bool ended; // end of file
+    uint32_t gainSum;
+    uint16_t granules;
+    uint8_t block[TRACK_INDEX_BLOCK];
+    int16_t length; // read into block
+
+    bool indexStep(Task &task);
+    bool openTrack();
+    void closeTrack();
+    bool readBlock();
+    void findFrame(const Mp3Frame *like);
+    void finishTrack();
+    void updateGains();
+};
+
+extern TrackIndex trackIndex;
+
+#endif
@@ -0,0 +1,54 @@
+#ifndef Volume_h
+#define Volume_h
+
+#include <Arduino.h>
+
+// VS1053 attenuation, in 0.5 dB steps
+#define VOLUME_USABLE_MIN 0x80
+#define VOLUME_MUTE       0xFE // theoretical min
+
+// floor(log2(n)), n > 0
+constexpr uint8_t volumeLog2(uint32_t n) {
+  return n <= 1 ? 0 : 1 + volumeLog2(n >> 1);
+}
+
+// bits fractional bits of log2(x), x in [1, 2) in Q16: squaring x doubles
+// its log, the integer part that comes out is the next bit
+constexpr uint32_t volumeLog2Fraction(uint64_t x, uint8_t bits) {
+  return bits == 0 ? 0
+    : (x * x >> 16) >= (2 << 16) ? (1ul << (bits - 1)) | volumeLog2Fraction(x * x >> 17, bits - 1)
+    : volumeLog2Fraction(x * x >> 16, bits - 1);
+}
+
+// log2(n) in Q12
+constexpr uint32_t volumeLog2Q12(uint32_t n) {
+  return (uint32_t) volumeLog2(n) << 12 | volumeLog2Fraction(((uint64_t) n << 16) >> volumeLog2(n), 12);
+}
+
+// Loudness doubles every 10 dB, so does the volume setting: 20 * log2(99 / v)
+// half dB, 99 is no attenuation
+constexpr uint32_t volumeCurve(uint8_t v) {
+  return (20 * (volumeLog2Q12(99) - volumeLog2Q12(v)) + 2048) >> 12;
+}
+
+// down to the usable min, 1 and 0 included
+constexpr uint8_t volumeAttenuation(uint8_t v) {
+  return v == 0 || volumeCurve(v) > VOLUME_USABLE_MIN ? VOLUME_USABLE_MIN : volumeCurve(v);
+}
+
+// settings.volume [0-99] to attenuation, a lookup where a float multiply
+// would be software floating point on the M0
+#define VOLUME_ROW(t) \
+  volumeAttenuation(10 * t + 0), volumeAttenuation(10 * t + 1), volumeAttenuation(10 * t + 2), \
+  volumeAttenuation(10 * t + 3), volumeAttenuation(10 * t + 4), volumeAttenuation(10 * t + 5), \
+  volumeAttenuation(10 * t + 6), volumeAttenuation(10 * t + 7), volumeAttenuation(10 * t + 8), \
+  volumeAttenuation(10 * t + 9)
+
+constexpr uint8_t VOLUME_ATTENUATION[100] = {
+  VOLUME_ROW(0), VOLUME_ROW(1), VOLUME_ROW(2), VOLUME_ROW(3), VOLUME_ROW(4),
+  VOLUME_ROW(5), VOLUME_ROW(6), VOLUME_ROW(7), VOLUME_ROW(8), VOLUME_ROW(9)
+};
+
+#undef VOLUME_ROW
+
+#endif
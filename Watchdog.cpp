@@ -0,0 +1,37 @@
+#include "Watchdog.h"
+
+void Watchdog::enable(uint16_t timeout) {
+  // Feed the WDT with generic clock 2: 32kHz ultra low power oscillator
+  // divided by 2^(4+1) = 1024Hz
+  GCLK->GENDIV.reg = GCLK_GENDIV_ID(2) | GCLK_GENDIV_DIV(4);
+  GCLK->GENCTRL.reg = GCLK_GENCTRL_ID(2) | GCLK_GENCTRL_GENEN | GCLK_GENCTRL_SRC_OSCULP32K | GCLK_GENCTRL_DIVSEL;
+  while (GCLK->STATUS.bit.SYNCBUSY);
+  GCLK->CLKCTRL.reg = GCLK_CLKCTRL_ID_WDT | GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK2;
+
+  // Period is 8 << PER cycles, pick the first one >= timeout
+  uint32_t cycles = (uint32_t) timeout * 1024 / 1000;
+  uint8_t period = 0;
+  while ((8UL << period) < cycles && period < 11) period++;
+
+  disable();
+  WDT->CONFIG.reg = WDT_CONFIG_PER(period);
+  WDT->CTRL.reg = WDT_CTRL_ENABLE;
+  while (WDT->STATUS.bit.SYNCBUSY);
+}
+
+void Watchdog::disable() {
+  WDT->CTRL.reg = 0;
+  while (WDT->STATUS.bit.SYNCBUSY);
+}
+
+void Watchdog::reset() {
+  // Writing CLEAR while synchronizing would stall the bus, skip this loop
+  // instead, the next one will do it
+  if (!WDT->STATUS.bit.SYNCBUSY) {
+    WDT->CLEAR.reg = WDT_CLEAR_CLEAR_KEY;
+  }
+}
+
+bool isWarmReset() {
+  return (PM->RCAUSE.reg & PM_RCAUSE_POR) == 0;
+}
@@ -0,0 +1,18 @@
+#ifndef Watchdog_h
+#define Watchdog_h
+
+#include <Arduino.h>
+
+// SAMD21 hardware watchdog, resets the board if reset() isn't called at least
+// every timeout ms
+class Watchdog {
+  public:
+    void enable(uint16_t timeout);
+    void disable();
+    void reset();
+};
+
+// true if the last reset wasn't a power-on reset, i.e. RAM content was kept
+bool isWarmReset();
+
+#endif
@@ -3,6 +3,33 @@ const { execSync } = require("child_process");
 
 const BOARD_FQBN = "adafruit:samd:adafruit_feather_m0";
 
+// Features of constants.h, `--sizes` compiles without each one and reports
+// what it costs
+const FEATURES = ["FEATURE_NAP", "FEATURE_ALARM_2", "FEATURE_VOLUME_MENU", "FEATURE_SERIAL_LOG", "FEATURE_LATENCY_TRACE", "FEATURE_BENCHMARK", "FEATURE_HISTORY", "FEATURE_CONFIG_FILE"];
+
+function compileSizes(defines = []) {
+    const flags = defines.map(d => `-D${d}=0`).join(" ");
+    const output = execSync(
+        `arduino-cli compile --fqbn ${BOARD_FQBN} --build-property "compiler.cpp.extra_flags=${flags}" .`,
+        { encoding: "utf8" }
+    );
+    return {
+        flash: Number(output.match(/Sketch uses (\d+) bytes/)[1]),
+        ram: Number(output.match(/Global variables use (\d+) bytes/)[1]),
+    };
+}
+
+if (process.argv.includes("--sizes")) {
+    console.log("📏 Measuring features…");
+    const all = compileSizes();
+    console.log(`All features: ${all.flash} bytes flash, ${all.ram} bytes RAM`);
+    for (const feature of FEATURES) {
+        const without = compileSizes([feature]);
+        console.log(`${feature.padEnd(20)} ${String(all.flash - without.flash).padStart(6)} bytes flash ${String(all.ram - without.ram).padStart(6)} bytes RAM`);
+    }
+    process.exit(0);
+}
+
 // 1 - Compile, keep stdout in terminal
 console.log("🚧 Compiling…");
 execSync(`arduino-cli compile --fqbn ${BOARD_FQBN} .`, { stdio: "inherit" });
@@ -23,7 +50,7 @@ else {
 // 3 - Kill current serial connection
 try {
     console.log("✂️ Closing previous serial connection…");
-    execSync("screen -XS arduino kill", { stdio: "inherit" });
+    execSync("pkill -f serial.js", { stdio: "inherit" });
 } catch (e) {}
 
 // 4 - Upload, keep stdout in terminal
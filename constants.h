@@ -1,6 +1,32 @@
 #ifndef constants_h
 #define constants_h
 
+// Features, 0 to compile out (`node build.js --sizes` reports what each costs)
+#ifndef FEATURE_NAP
+#define FEATURE_NAP          1
+#endif
+#ifndef FEATURE_ALARM_2
+#define FEATURE_ALARM_2      1
+#endif
+#ifndef FEATURE_VOLUME_MENU
+#define FEATURE_VOLUME_MENU  1
+#endif
+#ifndef FEATURE_SERIAL_LOG
+#define FEATURE_SERIAL_LOG   1
+#endif
+#ifndef FEATURE_LATENCY_TRACE
+#define FEATURE_LATENCY_TRACE 1
+#endif
+#ifndef FEATURE_BENCHMARK
+#define FEATURE_BENCHMARK    1
+#endif
+#ifndef FEATURE_HISTORY
+#define FEATURE_HISTORY      1
+#endif
+#ifndef FEATURE_CONFIG_FILE
+#define FEATURE_CONFIG_FILE  1
+#endif
+
 // Sound files
 #define TRACK_BOOT          "/sounds/boot.mp3"
 #define TRACK_BUTTON_PRESS  "/sounds/button.mp3"
@@ -18,27 +44,95 @@
 #define BLINK_DIGIT_3    0b01000
 #define BLINK_DIGIT_4    0b10000
 
-#define LETTER_A       0b1110111
-#define LETTER_E       0b1111001
-#define LETTER_L       0b0111000
-#define LETTER_S       0b1101101
-#define LETTER_U       0b0111110
-#define LETTER_P       0b1110011
-#define LETTER_b       0b1111100
-#define LETTER_o       0b1011100
-#define LETTER_n       0b1010100
-#define LETTER_f       0b1110001
-#define LETTER_r       0b1010000
-#define LETTER_t       0b1111000
-
-#define EXIT_VOLUME_DELAY   3000
+#define EXIT_VOLUME_DELAY   3000 // defaults, the settings have them
 #define EXIT_MENU_DELAY    10000
 #define BLINK_DELAY          300
+#define SCROLL_DELAY         250
+#define SCROLL_MAX_LENGTH     16
 #define LONG_PRESS_DELAY    2000
+#define DEBOUNCE_SAMPLE_PERIOD 12 // 4 stable samples to debounce ~50ms
 #define NAP_INCREMENT        600
 #define NAP_INTRO_DELAY     2000
 #define NAP_SET_DELAY       3000
 #define DARK_MODE_DELAY    60000
+#define ALARM_PREWARM_TIME     5 // s before the minute to buffer the track
+#define ALARM_PREWARM_SPIN    50 // ms polling the RTC before the minute
+#define DARK_MODE_WAKE_MARGIN (ALARM_PREWARM_TIME + 1) // s awake before a minute with an alarm
+#define DARK_MODE_MAX_WAKE_LATENCY 20 // ms from button to time shown
+#define WATCHDOG_TIMEOUT    4000
+#define DIE_REBOOT_DELAY    5000 // error shown, times consecutive crashes
+#define DIE_MAX_REBOOT_DELAY 60000
+
+// Tasks
+#define TASK_MAX               9
+#define TASK_BUDGET         2000 // us of task steps per loop, the first one always runs
+
+// Logs
+#define LOG_LEVEL  LOG_LEVEL_INFO
+
+// Self-benchmark
+#define BENCHMARK_RUNS         8 // of every render() and RTC read
+#define BENCHMARK_INPUT_RUNS  64
+#define BENCHMARK_PAGE_DELAY 1000 // ms per label or figure of the summary
+#define BENCHMARK_SHOW_TIME 60000 // ms the summary stays without input
+#define ALARM_TRACK_MAX        8
+
+// Event history in flash, see History.h
+#define HISTORY_ROWS          16 // of 256 bytes, 32 records each, one kept erased
+#define HISTORY_PENDING_MAX   16 // records waiting in RAM
+#define HISTORY_FLUSH_DELAY 60000 // ms a record waits for its page to fill
+
+// Post-mortem trace
+#define TRACE_SIZE            64 // records
+#define TRACE_SLOW_LOOP_TIME 50000 // us
+#define TRACE_STABLE_TIME  60000 // ms up before crashes are forgiven
+
+// Serial link
+#define LINK_TX_BUFFER_SIZE  256 // bytes, power of 2
+#define LINK_MAX_PAYLOAD      32
+#define LINK_RX_BUDGET        32 // bytes parsed per loop
+
+// I2C
+#define I2C_CLOCK         400000 // Hz, both the DS3231 and the HT16K33 support fast mode
+#define I2C_QUEUE_SIZE         4
+#define I2C_TIMEOUT           10 // ms per transfer, the bus is recovered after that
+#define DISPLAY_I2C_ADDRESS 0x70
+#define RTC_I2C_ADDRESS     0x68
+
+// Host time sync, see timesync.js
+#define SYNC_SPIN_TIME     20000 // us spun before writing the time, the loop may be that late
+#define SYNC_MAX_LATE       2000 // us past the host's target, the write is given up
+#define SYNC_MAX_LEAD    2000000 // us, the furthest target accepted
+#define SYNC_AWAKE_TIME     5000 // ms out of dark mode sleep after a ping, second edges are seen
+
+// Audio
+#define AUDIO_BUFFER_SIZE     2048 // bytes, power of 2
+#define AUDIO_BLOCK_SIZE       512 // bytes read from the card at once
+#define AUDIO_PREFILL_BLOCKS     2 // read before starting a track
+#define AUDIO_BLOCKS_PER_SERVICE 2 // max read per loop
+#define AUDIO_TONE_TIME      60000 // ms of the built-in tone standing in for a track
+#define AUDIO_TONE_BEEP        250 // ms on, then as long off
+#define AUDIO_TONE_SINE       0x46 // VS1053 sine test: 22050Hz * 6 / 128, 1034Hz
+
+// SD card probe, once per card
+#define SD_PROBE_SEQUENTIAL_BLOCKS 32 // from block 0
+#define SD_PROBE_RANDOM_BLOCKS     16 // spread over the card
+
+// SD card hot-plug
+#define CARD_DETECT_DEBOUNCE  500 // ms the alternate slot's switch is stable before a remount
+#define CARD_POLL_DELAY      5000 // ms between checks of the main slot, which has no switch
+
+// Alarm track index, see TrackIndex.h
+#define TRACK_INDEX_BLOCK      512 // bytes read from the card at once
+#define TRACK_INDEX_SAMPLES      8 // frames sampled per track
+#define TRACK_INDEX_SCAN_BLOCKS  4 // read looking for a frame, before giving up
+#define TRACK_GAIN_MAX          48 // 0.5 dB steps, the most a track is brought down
+#define ALARM_LOOP_TIME         60 // s a shorter track is played again while ringing
+
+// Config file, see Config.h
+#define CONFIG_FILE       "/config.txt"
+#define CONFIG_CHUNK_SIZE   32 // bytes read from the card per step
+#define CONFIG_TOKEN_MAX    20 // longest word, longer ones fail their line
 
 /********
  * PINS *
@@ -0,0 +1,238 @@
+#!/usr/bin/env node
+// Configure the clock over USB serial (see Link.h / protocol.js)
+//   node control.js get                      print settings
+//   node control.js set '{"volume": 40}'     merge and write settings (one flash write)
+//   node control.js set '{"alarm2": {"enabled": true, "days": ["sat"], "everyWeeks": 2}}'
+//   node control.js time                     set the RTC to the host local time
+//   node control.js telemetry [periodMs]     stream telemetry (default 1000ms)
+//   node control.js latency [reset|json]     press to display/sound latency histograms
+//   node control.js trace                    last crash and the trace records before it
+//   node control.js benchmark [json]         run the self-benchmark, print its timings
+//   node control.js benchmark compare a.json b.json   average deltas between two saved runs
+//   node control.js history [json]           rings, how they ended and naps, oldest first
+const fs = require("fs");
+const {
+    FRAME, ACK_STATUS, encodeFrame, createFrameDecoder, formatLog,
+    decodeSettings, encodeSettings, decodeTelemetry, localUnixTime,
+    decodeLatency, latencyBucketLabel, decodeBenchmark, decodeHistory, formatHistoryRecord, decodeCrash, formatCrash, formatTraceEntry,
+    findBoardPort, openPort,
+} = require("./protocol");
+
+const TIMEOUT = 3000;
+
+const [command, arg, ...files] = process.argv.slice(2);
+
+function formatUs(us) {
+    return us >= 10000 ? `${(us / 1000).toFixed(1)}ms` : `${us}us`;
+}
+
+// Saved `benchmark json` outputs of two builds, matched by name
+function compareBenchmarks(before, after) {
+    const old = new Map(before.map(t => [t.name, t]));
+    for (const t of after) {
+        const o = old.get(t.name);
+        if (!o) {
+            console.log(`${t.name.padEnd(30)} ${formatUs(t.avgUs).padStart(9)}  (new)`);
+            continue;
+        }
+        const delta = o.avgUs ? ((t.avgUs - o.avgUs) / o.avgUs * 100).toFixed(1) : "-";
+        console.log(`${t.name.padEnd(30)} ${formatUs(o.avgUs).padStart(9)} -> ${formatUs(t.avgUs).padStart(9)}  ${delta}%`);
+    }
+}
+
+// works on files, no board needed
+if (command === "benchmark" && arg === "compare") {
+    if (files.length !== 2) {
+        console.error("Usage: control.js benchmark compare <before.json> <after.json>");
+        process.exit(1);
+    }
+    const [before, after] = files.map(f => JSON.parse(fs.readFileSync(f, "utf8")));
+    compareBenchmarks(before, after);
+    process.exit(0);
+}
+
+const address = findBoardPort();
+if (!address) {
+    console.error("Board not found");
+    process.exit(1);
+}
+const { input, output } = openPort(address);
+
+// frames we wait for, resolved in arrival order
+let waiting = [];
+let latencyListener = null;
+let traceListener = null;
+let benchmarkListener = null;
+let historyListener = null;
+function expect(predicate) {
+    return new Promise((resolve, reject) => {
+        const timer = setTimeout(() => reject(new Error("No answer from the clock")), TIMEOUT);
+        waiting.push({ predicate, resolve: frame => { clearTimeout(timer); resolve(frame); } });
+    });
+}
+
+input.on("data", createFrameDecoder((type, payload) => {
+    const waiter = waiting.find(w => w.predicate(type, payload));
+    if (waiter) {
+        waiting = waiting.filter(w => w !== waiter);
+        waiter.resolve({ type, payload });
+    }
+    else if (type === FRAME.LOG) {
+        console.error(formatLog(payload));
+    }
+    else if (type === FRAME.TELEMETRY) {
+        console.log(JSON.stringify(decodeTelemetry(payload)));
+    }
+    else if (type === FRAME.LATENCY && latencyListener) {
+        latencyListener(payload);
+    }
+    else if ((type === FRAME.CRASH || type === FRAME.TRACE) && traceListener) {
+        traceListener(type, payload);
+    }
+    else if (type === FRAME.BENCHMARK && benchmarkListener) {
+        benchmarkListener(payload);
+    }
+    else if (type === FRAME.HISTORY && historyListener) {
+        historyListener(payload);
+    }
+}));
+
+async function request(type, payload) {
+    const answer = type === FRAME.GET_SETTINGS
+        ? expect(t => t === FRAME.SETTINGS)
+        : expect((t, p) => t === FRAME.ACK && p[0] === type);
+    output.write(encodeFrame(type, payload));
+    const frame = await answer;
+    if (frame.type === FRAME.ACK && frame.payload[1] !== 0) {
+        throw new Error(`Clock refused the request: ${ACK_STATUS[frame.payload[1]]}`);
+    }
+    return frame;
+}
+
+function merge(target, patch) {
+    for (const [k, v] of Object.entries(patch)) {
+        target[k] = typeof v === "object" && !Array.isArray(v) ? merge(target[k], v) : v;
+    }
+    return target;
+}
+
+async function main() {
+    switch (command) {
+        case "get": {
+            const { payload } = await request(FRAME.GET_SETTINGS);
+            console.log(JSON.stringify(decodeSettings(payload), null, 2));
+            break;
+        }
+        case "set": {
+            const { payload } = await request(FRAME.GET_SETTINGS);
+            const settings = merge(decodeSettings(payload), JSON.parse(arg));
+            await request(FRAME.SET_SETTINGS, encodeSettings(settings));
+            console.log(JSON.stringify(settings, null, 2));
+            break;
+        }
+        case "time": {
+            const time = Buffer.alloc(4);
+            time.writeUInt32LE(localUnixTime());
+            await request(FRAME.SET_TIME, time);
+            console.log("RTC set");
+            break;
+        }
+        case "telemetry": {
+            const period = Buffer.alloc(2);
+            period.writeUInt16LE(Number(arg || 1000));
+            await request(FRAME.SET_TELEMETRY, period);
+            return; // keep streaming
+        }
+        case "trace": {
+            // the crash header, then one frame per record
+            const records = [];
+            let header = null;
+            const done = new Promise(resolve => {
+                traceListener = (type, payload) => {
+                    if (type === FRAME.CRASH) {
+                        header = decodeCrash(payload);
+                    }
+                    else if (header) {
+                        records.push(formatTraceEntry(payload));
+                    }
+                    if (header && records.length === header.records) {
+                        resolve();
+                    }
+                };
+            });
+            await request(FRAME.GET_TRACE);
+            await done;
+            console.log(formatCrash(header));
+            records.forEach(r => console.log("  " + r));
+            break;
+        }
+        case "latency": {
+            const histograms = [];
+            const done = new Promise(resolve => {
+                latencyListener = payload => {
+                    const h = decodeLatency(payload);
+                    h ? histograms.push(h) : resolve();
+                };
+            });
+            await request(FRAME.GET_LATENCY, Buffer.from([arg === "reset" ? 1 : 0]));
+            await done;
+            if (arg === "json") {
+                console.log(JSON.stringify(histograms, null, 2));
+                break;
+            }
+            for (const h of histograms) {
+                const counts = h.counts.map((n, i) => `${latencyBucketLabel(i)}: ${n}`).join("  ");
+                console.log(`${h.kind.padEnd(8)} ${h.name.padEnd(18)} ${counts}`);
+            }
+            break;
+        }
+        case "benchmark": {
+            // the clock must show the time, it takes a few seconds per track
+            const timings = [];
+            const done = new Promise(resolve => {
+                benchmarkListener = payload => {
+                    const t = decodeBenchmark(payload);
+                    t ? timings.push(t) : resolve();
+                };
+            });
+            await request(FRAME.RUN_BENCHMARK);
+            await done;
+            if (arg === "json") {
+                console.log(JSON.stringify(timings, null, 2));
+                break;
+            }
+            console.log(`${"".padEnd(30)} ${"runs".padStart(5)} ${"min".padStart(9)} ${"avg".padStart(9)} ${"max".padStart(9)}`);
+            for (const t of timings) {
+                const figures = [t.minUs, t.avgUs, t.maxUs].map(us => formatUs(us).padStart(9)).join(" ");
+                console.log(`${t.name.padEnd(30)} ${String(t.runs).padStart(5)} ${figures}`);
+            }
+            break;
+        }
+        case "history": {
+            const records = [];
+            const done = new Promise(resolve => {
+                historyListener = payload => {
+                    const r = decodeHistory(payload);
+                    r ? records.push(...r) : resolve();
+                };
+            });
+            await request(FRAME.GET_HISTORY);
+            await done;
+            if (arg === "json") {
+                console.log(JSON.stringify(records, null, 2));
+                break;
+            }
+            records.forEach(r => console.log(formatHistoryRecord(r)));
+            break;
+        }
+        default:
+            console.error("Usage: control.js get | set <json> | time | telemetry [periodMs] | latency [reset|json] | trace | benchmark [json] | benchmark compare <a.json> <b.json> | history [json]");
+            process.exit(1);
+    }
+    process.exit(0);
+}
+
+main().catch(e => {
+    console.error(e.message);
+    process.exit(1);
+});
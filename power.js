@@ -0,0 +1,65 @@
+#!/usr/bin/env node
+// Supply current model per state, in mA, from datasheet typical figures.
+// Rough numbers meant to compare states and sleep strategies, not to replace
+// a measurement. `node power.js` prints the table and a typical day, the soak
+// (sim/soak.cpp) weighs the time the simulated parts spend in each mode with
+// PARTS, which it must follow.
+const { STATES } = require("./protocol");
+
+const PARTS = {
+    mcu: { active: 6.5, idle: 3.0, standby: 0.01 },        // SAMD21 @48MHz
+    display: { lit: 8.0, standby: 0.01 },                  // HT16K33, brightness 0
+    player: { playing: 14.0, idle: 8.5, lowPower: 1.5 },   // VS1053, analog off when low power
+    sd: { reading: 25.0, idle: 0.25 },
+    rtc: { active: 0.1 },                                  // DS3231
+};
+
+// What every part does in a state
+function partsInState(state, { usb = false } = {}) {
+    const dark = state === "DARK_MODE";
+    const ringing = state.startsWith("RINGING_");
+    return {
+        mcu: dark ? (usb ? "idle" : "standby") : "active",
+        display: dark ? "standby" : "lit",
+        player: ringing ? "playing" : dark ? "lowPower" : "idle",
+        // tracks are streamed in blocks, the card reads a fraction of the time
+        sd: "idle",
+        rtc: "active",
+    };
+}
+
+function stateCurrent(state, options) {
+    const parts = partsInState(state, options);
+    let current = 0;
+    for (const [part, mode] of Object.entries(parts)) {
+        current += PARTS[part][mode];
+    }
+    if (state.startsWith("RINGING_")) {
+        current += 0.1 * (PARTS.sd.reading - PARTS.sd.idle);
+    }
+    return current;
+}
+
+// hours per state over a typical day
+const TYPICAL_DAY = {
+    DARK_MODE: 22,
+    DISPLAY_TIME: 1.9,
+    RINGING_ALARM_1: 0.1,
+};
+
+function dailyCharge(day = TYPICAL_DAY, options) {
+    let mAh = 0;
+    for (const [state, hours] of Object.entries(day)) {
+        mAh += stateCurrent(state, options) * hours;
+    }
+    return mAh;
+}
+
+module.exports = { PARTS, partsInState, stateCurrent, dailyCharge, TYPICAL_DAY };
+
+if (require.main === module) {
+    for (const state of STATES) {
+        console.log(`${state.padEnd(18)} ${stateCurrent(state).toFixed(2).padStart(6)} mA`);
+    }
+    console.log(`Typical day: ${dailyCharge().toFixed(0)} mAh (USB connected: ${dailyCharge(TYPICAL_DAY, { usb: true }).toFixed(0)} mAh)`);
+}
@@ -0,0 +1,366 @@
+// Host side of the serial link (see Link.h): frame codec, log decoding
+// (message strings come from LogMessages.h) and board port helpers.
+const { execSync } = require("child_process");
+const fs = require("fs");
+const path = require("path");
+
+const BOARD_FQBN = "adafruit:samd:adafruit_feather_m0";
+const SYNC = 0xA5;
+const MAX_PAYLOAD = 32;
+
+const FRAME = {
+    LOG: 0x01,
+    TELEMETRY: 0x02,
+    SETTINGS: 0x03,
+    ACK: 0x04,
+    LATENCY: 0x05,
+    CRASH: 0x06,
+    TRACE: 0x07,
+    BENCHMARK: 0x08,
+    TIME_SYNC: 0x09,
+    HISTORY: 0x0A,
+    GET_SETTINGS: 0x10,
+    SET_SETTINGS: 0x11,
+    SET_TIME: 0x12,
+    SET_TELEMETRY: 0x13,
+    GET_LATENCY: 0x14,
+    GET_TRACE: 0x15,
+    RUN_BENCHMARK: 0x16,
+    SYNC_PING: 0x17,
+    SYNC_TIME: 0x18,
+    GET_HISTORY: 0x19,
+};
+
+const ACK_STATUS = ["ok", "bad frame", "bad value", "unknown frame"];
+
+// Must follow State.h
+const STATES = [
+    "DISPLAY_VOLUME", "DISPLAY_TIME", "SET_HOURS", "SET_MINUTES", "DISPLAY_DATE",
+    "SET_YEAR", "SET_MONTH", "SET_DAY", "DISPLAY_ALARM_1", "SET_ENABLED_1",
+    "SET_HOURS_1", "SET_MINUTES_1", "SET_WEEKEND_1", "SET_TRACK_1", "DISPLAY_ALARM_2",
+    "SET_ENABLED_2", "SET_HOURS_2", "SET_MINUTES_2", "SET_WEEKEND_2", "SET_TRACK_2",
+    "RINGING_ALARM_1", "RINGING_ALARM_2", "RINGING_NAP", "DISPLAY_NAP_INTRO", "SET_NAP",
+    "DISPLAY_NAP", "DARK_MODE", "DISPLAY_BENCHMARK",
+];
+
+// CRC-16/CCITT-FALSE
+function crc16(bytes, crc = 0xFFFF) {
+    for (const b of bytes) {
+        crc ^= b << 8;
+        for (let i = 0; i < 8; i++) {
+            crc = crc & 0x8000 ? ((crc << 1) ^ 0x1021) & 0xFFFF : (crc << 1) & 0xFFFF;
+        }
+    }
+    return crc;
+}
+
+function encodeFrame(type, payload = Buffer.alloc(0)) {
+    const body = Buffer.concat([Buffer.from([type, payload.length]), payload]);
+    const crc = Buffer.alloc(2);
+    crc.writeUInt16LE(crc16(body));
+    return Buffer.concat([Buffer.from([SYNC]), body, crc]);
+}
+
+// Returns a function to feed with raw bytes, onFrame(type, payload) is called
+// for every frame with a valid CRC, anything else is skipped.
+function createFrameDecoder(onFrame) {
+    let pending = Buffer.alloc(0);
+    return chunk => {
+        pending = Buffer.concat([pending, chunk]);
+        let i = 0;
+        while (pending.length - i >= 5) {
+            const length = pending[i + 2];
+            if (pending[i] !== SYNC || length > MAX_PAYLOAD) {
+                i++;
+                continue;
+            }
+            if (pending.length - i < length + 5) {
+                break;
+            }
+            const body = pending.subarray(i + 1, i + 3 + length);
+            if (crc16(body) !== pending.readUInt16LE(i + 3 + length)) {
+                i++;
+                continue;
+            }
+            onFrame(body[0], Buffer.from(body.subarray(2)));
+            i += length + 5;
+        }
+        pending = pending.subarray(i);
+    };
+}
+
+function loadLogMessages() {
+    const source = fs.readFileSync(path.join(__dirname, "LogMessages.h"), "utf8");
+    const messages = [];
+    const re = /^\s*X\(\s*(\w+)\s*,\s*"((?:[^"\\]|\\.)*)"\s*\)/gm;
+    let match;
+    while ((match = re.exec(source))) {
+        messages.push({ id: match[1], text: match[2] });
+    }
+    return messages;
+}
+
+const logMessages = loadLogMessages();
+
+function formatLog(payload) {
+    const message = logMessages[payload[0]];
+    const time = payload.readUInt32LE(1);
+    const arg = payload.readInt32LE(5);
+    const text = message ? message.text.replace("%d", arg) : `unknown message ${payload[0]} (${arg})`;
+    return `[${(time / 1000).toFixed(3).padStart(10)}s] ${text}`;
+}
+
+// Settings::pack/unpack, Alarm::pack/unpack
+const ALARM_PACKED_SIZE = 8;
+// bit n of the days mask, DateTime::dayOfTheWeek()
+const DAYS = ["sun", "mon", "tue", "wed", "thu", "fri", "sat"];
+
+function decodeAlarm(payload, offset) {
+    return {
+        enabled: payload[offset] !== 0,
+        hour: payload[offset + 1],
+        minute: payload[offset + 2],
+        days: DAYS.filter((d, i) => payload[offset + 3] & (1 << i)),
+        track: payload[offset + 4],
+        oneShot: (payload[offset + 5] & 1) !== 0,
+        skipNext: (payload[offset + 5] & 2) !== 0,
+        // rings on weeks where weekNumber() % everyWeeks === weekPhase
+        everyWeeks: payload[offset + 6],
+        weekPhase: payload[offset + 7],
+    };
+}
+
+function encodeAlarm(a) {
+    const days = a.days.reduce((mask, d) => mask | (1 << DAYS.indexOf(d)), 0);
+    return [
+        Number(a.enabled), a.hour, a.minute, days, a.track,
+        Number(a.oneShot) | Number(a.skipNext) << 1, a.everyWeeks, a.weekPhase,
+    ];
+}
+
+function decodeSettings(payload) {
+    return {
+        alarm1: decodeAlarm(payload, 0),
+        alarm2: decodeAlarm(payload, ALARM_PACKED_SIZE),
+        volume: payload[2 * ALARM_PACKED_SIZE],
+    };
+}
+
+function encodeSettings(settings) {
+    return Buffer.from([...encodeAlarm(settings.alarm1), ...encodeAlarm(settings.alarm2), settings.volume]);
+}
+
+// weeks since 1970 starting on Sundays, as weekNumber() in Clock.cpp: set
+// weekPhase to weekNumber() % everyWeeks to ring from this week on
+function weekNumber(unixTime = localUnixTime()) {
+    return Math.floor((Math.floor(unixTime / 86400) + 4) / 7);
+}
+
+function decodeTelemetry(payload) {
+    return {
+        state: STATES[payload[0]] || payload[0],
+        time: new Date(payload.readUInt32LE(1) * 1000).toISOString().replace("T", " ").slice(0, 19),
+        loops: payload.readUInt16LE(5),
+        loopAvgUs: payload.readUInt16LE(7),
+        loopMaxUs: payload.readUInt32LE(9),
+        playing: payload[13] !== 0,
+        audioUnderruns: payload.readUInt16LE(14),
+        audioIsrUs: payload.readUInt32LE(16),
+        // boot time card probe, 0 if it failed
+        sdClockKHz: payload.readUInt16LE(20),
+        sdSequentialUs: payload.readUInt16LE(22),
+        sdRandomUs: payload.readUInt16LE(24),
+        sdRandomMaxUs: payload.readUInt16LE(26),
+    };
+}
+
+// Must follow Command.h
+const COMMANDS = ["NONE", "MODE", "SET", "UP", "DOWN", "STOP_ADD_5", "NAP", "BENCHMARK"];
+
+// Latency.h histograms: bucket n counts latencies under 1ms << n, the last
+// one everything above
+const LATENCY_KINDS = ["display", "sound"];
+const LATENCY_BUCKETS = 8;
+
+// null for the end of export marker
+function decodeLatency(payload) {
+    if (payload.length === 0) {
+        return null;
+    }
+    const group = payload[1] === 0 ? "command" : "state";
+    return {
+        kind: LATENCY_KINDS[payload[0]],
+        group,
+        name: (group === "command" ? COMMANDS : STATES)[payload[2]] || payload[2],
+        counts: Array.from({ length: LATENCY_BUCKETS }, (_, i) => payload.readUInt16LE(3 + 2 * i)),
+    };
+}
+
+function latencyBucketLabel(i) {
+    return i === LATENCY_BUCKETS - 1 ? `>=${1 << (i - 1)}ms` : `<${1 << i}ms`;
+}
+
+// Must follow Benchmark.h
+const BENCHMARK_KINDS = ["render", "flush", "rtc read", "play start", "flash erase", "flash write", "input"];
+
+// One timing of a self-benchmark run, in us. Render is by state, play start
+// by track. null for the end of the results.
+function decodeBenchmark(payload) {
+    if (payload.length === 0) {
+        return null;
+    }
+    const kind = BENCHMARK_KINDS[payload[0]] || `kind ${payload[0]}`;
+    const index = payload[1];
+    const name = kind === "render" ? `${kind} ${STATES[index] || index}`
+        : kind === "play start" ? `${kind} track ${index + 1}` : kind;
+    return {
+        name,
+        runs: payload.readUInt16LE(2),
+        minUs: payload.readUInt32LE(4),
+        avgUs: payload.readUInt32LE(8),
+        maxUs: payload.readUInt32LE(12),
+    };
+}
+
+// Answer to SYNC_PING, times are the clock's micros() (wrapping) except the
+// unixtimes. The last second edge is only known to a loop.
+function decodeTimeSync(payload) {
+    return {
+        seq: payload[0],
+        receivedUs: payload.readUInt32LE(1),
+        sentUs: payload.readUInt32LE(5),
+        edgeTime: payload.readUInt32LE(9),
+        edgeUs: payload.readUInt32LE(13),
+        aging: payload.readInt8(17),
+        lastSync: payload.readUInt32LE(18), // 0 if the time was set otherwise since
+    };
+}
+
+function encodeSyncTime(unixTime, atUs, aging) {
+    const payload = Buffer.alloc(9);
+    payload.writeUInt32LE(unixTime);
+    payload.writeUInt32LE(atUs >>> 0, 4);
+    payload.writeInt8(aging, 8);
+    return payload;
+}
+
+// Must follow History.h
+const HISTORY_TYPES = ["boot", "ring", "ring stopped", "ring ended", "ring missed", "nap set", "nap extended", "ring merged"];
+const RINGING = { RINGING_ALARM_1: "alarm 1", RINGING_ALARM_2: "alarm 2", RINGING_NAP: "nap" };
+
+// Records of a history frame, null for the end of the export
+function decodeHistory(payload) {
+    if (payload.length === 0) {
+        return null;
+    }
+    const records = [];
+    for (let i = 0; i + 8 <= payload.length; i += 8) {
+        const type = HISTORY_TYPES[payload[i + 4]] || `type ${payload[i + 4]}`;
+        const a = payload[i + 5];
+        const b = payload.readUInt16LE(i + 6);
+        const record = { time: payload.readUInt32LE(i), type };
+        if (type === "boot") {
+            record.resetCause = a;
+        }
+        else if (type.startsWith("ring")) {
+            record.ring = RINGING[STATES[a]] || a;
+            if (type === "ring") {
+                record.track = b + 1;
+            }
+            else if (type === "ring missed") {
+                record.minutesLate = b;
+            }
+            else if (type === "ring merged") {
+                record.with = RINGING[STATES[b]] || b;
+            }
+            else {
+                record.seconds = b;
+            }
+        }
+        else {
+            record.seconds = b; // set, or left after the extension
+        }
+        records.push(record);
+    }
+    return records;
+}
+
+function formatHistoryRecord(r) {
+    const time = new Date(r.time * 1000).toISOString().replace("T", " ").slice(0, 19);
+    const details = r.type === "boot" ? `reset cause 0x${r.resetCause.toString(16)}`
+        : r.type === "ring" ? `${r.ring}${r.ring === "nap" ? "" : `, track ${r.track}`}`
+        : r.type === "ring missed" ? `${r.ring}, ${r.minutesLate} min late`
+        : r.type === "ring merged" ? `${r.ring} with ${r.with}`
+        : r.ring !== undefined ? `${r.ring} after ${r.seconds}s`
+        : `${Math.floor(r.seconds / 60)}:${String(r.seconds % 60).padStart(2, "0")}`;
+    return `${time} ${r.type.padEnd(13)} ${details}`;
+}
+
+// Must follow Trace.h
+const CRASH_REASONS = ["none", "die", "fault", "watchdog"];
+const TRACE_TYPES = ["boot", "state", "command", "i2c error", "i2c recover", "sd error", "slow loop", "die"];
+
+// Header of a trace dump, sent on boot after a crash and on GET_TRACE
+function decodeCrash(payload) {
+    return {
+        reason: CRASH_REASONS[payload[0]] || payload[0],
+        arg: payload.readUInt32LE(1), // die() error code or faulting PC
+        crashes: payload[5],
+        records: payload[6],
+    };
+}
+
+function formatTraceEntry(payload) {
+    const time = payload.readUInt32LE(0);
+    const type = TRACE_TYPES[payload[4]] || `type ${payload[4]}`;
+    const a = payload[5];
+    const b = payload.readUInt16LE(6);
+    let details;
+    switch (type) {
+        case "boot": details = `reset cause 0x${a.toString(16)}`; break;
+        case "state": details = `${STATES[a] || a} -> ${STATES[b] || b}`; break;
+        case "command": details = `${COMMANDS[a] || a} in ${STATES[b] || b}`; break;
+        case "i2c error": details = `address 0x${a.toString(16)}, status ${b}`; break;
+        case "sd error": details = a === 0 ? "open" : "read"; break;
+        case "slow loop": details = `${b}ms`; break;
+        case "die": details = `error ${a}`; break;
+        default: details = "";
+    }
+    return `[${(time / 1000).toFixed(3).padStart(10)}s] ${type} ${details}`.trimEnd();
+}
+
+function formatCrash(crash) {
+    const arg = crash.reason === "fault" ? `pc 0x${crash.arg.toString(16).padStart(8, "0")}`
+        : crash.reason === "die" ? `error ${crash.arg}` : "";
+    return `Crash: ${crash.reason} ${arg}, ${crash.crashes} in a row, ${crash.records} trace records`;
+}
+
+// The clock displays local time, the RTC is set with a local unixtime
+function localUnixTime(date = new Date()) {
+    return Math.floor(date.getTime() / 1000) - date.getTimezoneOffset() * 60;
+}
+
+function findBoardPort() {
+    const ports = JSON.parse(execSync("arduino-cli board list --format json"));
+    const port = ports.find(p => p.boards && p.boards.find(b => b.FQBN === BOARD_FQBN));
+    return port && port.address;
+}
+
+// Raw mode serial port, returns { input, output } streams
+function openPort(address) {
+    const sttyDevice = process.platform === "darwin" ? "-f" : "-F";
+    execSync(`stty ${sttyDevice} ${address} 9600 raw -echo`);
+    return {
+        input: fs.createReadStream(address),
+        output: fs.createWriteStream(address),
+    };
+}
+
+module.exports = {
+    BOARD_FQBN, FRAME, ACK_STATUS, STATES, COMMANDS,
+    crc16, encodeFrame, createFrameDecoder,
+    formatLog, decodeSettings, encodeSettings, decodeTelemetry, localUnixTime, weekNumber,
+    decodeLatency, latencyBucketLabel, decodeBenchmark, decodeTimeSync, encodeSyncTime,
+    decodeHistory, formatHistoryRecord, decodeCrash, formatCrash, formatTraceEntry,
+    findBoardPort, openPort,
+};
@@ -1,16 +1,56 @@
 #!/usr/bin/env node
-const { execSync } = require("child_process");
+// Board serial monitor (see Link.h / protocol.js)
+//   node serial.js         print logs, telemetry and crash traces
+//   node serial.js sync    set the RTC to the host local time to the ms, and
+//                          its aging offset from the drift since the last
+//                          sync (a day at least, see timesync.js)
+const {
+    FRAME, createFrameDecoder, formatLog, decodeTelemetry, decodeCrash, formatCrash, formatTraceEntry,
+    findBoardPort, openPort,
+} = require("./protocol");
+const { createTimeSync } = require("./timesync");
 
-const BOARD_FQBN = "adafruit:samd:adafruit_feather_m0";
+const mode = process.argv[2];
 
 // 1 - Find board
-const ports = JSON.parse(execSync("arduino-cli board list --format json"));
-const port = ports.find(p => p.boards && p.boards.find(b => b.FQBN === BOARD_FQBN));
+const address = findBoardPort();
 
-if (!port) {
+if (!address) {
     console.error("Board not found");
     process.exit(1);
 }
 
-// 2 - Open serial stream
-execSync(`screen -S arduino ${port.address} 9600`, { stdio: "inherit" });
+// 2 - Open serial stream, print logs, telemetry and crash traces
+const { input, output } = openPort(address);
+const sync = mode === "sync" ? createTimeSync(frame => output.write(frame)) : null;
+input.on("data", createFrameDecoder((type, payload) => {
+    if (sync && sync.onFrame(type, payload)) {
+        return;
+    }
+    if (type === FRAME.LOG) {
+        console.log(formatLog(payload));
+    }
+    if (type === FRAME.TELEMETRY) {
+        console.log(JSON.stringify(decodeTelemetry(payload)));
+    }
+    if (type === FRAME.CRASH) {
+        console.log(formatCrash(decodeCrash(payload)));
+    }
+    if (type === FRAME.TRACE) {
+        console.log("  " + formatTraceEntry(payload));
+    }
+}));
+
+// 3 - Sync the time
+if (sync) {
+    const ms = us => us === null ? "unknown" : `${(us / 1000).toFixed(2)}ms`;
+    sync.run().then(report => {
+        console.log(`RTC error ${ms(report.errorBeforeUs)} before, ${ms(report.errorAfterUs)} after (round trip ${ms(report.delayUs)})`);
+        console.log(report.drift === null ? `Aging offset ${report.aging.after}, no drift estimate`
+            : `Drift ${report.drift.toFixed(2)}ppm, aging offset ${report.aging.before} -> ${report.aging.after}`);
+        process.exit(report.synced ? 0 : 1);
+    }).catch(e => {
+        console.error(e.message);
+        process.exit(1);
+    });
+}
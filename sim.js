@@ -0,0 +1,320 @@
+#!/usr/bin/env node
+// Host simulation of the clock (see sim/Sim.h), built with g++ and the
+// address and undefined behaviour sanitizers. Fuzz workers run a build
+// without them, at -O2, what they find is minimized on the sanitized one.
+//   node sim.js fuzz [--jobs N] [--time S]   coverage guided fuzzing on every core,
+//                                            failures are minimized into sim/out/crashes
+//   node sim.js replay <input>               run one input, print what happens
+//   node sim.js minimize <input>             smallest input failing the same way
+//   node sim.js soak [--years N] [--seed S]  years of a user's life with the clock,
+//                    [--verbose]             checking every ring
+const { execFile, spawn, spawnSync } = require("child_process");
+const fs = require("fs");
+const os = require("os");
+const path = require("path");
+const { FRAME, STATES, createFrameDecoder, formatLog, decodeCrash, formatCrash, formatTraceEntry } = require("./protocol");
+
+const ROOT = __dirname;
+const SIM = path.join(ROOT, "sim");
+const BUILD = path.join(SIM, "build");
+const OUT = path.join(SIM, "out");
+// one executable each, on top of the rest of sim/ and the sketch
+const TOOLS = ["fuzz", "soak"];
+const FUZZ = path.join(BUILD, "fuzz");
+const FAST_FUZZ = path.join(BUILD, "fast", "fuzz");
+const SOAK = path.join(BUILD, "soak");
+
+// the tools each build has, in its own folder
+const VARIANTS = [
+    { dir: BUILD, tools: TOOLS,
+        flags: ["-g", "-O1", "-fsanitize=address,undefined", "-fno-sanitize-recover=undefined", "-fno-omit-frame-pointer"] },
+    { dir: path.join(BUILD, "fast"), tools: ["fuzz"], flags: ["-g", "-O2"] },
+];
+const INCLUDES = [`-I${path.join(SIM, "include")}`, `-I${SIM}`, `-I${ROOT}`, "-include", path.join(SIM, "Ilp32.h")];
+
+function sources() {
+    const host = fs.readdirSync(SIM).filter(f => f.endsWith(".cpp") && !TOOLS.includes(path.basename(f, ".cpp")));
+    // root sources with a host version in sim/ are replaced by it, the DMA
+    // controller is only used by the real AudioPlayer
+    const sketch = fs.readdirSync(ROOT).filter(f => f.endsWith(".cpp") && !host.includes(f) && f !== "Dma.cpp");
+    return [
+        // only the sketch is instrumented for coverage
+        ...sketch.map(f => ({ file: path.join(ROOT, f), flags: ["-std=gnu++11", "-fsanitize-coverage=trace-pc"] })),
+        ...host.map(f => ({ file: path.join(SIM, f), flags: ["-std=gnu++17"] })),
+    ];
+}
+
+function newestSource() {
+    const dirs = [ROOT, SIM, path.join(SIM, "include")];
+    return Math.max(...dirs.flatMap(dir => fs.readdirSync(dir)
+        .filter(f => /\.(cpp|h)$/.test(f))
+        .map(f => fs.statSync(path.join(dir, f)).mtimeMs)));
+}
+
+function compile(command, args) {
+    return new Promise((resolve, reject) => execFile(command, args, (error, stdout, stderr) => {
+        process.stderr.write(stderr);
+        error ? reject(new Error(`${command} failed`)) : resolve();
+    }));
+}
+
+async function build() {
+    const newest = newestSource();
+    const stale = VARIANTS.filter(({ dir, tools }) =>
+        !tools.every(tool => fs.existsSync(path.join(dir, tool)) && fs.statSync(path.join(dir, tool)).mtimeMs > newest));
+    if (stale.length === 0) {
+        return;
+    }
+    console.log("🚧 Compiling the simulation…");
+    await Promise.all(stale.map(buildVariant));
+}
+
+async function buildVariant({ dir, tools: names, flags: variantFlags }) {
+    fs.mkdirSync(dir, { recursive: true });
+    const object = file => path.join(dir, path.basename(path.dirname(file)) + "-" + path.basename(file, ".cpp") + ".o");
+    const common = sources();
+    const tools = names.map(tool => ({ file: path.join(SIM, tool + ".cpp"), flags: ["-std=gnu++17"] }));
+    await Promise.all([...common, ...tools].map(({ file, flags }) =>
+        compile("g++", [...variantFlags, ...flags, ...INCLUDES, "-c", file, "-o", object(file)])));
+    await Promise.all(tools.map(({ file }) =>
+        compile("g++", [...variantFlags, ...common.map(({ file }) => object(file)), object(file), "-o", path.join(dir, path.basename(file, ".cpp"))])));
+}
+
+// the FAIL line or the sanitizer summary, what makes two failures the same
+function signature(output) {
+    const line = output.split("\n").find(l => l.startsWith("FAIL ") || l.startsWith("SUMMARY: ") || l.includes(": runtime error: "));
+    return line && line.replace(/ \/\S+/g, "");
+}
+
+function runInput(file) {
+    const result = spawnSync(FUZZ, ["--run", file], { encoding: "utf8" });
+    return result.status === 0 ? null : signature(result.stdout + result.stderr) || `exit ${result.status}`;
+}
+
+// ddmin over bytes, the wiring and start time (2 first bytes) are kept
+function minimize(file) {
+    const expected = runInput(file);
+    if (!expected) {
+        console.log(`${file} doesn't fail`);
+        return null;
+    }
+    const candidate = path.join(os.tmpdir(), `sim-minimize-${process.pid}`);
+    const fails = bytes => {
+        fs.writeFileSync(candidate, bytes);
+        return runInput(candidate) === expected;
+    };
+    let input = fs.readFileSync(file);
+    for (let chunk = Math.max(1, (input.length - 2) >> 1); chunk >= 1; chunk >>= 1) {
+        for (let at = 2; at < input.length;) {
+            const smaller = Buffer.concat([input.subarray(0, at), input.subarray(at + chunk)]);
+            if (fails(smaller)) {
+                input = smaller;
+            }
+            else {
+                at += chunk;
+            }
+        }
+    }
+    // then simpler bytes: actions with smaller opcodes and arguments
+    for (let i = 2; i < input.length; i++) {
+        for (const value of [0, 1, 7, input[i] >> 1]) {
+            if (value >= input[i]) {
+                continue;
+            }
+            const simpler = Buffer.from(input);
+            simpler[i] = value;
+            if (fails(simpler)) {
+                input = simpler;
+                break;
+            }
+        }
+    }
+    fs.rmSync(candidate, { force: true });
+    const minimized = file.replace(/(\.min)?$/, ".min");
+    fs.writeFileSync(minimized, input);
+    console.log(`${expected}: ${minimized} (${input.length} bytes)`);
+    return minimized;
+}
+
+// event lines of fuzz and soak ("<ms> <kind> ..."), with names and decoded
+// frames
+function printEvent(line) {
+    const [time, kind, ...rest] = line.split(" ");
+    const prefix = `[${(Number(time) / 1000).toFixed(3).padStart(10)}s]`;
+    if (kind === "state") {
+        const [from, to, unixtime] = rest.map(Number);
+        console.log(`${prefix} ${STATES[from]} -> ${STATES[to]} (${formatDate(unixtime)})`);
+    }
+    else if (kind === "serial") {
+        const decode = createFrameDecoder((type, payload) => {
+            if (type === FRAME.LOG) {
+                console.log(`${prefix}   ${formatLog(payload)}`);
+            }
+            else if (type === FRAME.CRASH) {
+                console.log(`${prefix}   ${formatCrash(decodeCrash(payload))}`);
+            }
+            else if (type === FRAME.TRACE) {
+                console.log(`${prefix}     ${formatTraceEntry(payload)}`);
+            }
+            else {
+                console.log(`${prefix}   frame 0x${type.toString(16)} ${payload.toString("hex")}`);
+            }
+        });
+        decode(Buffer.from(rest[0], "hex"));
+    }
+    else if (/^\d+$/.test(time)) {
+        console.log(`${prefix} ${kind} ${rest.join(" ")}`);
+    }
+    else {
+        console.log(line);
+    }
+}
+
+function formatDate(unixtime) {
+    return new Date(unixtime * 1000).toISOString().replace("T", " ").slice(0, 19);
+}
+
+// the machine-readable replay of fuzz, formatted
+function replay(file) {
+    const result = spawnSync(FUZZ, ["--replay", file], { encoding: "utf8" });
+    result.stdout.split("\n").filter(l => l).forEach(printEvent);
+    process.stderr.write(result.stderr);
+    return result.status;
+}
+
+// years of simulated time, a line per month
+function soak(years, seed, verbose) {
+    const args = ["--years", String(years), "--seed", String(seed), ...(verbose ? ["--verbose"] : [])];
+    console.log(`⏳ Soaking ${years} years, seed ${seed}…`);
+    const began = Date.now();
+    const worker = spawn(SOAK, args, { stdio: ["ignore", "pipe", "inherit"] });
+    let pending = "";
+    worker.stdout.setEncoding("utf8");
+    worker.stdout.on("data", chunk => {
+        const lines = (pending + chunk).split("\n");
+        pending = lines.pop();
+        for (const line of lines) {
+            const [kind, ...rest] = line.split(" ");
+            if (kind === "progress") {
+                const [unixtime, loops, rings, wraps] = rest.map(Number);
+                const elapsed = (Date.now() - began) / 1000;
+                process.stdout.write(`\r${elapsed.toFixed(0)}s: ${formatDate(unixtime).slice(0, 10)}, ${loops} loops, ` +
+                    `${rings} rings, ${wraps} millis() wraps   `);
+            }
+            else if (kind === "summary") {
+                console.log(`\n✅ ${rest.join(" ")} in ${((Date.now() - began) / 1000).toFixed(0)}s`);
+            }
+            else if (kind === "FAIL") {
+                console.log(`\n💥 ${rest.join(" ")}`);
+            }
+            else if (line) {
+                printEvent(line);
+            }
+        }
+    });
+    return new Promise(resolve => worker.on("exit", code => resolve(code)));
+}
+
+function fuzz(jobs, seconds) {
+    fs.mkdirSync(path.join(OUT, "crashes"), { recursive: true });
+    const stats = [];
+    const restarted = [0, 0]; // runs and loops of the workers that died
+    const crashes = new Map(); // signature -> file
+    const workers = [];
+
+    function start(id) {
+        const worker = spawn(FAST_FUZZ, ["--worker", String(id), "--out", OUT]);
+        let stderr = "";
+        worker.stdout.setEncoding("utf8");
+        worker.stdout.on("data", chunk => {
+            for (const line of chunk.split("\n")) {
+                const [kind, ...rest] = line.split(" ");
+                if (kind === "stats") {
+                    stats[id] = rest.map(Number);
+                }
+                else if (kind === "crash") {
+                    const failure = rest.slice(1).join(" ").replace(/: .*$/, "");
+                    if (!crashes.has(failure)) {
+                        crashes.set(failure, rest[0]);
+                        console.log(`\n💥 ${failure} (${rest[0]})`);
+                    }
+                }
+            }
+        });
+        worker.stderr.on("data", chunk => stderr += chunk);
+        // a crash stops the worker, its current input is the failure
+        worker.on("exit", (code, signal) => {
+            if (stopping) {
+                return;
+            }
+            const failure = signature(stderr) || `exit ${code || signal}`;
+            const current = path.join(OUT, `worker-${id}.cur`);
+            if (!crashes.has(failure) && fs.existsSync(current)) {
+                const file = path.join(OUT, "crashes", `worker-${id}-${Date.now()}`);
+                fs.copyFileSync(current, file);
+                crashes.set(failure, file);
+                console.log(`\n💥 ${failure} (${file})`);
+            }
+            if (stats[id]) {
+                restarted[0] += stats[id][0];
+                restarted[1] += stats[id][1];
+                stats[id] = null;
+            }
+            workers[id] = start(id);
+        });
+        return worker;
+    }
+
+    let stopping = false;
+    const began = Date.now();
+    console.log(`🐛 Fuzzing with ${jobs} workers for ${seconds}s…`);
+    for (let i = 0; i < jobs; i++) {
+        workers[i] = start(i);
+    }
+    const timer = setInterval(() => {
+        // the corpus is shared, workers only differ on what they haven't synced yet
+        const live = stats.filter(s => s);
+        const total = live.reduce((t, s) => [t[0] + s[0], t[1] + s[1]], restarted);
+        const elapsed = (Date.now() - began) / 1000;
+        process.stdout.write(`\r${elapsed.toFixed(0)}s: ${total[0]} runs, ${(total[1] / elapsed / 1e6).toFixed(2)}M loops/s, ` +
+            `corpus ${Math.max(0, ...live.map(s => s[2]))}, edges ${Math.max(0, ...live.map(s => s[4]))}, ${crashes.size} failures   `);
+    }, 1000);
+    setTimeout(() => {
+        stopping = true;
+        clearInterval(timer);
+        workers.forEach(w => w.kill());
+        console.log("");
+        for (const file of crashes.values()) {
+            minimize(file);
+        }
+        process.exit(crashes.size > 0 ? 1 : 0);
+    }, seconds * 1000);
+}
+
+function option(name, fallback) {
+    const i = process.argv.indexOf(name);
+    return i >= 0 ? Number(process.argv[i + 1]) : fallback;
+}
+
+(async () => {
+    const [command, file] = process.argv.slice(2);
+    await build();
+    switch (command) {
+        case "fuzz":
+            fuzz(option("--jobs", os.cpus().length), option("--time", 600));
+            break;
+        case "replay":
+            process.exit(replay(file));
+        case "minimize":
+            process.exit(minimize(file) ? 0 : 1);
+        case "soak":
+            process.exit(await soak(option("--years", 10), option("--seed", 1), process.argv.includes("--verbose")));
+        default:
+            console.error("usage: node sim.js fuzz [--jobs N] [--time S] | replay <input> | minimize <input> | " +
+                "soak [--years N] [--seed S] [--verbose]");
+            process.exit(2);
+    }
+})().catch(e => {
+    console.error(e.message);
+    process.exit(1);
+});
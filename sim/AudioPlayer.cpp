@@ -0,0 +1,203 @@
+#include "AudioPlayer.h"
+#include "Trace.h"
+#include "Sim.h"
+
+// Host version: the decoder consumes the buffer at the bit rate of the
+// tracks, in feed(), whenever the loop looks at it. The card reads and their
+// cost are the real ones.
+
+#define AUDIO_MASK      (AUDIO_BUFFER_SIZE - 1)
+#define SIM_BYTE_RATE   16000 // bytes/s, 128kbps
+
+AudioPlayer *AudioPlayer::instance = nullptr;
+
+static uint64_t decodedUntil; // sim.now the decoder caught up with
+
+AudioPlayer::AudioPlayer(int8_t reset, int8_t cs, int8_t dcs, int8_t dreq)
+  : Adafruit_VS1053(reset, cs, dcs, dreq), dcsPin(dcs), dreqPin(dreq) {
+}
+
+bool AudioPlayer::begin() {
+  instance = this;
+  sim.advance(100000); // reset and clock setup
+  return sim.config.playerPresent;
+}
+
+void AudioPlayer::setVolume(uint8_t left, uint8_t right) {
+  volumeLeft = left;
+  volumeRight = right;
+  sim.volume = left;
+}
+
+void AudioPlayer::sleep() {
+  if (asleep) {
+    return;
+  }
+  stopPlaying();
+  asleep = true;
+  sim.playerAsleep = true;
+}
+
+void AudioPlayer::wake() {
+  asleep = false;
+  sim.playerAsleep = false;
+}
+
+bool AudioPlayer::startPlayingFile(const char *path) {
+  return prepareFile(path) && start();
+}
+
+bool AudioPlayer::prepareFile(const char *path, uint8_t blocks) {
+  if (playing || prepared) {
+    stopPlaying();
+  }
+  wake();
+  spiArbiter.acquire();
+  track = SD.open(path);
+  spiArbiter.release();
+  if (!track) {
+    trace.record(TRACE_SD_ERROR, 0);
+    return false;
+  }
+  readIndex = writeIndex = 0;
+  endOfFile = false;
+  starving = false;
+  blocks = min(blocks, (uint8_t) (AUDIO_BUFFER_SIZE / AUDIO_BLOCK_SIZE));
+  for (uint8_t i = 0; i < blocks && !endOfFile; i++) {
+    readBlock();
+  }
+  prepared = true;
+  return true;
+}
+
+bool AudioPlayer::prefill() {
+  if (!prepared || endOfFile || (uint16_t) (writeIndex - readIndex) >= AUDIO_PREFILL_BLOCKS * AUDIO_BLOCK_SIZE) {
+    return false;
+  }
+  readBlock();
+  return true;
+}
+
+bool AudioPlayer::start() {
+  if (!prepared) {
+    return false;
+  }
+  prepared = false;
+  playing = true;
+  decodedUntil = sim.now;
+  sim.tracksStarted.push_back(track.name());
+  sim.playing = true;
+  return true;
+}
+
+// no sound of its own: started and stopped like a track
+void AudioPlayer::startTone(uint16_t ms) {
+  stopPlaying();
+  wake();
+  tone = true;
+  toneStart = millis();
+  toneLength = ms;
+  sim.tracksStarted.push_back(SIM_TONE);
+  sim.playing = true;
+}
+
+bool AudioPlayer::toning() {
+  return tone;
+}
+
+void AudioPlayer::serviceTone() {
+  if (millis() - toneStart >= toneLength) {
+    sim.playing = false; // ended, not cut
+    stopPlaying();
+  }
+}
+
+void AudioPlayer::stopPlaying() {
+  if (sim.playing) {
+    sim.soundsCut++;
+  }
+  tone = false;
+  playing = false;
+  sim.playing = false;
+  prepared = false;
+  track.close();
+  readIndex = writeIndex = 0;
+  endOfFile = true;
+}
+
+bool AudioPlayer::stopped() {
+  feed();
+  if (tone) {
+    serviceTone();
+  }
+  return !playing && !tone;
+}
+
+bool AudioPlayer::readFailed() {
+  bool failed = readError;
+  readError = false;
+  return failed;
+}
+
+void AudioPlayer::readBlock() {
+  spiArbiter.acquire();
+  int length = track.read(buffer + (writeIndex & AUDIO_MASK), AUDIO_BLOCK_SIZE);
+  spiArbiter.release();
+  if (length > 0) {
+    writeIndex += length;
+  }
+  else if (length < 0) {
+    trace.record(TRACE_SD_ERROR, 1);
+    readError = true;
+  }
+  if (length < AUDIO_BLOCK_SIZE) {
+    endOfFile = true;
+  }
+}
+
+void AudioPlayer::service() {
+  if (tone) {
+    serviceTone();
+  }
+  if (!playing) {
+    return;
+  }
+  feed();
+  for (uint8_t i = 0; i < AUDIO_BLOCKS_PER_SERVICE; i++) {
+    uint16_t space = AUDIO_BUFFER_SIZE - (uint16_t) (writeIndex - readIndex);
+    if (endOfFile || space < AUDIO_BLOCK_SIZE) {
+      break;
+    }
+    readBlock();
+  }
+  if (!playing) {
+    track.close();
+  }
+}
+
+// what the decoder took since the last call, an underrun when that was more
+// than the buffer held
+void AudioPlayer::feed() {
+  if (!playing) {
+    return;
+  }
+  uint64_t bytes = (sim.now - decodedUntil) * SIM_BYTE_RATE / 1000000;
+  decodedUntil += bytes * 1000000 / SIM_BYTE_RATE;
+  uint16_t available = writeIndex - readIndex;
+  if (bytes < available) {
+    readIndex += bytes;
+    starving = false;
+    return;
+  }
+  readIndex = writeIndex;
+  if (endOfFile) {
+    playing = false;
+    sim.playing = false;
+    return;
+  }
+  if (!starving) {
+    underruns++;
+  }
+  starving = true;
+  decodedUntil = sim.now; // the decoder waits for data
+}
@@ -0,0 +1,92 @@
+#include "Sim.h"
+
+// Arduino core on the simulated board. Every look at the clock costs time
+// (Sim::clockRead), so that loops waiting on time always make progress.
+
+PortIobus simPortIobus = { { { { 0xFFFFFFFF } }, { { 0xFFFFFFFF } } } };
+PmRegisters simPm = { { PM_RCAUSE_POR } };
+Serial_ Serial;
+
+#define PA 0
+#define PB 1
+
+// Feather M0 variant, pins 0 to 24
+const PinDescription g_APinDescription[] = {
+  { PA, 11, 11 }, { PA, 10, 10 }, { PA, 14, 14 }, { PA, 9, 9 }, { PA, 8, 0 },
+  { PA, 15, 15 }, { PA, 20, 4 }, { PA, 21, 5 }, { PA, 6, 6 }, { PA, 7, 7 },
+  { PA, 18, 2 }, { PA, 16, 0 }, { PA, 19, 3 }, { PA, 17, 1 }, { PA, 2, 2 },
+  { PB, 8, 8 }, { PB, 9, 9 }, { PA, 4, 4 }, { PA, 5, 5 }, { PB, 2, 2 },
+  { PA, 22, 6 }, { PA, 23, 7 }, { PA, 12, 12 }, { PB, 10, 10 }, { PB, 11, 11 }
+};
+
+unsigned long millis() {
+  sim.clockRead();
+  return sim.ticks / 1000;
+}
+
+unsigned long micros() {
+  sim.clockRead();
+  return sim.ticks;
+}
+
+void delay(unsigned long ms) {
+  sim.advance(ms * 1000ULL);
+}
+
+void delayMicroseconds(unsigned int us) {
+  sim.advance(us);
+}
+
+void pinMode(uint32_t pin, uint32_t mode) {}
+
+int digitalRead(uint32_t pin) {
+  if (pin == ALT_CARD_DETECT) {
+    return sim.config.altCard && sim.config.cardPresent;
+  }
+  if (pin < sizeof(g_APinDescription) / sizeof(g_APinDescription[0])) {
+    const PinDescription &p = g_APinDescription[pin];
+    return PORT_IOBUS->Group[p.ulPort].IN.reg >> p.ulPin & 1;
+  }
+  return HIGH;
+}
+
+void digitalWrite(uint32_t pin, uint32_t value) {
+  sim.chipSelect(pin, value == LOW);
+}
+
+void attachInterrupt(uint32_t pin, void (*callback)(), uint32_t mode) {}
+
+void NVIC_SystemReset() {
+  throw SimReset{ PM_RCAUSE_SYST };
+}
+
+int Serial_::available() {
+  return sim.serialIn.size();
+}
+
+int Serial_::read() {
+  if (sim.serialIn.empty()) {
+    return -1;
+  }
+  uint8_t b = sim.serialIn.front();
+  sim.serialIn.pop_front();
+  return b;
+}
+
+// one USB packet at a time
+int Serial_::availableForWrite() {
+  return 63;
+}
+
+size_t Serial_::write(uint8_t b) {
+  return write(&b, 1);
+}
+
+// nothing goes out without a host
+size_t Serial_::write(const uint8_t *buffer, size_t size) {
+  if (!sim.config.usbConnected) {
+    return 0;
+  }
+  sim.serialOut.insert(sim.serialOut.end(), buffer, buffer + size);
+  return size;
+}
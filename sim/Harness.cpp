@@ -0,0 +1,287 @@
+#include "Harness.h"
+
+/************
+ * Coverage *
+ ************/
+
+uint8_t coverage[MAP_SIZE];
+uintptr_t previousBlock;
+
+// runs at every basic block of the sketch
+extern "C" __attribute__((no_sanitize("address", "undefined"))) void __sanitizer_cov_trace_pc() {
+  uintptr_t pc = (uintptr_t) __builtin_return_address(0);
+  uintptr_t block = (pc ^ pc >> 16) & (MAP_SIZE - 1);
+  coverage[block ^ previousBlock]++;
+  previousBlock = block >> 1;
+}
+
+/********
+ * Boot *
+ ********/
+
+alignas(Clock) static uint8_t clockStorage[sizeof(Clock)];
+Clock *alarmClock;
+
+void bootSketch(uint8_t cause) {
+  if (alarmClock) {
+    alarmClock->~Clock();
+    alarmClock = nullptr;
+  }
+  sim.boot(cause);
+  simPm.RCAUSE.reg = cause;
+  if (cause & PM_RCAUSE_POR) {
+    memset((void *) &snapshot, 0xA5, sizeof(snapshot));
+    memset((void *) &trace, 0xA5, sizeof(trace));
+  }
+  new (&serialLink) Link();
+#if FEATURE_SERIAL_LOG
+  new (&logger) Logger();
+#endif
+#if FEATURE_LATENCY_TRACE
+  new (&latencyTrace) LatencyTrace();
+#endif
+  new (&spiArbiter) SpiArbiter();
+  new (&i2cBus) I2CBus();
+  new (&Wire) TwoWire();
+  memset(clockStorage, 0, sizeof(clockStorage));
+  alarmClock = new (clockStorage) Clock();
+  loopRan = false;
+  alarmClock->init();
+}
+
+bool loopRan = false;
+I2CTraffic loopRtcTraffic;
+I2CTraffic loopDisplayTraffic;
+State loopStartState;
+RingQueue loopStartRings;
+RingEvent loopStartRing;
+uint32_t loopSoundsCut;
+
+static I2CTraffic since(const I2CTraffic &now, const I2CTraffic &start) {
+  I2CTraffic t;
+  t.transfers = now.transfers - start.transfers;
+  t.bytes = now.bytes - start.bytes;
+  t.blockingBytes = now.blockingBytes - start.blockingBytes;
+  t.timeReads = now.timeReads - start.timeReads;
+  t.frames = now.frames - start.frames;
+  t.sameFrames = now.sameFrames - start.sameFrames;
+  return t;
+}
+
+void runLoop() {
+  I2CTraffic rtc = sim.rtcTraffic;
+  I2CTraffic display = sim.displayTraffic;
+  uint32_t cut = sim.soundsCut;
+  loopStartState = ClockProbe::state(*alarmClock);
+  loopStartRings = ClockProbe::rings(*alarmClock);
+  loopStartRing = ClockProbe::currentRing(*alarmClock);
+  alarmClock->run();
+  loopSoundsCut = sim.soundsCut - cut;
+  loopRtcTraffic = since(sim.rtcTraffic, rtc);
+  loopDisplayTraffic = since(sim.displayTraffic, display);
+  loopRan = true;
+}
+
+/**********
+ * Probes *
+ **********/
+
+static const uint8_t DAYS_IN_MONTH[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+static uint8_t daysIn(uint8_t month, uint16_t year) {
+  return DAYS_IN_MONTH[month - 1] + (month == 2 && year % 4 == 0);
+}
+
+char detail[256];
+
+const char *fail(const char *signature, const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  vsnprintf(detail, sizeof(detail), format, args);
+  va_end(args);
+  return signature;
+}
+
+uint32_t ClockProbe::nextRing(Clock &c, uint8_t alarm) {
+#if FEATURE_ALARM_2
+  if (alarm == 1) {
+    return c.schedule2.next;
+  }
+#endif
+  return c.schedule1.next;
+}
+
+const char *ClockProbe::check(Clock &c) {
+  if (c.state >= STATE_COUNT) {
+    return fail("state out of range", "%d", c.state);
+  }
+  const char *b = checkBus(c);
+  if (b) {
+    return b;
+  }
+  const char *r = checkRings(c);
+  if (r) {
+    return r;
+  }
+  const char *s = checkSettings(c.settings);
+  if (s) {
+    return s;
+  }
+  // clamped whenever a card's tracks are counted
+  uint8_t tracks = max(c.alarmTrackCount, (uint8_t) 1);
+  if (c.cardReady && c.tracksCounted && (c.settings.alarm1.track >= tracks || c.settings.alarm2.track >= tracks)) {
+    return fail("alarm track past the card's", "%d and %d of %d", c.settings.alarm1.track, c.settings.alarm2.track,
+      c.alarmTrackCount);
+  }
+  DateTime t = c.currentTime;
+  if (t.year() < 2000 || t.year() > 2099 || t.month() < 1 || t.month() > 12 ||
+      t.day() < 1 || t.day() > daysIn(t.month(), t.year()) ||
+      t.hour() >= 24 || t.minute() >= 60 || t.second() >= 60) {
+    return fail("invalid current time", "%d-%d-%d %d:%d:%d", t.year(), t.month(), t.day(), t.hour(), t.minute(), t.second());
+  }
+  switch (c.state) {
+    case SET_HOURS:
+    case SET_MINUTES:
+      if (c.hour >= 24 || c.minute >= 60) {
+        return fail("invalid time being set", "%d:%d", c.hour, c.minute);
+      }
+      break;
+    case SET_DAY:
+      if (c.year >= 100 || c.month >= 12 || c.day >= daysIn(c.month + 1, c.year)) {
+        return fail("invalid date being set", "%d-%d-%d", c.year, c.month + 1, c.day + 1);
+      }
+      break;
+    case SET_MONTH:
+    case SET_YEAR:
+      if (c.year >= 100 || c.month >= 12) {
+        return fail("invalid date being set", "%d-%d", c.year, c.month + 1);
+      }
+      break;
+#if FEATURE_NAP
+    case DISPLAY_NAP: {
+      int32_t remaining = (c.napTime - c.currentTime).totalseconds();
+      if (remaining <= 0 || remaining >= 100 * 60) {
+        return fail("nap countdown out of range", "%d s", remaining);
+      }
+      break;
+    }
+#endif
+    default:
+      break;
+  }
+  if (!editingAlarm(c.state)) {
+    s = checkSchedule(c.settings.alarm1, c.schedule1);
+#if FEATURE_ALARM_2
+    if (!s) {
+      s = checkSchedule(c.settings.alarm2, c.schedule2);
+    }
+#endif
+  }
+  return s;
+}
+
+const char *ClockProbe::checkSettings(const Settings &s) {
+  if (s.version != SETTINGS_VERSION || s.volume > 99 || s.brightness > 15 ||
+      s.exitVolumeDelay < 10 || s.exitMenuDelay < 10) {
+    return fail("settings out of range", "version %d volume %d brightness %d delays %d %d", s.version, s.volume,
+      s.brightness, s.exitVolumeDelay, s.exitMenuDelay);
+  }
+  const Alarm *alarms[] = { &s.alarm1, &s.alarm2 };
+  for (const Alarm *a : alarms) {
+    if (a->hour >= 24 || a->minute >= 60 || a->days > ALL_DAYS || a->track >= 9 ||
+        a->everyWeeks < 1 || a->everyWeeks > ALARM_MAX_EVERY_WEEKS || a->weekPhase >= a->everyWeeks) {
+      return fail("alarm settings out of range", "%d:%d days %x track %d every %d phase %d",
+        a->hour, a->minute, a->days, a->track, a->everyWeeks, a->weekPhase);
+    }
+  }
+  return nullptr;
+}
+
+// A loop queues one time read, and a frame only if it changed: two frames
+// may go out in a loop, the previous one's if the bus was busy. The benchmark
+// does more on purpose.
+const char *ClockProbe::checkBus(Clock &c) {
+  if (!loopRan) {
+    return nullptr;
+  }
+#if FEATURE_BENCHMARK
+  if (c.state == DISPLAY_BENCHMARK || c.benchmarkTask.running()) {
+    return nullptr;
+  }
+#endif
+  if (loopRtcTraffic.timeReads > 1) {
+    return fail("time read queued more than once in a loop", "%u reads, %u bytes", loopRtcTraffic.timeReads,
+      loopRtcTraffic.bytes);
+  }
+  if (loopDisplayTraffic.sameFrames > 0) {
+    return fail("display frame sent for nothing", "%u frames, %u unchanged, %u bytes", loopDisplayTraffic.frames,
+      loopDisplayTraffic.sameFrames, loopDisplayTraffic.bytes);
+  }
+  return nullptr;
+}
+
+static bool ringing(State s) {
+  return s == RINGING_ALARM_1 || s == RINGING_ALARM_2 || s == RINGING_NAP;
+}
+
+// One ring sounds at a time: it's never stopped for another, the queue only
+// holds rings waiting for it, in order, one per ringing state
+const char *ClockProbe::checkRings(Clock &c) {
+  if (loopRan && ringing(loopStartState) && ringing(c.state) && c.state != loopStartState && loopSoundsCut > 0) {
+    return fail("ring cut off by another", "state %d by %d", loopStartState, c.state);
+  }
+  // a stop leaves the ones it doesn't merge for the next loop to start
+  if (c.rings.size() > 0 && !ringing(c.state) && !(loopRan && ringing(loopStartState))) {
+    return fail("rings queued and none ringing", "%d queued, state %d", c.rings.size(), c.state);
+  }
+  // a ring queued goes only by ringing, or merged into the one ringing when
+  // the loop started or the one that rang last
+  for (uint8_t i = 0; loopRan && i < loopStartRings.size(); i++) {
+    const RingEvent &e = loopStartRings.at(i);
+    bool queued = false;
+    for (uint8_t j = 0; j < c.rings.size(); j++) {
+      queued |= c.rings.at(j).state == e.state;
+    }
+    if (!queued && e.state != c.state && !ringsWith(loopStartRing, e) && !ringsWith(c.currentRing, e)) {
+      return fail("queued ring dropped", "state %d due %u while %d, %d started the loop", e.state, e.due, c.state,
+        loopStartState);
+    }
+  }
+  for (uint8_t i = 0; i < c.rings.size(); i++) {
+    const RingEvent &e = c.rings.at(i);
+    if (!ringing(e.state) || e.state == c.state || (e.track == RING_TRACK_NAP) != (e.state == RINGING_NAP)) {
+      return fail("invalid ring queued", "state %d track %d while %d", e.state, e.track, c.state);
+    }
+    if (i > 0 && (e.due < c.rings.at(i - 1).due || (e.due == c.rings.at(i - 1).due && e.state <= c.rings.at(i - 1).state))) {
+      return fail("rings queued out of order", "%u %d after %u %d", e.due, e.state, c.rings.at(i - 1).due,
+        c.rings.at(i - 1).state);
+    }
+  }
+#if FEATURE_NAP
+  if ((c.napping && c.state != DISPLAY_NAP && !ringing(c.state)) || (c.state == DISPLAY_NAP && !c.napping)) {
+    return fail("nap lost", "state %d napping %d", c.state, c.napping);
+  }
+#endif
+  return nullptr;
+}
+
+// as Clock::ringsWith
+bool ClockProbe::ringsWith(const RingEvent &ring, const RingEvent &e) {
+  return e.due < ring.due + 60 || e.track == ring.track;
+}
+
+// menus change the alarm in place and reschedule it when leaving
+bool ClockProbe::editingAlarm(State s) {
+  return (s >= SET_ENABLED_1 && s <= SET_TRACK_1) || (s >= SET_ENABLED_2 && s <= SET_TRACK_2);
+}
+
+const char *ClockProbe::checkSchedule(const Alarm &a, const AlarmSchedule &schedule) {
+  if (a.enabled && (a.days & ALL_DAYS) && schedule.next == 0) {
+    return fail("enabled alarm never rings", "%d:%d days %x every %d phase %d one shot %d skip %d, skipped %u last %u",
+      a.hour, a.minute, a.days, a.everyWeeks, a.weekPhase, a.oneShot, a.skipNext, schedule.skipped, schedule.lastRing);
+  }
+  if (schedule.next != 0 && schedule.next <= schedule.lastRing) {
+    return fail("alarm scheduled before its last ring", "next %u last %u", schedule.next, schedule.lastRing);
+  }
+  return nullptr;
+}
@@ -0,0 +1,95 @@
+#ifndef Harness_h
+#define Harness_h
+
+#include "Sim.h"
+#include "Clock.h"
+
+// What the simulation tools (fuzz, soak) share: the sketch booted the way
+// the startup code does it, and a look at the Clock's private state.
+
+#define MAP_SIZE 65536
+
+// AFL style edge hit counts, the sketch is built with
+// -fsanitize-coverage=trace-pc. Cleared by the fuzzer before every run.
+extern uint8_t coverage[MAP_SIZE];
+extern uintptr_t previousBlock;
+
+// the sketch's Clock, null until the first boot
+extern Clock *alarmClock;
+
+// What happens before setup() after a reset of this cause (PM_RCAUSE_*):
+// .bss zeroed and .data copied, .noinit (snapshot, trace) left as it is, or
+// garbage after a power cycle. Then setup(). Throws SimReset if it dies.
+void bootSketch(uint8_t cause);
+
+// One loop of the sketch, its bus traffic kept for check() and the tools.
+// Boots don't count, they talk to the devices the blocking way.
+void runLoop();
+extern bool loopRan; // since the last boot
+extern I2CTraffic loopRtcTraffic;
+extern I2CTraffic loopDisplayTraffic;
+extern State loopStartState;
+extern RingQueue loopStartRings;
+extern RingEvent loopStartRing;
+extern uint32_t loopSoundsCut;
+
+// Failures are a signature, constant so that they can be compared, and a
+// detail
+extern char detail[256];
+const char *fail(const char *signature, const char *format = "", ...);
+
+class ClockProbe {
+  public:
+    static State state(Clock &c) {
+      return c.state;
+    }
+    static const RingQueue &rings(Clock &c) {
+      return c.rings;
+    }
+    static const RingEvent &currentRing(Clock &c) {
+      return c.currentRing;
+    }
+    static uint32_t time(Clock &c) {
+      return c.currentTime.unixtime();
+    }
+    // alarm 0 or 1
+    static uint32_t nextRing(Clock &c, uint8_t alarm);
+#if FEATURE_NAP
+    static uint32_t napTime(Clock &c) {
+      return c.napTime.unixtime();
+    }
+#endif
+    // nothing in flight: the next loop only matters for the time it sees
+    static bool idle(Clock &c) {
+      return c.tasks.idle() && !c.armed;
+    }
+    static bool alarmDueNextMinute(Clock &c) {
+      return c.alarmDueNextMinute();
+    }
+    static bool cardReady(Clock &c) {
+      return c.cardReady;
+    }
+    static uint8_t volume(Clock &c) {
+      return c.settings.volume;
+    }
+    static uint8_t brightness(Clock &c) {
+      return c.settings.brightness;
+    }
+    // the gains of the card's tracks are known
+    static bool indexed(Clock &c) {
+      return c.cardReady && c.tracksCounted && !trackIndex.indexTask.running();
+    }
+
+    // the first invariant that doesn't hold, null if all do
+    static const char *check(Clock &c);
+
+  private:
+    static const char *checkSettings(const Settings &s);
+    static const char *checkBus(Clock &c);
+    static const char *checkRings(Clock &c);
+    static bool ringsWith(const RingEvent &ring, const RingEvent &e);
+    static bool editingAlarm(State s);
+    static const char *checkSchedule(const Alarm &a, const AlarmSchedule &schedule);
+};
+
+#endif
@@ -0,0 +1,90 @@
+#include "I2CBus.h"
+#include "Trace.h"
+#include "Sim.h"
+
+// Host version: a transaction reaches the device when it starts and is over
+// once the bus would be done with it. NACKs fail it, timeouts don't happen.
+
+I2CBus i2cBus;
+
+static uint64_t phaseEnd; // sim.now at the end of the current phase
+
+void I2CBus::begin() {
+  recover();
+}
+
+bool I2CBus::submit(I2CTransaction *t) {
+  if (t->busy() || queueCount == I2C_QUEUE_SIZE) {
+    return false;
+  }
+  t->status = I2C_QUEUED;
+  queue[(queueHead + queueCount) % I2C_QUEUE_SIZE] = t;
+  queueCount++;
+  poll(); // start right away if the bus is free
+  return true;
+}
+
+void I2CBus::poll() {
+  sim.advance(1); // a few register reads
+  if (current != nullptr && sim.now >= phaseEnd) {
+    if (current->status == I2C_WRITING && current->rxLength > 0) {
+      startRead();
+    }
+    else {
+      finish(I2C_DONE);
+    }
+  }
+
+  if (current == nullptr && queueCount > 0) {
+    current = queue[queueHead];
+    queueHead = (queueHead + 1) % I2C_QUEUE_SIZE;
+    queueCount--;
+    if (current->txLength > 0) {
+      startWrite();
+    }
+    else {
+      startRead();
+    }
+  }
+}
+
+void I2CBus::startWrite() {
+  current->status = I2C_WRITING;
+  phaseStart = millis();
+  phaseEnd = sim.now + sim.i2cDuration(1 + current->txLength);
+  if (!sim.i2c(current->address, current->txData, current->txLength, nullptr, 0, false)) {
+    finish(I2C_FAILED);
+  }
+}
+
+void I2CBus::startRead() {
+  current->status = I2C_READING;
+  phaseStart = millis();
+  phaseEnd = sim.now + sim.i2cDuration(1 + current->rxLength);
+  if (!sim.i2c(current->address, nullptr, 0, current->rxData, current->rxLength, false)) {
+    finish(I2C_FAILED);
+  }
+}
+
+void I2CBus::finish(I2CStatus status) {
+  if (status == I2C_FAILED) {
+    errors++;
+    trace.record(TRACE_I2C_ERROR, current->address, current->status);
+  }
+  current->status = status;
+  current = nullptr;
+}
+
+void I2CBus::drain() {
+  while (current != nullptr || queueCount > 0) {
+    if (current != nullptr && sim.now < phaseEnd) {
+      sim.advance(phaseEnd - sim.now);
+    }
+    poll();
+  }
+}
+
+void I2CBus::recover() {
+  Wire.begin();
+  Wire.setClock(I2C_CLOCK);
+}
@@ -0,0 +1,33 @@
+#ifndef Ilp32_h
+#define Ilp32_h
+
+// The SAMD21 is ILP32: long is 32 bits, so millis() wraps after 49.7 days
+// and micros() after 71 minutes, and the sketch's unsigned long arithmetic
+// wraps with them. sim.js includes this first in every file: the host's
+// library headers are read as they are, then long means int. Not in this
+// folder's code: long long, printf's %l.
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdarg.h>
+#include <string.h>
+#include <inttypes.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <algorithm>
+#include <chrono>
+#include <deque>
+#include <map>
+#include <new>
+#include <random>
+#include <set>
+#include <string>
+#include <vector>
+
+#define long int
+
+#endif
@@ -0,0 +1,483 @@
+#include "Sim.h"
+#include <Wire.h>
+#include <SPI.h>
+#include <SD.h>
+#include <FlashStorage.h>
+#include <RTClib.h>
+#include <Adafruit_LEDBackpack.h>
+
+// The libraries the sketch uses, on the simulated devices. Their bus traffic
+// is what the real ones put on the bus.
+
+TwoWire Wire;
+SPIClass SPI;
+SDClass SD;
+
+/********
+ * Wire *
+ ********/
+
+void TwoWire::begin() {
+  sim.i2cClock = 100000;
+}
+
+void TwoWire::setClock(uint32_t clock) {
+  sim.i2cClock = clock;
+}
+
+void TwoWire::beginTransmission(uint8_t a) {
+  address = a;
+  txLength = 0;
+}
+
+size_t TwoWire::write(uint8_t b) {
+  if (txLength == sizeof(txBuffer)) {
+    return 0;
+  }
+  txBuffer[txLength++] = b;
+  return 1;
+}
+
+size_t TwoWire::write(const uint8_t *data, size_t length) {
+  size_t n = 0;
+  while (n < length && write(data[n])) {
+    n++;
+  }
+  return n;
+}
+
+// 0 on success, 2 on address NACK
+uint8_t TwoWire::endTransmission(bool stop) {
+  sim.advance(sim.i2cDuration(1 + txLength));
+  return sim.i2c(address, txBuffer, txLength, nullptr, 0, true) ? 0 : 2;
+}
+
+uint8_t TwoWire::requestFrom(uint8_t a, size_t length, bool stop) {
+  length = min(length, sizeof(rxBuffer));
+  sim.advance(sim.i2cDuration(1 + length));
+  rxIndex = 0;
+  rxLength = sim.i2c(a, nullptr, 0, rxBuffer, length, true) ? length : 0;
+  return rxLength;
+}
+
+int TwoWire::available() {
+  return rxLength - rxIndex;
+}
+
+int TwoWire::read() {
+  return rxIndex < rxLength ? rxBuffer[rxIndex++] : -1;
+}
+
+/*******
+ * SPI *
+ *******/
+
+uint8_t SPIClass::transfer(uint8_t b) {
+  return sim.spiTransfer(b);
+}
+
+/******
+ * SD *
+ ******/
+
+static uint32_t sdClock = 4000000;
+static uint32_t fileBlock = 0; // card position of the file being read
+
+static bool cardInSlot(uint8_t csPin) {
+  return sim.config.cardPresent && csPin == (sim.config.altCard ? ALT_CARD_CS : CARD_CS);
+}
+
+bool SDClass::begin(uint8_t csPin) {
+  return begin(4000000, csPin);
+}
+
+// reset, then the partition and FAT boot blocks
+bool SDClass::begin(uint32_t clock, uint8_t csPin) {
+  sdClock = clock;
+  if (!cardInSlot(csPin)) {
+    sim.advance(2000000); // card init timeout, as Sd2Card::init
+    return false;
+  }
+  sim.advance(10000);
+  sim.cardRead(sdClock, 0, false);
+  sim.cardRead(sdClock, 1, false);
+  sim.cardMounted = true;
+  return true;
+}
+
+void SDClass::end() {
+  sim.cardMounted = false;
+}
+
+// a directory block per path component
+bool SDClass::exists(const char *path) {
+  if (!sim.config.cardPresent || !sim.cardMounted) {
+    return false;
+  }
+  sim.cardRead(sdClock, 0, false);
+  sim.cardRead(sdClock, 1, true);
+  return sim.files.count(path) > 0;
+}
+
+File SDClass::open(const char *path, uint8_t mode) {
+  if (!exists(path)) {
+    return File();
+  }
+  fileBlock = 0;
+  return File(path, sim.files[path]);
+}
+
+int File::read() {
+  uint8_t b;
+  return read(&b, 1) == 1 ? b : -1;
+}
+
+// one card block read per call
+int File::read(void *buffer, size_t size) {
+  if (!valid || !sim.config.cardPresent || !sim.cardMounted) {
+    return -1;
+  }
+  size = min(size, (size_t) (length - pos));
+  if (size > 0) {
+    sim.cardRead(sdClock, fileBlock++, true);
+  }
+  sim.fileContents(path_, pos, (uint8_t *) buffer, size);
+  pos += size;
+  return size;
+}
+
+bool File::seek(uint32_t position) {
+  if (position > length) {
+    return false;
+  }
+  pos = position;
+  return true;
+}
+
+// the library gives up on a card that doesn't answer after 2s
+uint8_t Sd2Card::init(uint8_t sckRateID, uint8_t chipSelectPin) {
+  clock = 4000000;
+  if (!cardInSlot(chipSelectPin)) {
+    sim.advance(2000000);
+    return false;
+  }
+  sim.advance(10000);
+  return true;
+}
+
+uint8_t Sd2Card::setSpiClock(uint32_t c) {
+  clock = c;
+  return true;
+}
+
+// Blocks read the same at every clock the card supports, above that a byte
+// comes back wrong
+uint8_t Sd2Card::readBlock(uint32_t block, uint8_t *dst) {
+  if (!sim.config.cardPresent) {
+    return false;
+  }
+  sim.cardRead(clock, block, block == lastBlock + 1);
+  lastBlock = block;
+  uint32_t hash = 2166136261UL ^ block;
+  for (uint16_t i = 0; i < 512; i++) {
+    hash = (hash ^ i) * 16777619UL;
+    dst[i] = hash >> 24;
+  }
+  if (clock > sim.config.cardMaxClock) {
+    dst[block % 512] ^= 0x5A;
+  }
+  return true;
+}
+
+uint8_t Sd2Card::readCID(cid_t *cid) {
+  if (!sim.config.cardPresent) {
+    return false;
+  }
+  for (uint8_t i = 0; i < sizeof(cid->bytes); i++) {
+    cid->bytes[i] = 0x40 + i + sim.config.cardMaxClock / 1000000;
+  }
+  return true;
+}
+
+// 1GB
+uint32_t Sd2Card::cardSize() {
+  return sim.config.cardPresent ? 2097152 : 0;
+}
+
+/*********
+ * Flash *
+ *********/
+
+#define FLASH_PAGE_SIZE 64
+#define FLASH_ROW_SIZE 256
+#define FLASH_ERASE_TIME 6000 // us per row
+#define FLASH_WRITE_TIME 2500 // us per page
+
+static FlashClass *flashInstances = nullptr;
+
+FlashClass::FlashClass(const void *flash_addr, uint32_t s) : address((const uint8_t *) flash_addr), size(s) {
+  bytes = new uint8_t[size];
+  memset(bytes, 0xFF, size);
+  nextInstance = flashInstances;
+  flashInstances = this;
+}
+
+FlashClass::~FlashClass() {
+  delete[] bytes;
+}
+
+// bits can only be cleared
+void FlashClass::write(const void *data) {
+  const uint8_t *d = (const uint8_t *) data;
+  for (uint32_t i = 0; i < size; i++) {
+    bytes[i] &= d[i];
+  }
+  sim.advance((size + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_WRITE_TIME);
+}
+
+void FlashClass::erase() {
+  memset(bytes, 0xFF, size);
+  sim.advance(FLASH_ERASE_TIME);
+}
+
+void FlashClass::read(void *data) {
+  memcpy(data, bytes, size);
+}
+
+// offsets into the region, which must hold them
+void FlashClass::write(const volatile void *flash_ptr, const void *data, uint32_t n) {
+  uint32_t offset = (const volatile uint8_t *) flash_ptr - address;
+  const uint8_t *d = (const uint8_t *) data;
+  for (uint32_t i = 0; i < n; i++) {
+    bytes[offset + i] &= d[i];
+  }
+  sim.advance((offset % FLASH_PAGE_SIZE + n + FLASH_PAGE_SIZE - 1) / FLASH_PAGE_SIZE * FLASH_WRITE_TIME);
+}
+
+void FlashClass::erase(const volatile void *flash_ptr, uint32_t n) {
+  uint32_t offset = (const volatile uint8_t *) flash_ptr - address;
+  uint32_t first = offset / FLASH_ROW_SIZE * FLASH_ROW_SIZE;
+  uint32_t end = min((offset + n + FLASH_ROW_SIZE - 1) / FLASH_ROW_SIZE * FLASH_ROW_SIZE, size);
+  memset(bytes + first, 0xFF, end - first);
+  sim.advance((end - first + FLASH_ROW_SIZE - 1) / FLASH_ROW_SIZE * FLASH_ERASE_TIME);
+}
+
+void FlashClass::read(const volatile void *flash_ptr, void *data, uint32_t n) {
+  memcpy(data, bytes + ((const volatile uint8_t *) flash_ptr - address), n);
+}
+
+void Sim::eraseFlash() {
+  for (FlashClass *f = flashInstances; f; f = f->nextInstance) {
+    memset(f->bytes, 0xFF, f->size);
+  }
+}
+
+/**********
+ * RTClib *
+ **********/
+
+static const uint8_t daysInMonth[] = { 31, 28, 31, 30, 31, 30, 31, 31, 30, 31, 30, 31 };
+
+static uint16_t date2days(uint16_t y, uint8_t m, uint8_t d) {
+  if (y >= 2000U) {
+    y -= 2000U;
+  }
+  uint16_t days = d;
+  for (uint8_t i = 1; i < m; ++i) {
+    days += daysInMonth[i - 1];
+  }
+  if (m > 2 && y % 4 == 0) {
+    ++days;
+  }
+  return days + 365 * y + (y + 3) / 4 - 1;
+}
+
+static uint32_t time2ulong(uint16_t days, uint8_t h, uint8_t m, uint8_t s) {
+  return ((days * 24UL + h) * 60 + m) * 60 + s;
+}
+
+static uint8_t conv2d(const char *p) {
+  uint8_t v = 0;
+  if ('0' <= *p && *p <= '9') {
+    v = *p - '0';
+  }
+  return 10 * v + *++p - '0';
+}
+
+DateTime::DateTime(uint32_t t) {
+  t -= SECONDS_FROM_1970_TO_2000;
+  ss = t % 60;
+  t /= 60;
+  mm = t % 60;
+  t /= 60;
+  hh = t % 24;
+  uint16_t days = t / 24;
+  uint8_t leap;
+  for (yOff = 0;; ++yOff) {
+    leap = yOff % 4 == 0;
+    if (days < 365U + leap) {
+      break;
+    }
+    days -= 365 + leap;
+  }
+  for (m = 1; m < 12; ++m) {
+    uint8_t daysPerMonth = daysInMonth[m - 1];
+    if (leap && m == 2) {
+      ++daysPerMonth;
+    }
+    if (days < daysPerMonth) {
+      break;
+    }
+    days -= daysPerMonth;
+  }
+  d = days + 1;
+}
+
+DateTime::DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour, uint8_t min, uint8_t sec) {
+  if (year >= 2000U) {
+    year -= 2000U;
+  }
+  yOff = year;
+  m = month;
+  d = day;
+  hh = hour;
+  mm = min;
+  ss = sec;
+}
+
+// "Mmm dd yyyy", "hh:mm:ss"
+DateTime::DateTime(const __FlashStringHelper *date, const __FlashStringHelper *time) {
+  const char *ds = (const char *) date;
+  const char *ts = (const char *) time;
+  static const char months[] = "JanFebMarAprMayJunJulAugSepOctNovDec";
+  yOff = conv2d(ds + 9);
+  m = 1;
+  while (m < 12 && strncmp(ds, months + 3 * (m - 1), 3) != 0) {
+    m++;
+  }
+  d = conv2d(ds + 4);
+  hh = conv2d(ts);
+  mm = conv2d(ts + 3);
+  ss = conv2d(ts + 6);
+}
+
+// Jan 1, 2000 is a Saturday
+uint8_t DateTime::dayOfTheWeek() const {
+  uint16_t day = date2days(yOff, m, d);
+  return (day + 6) % 7;
+}
+
+uint32_t DateTime::unixtime() const {
+  return time2ulong(date2days(yOff, m, d), hh, mm, ss) + SECONDS_FROM_1970_TO_2000;
+}
+
+static uint8_t bcd2bin(uint8_t v) {
+  return v - 6 * (v >> 4);
+}
+
+static uint8_t bin2bcd(uint8_t v) {
+  return v + 6 * (v / 10);
+}
+
+static uint8_t readRegister(uint8_t reg) {
+  Wire.beginTransmission(RTC_I2C_ADDRESS);
+  Wire.write(reg);
+  Wire.endTransmission();
+  Wire.requestFrom(RTC_I2C_ADDRESS, 1);
+  return Wire.read();
+}
+
+static void writeRegister(uint8_t reg, uint8_t value) {
+  Wire.beginTransmission(RTC_I2C_ADDRESS);
+  Wire.write(reg);
+  Wire.write(value);
+  Wire.endTransmission();
+}
+
+bool RTC_DS3231::begin() {
+  Wire.begin();
+  Wire.beginTransmission(RTC_I2C_ADDRESS);
+  return Wire.endTransmission() == 0;
+}
+
+bool RTC_DS3231::lostPower() {
+  return readRegister(0x0F) >> 7;
+}
+
+void RTC_DS3231::adjust(const DateTime &dt) {
+  uint8_t buffer[8] = {
+    0,
+    bin2bcd(dt.second()),
+    bin2bcd(dt.minute()),
+    bin2bcd(dt.hour()),
+    (uint8_t) (dt.dayOfTheWeek() == 0 ? 7 : dt.dayOfTheWeek()),
+    bin2bcd(dt.day()),
+    bin2bcd(dt.month()),
+    bin2bcd(dt.year() - 2000U)
+  };
+  Wire.beginTransmission(RTC_I2C_ADDRESS);
+  Wire.write(buffer, sizeof(buffer));
+  Wire.endTransmission();
+  writeRegister(0x0F, readRegister(0x0F) & ~0x80);
+}
+
+DateTime RTC_DS3231::now() {
+  Wire.beginTransmission(RTC_I2C_ADDRESS);
+  Wire.write(0);
+  Wire.endTransmission();
+  Wire.requestFrom(RTC_I2C_ADDRESS, 7);
+  uint8_t buffer[7];
+  for (uint8_t i = 0; i < sizeof(buffer); i++) {
+    buffer[i] = Wire.read();
+  }
+  return DateTime(
+    bcd2bin(buffer[6]) + 2000U,
+    bcd2bin(buffer[5] & 0x7F),
+    bcd2bin(buffer[4]),
+    bcd2bin(buffer[2]),
+    bcd2bin(buffer[1]),
+    bcd2bin(buffer[0] & 0x7F)
+  );
+}
+
+/************************
+ * Adafruit_LEDBackpack *
+ ************************/
+
+static void displayCommand(uint8_t address, uint8_t command) {
+  Wire.beginTransmission(address);
+  Wire.write(command);
+  Wire.endTransmission();
+}
+
+// oscillator on, no blinking, full brightness
+bool Adafruit_LEDBackpack::begin(uint8_t address) {
+  i2c_addr = address;
+  Wire.begin();
+  Wire.beginTransmission(i2c_addr);
+  if (Wire.endTransmission() != 0) {
+    return false;
+  }
+  displayCommand(i2c_addr, 0x21);
+  blinkRate(0);
+  setBrightness(15);
+  return true;
+}
+
+void Adafruit_LEDBackpack::setBrightness(uint8_t b) {
+  displayCommand(i2c_addr, 0xE0 | min(b, (uint8_t) 15));
+}
+
+void Adafruit_LEDBackpack::blinkRate(uint8_t b) {
+  displayCommand(i2c_addr, 0x81 | (b > 3 ? 0 : b) << 1);
+}
+
+void Adafruit_LEDBackpack::writeDisplay() {
+  Wire.beginTransmission(i2c_addr);
+  Wire.write(0);
+  for (uint8_t i = 0; i < 8; i++) {
+    Wire.write(displaybuffer[i] & 0xFF);
+    Wire.write(displaybuffer[i] >> 8);
+  }
+  Wire.endTransmission();
+}
@@ -0,0 +1,385 @@
+#include "Sim.h"
+#include "Input.h"
+#include <RTClib.h>
+
+Sim sim;
+
+static uint8_t bcd2bin(uint8_t v) {
+  return v - 6 * (v >> 4);
+}
+
+static uint8_t bin2bcd(uint8_t v) {
+  return v + 6 * (v / 10);
+}
+
+void Sim::begin(const SimConfig &c, uint32_t unixtime) {
+  config = c;
+  now = 0;
+  ticks = 0;
+  buttonChanges.clear();
+  buttons = 0;
+  applyButtons();
+  files.clear();
+  texts.clear();
+  rtcTraffic = I2CTraffic();
+  displayTraffic = I2CTraffic();
+  serialIn.clear();
+  serialOut.clear();
+  tracksStarted.clear();
+  power = PowerTime();
+  rtcPointer = 0;
+  rtcControl = 0x1C;
+  memset(rtcAlarms, 0, sizeof(rtcAlarms));
+  rtcAging = 0;
+  rtcAgingApplied = 0;
+  setRtcTime(unixtime);
+  rtcOsf = config.rtcLostPower;
+  boot(PM_RCAUSE_POR);
+}
+
+void Sim::boot(uint8_t cause) {
+  resetCause = cause;
+  ticks = 0; // the core's millis() counter is in .bss
+  playing = false;
+  playerAsleep = false; // reset with the MCU
+  cardMounted = false;
+  cardSelect = -1;
+  watchdogEnabled = false;
+  i2cClock = 100000;
+  // the host sees the port go away and come back
+  serialIn.clear();
+  if (cause & PM_RCAUSE_POR) {
+    memset(displayRam, 0, sizeof(displayRam));
+    displayOscillator = false;
+    displayOn = false;
+    displayBlink = 0;
+    displayDimming = 15;
+    displayPointer = 0;
+  }
+}
+
+void Sim::advance(uint64_t us) {
+  if (us > 1) {
+    idleClockReads = 0;
+  }
+  accountPower(us, true);
+  now += us;
+  ticks += us;
+  if (!buttonChanges.empty() && buttonChanges.front().at <= now) {
+    applyButtons();
+  }
+  if (watchdogEnabled && now - watchdogFed > watchdogTimeout) {
+    watchdogEnabled = false;
+    throw SimReset{ PM_RCAUSE_WDT };
+  }
+}
+
+// Waiting loops like die() read the clock millions of times, past a
+// millisecond without I/O they move in 100us steps
+void Sim::clockRead() {
+  uint32_t reads = idleClockReads + 1;
+  advance(reads < 1000 ? 1 : 100);
+  idleClockReads = reads;
+}
+
+bool Sim::sleep(uint64_t us) {
+  idleClockReads = 0;
+  uint64_t end = now + us;
+  uint64_t press = nextPress();
+  bool button = press <= end;
+  uint64_t wake = button ? press : end;
+  accountPower(wake - now, false);
+  // SysTick keeps going in idle sleep, which is used while USB is up
+  if (config.usbConnected) {
+    ticks += wake - now;
+  }
+  now = wake;
+  applyButtons();
+  return button;
+}
+
+// the modes the parts are in while us goes by, awake or asleep
+void Sim::accountPower(uint64_t us, bool awake) {
+  (awake ? power.mcuActive : config.usbConnected ? power.mcuIdle : power.mcuStandby) += us;
+  (displayOscillator && displayOn ? power.displayLit : power.displayStandby) += us;
+  (playing ? power.playerPlaying : playerAsleep ? power.playerLowPower : power.playerIdle) += us;
+}
+
+void Sim::button(uint8_t b, bool pressed, uint64_t at) {
+  // kept in time order, changes at the same time in call order
+  auto i = buttonChanges.end();
+  while (i != buttonChanges.begin() && (i - 1)->at > at) {
+    i--;
+  }
+  buttonChanges.insert(i, ButtonChange{ at, b, pressed });
+  applyButtons();
+}
+
+bool Sim::buttonDown(uint8_t b) {
+  return buttons >> b & 1;
+}
+
+uint64_t Sim::nextPress() {
+  uint8_t down = buttons;
+  for (const ButtonChange &c : buttonChanges) {
+    if (c.pressed && !(down >> c.button & 1)) {
+      return c.at;
+    }
+    down = c.pressed ? down | 1 << c.button : down & ~(1 << c.button);
+  }
+  return UINT64_MAX;
+}
+
+// buttons pull their pin low
+void Sim::applyButtons() {
+  while (!buttonChanges.empty() && buttonChanges.front().at <= now) {
+    const ButtonChange &c = buttonChanges.front();
+    buttons = c.pressed ? buttons | 1 << c.button : buttons & ~(1 << c.button);
+    buttonChanges.erase(buttonChanges.begin());
+  }
+  simPortIobus.Group[0].IN.reg = 0xFFFFFFFF;
+  simPortIobus.Group[1].IN.reg = 0xFFFFFFFF;
+  for (uint8_t b = 0; b < SIM_BUTTONS; b++) {
+    if (buttons >> b & 1) {
+      const PinDescription &pin = g_APinDescription[BUTTON_PINS[b]];
+      simPortIobus.Group[pin.ulPort].IN.reg &= ~(1UL << pin.ulPin);
+    }
+  }
+}
+
+// address, then each byte and its ACK, plus start and stop
+uint64_t Sim::i2cDuration(uint16_t bytes) {
+  return (bytes * 9ULL + 2) * 1000000 / i2cClock;
+}
+
+bool Sim::i2c(uint8_t address, const uint8_t *tx, uint8_t txLength, uint8_t *rx, uint8_t rxLength, bool blocking) {
+  idleClockReads = 0;
+  I2CTraffic *traffic = address == RTC_I2C_ADDRESS ? &rtcTraffic : address == DISPLAY_I2C_ADDRESS ? &displayTraffic : nullptr;
+  bool present = address == RTC_I2C_ADDRESS ? config.rtcPresent : address == DISPLAY_I2C_ADDRESS && config.displayPresent;
+  if (traffic) {
+    uint32_t bytes = 1 + (present ? txLength + rxLength : 0);
+    traffic->transfers++;
+    traffic->bytes += bytes;
+    traffic->blockingBytes += blocking ? bytes : 0;
+  }
+  if (!present) {
+    return false;
+  }
+  if (address == RTC_I2C_ADDRESS) {
+    // the pointer set to the seconds, the read follows
+    if (!blocking && txLength == 1 && tx[0] == 0) {
+      rtcTraffic.timeReads++;
+    }
+    return rtcTransfer(tx, txLength, rx, rxLength);
+  }
+  if (rx) {
+    memset(rx, 0, rxLength);
+  }
+  return displayTransfer(tx, txLength, rxLength);
+}
+
+uint32_t Sim::rtcTime() {
+  return rtcMicros() / 1000000;
+}
+
+uint64_t Sim::rtcMicros() {
+  double rate = rtcRate();
+  uint64_t elapsed = now - rtcBaseTime;
+  return rtcBase + (rate == 1 ? elapsed : (uint64_t) (elapsed * rate));
+}
+
+double Sim::rtcRate() {
+  return 1 + (config.rtcPpm - rtcAgingApplied * 0.1) / 1000000;
+}
+
+// writing the seconds restarts the countdown chain
+void Sim::setRtcTime(uint32_t t) {
+  rtcBase = t * 1000000ULL;
+  rtcBaseTime = now;
+}
+
+// The register pointer is set by the first byte written and incremented by
+// every byte written or read. The time registers are 24h mode BCD.
+bool Sim::rtcTransfer(const uint8_t *tx, uint8_t txLength, uint8_t *rx, uint8_t rxLength) {
+  DateTime t(rtcTime());
+  uint8_t registers[0x13] = {
+    bin2bcd(t.second()),
+    bin2bcd(t.minute()),
+    bin2bcd(t.hour()),
+    (uint8_t) (t.dayOfTheWeek() == 0 ? 7 : t.dayOfTheWeek()),
+    bin2bcd(t.day()),
+    (uint8_t) (bin2bcd(t.month()) | (t.year() >= 2100 ? 0x80 : 0)),
+    bin2bcd(t.year() % 100),
+  };
+  memcpy(registers + 0x07, rtcAlarms, sizeof(rtcAlarms));
+  registers[0x0E] = rtcControl;
+  registers[0x0F] = rtcOsf ? 0x80 : 0;
+  registers[0x10] = rtcAging;
+  registers[0x11] = 25; // °C
+  bool timeWritten = false;
+  if (txLength > 0) {
+    rtcPointer = tx[0] % sizeof(registers);
+    for (uint8_t i = 1; i < txLength; i++) {
+      registers[rtcPointer] = tx[i];
+      timeWritten |= rtcPointer < 7;
+      if (rtcPointer == 0x0F && !(tx[i] & 0x80)) {
+        rtcOsf = false; // only cleared by writing 0
+      }
+      rtcPointer = (rtcPointer + 1) % sizeof(registers);
+    }
+  }
+  if (timeWritten) {
+    // out of range values aren't modeled, the date is what RTClib makes of it
+    setRtcTime(DateTime(
+      2000 + bcd2bin(registers[6]) % 100,
+      bcd2bin(registers[5] & 0x1F),
+      bcd2bin(registers[4] & 0x3F),
+      bcd2bin(registers[2] & 0x3F),
+      bcd2bin(registers[1] & 0x7F),
+      bcd2bin(registers[0] & 0x7F)
+    ).unixtime());
+  }
+  memcpy(rtcAlarms, registers + 0x07, sizeof(rtcAlarms));
+  rtcAging = registers[0x10];
+  // CONV: the conversion is instantaneous, the new rate starts now
+  if (registers[0x0E] & 0x20) {
+    rtcBase = rtcMicros();
+    rtcBaseTime = now;
+    rtcAgingApplied = rtcAging;
+    registers[0x0E] &= ~0x20;
+  }
+  rtcControl = registers[0x0E];
+  for (uint8_t i = 0; i < rxLength; i++) {
+    rx[i] = registers[rtcPointer];
+    rtcPointer = (rtcPointer + 1) % sizeof(registers);
+  }
+  return true;
+}
+
+// First byte: display RAM address followed by data, or a command
+bool Sim::displayTransfer(const uint8_t *tx, uint8_t txLength, uint8_t rxLength) {
+  if (txLength == 0) {
+    return true;
+  }
+  uint8_t command = tx[0];
+  if (command < 0x10) {
+    displayPointer = command;
+    uint8_t *ram = (uint8_t *) displayRam;
+    bool same = true;
+    for (uint8_t i = 1; i < txLength; i++) {
+      same &= ram[displayPointer] == tx[i];
+      ram[displayPointer] = tx[i];
+      displayPointer = (displayPointer + 1) % sizeof(displayRam);
+    }
+    if (txLength > 1) {
+      displayTraffic.frames++;
+      displayTraffic.sameFrames += same;
+    }
+  }
+  else if ((command & 0xF0) == 0x20) {
+    displayOscillator = command & 1;
+  }
+  else if ((command & 0xF0) == 0x80) {
+    displayOn = command & 1;
+    displayBlink = command >> 1 & 3;
+  }
+  else if ((command & 0xF0) == 0xE0) {
+    displayDimming = command & 0x0F;
+  }
+  return true;
+}
+
+// the command, the block and its CRC, plus the card's access time
+void Sim::cardRead(uint32_t clock, uint32_t block, bool sequential) {
+  uint64_t us = (6 + 512 + 2) * 8ULL * 1000000 / clock + (sequential ? 50 : 400);
+  power.sdReading += us;
+  advance(us);
+  cardSpiMode = true;
+}
+
+// 150 to 165, a 22.5 dB spread
+uint8_t Sim::fileGain(const std::string &path) {
+  uint32_t hash = 2166136261u;
+  for (char c : path) {
+    hash = (hash ^ (uint8_t) c) * 16777619u;
+  }
+  return 150 + hash % 16;
+}
+
+#define SIM_FRAME_SIZE 384 // 128kbps at 48kHz, no padding
+#define SIM_FRAME_HEAD 36 // header then the side info, the rest is zeros
+
+static void setBits(uint8_t *p, uint16_t bit, uint8_t n, uint32_t v) {
+  for (uint8_t i = 0; i < n; i++, bit++) {
+    if (v >> (n - 1 - i) & 1) {
+      p[bit / 8] |= 0x80 >> (bit % 8);
+    }
+  }
+}
+
+void Sim::writeText(const std::string &path, const std::string &text) {
+  files[path] = text.size();
+  texts[path] = text;
+}
+
+// MPEG 1 layer III joint stereo without CRC, every granule with data
+void Sim::fileContents(const std::string &path, uint32_t pos, uint8_t *out, uint32_t size) {
+  auto text = texts.find(path);
+  if (text != texts.end()) {
+    memcpy(out, text->second.data() + pos, size);
+    return;
+  }
+  uint8_t head[SIM_FRAME_HEAD] = { 0xFF, 0xFB, 0x94, 0x44 };
+  for (uint8_t g = 0; g < 4; g++) {
+    uint16_t bit = 4 * 8 + 20 + g * 59;
+    setBits(head, bit, 12, 1000); // part2_3_length
+    setBits(head, bit + 12, 9, 200); // big_values
+    setBits(head, bit + 21, 8, fileGain(path));
+  }
+  memset(out, 0, size);
+  for (uint32_t frame = pos / SIM_FRAME_SIZE * SIM_FRAME_SIZE; frame < pos + size; frame += SIM_FRAME_SIZE) {
+    for (uint32_t i = max(frame, pos); i < min(frame + SIM_FRAME_HEAD, pos + size); i++) {
+      out[i - pos] = head[i - frame];
+    }
+  }
+}
+
+void Sim::plugCard(bool present, bool alt) {
+  config.cardPresent = present;
+  config.altCard = alt;
+  cardMounted = false;
+  cardSpiMode = false;
+}
+
+void Sim::chipSelect(uint8_t pin, bool low) {
+  if (pin == CARD_CS || pin == ALT_CARD_CS) {
+    cardSelect = low ? pin : -1;
+    cardCommandLength = 0;
+  }
+}
+
+// A command (0x40 | index, 4 argument bytes, CRC), then R1 on the next byte:
+// idle for CMD0, which puts a card in SPI mode, ready for CMD13 once in it.
+// An empty slot leaves the line high. At 250kHz.
+uint8_t Sim::spiTransfer(uint8_t b) {
+  advance(32);
+  if (cardSelect < 0) {
+    return 0xFF;
+  }
+  if (cardCommandLength < sizeof(cardCommand)) {
+    if (cardCommandLength > 0 || (b & 0xC0) == 0x40) {
+      cardCommand[cardCommandLength++] = b;
+    }
+    return 0xFF;
+  }
+  cardCommandLength = 0;
+  if (!config.cardPresent || cardSelect != (config.altCard ? ALT_CARD_CS : CARD_CS)) {
+    return 0xFF;
+  }
+  uint8_t index = cardCommand[0] & 0x3F;
+  if (index == 0) {
+    cardSpiMode = true;
+    return 0x01;
+  }
+  return index == 13 && cardSpiMode ? 0x00 : 0xFF;
+}
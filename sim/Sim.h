@@ -0,0 +1,195 @@
+#ifndef Sim_h
+#define Sim_h
+
+#include <Arduino.h>
+#include <map>
+#include <string>
+#include <vector>
+#include <deque>
+#include "constants.h"
+
+// Host model of the board and what is wired to it: time, buttons, the
+// DS3231, the HT16K33, the card, USB serial and resets. The sketch runs on top
+// of it unmodified, the hardware modules (I2CBus, AudioPlayer, Sleep,
+// Watchdog) are replaced by the versions in this folder.
+
+#define SIM_BUTTONS 5
+#define SIM_TONE "(tone)" // in tracksStarted, the player's built-in tone
+
+// thrown by NVIC_SystemReset() and the watchdog, caught by the harness which
+// boots the sketch again
+class SimReset {
+  public:
+    uint8_t cause; // PM_RCAUSE_*
+};
+
+// what a run is wired with
+class SimConfig {
+  public:
+    bool usbConnected = true;
+    bool altCard = false; // card in the alternate slot
+    bool rtcPresent = true;
+    bool rtcLostPower = false;
+    bool displayPresent = true;
+    bool playerPresent = true;
+    bool cardPresent = true;
+    uint32_t cardMaxClock = 24000000; // reads above that are corrupted
+    double rtcPpm = 0; // crystal error at aging offset 0, > 0 runs fast
+};
+
+// Bus traffic of a device, as on the wire: a transfer is a start condition,
+// the address byte, then the data bytes, none after an address NACK
+class I2CTraffic {
+  public:
+    uint32_t transfers = 0;
+    uint32_t bytes = 0;
+    uint32_t blockingBytes = 0; // of those, through Wire
+    // DS3231: time reads queued on I2CBus, the blocking ones are the sketch
+    // resyncing on purpose. HT16K33: display RAM writes and those that
+    // changed nothing.
+    uint32_t timeReads = 0;
+    uint32_t frames = 0;
+    uint32_t sameFrames = 0;
+};
+
+// Time in us each part spent in each mode of the current model of power.js
+// (PARTS), the RTC is always active
+class PowerTime {
+  public:
+    uint64_t mcuActive = 0;
+    uint64_t mcuIdle = 0; // idle sleep, USB connected
+    uint64_t mcuStandby = 0;
+    uint64_t displayLit = 0;
+    uint64_t displayStandby = 0;
+    uint64_t playerPlaying = 0;
+    uint64_t playerIdle = 0;
+    uint64_t playerLowPower = 0;
+    uint64_t sdReading = 0; // the rest idle
+};
+
+class Sim {
+  public:
+    SimConfig config;
+
+    // Time, in us since the run started. SysTick (millis/micros) stops in
+    // standby, the rest of the world doesn't.
+    uint64_t now = 0;
+    uint64_t ticks = 0;
+    // CPU busy (both clocks move), checks the watchdog
+    void advance(uint64_t us);
+    // a look at millis()/micros(), dearer once the sketch spins without I/O
+    void clockRead();
+    // standby or idle sleep, until a button is pressed or us elapsed
+    bool sleep(uint64_t us);
+
+    // Buttons, pressed (true) or released at a time, applied as time moves
+    void button(uint8_t b, bool pressed, uint64_t at);
+    bool buttonDown(uint8_t b);
+    uint64_t nextPress(); // first pending press, UINT64_MAX if none
+
+    // Watchdog, in SysTick-independent time
+    bool watchdogEnabled = false;
+    uint64_t watchdogTimeout = 0;
+    uint64_t watchdogFed = 0;
+
+    // I2C, false on NACK. Takes the time the transfer takes on the bus.
+    uint32_t i2cClock = 100000;
+    bool i2c(uint8_t address, const uint8_t *tx, uint8_t txLength, uint8_t *rx, uint8_t rxLength, bool blocking);
+    uint64_t i2cDuration(uint16_t bytes);
+    // since begin(), whether it came through Wire or I2CBus
+    I2CTraffic rtcTraffic;
+    I2CTraffic displayTraffic;
+
+    // DS3231: the time registers, the alarm registers as storage, the
+    // oscillator stop flag and the aging offset (0.1ppm per step, > 0 slows
+    // down, applied on CONV)
+    uint32_t rtcTime(); // unixtime
+    uint64_t rtcMicros(); // us since 1970
+    void setRtcTime(uint32_t t);
+    bool rtcOsf = false;
+    int8_t rtcAging = 0;
+    double rtcRate(); // RTC seconds per second
+
+    // HT16K33
+    uint16_t displayRam[8] = {};
+    bool displayOscillator = false;
+    bool displayOn = false;
+    uint8_t displayBlink = 0; // 0 off, 1 2Hz, 2 1Hz, 3 0.5Hz
+    uint8_t displayDimming = 15; // power-on default
+
+    // Card: path to size. Files are CBR MP3 frames (fileContents()), silent
+    // but for the loudness their side info gives, one per file, or the text
+    // written with writeText().
+    std::map<std::string, uint32_t> files;
+    std::map<std::string, std::string> texts;
+    void writeText(const std::string &path, const std::string &text);
+    static uint8_t fileGain(const std::string &path); // global_gain of the granules
+    void fileContents(const std::string &path, uint32_t pos, uint8_t *out, uint32_t size);
+    // SPI block read from the card, cost included
+    void cardRead(uint32_t clock, uint32_t block, bool sequential);
+    // Hot-plug: the card goes (or comes) in a slot, files are then those of
+    // the new card. The detect switch of the alternate slot follows, the
+    // file system must be mounted again (SD.begin()).
+    bool cardMounted = false;
+    void plugCard(bool present, bool alt);
+    // SPI bytes to the card, with a chip select: only the commands
+    // SdProbe::present() sends are answered
+    void chipSelect(uint8_t pin, bool low);
+    uint8_t spiTransfer(uint8_t b);
+
+    // VS1053: tracks the decoder started on, in order, for the harness to
+    // empty. playing until the track ends or is stopped, soundsCut counts
+    // the stops.
+    std::vector<std::string> tracksStarted;
+    bool playing = false;
+    uint32_t soundsCut = 0;
+    bool playerAsleep = false; // low power
+    uint8_t volume = 0; // attenuation, left channel
+
+    // NVM, every FlashClass back to erased
+    void eraseFlash();
+
+    // since begin(), as time moves
+    PowerTime power;
+
+    // USB serial
+    std::deque<uint8_t> serialIn;
+    std::vector<uint8_t> serialOut;
+
+    // cause reported by PM->RCAUSE on the next boot
+    uint8_t resetCause = PM_RCAUSE_POR;
+    // new run: power off everything and wire it as config says
+    void begin(const SimConfig &c, uint32_t unixtime);
+    // reset of the MCU only, pending button changes are kept
+    void boot(uint8_t cause);
+
+  private:
+    struct ButtonChange {
+      uint64_t at;
+      uint8_t button;
+      bool pressed;
+    };
+    uint32_t idleClockReads = 0;
+    std::vector<ButtonChange> buttonChanges;
+    uint8_t buttons = 0;
+    void applyButtons();
+    void accountPower(uint64_t us, bool awake);
+
+    uint64_t rtcBase = 0; // rtcMicros() at rtcBaseTime
+    uint64_t rtcBaseTime = 0;
+    int8_t rtcAgingApplied = 0;
+    uint8_t rtcPointer = 0;
+    uint8_t rtcControl = 0x1C;
+    uint8_t rtcAlarms[7] = {};
+    uint8_t displayPointer = 0;
+    int8_t cardSelect = -1; // chip select pin held low
+    bool cardSpiMode = false; // until the card is pulled
+    uint8_t cardCommand[6];
+    uint8_t cardCommandLength = 0;
+    bool rtcTransfer(const uint8_t *tx, uint8_t txLength, uint8_t *rx, uint8_t rxLength);
+    bool displayTransfer(const uint8_t *tx, uint8_t txLength, uint8_t rxLength);
+};
+
+extern Sim sim;
+
+#endif
@@ -0,0 +1,24 @@
+#include "Sleep.h"
+#include "Sim.h"
+
+// Host version: the world moves on to the first button press or the timer,
+// SysTick only in idle sleep (USB connected)
+
+volatile bool Sleep::buttonPressed = false;
+volatile bool Sleep::timerExpired = false;
+
+void Sleep::begin(const uint8_t *buttonPins, uint8_t buttonCount) {
+}
+
+bool Sleep::until(uint32_t ms) {
+  // bytes from the host end idle sleep right away
+  if (sim.config.usbConnected && !sim.serialIn.empty()) {
+    buttonPressed = false;
+    timerExpired = false;
+    return false;
+  }
+  // the 1024Hz RTC counter
+  buttonPressed = sim.sleep((uint64_t) (ms * 1024 / 1000) * 1000000 / 1024);
+  timerExpired = !buttonPressed;
+  return buttonPressed;
+}
@@ -0,0 +1,33 @@
+#include "Watchdog.h"
+#include "Sim.h"
+
+// Host version: the simulation resets the sketch once the timeout elapsed
+// without reset(), whether the CPU is busy or not
+
+#define WDT_SYNC_TIME 3000 // us, 3 cycles of its 1024Hz clock
+
+void Watchdog::enable(uint16_t timeout) {
+  // Period is 8 << PER cycles, pick the first one >= timeout
+  uint32_t cycles = (uint32_t) timeout * 1024 / 1000;
+  uint8_t period = 0;
+  while ((8UL << period) < cycles && period < 11) period++;
+
+  disable();
+  sim.advance(WDT_SYNC_TIME);
+  sim.watchdogTimeout = (8ULL << period) * 1000000 / 1024;
+  sim.watchdogFed = sim.now;
+  sim.watchdogEnabled = true;
+}
+
+void Watchdog::disable() {
+  sim.watchdogEnabled = false;
+  sim.advance(WDT_SYNC_TIME);
+}
+
+void Watchdog::reset() {
+  sim.watchdogFed = sim.now;
+}
+
+bool isWarmReset() {
+  return (PM->RCAUSE.reg & PM_RCAUSE_POR) == 0;
+}
@@ -0,0 +1,701 @@
+// Coverage guided fuzzer of the sketch on the simulated board (see Sim.h).
+// An input is the wiring, the start time and a sequence of actions: button
+// presses, waits, RTC jumps, resets and serial frames. After every loop the
+// invariants of ClockProbe are checked, out of bounds accesses and other
+// undefined behaviour are caught by the sanitizers the sketch is built with.
+//
+//   fuzz --worker N --out DIR   fuzz until killed, new coverage goes to
+//                               DIR/corpus, failures to DIR/crashes
+//   fuzz --run FILE             one input, exit status 1 if it fails
+//   fuzz --replay FILE          one input, printing what happens
+//
+// sim.js runs the workers on a faster build without the sanitizers, minimizes
+// their failures on the sanitized one and formats replays.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <random>
+#include <set>
+#include <chrono>
+#include "Harness.h"
+
+#define INPUT_MAX_SIZE 512
+#define INPUT_MAX_LOOPS 200000
+#define LOOP_TIME 1000 // us between two loops
+#define LONG_WAIT_LOOP_TIME 20000
+
+extern FlashClass settingsFlash;
+
+/************
+ * Coverage *
+ ************/
+
+// hit counts in buckets: 1, 2, 3, 4-7, 8-15, 16-31, 32-127, 128+
+static uint8_t bucket(uint8_t hits) {
+  if (hits <= 3) {
+    return hits == 0 ? 0 : 1 << (hits - 1);
+  }
+  if (hits < 8) {
+    return 8;
+  }
+  if (hits < 16) {
+    return 16;
+  }
+  if (hits < 32) {
+    return 32;
+  }
+  return hits < 128 ? 64 : 128;
+}
+
+/*******
+ * Run *
+ *******/
+
+static const char *const BUTTON_NAMES[] = { "TOP", "UP", "DOWN", "LEFT", "RIGHT" };
+
+// config file words, and some that break their line
+static const char *const CONFIG_WORDS[] = {
+  "volume", "brightness", "exit_volume_delay", "exit_menu_delay", "alarm1", "alarm2", "on", "off",
+  "once", "repeat", "track", "all", "weekdays", "weekend", "sun", "wed", "sat", "7:05", "23:59", "24:00",
+  "9:5", "0", "9", "15", "16", "99", "100", "1000", "25500", "25600", "123456", "#", ",", "\t", "\r",
+  "-1", ":", "Alarm1", "ON", "a_word_longer_than_tokens_can_be",
+};
+
+// 2024-03-04 06:59:30 (a Monday, before the default alarm), the day before a
+// leap day, new year's eve, the end of the RTC range, a Saturday morning,
+// 2000-01-01, and two weekend noons
+static const uint32_t START_TIMES[] = {
+  1709535570, 1709164790, 1704067195, 4102444790, 1717829990, 946684800, 1760788800, 1792324800
+};
+
+static bool verbose = false;
+static uint64_t loops = 0;
+
+class Run {
+  public:
+    Run(const uint8_t *data, size_t size) : data(data), size(size) {}
+    const char *execute();
+
+  private:
+    const uint8_t *data;
+    size_t size;
+    size_t cursor = 0;
+    bool booted = false;
+    uint8_t bootCause = PM_RCAUSE_POR;
+    uint32_t runLoops = 0;
+    State lastState = DISPLAY_TIME;
+    const char *failure = nullptr;
+
+    uint8_t next() {
+      return cursor < size ? data[cursor++] : 0;
+    }
+    void wire(uint8_t wiring, uint8_t start);
+    void fillCard(uint8_t tracks, uint8_t contents);
+    void writeConfig();
+    void boot();
+    bool step(uint32_t gap);
+    void runFor(uint64_t us, uint32_t gap = LOOP_TIME);
+    void reset(const SimReset &r);
+    void click(uint8_t b, uint32_t duration);
+    void action(uint8_t op);
+    void send(uint8_t type, const uint8_t *payload, uint8_t length);
+    void printSerial();
+    void log(const char *format, ...);
+};
+
+void Run::log(const char *format, ...) {
+  if (!verbose) {
+    return;
+  }
+  va_list args;
+  va_start(args, format);
+  printf("%" PRIu64 " ", sim.now / 1000);
+  vprintf(format, args);
+  printf("\n");
+  fflush(stdout); // before a sanitizer stops the process
+  va_end(args);
+}
+
+// wiring: bit 0 USB unplugged, 1 card in the alternate slot, 2-3 card
+// contents, 4 RTC lost power, 5-6 fastest card clock, 7 settings of an older
+// version, which get the defaults
+void Run::wire(uint8_t wiring, uint8_t start) {
+  SimConfig config;
+  config.usbConnected = !(wiring & 1);
+  config.altCard = wiring & 2;
+  config.rtcLostPower = wiring & 0x10;
+  config.cardMaxClock = 24000000 >> (wiring >> 5 & 3);
+  sim.begin(config, START_TIMES[start & 7] + (start >> 3) * 61);
+  sim.eraseFlash();
+
+  uint8_t contents = wiring >> 2 & 3;
+  uint8_t tracks = contents == 0 ? 8 : contents == 1 ? 2 : contents == 2 ? 0 : 3;
+  fillCard(tracks, contents);
+
+  if (wiring & 0x80) {
+    // version 1: valid, two alarms (enabled, hour, minute, weekend, track),
+    // volume
+    uint8_t old[sizeof(Settings)] = { 1, 1, 6, 45, 0, 1, 0, 22, 30, 1, 0, 40 };
+    settingsFlash.erase();
+    settingsFlash.write(old);
+  }
+  log("wiring usb=%d altCard=%d tracks=%d button=%d nap=%d rtcLostPower=%d cardMaxClock=%u oldSettings=%d",
+    config.usbConnected, config.altCard, tracks, contents != 1, contents != 3, config.rtcLostPower,
+    config.cardMaxClock, wiring >> 7);
+  log("rtc %u", sim.rtcTime());
+}
+
+// contents 1: no button sound, 3: no nap track
+void Run::fillCard(uint8_t tracks, uint8_t contents) {
+  sim.files.clear();
+  sim.texts.clear();
+  for (uint8_t i = 0; i < tracks; i++) {
+    char path[] = TRACK_ALARM_PATTERN;
+    *strchr(path, '?') = '1' + i;
+    sim.files[path] = 30 * 16000 + i * 20 * 16000; // 30s to 2min40
+  }
+  sim.files[TRACK_BOOT] = 16000;
+  if (contents != 1) {
+    sim.files[TRACK_BUTTON_PRESS] = 3200;
+  }
+  if (contents != 3) {
+    sim.files[TRACK_NAP] = 60 * 16000;
+  }
+}
+
+// a length byte, then per byte a word (or that byte if past the words) and
+// in its top bits what follows it: nothing, a space, a new line or " = "
+void Run::writeConfig() {
+  static const char *const SEPARATORS[] = { "", " ", "\n", " = " };
+  std::string text;
+  for (uint8_t n = next() & 63; n > 0; n--) {
+    uint8_t b = next();
+    uint8_t word = b & 63;
+    text += word < sizeof(CONFIG_WORDS) / sizeof(CONFIG_WORDS[0]) ? std::string(CONFIG_WORDS[word]) : std::string(1, (char) b);
+    text += SEPARATORS[b >> 6];
+  }
+  sim.writeText(CONFIG_FILE, text);
+  log("config %s", text.c_str());
+}
+
+void Run::boot() {
+  bootSketch(bootCause);
+  booted = true;
+  lastState = ClockProbe::state(*alarmClock);
+}
+
+// resets the sketch didn't ask for are failures
+void Run::reset(const SimReset &r) {
+  log("reset %d %d %u", r.cause, trace.reason, trace.reasonArg);
+  booted = false;
+  bootCause = r.cause;
+  if (r.cause & PM_RCAUSE_WDT) {
+    failure = fail("watchdog reset", "state %d", lastState);
+  }
+  else if (trace.reason == CRASH_DIE) {
+    failure = fail("died", "error %u", trace.reasonArg);
+  }
+  else if (trace.reason == CRASH_FAULT) {
+    failure = fail("fault", "pc %x", trace.reasonArg);
+  }
+}
+
+// one loop (or boot) after gap us, false once the run is over
+bool Run::step(uint32_t gap) {
+  if (failure || runLoops >= INPUT_MAX_LOOPS) {
+    return false;
+  }
+  runLoops++;
+  loops++;
+  try {
+    if (!booted) {
+      boot();
+    }
+    else {
+      sim.advance(gap);
+      runLoop();
+    }
+  }
+  catch (const SimReset &r) {
+    reset(r);
+    printSerial();
+    return !failure;
+  }
+  State state = ClockProbe::state(*alarmClock);
+  if (state != lastState) {
+    log("state %d %d %u", lastState, state, ClockProbe::time(*alarmClock));
+    lastState = state;
+  }
+  printSerial();
+  failure = ClockProbe::check(*alarmClock);
+  return !failure;
+}
+
+void Run::runFor(uint64_t us, uint32_t gap) {
+  uint64_t end = sim.now + us;
+  while (sim.now < end && step(gap));
+}
+
+void Run::printSerial() {
+  if (verbose && !sim.serialOut.empty()) {
+    printf("%" PRIu64 " serial ", sim.now / 1000);
+    for (uint8_t b : sim.serialOut) {
+      printf("%02x", b);
+    }
+    printf("\n");
+  }
+  sim.serialOut.clear();
+}
+
+// from the next ms, so that a sleeping sketch wakes up on it
+void Run::click(uint8_t b, uint32_t duration) {
+  sim.button(b, true, sim.now + 1000);
+  sim.button(b, false, sim.now + 1000 + duration);
+}
+
+void Run::send(uint8_t type, const uint8_t *payload, uint8_t length) {
+  uint16_t crc = crc16(crc16(0xFFFF, type), length);
+  sim.serialIn.push_back(0xA5);
+  sim.serialIn.push_back(type);
+  sim.serialIn.push_back(length);
+  for (uint8_t i = 0; i < length; i++) {
+    sim.serialIn.push_back(payload[i]);
+    crc = crc16(crc, payload[i]);
+  }
+  sim.serialIn.push_back(crc);
+  sim.serialIn.push_back(crc >> 8);
+}
+
+// 16 actions, arguments in the following bytes
+void Run::action(uint8_t op) {
+  switch (op & 15) {
+    case 0:
+    case 1:
+    case 2:
+    case 3:
+    case 4:
+      log("action click %s", BUTTON_NAMES[op & 15]);
+      click(op & 15, 80000);
+      runFor(150000);
+      break;
+    case 5: {
+      uint8_t arg = next();
+      uint32_t duration = LONG_PRESS_DELAY * 1000 + 100000 + arg / 5 * 100000;
+      log("action long %s %u", BUTTON_NAMES[arg % 5], duration / 1000);
+      click(arg % 5, duration);
+      runFor(duration + 150000);
+      break;
+    }
+    case 6: {
+      uint8_t arg = next();
+      uint8_t a = arg % 5;
+      uint8_t b = arg / 5 % 5;
+      log("action chord %s %s", BUTTON_NAMES[a], BUTTON_NAMES[b]);
+      click(a, 100000);
+      click(b, 150000);
+      runFor(250000);
+      break;
+    }
+    case 7: {
+      uint32_t ms = (next() + 1) * 10;
+      log("action wait %u", ms);
+      runFor(ms * 1000);
+      break;
+    }
+    case 8: {
+      uint32_t s = next() + 1;
+      log("action wait %u", s * 1000);
+      runFor(s * 1000000ULL, LONG_WAIT_LOOP_TIME);
+      break;
+    }
+    case 9: {
+      // a few seconds before the next ring, or before midnight
+      uint8_t arg = next();
+      uint32_t t = booted ? ClockProbe::nextRing(*alarmClock, arg & 1) : 0;
+      if (t == 0) {
+        t = (sim.rtcTime() / 86400 + 1) * 86400;
+      }
+      t -= 1 + arg % 16;
+      if (t > sim.rtcTime()) {
+        log("action rtc %u", t);
+        sim.setRtcTime(t);
+      }
+      runFor(100000);
+      break;
+    }
+    case 10: {
+      // the RTC moves on as if the board had been off
+      uint32_t t = sim.rtcTime() + (next() + 1) * 600;
+      log("action rtc %u", t);
+      sim.setRtcTime(t);
+      runFor(100000);
+      break;
+    }
+    case 11:
+      log("action reset");
+      booted = false;
+      bootCause = PM_RCAUSE_EXT;
+      runFor(100000);
+      break;
+    case 12:
+      log("action power");
+      booted = false;
+      bootCause = PM_RCAUSE_POR;
+      runFor(100000);
+      break;
+    case 13: {
+      uint8_t payload[SETTINGS_PACKED_SIZE];
+      for (uint8_t &b : payload) {
+        b = next();
+      }
+      log("action settings");
+      send(FRAME_SET_SETTINGS, payload, sizeof(payload));
+      runFor(100000);
+      break;
+    }
+    case 14: {
+      // within the RTC range, or anything with the top bit
+      uint8_t payload[4];
+      for (uint8_t &b : payload) {
+        b = next();
+      }
+      uint32_t t = readU32(payload);
+      if (!(t & 0x80000000)) {
+        t = 946684800 + t % (100 * 365 * 86400UL);
+        writeU32(payload, t);
+      }
+      log("action time %u", readU32(payload));
+      send(FRAME_SET_TIME, payload, sizeof(payload));
+      runFor(100000);
+      break;
+    }
+    case 15: {
+      uint8_t arg = next();
+      uint8_t payload[2] = { (uint8_t) (arg >> 2), 0 };
+      switch (arg & 3) {
+        case 0:
+          if (arg & 0x80) {
+            log("action get history");
+            send(FRAME_GET_HISTORY, payload, 0);
+            break;
+          }
+          log("action get settings");
+          send(FRAME_GET_SETTINGS, payload, 0);
+          break;
+        case 1:
+          if (arg & 0x80) {
+            // pulled, or a card with 0 to 7 tracks in a slot
+            if (arg & 0x40) {
+              log("action card out");
+              sim.plugCard(false, sim.config.altCard);
+              break;
+            }
+            // odd track counts come with a config file
+            uint8_t tracks = arg >> 2 & 7;
+            log("action card in %d tracks %d", (arg & 0x20) != 0, tracks);
+            sim.plugCard(true, arg & 0x20);
+            fillCard(tracks, tracks == 3 ? 3 : 0);
+            if (tracks & 1) {
+              writeConfig();
+            }
+            break;
+          }
+          log("action telemetry %u", payload[0] * 10);
+          writeU16(payload, payload[0] * 10);
+          send(FRAME_SET_TELEMETRY, payload, 2);
+          break;
+        case 2:
+          if (arg & 0x80) {
+            log("action sync ping");
+            send(FRAME_SYNC_PING, payload, 1);
+            break;
+          }
+          if (arg & 0x40) {
+            // the next second, written within 2.5s or refused
+            uint8_t sync[9];
+            writeU32(sync, sim.rtcTime() + 1);
+            writeU32(sync + 4, (uint32_t) sim.ticks + next() * 10000);
+            sync[8] = next();
+            log("action sync time %u", readU32(sync + 4) - (uint32_t) sim.ticks);
+            send(FRAME_SYNC_TIME, sync, sizeof(sync));
+            break;
+          }
+          log("action get trace");
+          send(FRAME_GET_TRACE, payload, 0);
+          break;
+        case 3:
+          if (arg & 0x80) {
+            log("action benchmark");
+            send(FRAME_RUN_BENCHMARK, payload, 0);
+            break;
+          }
+          log("action get latency");
+          send(FRAME_GET_LATENCY, payload, 1);
+          break;
+      }
+      runFor(100000);
+      break;
+    }
+  }
+}
+
+const char *Run::execute() {
+  uint8_t wiring = next();
+  uint8_t start = next();
+  wire(wiring, start);
+  step(0);
+  while (cursor < size && !failure && runLoops < INPUT_MAX_LOOPS) {
+    action(next());
+  }
+  // time for whatever the last action started
+  runFor(1000000);
+  return failure;
+}
+
+static const char *execute(const uint8_t *data, size_t size) {
+  previousBlock = 0;
+  return Run(data, size).execute();
+}
+
+/*********
+ * Files *
+ *********/
+
+static std::vector<uint8_t> readFile(const char *path) {
+  std::vector<uint8_t> data;
+  FILE *f = fopen(path, "rb");
+  if (!f) {
+    return data;
+  }
+  uint8_t buffer[INPUT_MAX_SIZE];
+  size_t length = fread(buffer, 1, sizeof(buffer), f);
+  fclose(f);
+  data.assign(buffer, buffer + length);
+  return data;
+}
+
+static void writeFile(const std::string &path, const std::vector<uint8_t> &data) {
+  FILE *f = fopen(path.c_str(), "wb");
+  if (f) {
+    fwrite(data.data(), 1, data.size(), f);
+    fclose(f);
+  }
+}
+
+static std::string hashName(const std::vector<uint8_t> &data) {
+  uint32_t hash = 2166136261UL;
+  for (uint8_t b : data) {
+    hash = (hash ^ b) * 16777619UL;
+  }
+  char name[16];
+  snprintf(name, sizeof(name), "%08x", hash);
+  return name;
+}
+
+/**********
+ * Worker *
+ **********/
+
+class Worker {
+  public:
+    Worker(int id, const std::string &out) : id(id), out(out), random(id * 7919 + time(nullptr)) {}
+    void run();
+
+  private:
+    int id;
+    std::string out;
+    std::mt19937 random;
+    std::vector<std::vector<uint8_t>> corpus;
+    std::set<std::string> known; // corpus files already loaded
+    std::set<std::string> failures; // signatures already saved
+    uint8_t virgin[MAP_SIZE] = {};
+    uint32_t edges = 0;
+    uint64_t execs = 0;
+    int current = -1;
+
+    uint32_t below(uint32_t n) {
+      return n == 0 ? 0 : random() % n;
+    }
+    bool evaluate(const std::vector<uint8_t> &input);
+    std::vector<uint8_t> mutate();
+    void sync();
+};
+
+// run with coverage, true if it found new edges or hit counts
+bool Worker::evaluate(const std::vector<uint8_t> &input) {
+  // a sanitizer abort kills us, sim.js picks the input up from here
+  pwrite(current, input.data(), input.size(), 0);
+  ftruncate(current, input.size());
+  memset(coverage, 0, sizeof(coverage));
+  const char *failure = execute(input.data(), input.size());
+  execs++;
+  if (failure && failures.insert(failure).second) {
+    std::string name = out + "/crashes/" + hashName(input);
+    writeFile(name, input);
+    printf("crash %s %s: %s\n", name.c_str(), failure, detail);
+    fflush(stdout);
+  }
+  bool interesting = false;
+  for (uint32_t i = 0; i < MAP_SIZE; i++) {
+    uint8_t b = bucket(coverage[i]);
+    if (b & ~virgin[i]) {
+      if (!virgin[i]) {
+        edges++;
+      }
+      virgin[i] |= b;
+      interesting = true;
+    }
+  }
+  return interesting && !failure;
+}
+
+std::vector<uint8_t> Worker::mutate() {
+  std::vector<uint8_t> input = corpus[below(corpus.size())];
+  uint8_t count = 1 + below(4);
+  for (uint8_t i = 0; i < count; i++) {
+    size_t at = 2 + below(input.size() - 1); // wiring and start time kept apart
+    switch (below(8)) {
+      case 0:
+        input[below(input.size())] ^= 1 << below(8);
+        break;
+      case 1:
+        input[below(input.size())] = random();
+        break;
+      case 2:
+        // a whole action, arguments follow
+        for (uint8_t n = 1 + below(4); n > 0; n--) {
+          input.insert(input.begin() + at, random());
+        }
+        break;
+      case 3:
+        if (input.size() > 3) {
+          size_t length = min(1 + below(8), input.size() - at);
+          input.erase(input.begin() + at, input.begin() + at + length);
+        }
+        break;
+      case 4: {
+        size_t from = 2 + below(input.size() - 2);
+        size_t length = min(1 + below(16), input.size() - from);
+        std::vector<uint8_t> chunk(input.begin() + from, input.begin() + from + length);
+        input.insert(input.begin() + at, chunk.begin(), chunk.end());
+        break;
+      }
+      case 5: {
+        // the tail of another input
+        const std::vector<uint8_t> &other = corpus[below(corpus.size())];
+        size_t from = 2 + below(other.size() - 1);
+        input.resize(at);
+        input.insert(input.end(), other.begin() + min(from, other.size()), other.end());
+        break;
+      }
+      case 6:
+        // interesting action bytes: clicks and short waits dominate
+        input.insert(input.begin() + at, below(5));
+        break;
+      case 7:
+        input[below(2)] = random();
+        break;
+    }
+    if (input.size() < 2) {
+      input.resize(2);
+    }
+  }
+  if (input.size() > INPUT_MAX_SIZE) {
+    input.resize(INPUT_MAX_SIZE);
+  }
+  return input;
+}
+
+// inputs other workers found
+void Worker::sync() {
+  std::string dir = out + "/corpus";
+  DIR *d = opendir(dir.c_str());
+  if (!d) {
+    return;
+  }
+  while (struct dirent *e = readdir(d)) {
+    if (e->d_name[0] == '.' || !known.insert(e->d_name).second) {
+      continue;
+    }
+    std::vector<uint8_t> input = readFile((dir + "/" + e->d_name).c_str());
+    if (input.size() >= 2) {
+      evaluate(input);
+      corpus.push_back(input);
+    }
+  }
+  closedir(d);
+}
+
+void Worker::run() {
+  mkdir((out + "/corpus").c_str(), 0755);
+  mkdir((out + "/crashes").c_str(), 0755);
+  current = open((out + "/worker-" + std::to_string(id) + ".cur").c_str(), O_WRONLY | O_CREAT, 0644);
+  sync();
+  if (corpus.empty()) {
+    // boot, then click through the menus
+    corpus.push_back({ 0x00, 0x00, 7, 200, 3, 3, 0, 2, 1, 2, 3, 3, 3 });
+  }
+  auto lastSync = std::chrono::steady_clock::now();
+  auto lastStats = lastSync;
+  while (true) {
+    std::vector<uint8_t> input = mutate();
+    if (evaluate(input)) {
+      corpus.push_back(input);
+      std::string name = hashName(input);
+      known.insert(name);
+      writeFile(out + "/corpus/" + name, input);
+    }
+    auto now = std::chrono::steady_clock::now();
+    if (now - lastStats >= std::chrono::seconds(1)) {
+      lastStats = now;
+      printf("stats %" PRIu64 " %" PRIu64 " %zu %zu %u\n", execs, loops,
+        corpus.size(), failures.size(), edges);
+      fflush(stdout);
+    }
+    if (now - lastSync >= std::chrono::seconds(5)) {
+      lastSync = now;
+      sync();
+    }
+  }
+}
+
+int main(int argc, char **argv) {
+  std::string out = "sim/out";
+  int worker = -1;
+  const char *run = nullptr;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--worker" && i + 1 < argc) {
+      worker = atoi(argv[++i]);
+    }
+    else if (arg == "--out" && i + 1 < argc) {
+      out = argv[++i];
+    }
+    else if ((arg == "--run" || arg == "--replay") && i + 1 < argc) {
+      verbose = arg == "--replay";
+      run = argv[++i];
+    }
+  }
+  if (run) {
+    std::vector<uint8_t> input = readFile(run);
+    if (input.size() < 2) {
+      fprintf(stderr, "%s: not an input\n", run);
+      return 2;
+    }
+    const char *failure = execute(input.data(), input.size());
+    if (failure) {
+      printf("FAIL %s\ndetail %s\n", failure, detail);
+      return 1;
+    }
+    return 0;
+  }
+  if (worker < 0) {
+    fprintf(stderr, "usage: fuzz --worker N [--out DIR] | --run FILE | --replay FILE\n");
+    return 2;
+  }
+  Worker(worker, out).run();
+}
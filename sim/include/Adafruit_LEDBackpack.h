@@ -0,0 +1,34 @@
+#ifndef Adafruit_LEDBackpack_h
+#define Adafruit_LEDBackpack_h
+
+#include <Arduino.h>
+#include <Wire.h>
+
+// HT16K33 driver, blocking writes through Wire as the Adafruit library
+class Adafruit_LEDBackpack {
+  public:
+    bool begin(uint8_t address = 0x70);
+    void setBrightness(uint8_t b);
+    void blinkRate(uint8_t b);
+    void writeDisplay();
+    void clear() {
+      memset(displaybuffer, 0, sizeof(displaybuffer));
+    }
+
+    uint16_t displaybuffer[8] = {};
+
+  protected:
+    uint8_t i2c_addr = 0x70;
+};
+
+class Adafruit_7segment : public Adafruit_LEDBackpack {
+  public:
+    void writeDigitRaw(uint8_t d, uint8_t bitmask) {
+      if (d > 4) {
+        return;
+      }
+      displaybuffer[d] = bitmask;
+    }
+};
+
+#endif
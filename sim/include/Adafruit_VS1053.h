@@ -0,0 +1,37 @@
+#ifndef Adafruit_VS1053_h
+#define Adafruit_VS1053_h
+
+#include <Arduino.h>
+
+#define VS1053_REG_MODE 0x00
+#define VS1053_REG_STATUS 0x01
+#define VS1053_REG_CLOCKF 0x03
+#define VS1053_REG_DECODETIME 0x04
+#define VS1053_REG_WRAM 0x06
+#define VS1053_REG_WRAMADDR 0x07
+#define VS1053_REG_VOLUME 0x0B
+
+#define VS1053_MODE_SM_LAYER12 0x0002
+#define VS1053_MODE_SM_RESET 0x0004
+#define VS1053_MODE_SM_CANCEL 0x0008
+#define VS1053_MODE_SM_TESTS 0x0020
+#define VS1053_MODE_SM_SDINEW 0x0800
+#define VS1053_MODE_SM_LINE1 0x4000
+
+// Only the base class of AudioPlayer, whose host version (sim/AudioPlayer.cpp)
+// models the decoder itself
+class Adafruit_VS1053 {
+  public:
+    Adafruit_VS1053(int8_t rst, int8_t cs, int8_t dcs, int8_t dreq) {}
+    uint8_t begin() {
+      return 4;
+    }
+    void setVolume(uint8_t left, uint8_t right) {}
+    void sciWrite(uint8_t address, uint16_t data) {}
+    uint16_t sciRead(uint8_t address) {
+      return 0;
+    }
+    void playData(uint8_t *buffer, uint8_t length) {}
+};
+
+#endif
@@ -0,0 +1,130 @@
+#ifndef Arduino_h
+#define Arduino_h
+
+// Host version of the parts of the Arduino SAMD core the sketch uses, backed
+// by the simulated board in Sim.h
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <string>
+
+typedef bool boolean;
+typedef uint8_t byte;
+
+#define HIGH 1
+#define LOW 0
+#define INPUT 0
+#define OUTPUT 1
+#define INPUT_PULLUP 2
+#define RISING 3
+#define FALLING 2
+#define CHANGE 4
+
+// as the SAMD core, mixed types allowed
+template <class T, class L>
+auto min(const T &a, const L &b) -> decltype((b < a) ? b : a) {
+  return (b < a) ? b : a;
+}
+
+template <class T, class L>
+auto max(const T &a, const L &b) -> decltype((b < a) ? b : a) {
+  return (a < b) ? b : a;
+}
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void pinMode(uint32_t pin, uint32_t mode);
+int digitalRead(uint32_t pin);
+void digitalWrite(uint32_t pin, uint32_t value);
+#define digitalPinToInterrupt(pin) (pin)
+void attachInterrupt(uint32_t pin, void (*callback)(), uint32_t mode);
+static inline void noInterrupts() {}
+static inline void interrupts() {}
+
+// Pin table and IOBUS port input registers, as read by Input
+typedef struct {
+  uint8_t ulPort;
+  uint32_t ulPin;
+  uint8_t ulExtInt;
+} PinDescription;
+extern const PinDescription g_APinDescription[];
+
+typedef struct {
+  struct {
+    struct {
+      volatile uint32_t reg;
+    } IN;
+  } Group[2];
+} PortIobus;
+extern PortIobus simPortIobus;
+#define PORT_IOBUS (&simPortIobus)
+
+// Reset cause, set by the simulation on every reset
+typedef struct {
+  struct {
+    volatile uint8_t reg;
+  } RCAUSE;
+} PmRegisters;
+extern PmRegisters simPm;
+#define PM (&simPm)
+#define PM_RCAUSE_POR  0x01
+#define PM_RCAUSE_BOD12 0x02
+#define PM_RCAUSE_BOD33 0x04
+#define PM_RCAUSE_EXT  0x10
+#define PM_RCAUSE_WDT  0x20
+#define PM_RCAUSE_SYST 0x40
+
+// unwinds to the simulation, which restarts the sketch
+[[noreturn]] void NVIC_SystemReset();
+
+class __FlashStringHelper;
+#define F(s) ((const __FlashStringHelper *) (s))
+
+class String : public std::string {
+  public:
+    String(const char *s = "") : std::string(s) {}
+    String(const std::string &s) : std::string(s) {}
+};
+
+class Print {
+  public:
+    virtual size_t write(uint8_t b) = 0;
+    virtual size_t write(const uint8_t *buffer, size_t size) {
+      size_t n = 0;
+      while (size--) {
+        n += write(*buffer++);
+      }
+      return n;
+    }
+    virtual ~Print() {}
+};
+
+class Stream : public Print {
+  public:
+    virtual int available() = 0;
+    virtual int read() = 0;
+};
+
+// USB CDC serial: what the sketch writes is kept for the simulation, what the
+// simulation queues is read by the sketch
+class Serial_ : public Stream {
+  public:
+    void begin(unsigned long) {}
+    int available() override;
+    int read() override;
+    int availableForWrite();
+    size_t write(uint8_t b) override;
+    size_t write(const uint8_t *buffer, size_t size) override;
+    using Print::write;
+    operator bool() {
+      return true;
+    }
+};
+extern Serial_ Serial;
+
+#endif
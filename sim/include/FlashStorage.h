@@ -0,0 +1,51 @@
+#ifndef FlashStorage_h
+#define FlashStorage_h
+
+#include <Arduino.h>
+
+// Simulated NVM: erase sets bytes to 0xFF, write can only clear bits, both
+// stall the CPU as on the SAMD21. Contents survive resets, not a new run.
+class FlashClass {
+  public:
+    FlashClass(const void *flash_addr = NULL, uint32_t size = 0);
+    ~FlashClass();
+    void write(const void *data);
+    void erase();
+    void read(void *data);
+    // within the region: writes by page, erases by row
+    void write(const volatile void *flash_ptr, const void *data, uint32_t size);
+    void erase(const volatile void *flash_ptr, uint32_t size);
+    void read(const volatile void *flash_ptr, void *data, uint32_t size);
+
+    const uint8_t *address;
+    uint8_t *bytes;
+    uint32_t size;
+    FlashClass *nextInstance;
+};
+
+template <class T>
+class FlashStorageClass {
+  public:
+    FlashStorageClass(const void *flash_addr) : flash(flash_addr, sizeof(T)) {}
+    void read(T *data) {
+      flash.read(data);
+    }
+    T read() {
+      T data;
+      read(&data);
+      return data;
+    }
+    void write(T data) {
+      flash.erase();
+      flash.write(&data);
+    }
+
+  private:
+    FlashClass flash;
+};
+
+#define FlashStorage(name, T) \
+  __attribute__((__aligned__(256))) static const uint8_t _data##name[(sizeof(T) + 255) / 256 * 256] = { }; \
+  FlashStorageClass<T> name(_data##name);
+
+#endif
@@ -0,0 +1,93 @@
+#ifndef RTClib_h
+#define RTClib_h
+
+#include <Arduino.h>
+
+#define SECONDS_FROM_1970_TO_2000 946684800
+
+class TimeSpan {
+  public:
+    TimeSpan(int32_t seconds = 0) : _seconds(seconds) {}
+    TimeSpan(int16_t days, int8_t hours, int8_t minutes, int8_t seconds)
+      : _seconds((int32_t) days * 86400L + (int32_t) hours * 3600 + (int32_t) minutes * 60 + seconds) {}
+    int16_t days() const {
+      return _seconds / 86400L;
+    }
+    int8_t hours() const {
+      return _seconds / 3600 % 24;
+    }
+    int8_t minutes() const {
+      return _seconds / 60 % 60;
+    }
+    int8_t seconds() const {
+      return _seconds % 60;
+    }
+    int32_t totalseconds() const {
+      return _seconds;
+    }
+    TimeSpan operator+(const TimeSpan &right) const {
+      return TimeSpan(_seconds + right._seconds);
+    }
+    TimeSpan operator-(const TimeSpan &right) const {
+      return TimeSpan(_seconds - right._seconds);
+    }
+
+  protected:
+    int32_t _seconds;
+};
+
+// Same arithmetic as RTClib: 2000-2099, no validation of the fields
+class DateTime {
+  public:
+    DateTime(uint32_t t = SECONDS_FROM_1970_TO_2000);
+    DateTime(uint16_t year, uint8_t month, uint8_t day, uint8_t hour = 0, uint8_t min = 0, uint8_t sec = 0);
+    // __DATE__ and __TIME__
+    DateTime(const __FlashStringHelper *date, const __FlashStringHelper *time);
+    uint16_t year() const {
+      return 2000U + yOff;
+    }
+    uint8_t month() const {
+      return m;
+    }
+    uint8_t day() const {
+      return d;
+    }
+    uint8_t hour() const {
+      return hh;
+    }
+    uint8_t minute() const {
+      return mm;
+    }
+    uint8_t second() const {
+      return ss;
+    }
+    // 0 is Sunday
+    uint8_t dayOfTheWeek() const;
+    uint32_t unixtime() const;
+    uint32_t secondstime() const {
+      return unixtime() - SECONDS_FROM_1970_TO_2000;
+    }
+    DateTime operator+(const TimeSpan &span) const {
+      return DateTime(unixtime() + span.totalseconds());
+    }
+    DateTime operator-(const TimeSpan &span) const {
+      return DateTime(unixtime() - span.totalseconds());
+    }
+    TimeSpan operator-(const DateTime &right) const {
+      return TimeSpan(unixtime() - right.unixtime());
+    }
+
+  protected:
+    uint8_t yOff, m, d, hh, mm, ss;
+};
+
+// Blocking DS3231 access through Wire
+class RTC_DS3231 {
+  public:
+    bool begin();
+    bool lostPower();
+    void adjust(const DateTime &dt);
+    DateTime now();
+};
+
+#endif
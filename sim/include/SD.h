@@ -0,0 +1,89 @@
+#ifndef SD_h
+#define SD_h
+
+#include <Arduino.h>
+#include <SPI.h>
+
+#define FILE_READ 0
+#define FILE_WRITE 1
+
+// A file of the simulated card: only its size matters, reads return zeros
+class File : public Stream {
+  public:
+    File() {}
+    File(const char *path, uint32_t size) : valid(true), length(size) {
+      strncpy(path_, path, sizeof(path_) - 1);
+    }
+    int available() override {
+      return valid ? length - pos : 0;
+    }
+    int read() override;
+    int read(void *buffer, size_t size);
+    size_t write(uint8_t) override {
+      return 0;
+    }
+    using Print::write;
+    bool seek(uint32_t position);
+    uint32_t position() {
+      return pos;
+    }
+    uint32_t size() {
+      return length;
+    }
+    void close() {
+      valid = false;
+    }
+    const char *name() {
+      return path_;
+    }
+    operator bool() {
+      return valid;
+    }
+
+  private:
+    bool valid = false;
+    uint32_t length = 0;
+    uint32_t pos = 0;
+    char path_[32] = {};
+};
+
+class SDClass {
+  public:
+    bool begin(uint8_t csPin);
+    bool begin(uint32_t clock, uint8_t csPin);
+    bool exists(const char *path);
+    bool exists(const String &path) {
+      return exists(path.c_str());
+    }
+    File open(const char *path, uint8_t mode = FILE_READ);
+    File open(const String &path, uint8_t mode = FILE_READ) {
+      return open(path.c_str(), mode);
+    }
+    void end();
+};
+
+extern SDClass SD;
+
+// utility/Sd2Card.h
+#define SPI_FULL_SPEED 0
+#define SPI_HALF_SPEED 1
+#define SPI_QUARTER_SPEED 2
+
+typedef struct {
+  uint8_t bytes[16];
+} cid_t;
+
+class Sd2Card {
+  public:
+    uint8_t init(uint8_t sckRateID, uint8_t chipSelectPin);
+    uint8_t setSpiClock(uint32_t clock);
+    uint8_t readBlock(uint32_t block, uint8_t *dst);
+    uint8_t readCID(cid_t *cid);
+    uint32_t cardSize();
+
+  private:
+    uint32_t clock = 4000000;
+    uint32_t lastBlock = 0;
+};
+
+#endif
@@ -0,0 +1,25 @@
+#ifndef SPI_h
+#define SPI_h
+
+#include <Arduino.h>
+
+#define MSBFIRST 1
+#define SPI_MODE0 0
+
+class SPISettings {
+  public:
+    SPISettings(uint32_t clock = 4000000, uint8_t bitOrder = MSBFIRST, uint8_t mode = SPI_MODE0) : clock(clock) {}
+    uint32_t clock;
+};
+
+class SPIClass {
+  public:
+    void begin() {}
+    void beginTransaction(SPISettings) {}
+    void endTransaction() {}
+    uint8_t transfer(uint8_t b); // to the card (Sim::spiTransfer)
+};
+
+extern SPIClass SPI;
+
+#endif
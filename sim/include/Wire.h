@@ -0,0 +1,31 @@
+#ifndef Wire_h
+#define Wire_h
+
+#include <Arduino.h>
+
+// Blocking I2C master, transactions go to the simulated devices and take
+// the time they would on the bus
+class TwoWire {
+  public:
+    void begin();
+    void setClock(uint32_t clock);
+    void beginTransmission(uint8_t address);
+    size_t write(uint8_t b);
+    size_t write(const uint8_t *data, size_t length);
+    uint8_t endTransmission(bool stop = true);
+    uint8_t requestFrom(uint8_t address, size_t length, bool stop = true);
+    int available();
+    int read();
+
+  private:
+    uint8_t address;
+    uint8_t txBuffer[32];
+    uint8_t txLength = 0;
+    uint8_t rxBuffer[32];
+    uint8_t rxLength = 0;
+    uint8_t rxIndex = 0;
+};
+
+extern TwoWire Wire;
+
+#endif
@@ -0,0 +1,1189 @@
+// Years of the clock's life on the simulated board (see Sim.h), in seconds:
+// the loop only runs as often as what is going on needs it, and the sketch's
+// own sleep in dark mode skips to the next minute. A seeded user changes the
+// alarms, sets the time, naps, confirms the date on calendar edges, resets
+// the board once in a while, syncs it to a host (its RTC crystal is a few
+// ppm off), pulls the card out for a while, and presses buttons across
+// millis() wraps.
+// The build is ILP32 (see Ilp32.h), millis() wraps every 49.7 days.
+//
+// Checked, besides the invariants of ClockProbe and the sanitizers: every
+// occurrence of an alarm rule rings exactly once (the rule is evaluated
+// here, not with Alarm::nextRing), naps ring on time, the display goes dark
+// after DARK_MODE_DELAY without input and not before, the date menu doesn't
+// change the date, a host sync sets the RTC within SYNC_MAX_ERROR and its
+// drift estimate leaves it within SYNC_MAX_PPM, rings without a card have
+// the tone, a card put back is mounted, the history exported at the end has
+// the last rings, alarm tracks of different loudness ring as loud at the
+// same volume setting.
+//
+// The summary has the average supply current and daily charge, from the time
+// the parts spent in each mode (Sim::power) and the figures of power.js.
+//
+//   soak [--years N] [--seed S] [--verbose]
+//
+// Prints a progress line per simulated month and a summary, or FAIL, the
+// detail and the last events. sim.js soak formats them.
+
+#include <stdio.h>
+#include <stdarg.h>
+#include <random>
+#include <deque>
+#include "Harness.h"
+
+#define LOOP_TIME          1000 // us between loops while a task or a button is busy
+#define PREWARM_LOOP_TIME 20000 // the seconds before an alarm's minute
+#define PLAY_LOOP_TIME    50000 // the buffer holds 128ms, a loop refills 64ms
+#define IDLE_LOOP_TIME  1000000
+#define SAFE_MARGIN         180 // s between what the user does and any ring
+#define RING_SLACK            5 // s past its minute before a ring counts as missed
+#define DARK_MODE_SLACK    3000 // ms
+#define RESET_MIN_DAYS      120 // so that millis() gets to wrap in between
+#define EVENTS_KEPT          40 // printed on failure
+
+// Host time sync, as timesync.js
+#define SYNC_LOOP_TIME      1000 // us, the host keeps the clock awake
+#define SYNC_PINGS             8
+#define SYNC_MAX_PINGS        40
+#define SYNC_PING_TIMEOUT 500000 // us
+#define SYNC_MIN_LEAD     300000 // us
+#define SYNC_MIN_DRIFT_TIME 86400 // s
+#define SYNC_SETTLE_TIME 1500000 // us
+#define SYNC_MAX_ERROR     10000 // us between the RTC and the host after a sync
+#define SYNC_MAX_PPM         0.2 // left once the aging offset is corrected
+
+#define CARD_MOUNT_TIME       70 // s after a card is put back, a minute asleep included
+
+#define HISTORY_RINGS_KEPT  1000 // more than the flash holds
+#define HISTORY_SLACK          2 // s, currentTime may be a loop behind
+
+// Supply current by part and mode in mA, must follow PARTS in power.js
+#define CURRENT_MCU_ACTIVE      6.5
+#define CURRENT_MCU_IDLE        3.0
+#define CURRENT_MCU_STANDBY     0.01
+#define CURRENT_DISPLAY_LIT     8.0
+#define CURRENT_DISPLAY_STANDBY 0.01
+#define CURRENT_PLAYER_PLAYING 14.0
+#define CURRENT_PLAYER_IDLE     8.5
+#define CURRENT_PLAYER_LOW      1.5
+#define CURRENT_SD_READING     25.0
+#define CURRENT_SD_IDLE         0.25
+#define CURRENT_RTC             0.1
+
+// mean over the time p covers, mA
+static double averageCurrent(const PowerTime &p) {
+  uint64_t total = p.mcuActive + p.mcuIdle + p.mcuStandby;
+  if (total == 0) {
+    return 0;
+  }
+  double charge = p.mcuActive * CURRENT_MCU_ACTIVE + p.mcuIdle * CURRENT_MCU_IDLE + p.mcuStandby * CURRENT_MCU_STANDBY +
+    p.displayLit * CURRENT_DISPLAY_LIT + p.displayStandby * CURRENT_DISPLAY_STANDBY +
+    p.playerPlaying * CURRENT_PLAYER_PLAYING + p.playerIdle * CURRENT_PLAYER_IDLE +
+    p.playerLowPower * CURRENT_PLAYER_LOW + p.sdReading * (CURRENT_SD_READING - CURRENT_SD_IDLE);
+  return charge / total + CURRENT_SD_IDLE + CURRENT_RTC;
+}
+
+static double percent(uint64_t part, uint64_t total) {
+  return total ? 100.0 * part / total : 0;
+}
+
+static const char *const STATE_NAMES[] = {
+  "DISPLAY_VOLUME", "DISPLAY_TIME", "SET_HOURS", "SET_MINUTES", "DISPLAY_DATE", "SET_YEAR", "SET_MONTH",
+  "SET_DAY", "DISPLAY_ALARM_1", "SET_ENABLED_1", "SET_HOURS_1", "SET_MINUTES_1", "SET_WEEKEND_1",
+  "SET_TRACK_1", "DISPLAY_ALARM_2", "SET_ENABLED_2", "SET_HOURS_2", "SET_MINUTES_2", "SET_WEEKEND_2",
+  "SET_TRACK_2", "RINGING_ALARM_1", "RINGING_ALARM_2", "RINGING_NAP", "DISPLAY_NAP_INTRO", "SET_NAP",
+  "DISPLAY_NAP", "DARK_MODE", "DISPLAY_BENCHMARK"
+};
+
+static bool verbose = false;
+
+/**********
+ * Oracle *
+ **********/
+
+// First minute strictly after `after` where the rule matches, 0 if none.
+// Weeks start on Sundays and are counted from the one of 1970-01-01.
+static uint32_t occurrence(const Alarm &a, uint32_t after) {
+  if (!a.enabled || !(a.days & ALL_DAYS)) {
+    return 0;
+  }
+  for (uint32_t day = after / 86400; day <= after / 86400 + 7 * ALARM_MAX_EVERY_WEEKS + 1; day++) {
+    uint8_t weekday = DateTime(day * 86400).dayOfTheWeek();
+    uint32_t t = day * 86400 + a.hour * 3600 + a.minute * 60;
+    uint32_t week = (day - weekday + 4) / 7;
+    if (t > after && (a.days >> weekday & 1) && week % a.everyWeeks == a.weekPhase) {
+      return t;
+    }
+  }
+  return 0;
+}
+
+// when one alarm should ring next, as the user set it
+class Expected {
+  public:
+    Alarm alarm;
+    uint32_t next = 0;
+    uint32_t skipped = 0; // the occurrence skipNext skips, until it's past
+    uint32_t lastRing = 0;
+    uint32_t rings = 0;
+
+    // the settings or the time changed, at clock time now: from the start
+    // of this minute
+    void restart(uint32_t now) {
+      // back in time, rings in the future happen again
+      if (lastRing > now) {
+        lastRing = 0;
+      }
+      next = occurrence(alarm, max(now - now % 60 - 1, lastRing));
+      skipped = 0;
+      if (alarm.skipNext && next != 0) {
+        skipped = next;
+        next = occurrence(alarm, skipped);
+      }
+    }
+
+    const char *tick(uint32_t now) {
+      if (skipped != 0 && now >= skipped) {
+        skipped = 0;
+        alarm.skipNext = false;
+      }
+      if (next != 0 && now >= next + 60 + RING_SLACK) {
+        return fail("missed ring", "expected at %u, now %u", next, now);
+      }
+      return nullptr;
+    }
+
+    const char *rang(uint32_t now) {
+      if (next == 0 || now < next || now >= next + 60) {
+        return fail("unexpected ring", "at %u, expected at %u", now, next);
+      }
+      lastRing = next;
+      rings++;
+      if (alarm.oneShot) {
+        alarm.enabled = false;
+        next = 0;
+      }
+      else {
+        next = occurrence(alarm, next);
+      }
+      return nullptr;
+    }
+
+    // no ring, skipped or not, within margin of [from, to]
+    bool clear(uint32_t from, uint32_t to) {
+      return clear(next, from, to) && clear(skipped, from, to);
+    }
+
+  private:
+    static bool clear(uint32_t ring, uint32_t from, uint32_t to) {
+      return ring == 0 || ring + 60 + SAFE_MARGIN < from || ring > to + SAFE_MARGIN;
+    }
+};
+
+/********
+ * Soak *
+ ********/
+
+typedef enum {
+  ACTION_SETTINGS,
+  ACTION_TIME,
+  ACTION_NAP,
+  ACTION_DATE_MENU,
+  ACTION_LOOK,
+  ACTION_RESET,
+  ACTION_POWER,
+  ACTION_SYNC,
+  ACTION_CARD,
+  ACTION_COUNT
+} Action;
+
+static const uint8_t ACTION_WEIGHTS[ACTION_COUNT] = { 25, 10, 15, 15, 10, 5, 5, 10, 5 };
+
+// A ping answer (Clock::sendTimeSync) mapped onto the host clock
+struct SyncSample {
+  uint32_t receivedUs;
+  uint32_t edgeTime;
+  uint32_t edgeUs;
+  int8_t aging;
+  uint32_t lastSync;
+  int64_t delayUs;
+  double hostMid;
+  uint32_t clockMid;
+
+  double toHost(uint32_t clockUs) const {
+    return hostMid + (int32_t) (clockUs - clockMid);
+  }
+  uint32_t toClock(uint64_t hostUs) const {
+    return clockMid + (uint32_t) llround(hostUs - hostMid);
+  }
+};
+
+// the best round trip and the last answer
+struct SyncMeasure {
+  SyncSample best;
+  SyncSample last;
+  bool fresh; // an edge was seen since the first ping
+  double errorUs; // RTC ahead of the host at the last edge
+};
+
+class Soak {
+  public:
+    Soak(uint32_t seed, uint16_t years) : random(seed), years(years) {}
+    const char *run();
+    void printEvents();
+
+  private:
+    std::mt19937 random;
+    uint16_t years;
+    uint32_t end; // clock time
+    const char *failure = nullptr;
+    bool booted = false;
+    uint8_t bootCause = PM_RCAUSE_POR;
+    State lastState = DISPLAY_TIME;
+    State sounding = DISPLAY_TIME; // the ringing state a track started for
+    uint64_t loops = 0;
+
+    Expected expected[2];
+    uint32_t expectedNap = 0;
+    bool timeChanging = false; // the oracle waits for the RTC to be set, or a boot
+
+    uint64_t lastInput = 0; // sim.now of the last release, or boot
+    uint64_t awakeSince = 0; // sim.now DISPLAY_TIME was entered
+    std::deque<uint64_t> releases; // of the presses scheduled
+    uint64_t nextAction = 0;
+    Action action = ACTION_LOOK;
+    uint32_t lastReset = 0; // clock time
+
+    uint32_t lastMillis = 0;
+    uint32_t lastMicros = 0;
+    bool wrapPlanned = false;
+
+    uint64_t hostBase = 0; // host clock (local us since 1970) at sim.now 0
+    bool listening = false; // to the sketch's frames
+    std::vector<uint8_t> received;
+    std::deque<std::pair<uint32_t, State>> ringLog; // clock time, ringing state
+
+    // summary
+    uint32_t naps = 0;
+    uint32_t dateChecks = 0;
+    uint32_t timeChanges = 0;
+    uint32_t resets = 0;
+    uint32_t millisWraps = 0;
+    uint32_t wrapsPressed = 0;
+    uint32_t microsWraps = 0;
+    uint32_t syncs = 0;
+    uint32_t agingCorrections = 0;
+    uint32_t cardSwaps = 0;
+    uint32_t tones = 0;
+    uint32_t trackLoops = 0;
+    uint8_t brightness = 0; // the card's config file has
+    // most a loop put on the bus through I2CBus, blocking transfers aside
+    uint32_t rtcLoopBytes = 0;
+    uint32_t displayLoopBytes = 0;
+    uint8_t lastMonth = 0;
+    uint64_t stateTime[STATE_COUNT] = {}; // us
+    // 3 * global_gain (1.5 dB per unit) - attenuation, by volume setting
+    std::map<uint8_t, int> levels;
+
+    std::deque<std::string> events;
+
+    uint32_t below(uint32_t n) {
+      return random() % n;
+    }
+    uint32_t now() {
+      return sim.rtcTime();
+    }
+    bool clear(uint32_t from, uint32_t to) {
+      return expected[0].clear(from, to) && expected[1].clear(from, to) &&
+        (expectedNap == 0 || expectedNap + SAFE_MARGIN < from || expectedNap > to + SAFE_MARGIN);
+    }
+    void log(const char *format, ...);
+    void wire();
+    uint64_t gap();
+    bool step(uint64_t gap);
+    void runFor(uint64_t us);
+    void observe();
+    void rang(const std::string &track);
+    void press(uint8_t b, uint64_t at, uint32_t duration);
+    bool click(uint8_t b, State expectedState);
+    bool wake();
+    void queue(uint8_t type, const uint8_t *payload, uint8_t length);
+    void send(uint8_t type, const uint8_t *payload, uint8_t length);
+    bool receive(uint8_t type, uint8_t *payload, uint8_t *length = nullptr);
+    uint64_t hostMicros() {
+      return hostBase + sim.now;
+    }
+    void spin(uint64_t us);
+    bool ping(uint8_t seq, SyncSample &s);
+    bool measure(SyncMeasure &m);
+    void planAction();
+    void planWrap();
+    void act();
+    void changeSettings();
+    void changeTime();
+    void nap();
+    void dateMenu();
+    void reset(bool power);
+    void sync();
+    void swapCard();
+    void provision();
+    void checkHistory();
+};
+
+void Soak::log(const char *format, ...) {
+  char line[192];
+  int n = snprintf(line, sizeof(line), "%" PRIu64 " ", sim.now / 1000);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line + n, sizeof(line) - n, format, args);
+  va_end(args);
+  if (verbose) {
+    printf("%s\n", line);
+    fflush(stdout);
+  }
+  events.push_back(line);
+  if (events.size() > EVENTS_KEPT) {
+    events.pop_front();
+  }
+}
+
+void Soak::printEvents() {
+  for (const std::string &e : events) {
+    printf("%s\n", e.c_str());
+  }
+}
+
+// everything present, USB connected so that SysTick runs while the sketch
+// sleeps, 4 tracks for each alarm
+void Soak::wire() {
+  SimConfig config;
+  uint16_t year = 2000 + below(100 - years);
+  config.rtcPpm = ((int32_t) below(81) - 40) / 10.0;
+  sim.begin(config, DateTime(year, 1 + below(12), 1 + below(28), below(24), below(60), 0).unixtime());
+  hostBase = sim.rtcMicros() - sim.now;
+  sim.eraseFlash();
+  for (uint8_t i = 0; i < 8; i++) {
+    char path[] = TRACK_ALARM_PATTERN;
+    *strchr(path, '?') = '1' + i;
+    sim.files[path] = 30 * 16000 + i * 20 * 16000;
+  }
+  sim.files[TRACK_BOOT] = 16000;
+  sim.files[TRACK_BUTTON_PRESS] = 3200;
+  sim.files[TRACK_NAP] = 60 * 16000;
+  provision();
+  end = DateTime(year + years, 1, 1).unixtime();
+  if (year + years > 2099) {
+    end = DateTime(2099, 12, 31).unixtime();
+  }
+  lastReset = now();
+  log("rtc %u ppb %d", now(), (int32_t) lround(config.rtcPpm * 1000));
+}
+
+// as rarely as what is going on allows
+uint64_t Soak::gap() {
+  Clock &c = *alarmClock;
+  uint64_t us = IDLE_LOOP_TIME;
+  if (!ClockProbe::idle(c)) {
+    us = LOOP_TIME;
+  }
+  else if (ClockProbe::alarmDueNextMinute(c) && DateTime(now()).second() >= 50) {
+    us = PREWARM_LOOP_TIME;
+  }
+  else if (sim.playing) {
+    us = PLAY_LOOP_TIME;
+  }
+  else if (ClockProbe::state(c) == DARK_MODE) {
+    us = LOOP_TIME; // and the sketch sleeps
+  }
+  uint64_t press = sim.nextPress();
+  bool down = false;
+  for (uint8_t b = 0; b < SIM_BUTTONS; b++) {
+    down |= sim.buttonDown(b);
+  }
+  // and until the release is debounced
+  if (down || press < sim.now + IDLE_LOOP_TIME || sim.now - lastInput < 100000) {
+    us = min(us, (uint64_t) 10000);
+  }
+  if (nextAction > sim.now) {
+    us = min(us, nextAction - sim.now);
+  }
+  return max(us, (uint64_t) 1);
+}
+
+// one loop (or boot) after gap us, false once something failed
+bool Soak::step(uint64_t gap) {
+  if (failure) {
+    return false;
+  }
+  loops++;
+  uint64_t start = sim.now;
+  try {
+    if (!booted) {
+      bootSketch(bootCause);
+      booted = true;
+      lastInput = sim.now;
+      lastState = ClockProbe::state(*alarmClock);
+      log("boot %d", bootCause);
+    }
+    else {
+      sim.advance(gap);
+      runLoop();
+      rtcLoopBytes = max(rtcLoopBytes, loopRtcTraffic.bytes - loopRtcTraffic.blockingBytes);
+      displayLoopBytes = max(displayLoopBytes, loopDisplayTraffic.bytes - loopDisplayTraffic.blockingBytes);
+    }
+  }
+  catch (const SimReset &r) {
+    log("reset %d %d %u", r.cause, trace.reason, trace.reasonArg);
+    failure = fail("unexpected reset", "cause %d reason %d arg %u", r.cause, trace.reason, trace.reasonArg);
+    return false;
+  }
+  if (listening) {
+    received.insert(received.end(), sim.serialOut.begin(), sim.serialOut.end());
+  }
+  sim.serialOut.clear();
+  stateTime[lastState] += sim.now - start;
+  observe();
+  if (!failure) {
+    failure = ClockProbe::check(*alarmClock);
+  }
+  return !failure;
+}
+
+void Soak::runFor(uint64_t us) {
+  uint64_t until = sim.now + us;
+  while (sim.now < until && step(min(gap(), until - sim.now)));
+}
+
+void Soak::observe() {
+  uint32_t t = now();
+  for (const std::string &track : sim.tracksStarted) {
+    rang(track);
+  }
+  sim.tracksStarted.clear();
+
+  State state = ClockProbe::state(*alarmClock);
+  if (state != lastState) {
+    log("state %d %d %u", lastState, state, t);
+    if (state == DARK_MODE && lastState == DISPLAY_TIME && sim.now - lastInput < (DARK_MODE_DELAY - 1000) * 1000ULL) {
+      failure = fail("display went dark early", "%" PRIu64 " ms after the last input", (sim.now - lastInput) / 1000);
+    }
+    if (state == DISPLAY_TIME) {
+      awakeSince = sim.now;
+    }
+#if FEATURE_NAP
+    if (state == DISPLAY_NAP && lastState == SET_NAP) {
+      expectedNap = ClockProbe::napTime(*alarmClock);
+    }
+    if (lastState == DISPLAY_NAP && state != RINGING_NAP) {
+      expectedNap = 0; // cancelled
+    }
+#endif
+    lastState = state;
+    if (state != sounding) {
+      sounding = DISPLAY_TIME;
+    }
+  }
+  while (!releases.empty() && releases.front() <= sim.now) {
+    lastInput = releases.front();
+    releases.pop_front();
+  }
+  // back from a ring or a nap, the delay may already be over
+  uint64_t lastActivity = max(lastInput, awakeSince);
+  if (state == DISPLAY_TIME && sim.now - lastActivity > (DARK_MODE_DELAY + DARK_MODE_SLACK) * 1000ULL) {
+    failure = fail("display never went dark", "%" PRIu64 " ms after the last input", (sim.now - lastInput) / 1000);
+  }
+
+  if (!timeChanging) {
+    for (Expected &e : expected) {
+      const char *f = e.tick(t);
+      if (f && !failure) {
+        failure = f;
+      }
+    }
+    if (expectedNap != 0 && t > expectedNap + RING_SLACK + 1 && !failure) {
+      failure = fail("nap never rang", "expected at %u, now %u", expectedNap, t);
+    }
+  }
+
+  uint32_t ms = sim.ticks / 1000;
+  uint32_t us = sim.ticks;
+  if (ms < lastMillis) {
+    millisWraps++;
+    wrapPlanned = false;
+    log("wrap millis");
+  }
+  if (us < lastMicros) {
+    microsWraps++;
+  }
+  lastMillis = ms;
+  lastMicros = us;
+}
+
+// a track started: which alarm, or the nap. The tone rings for whichever is
+// due.
+void Soak::rang(const std::string &track) {
+  uint32_t t = now();
+  const char *f = nullptr;
+  char nap[] = TRACK_NAP;
+  char pattern[] = TRACK_ALARM_PATTERN;
+  char *digit = strchr(pattern, '?');
+  *digit = 0;
+  int8_t alarm = -1; // the nap
+  State state = ClockProbe::state(*alarmClock);
+  if ((state == RINGING_ALARM_1 || state == RINGING_ALARM_2) && state == sounding) {
+    log("loop %u", t); // a short track again, the same ring
+    trackLoops++;
+    return;
+  }
+  if (track == SIM_TONE) {
+    log("tone %u", t);
+    tones++;
+    if (expectedNap == 0 || t + RING_SLACK < expectedNap) {
+      alarm = expected[1].next != 0 && expected[1].next <= t && t < expected[1].next + 60;
+    }
+  }
+  else if (track != nap) {
+    if (track.compare(0, digit - pattern, pattern) != 0 || track.size() <= (size_t) (digit - pattern)) {
+      return; // boot and button sounds
+    }
+    alarm = (track[digit - pattern] - '1') / 4;
+    if (ClockProbe::indexed(*alarmClock) && sim.volume != VOLUME_MUTE) {
+      uint8_t volume = ClockProbe::volume(*alarmClock);
+      int level = 3 * Sim::fileGain(track) - sim.volume;
+      if (levels.count(volume) && levels[volume] != level && !failure) {
+        failure = fail("tracks not as loud", "%s at %d, %d before at volume %u", track.c_str(), level, levels[volume], volume);
+      }
+      levels[volume] = level;
+    }
+  }
+  if (alarm < 0) {
+    log("nap %u", t);
+    ringLog.push_back({ t, RINGING_NAP });
+    // currentTime is the RTC read of the loop before, up to 2s behind with
+    // idle loops, when the nap is set and when it's checked
+    if (expectedNap == 0 || t < expectedNap || t > expectedNap + RING_SLACK) {
+      f = fail("nap rang off time", "at %u, expected at %u", t, expectedNap);
+    }
+    expectedNap = 0;
+    naps++;
+  }
+  else {
+    log("ring %d %u", alarm, t);
+    ringLog.push_back({ t, alarm == 0 ? RINGING_ALARM_1 : RINGING_ALARM_2 });
+    f = expected[alarm].rang(t);
+  }
+  if (f && !failure) {
+    failure = f;
+  }
+  sounding = state;
+  // half of the time, stopped before the end of the track
+  if (below(2)) {
+    uint32_t after = 3 + below(40);
+    log("action stop %u", after);
+    press(BUTTON_TOP, sim.now + after * 1000000ULL, 80000);
+  }
+}
+
+void Soak::press(uint8_t b, uint64_t at, uint32_t duration) {
+  sim.button(b, true, at);
+  sim.button(b, false, at + duration);
+  releases.push_back(at + duration);
+  std::sort(releases.begin(), releases.end());
+}
+
+// false (and the run fails) if the state isn't the expected one after it
+bool Soak::click(uint8_t b, State expectedState) {
+  press(b, sim.now + 1000, 80000);
+  runFor(250000);
+  State state = ClockProbe::state(*alarmClock);
+  if (state != expectedState && !failure) {
+    failure = fail("unexpected menu state", "%s instead of %s", STATE_NAMES[state], STATE_NAMES[expectedState]);
+  }
+  return !failure;
+}
+
+// to DISPLAY_TIME from dark mode
+bool Soak::wake() {
+  State state = ClockProbe::state(*alarmClock);
+  if (state == DARK_MODE) {
+    return click(BUTTON_TOP, DISPLAY_TIME);
+  }
+  return state == DISPLAY_TIME;
+}
+
+void Soak::queue(uint8_t type, const uint8_t *payload, uint8_t length) {
+  uint16_t crc = crc16(crc16(0xFFFF, type), length);
+  sim.serialIn.push_back(0xA5);
+  sim.serialIn.push_back(type);
+  sim.serialIn.push_back(length);
+  for (uint8_t i = 0; i < length; i++) {
+    sim.serialIn.push_back(payload[i]);
+    crc = crc16(crc, payload[i]);
+  }
+  sim.serialIn.push_back(crc);
+  sim.serialIn.push_back(crc >> 8);
+}
+
+void Soak::send(uint8_t type, const uint8_t *payload, uint8_t length) {
+  queue(type, payload, length);
+  // read when the sketch wakes up, a minute at most in dark mode
+  uint64_t until = sim.now + 70000000;
+  while (!sim.serialIn.empty() && sim.now < until && step(gap()));
+  runFor(100000);
+}
+
+// A day or so from now, or the next calendar edge (Feb 28, Feb 29, Mar 1,
+// Dec 31, Jan 1) for the date menu. Away from midnight and from any ring.
+void Soak::planAction() {
+  uint32_t weight = below(100);
+  uint8_t a = 0;
+  while (weight >= ACTION_WEIGHTS[a]) {
+    weight -= ACTION_WEIGHTS[a++];
+  }
+  action = (Action) a;
+  if ((action == ACTION_RESET || action == ACTION_POWER) && now() - lastReset < RESET_MIN_DAYS * 86400UL) {
+    action = ACTION_LOOK;
+  }
+  uint32_t t = now() + 3600 + below(3 * 86400);
+  for (uint32_t day = now() / 86400 + 1; day <= t / 86400; day++) {
+    DateTime d(day * 86400);
+    if ((d.month() == 2 && d.day() >= 28) || (d.month() == 3 && d.day() == 1) ||
+        (d.month() == 12 && d.day() == 31) || (d.month() == 1 && d.day() == 1)) {
+      action = ACTION_DATE_MENU;
+      t = day * 86400 + below(86400);
+      break;
+    }
+  }
+  while (t % 86400 < 600 || t % 86400 > 86400 - 600 || !clear(t, t + 30 * 60)) {
+    t += 600;
+  }
+  nextAction = sim.now + (uint64_t) (t - now()) * 1000000;
+}
+
+// A click 30s before millis() wraps, and a long press (a nap) across it:
+// the press, the long press and the dark mode timeout straddle the wrap.
+void Soak::planWrap() {
+  uint32_t toWrap = UINT32_MAX - (uint32_t) (sim.ticks / 1000);
+  if (wrapPlanned || toWrap > 120000 || toWrap < 35000) {
+    return;
+  }
+  State state = ClockProbe::state(*alarmClock);
+  if ((state != DISPLAY_TIME && state != DARK_MODE) || !clear(now(), now() + 20 * 60) ||
+      nextAction < sim.now + 20 * 60 * 1000000ULL) {
+    return;
+  }
+  wrapPlanned = true;
+  wrapsPressed++;
+  uint64_t wrap = sim.now + toWrap * 1000ULL;
+  log("action wrap %u", toWrap);
+  press(BUTTON_TOP, wrap - 30000000, 80000);
+  press(BUTTON_TOP, wrap - 1000000, LONG_PRESS_DELAY * 1000 + 1000000);
+}
+
+void Soak::act() {
+  State state = ClockProbe::state(*alarmClock);
+  if ((state != DISPLAY_TIME && state != DARK_MODE) || !clear(now(), now() + 20 * 60)) {
+    // a nap, a ring or a menu left open: later
+    nextAction = sim.now + 600 * 1000000ULL;
+    return;
+  }
+  switch (action) {
+    case ACTION_SETTINGS:
+      changeSettings();
+      break;
+    case ACTION_TIME:
+      changeTime();
+      break;
+    case ACTION_NAP:
+      nap();
+      break;
+    case ACTION_DATE_MENU:
+      dateMenu();
+      break;
+    case ACTION_LOOK:
+      log("action look");
+      wake();
+      break;
+    case ACTION_RESET:
+    case ACTION_POWER:
+      reset(action == ACTION_POWER);
+      break;
+    case ACTION_SYNC:
+      sync();
+      break;
+    case ACTION_CARD:
+      swapCard();
+      break;
+    default:
+      break;
+  }
+  planAction();
+}
+
+// alarm 1 on tracks 1-4, alarm 2 on 5-8 and 5 minutes apart at least: a
+// track tells which alarm rang
+void Soak::changeSettings() {
+  Settings s;
+  for (uint8_t i = 0; i < 2; i++) {
+    Alarm &a = i == 0 ? s.alarm1 : s.alarm2;
+    a.enabled = below(10) < (i == 0 ? 9 : 6);
+    do {
+      a.hour = below(24);
+      a.minute = below(60);
+    } while (i == 1 && abs((a.hour * 60 + a.minute) - (s.alarm1.hour * 60 + s.alarm1.minute)) < 5);
+    uint8_t kind = below(4);
+    a.days = kind == 0 ? ALL_DAYS : kind == 1 ? WORK_DAYS : kind == 2 ? WEEKEND_DAYS : 1 + below(ALL_DAYS);
+    a.track = i * 4 + below(4);
+    a.oneShot = below(10) == 0;
+    a.skipNext = below(10) == 0;
+    a.everyWeeks = below(10) < 7 ? 1 : 2 + below(3);
+    a.weekPhase = below(a.everyWeeks);
+  }
+  s.volume = below(100);
+  // none of the new rings within the margin either
+  Expected check[2];
+  check[0].alarm = s.alarm1;
+  check[1].alarm = s.alarm2;
+  for (Expected &e : check) {
+    e.restart(now());
+    if (!e.clear(now(), now() + 120)) {
+      return;
+    }
+  }
+  log("action settings %d %02d:%02d %x/%d/%d %d%d %d %02d:%02d %x/%d/%d %d%d", s.alarm1.enabled, s.alarm1.hour,
+    s.alarm1.minute, s.alarm1.days, s.alarm1.everyWeeks, s.alarm1.weekPhase, s.alarm1.oneShot, s.alarm1.skipNext,
+    s.alarm2.enabled, s.alarm2.hour, s.alarm2.minute, s.alarm2.days, s.alarm2.everyWeeks, s.alarm2.weekPhase,
+    s.alarm2.oneShot, s.alarm2.skipNext);
+  uint8_t payload[SETTINGS_PACKED_SIZE];
+  s.pack(payload);
+  send(FRAME_SET_SETTINGS, payload, sizeof(payload));
+  expected[0].alarm = s.alarm1;
+  expected[1].alarm = s.alarm2;
+  for (Expected &e : expected) {
+    e.restart(now());
+  }
+}
+
+// an hour either way (daylight saving time), or days
+void Soak::changeTime() {
+  int32_t delta = below(2) ? 3600 : (1 + below(40)) * 86400;
+  if (below(2)) {
+    delta = -delta;
+  }
+  uint32_t t = now() + delta;
+  if (t < DateTime(2000, 1, 1).unixtime() + 86400 || t > end - 86400) {
+    return;
+  }
+  // the rings around the new time are known only after it's set
+  Expected check[2] = { expected[0], expected[1] };
+  for (Expected &e : check) {
+    e.restart(t);
+    if (!e.clear(t, t + 120)) {
+      return;
+    }
+  }
+  if ((t % 86400) < 600 || (t % 86400) > 86400 - 600) {
+    return;
+  }
+  log("action time %d", delta);
+  timeChanging = true;
+  uint8_t payload[4];
+  writeU32(payload, t);
+  send(FRAME_SET_TIME, payload, sizeof(payload));
+  runFor(1000000); // written to the RTC by a task
+  timeChanging = false;
+  if (now() - t > 120) {
+    failure = fail("time not set", "%u instead of %u", now(), t);
+    return;
+  }
+  // the host moved with it
+  hostBase = sim.rtcMicros() - sim.now;
+  for (Expected &e : expected) {
+    e.restart(now());
+  }
+  timeChanges++;
+}
+
+void Soak::nap() {
+  log("action nap");
+  if (!wake()) {
+    return;
+  }
+  press(BUTTON_TOP, sim.now + 1000, LONG_PRESS_DELAY * 1000 + 500000);
+  runFor(LONG_PRESS_DELAY * 1000 + 700000);
+  if (ClockProbe::state(*alarmClock) != DISPLAY_NAP_INTRO && !failure) {
+    failure = fail("unexpected menu state", "%s instead of DISPLAY_NAP_INTRO", STATE_NAMES[ClockProbe::state(*alarmClock)]);
+  }
+}
+
+// Through the date menu without changing anything: writeDate() must give
+// the same date back, February 29 included
+void Soak::dateMenu() {
+  log("action date");
+  if (!wake()) {
+    return;
+  }
+  DateTime before(now());
+  if (click(BUTTON_LEFT, DISPLAY_DATE) && click(BUTTON_RIGHT, SET_DAY) && click(BUTTON_RIGHT, SET_MONTH) &&
+      click(BUTTON_RIGHT, SET_YEAR) && click(BUTTON_RIGHT, DISPLAY_DATE)) {
+    runFor(1000000); // written to the RTC by a task
+    DateTime after(now());
+    if (after.year() != before.year() || after.month() != before.month() || after.day() != before.day() ||
+        now() - before.unixtime() > 10) {
+      failure = fail("date menu changed the date", "%d-%02d-%02d %02d:%02d:%02d to %d-%02d-%02d %02d:%02d:%02d",
+        before.year(), before.month(), before.day(), before.hour(), before.minute(), before.second(),
+        after.year(), after.month(), after.day(), after.hour(), after.minute(), after.second());
+    }
+    // the seconds are gone, the host is set as the clock
+    hostBase = sim.rtcMicros() - sim.now;
+    for (Expected &e : expected) {
+      e.restart(now());
+    }
+    dateChecks++;
+  }
+}
+
+// a warm reset, or the board off for up to 6 hours (the RTC goes on)
+void Soak::reset(bool power) {
+  uint32_t off = power ? 60 + below(6 * 3600) : 0;
+  if (!clear(now(), now() + off + 120)) {
+    return;
+  }
+  log("action %s %u", power ? "power" : "reset", off);
+  booted = false;
+  bootCause = power ? PM_RCAUSE_POR : PM_RCAUSE_EXT;
+  sim.watchdogEnabled = false;
+  sim.playing = false;
+  sim.sleep(off * 1000000ULL); // nothing runs, nothing wakes it up
+  // skipNext is kept in flash: only an occurrence the clock was on for uses
+  // it up
+  timeChanging = true;
+  step(0);
+  runFor(1000000);
+  timeChanging = false;
+  for (Expected &e : expected) {
+    e.restart(now());
+  }
+  lastReset = now();
+  resets++;
+}
+
+// 1ms loops
+void Soak::spin(uint64_t us) {
+  uint64_t until = sim.now + us;
+  while (sim.now < until && step(SYNC_LOOP_TIME));
+}
+
+// the next frame of that type the sketch sent, those before it are dropped
+bool Soak::receive(uint8_t type, uint8_t *payload, uint8_t *lengthOut) {
+  size_t i = 0;
+  bool found = false;
+  while (!found && received.size() - i >= 5) {
+    uint8_t length = received[i + 2];
+    if (received[i] != 0xA5 || length > LINK_MAX_PAYLOAD) {
+      i++;
+      continue;
+    }
+    if (received.size() - i < length + 5u) {
+      break;
+    }
+    uint16_t crc = 0xFFFF;
+    for (uint8_t j = 0; j < length + 2; j++) {
+      crc = crc16(crc, received[i + 1 + j]);
+    }
+    if (crc != (received[i + 3 + length] | received[i + 4 + length] << 8)) {
+      i++;
+      continue;
+    }
+    if (received[i + 1] == type) {
+      memcpy(payload, &received[i + 3], length);
+      found = true;
+    }
+    i += length + 5;
+    if (found && lengthOut) {
+      *lengthOut = length;
+    }
+  }
+  received.erase(received.begin(), received.begin() + i);
+  return found;
+}
+
+// a round trip, false (and the run fails) without an answer
+bool Soak::ping(uint8_t seq, SyncSample &s) {
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  uint64_t t0 = hostMicros();
+  queue(FRAME_SYNC_PING, &seq, 1);
+  uint64_t until = sim.now + SYNC_PING_TIMEOUT;
+  while (sim.now < until && step(SYNC_LOOP_TIME)) {
+    if (!receive(FRAME_TIME_SYNC, payload) || payload[0] != seq) {
+      continue;
+    }
+    uint64_t t3 = hostMicros();
+    s.receivedUs = readU32(payload + 1);
+    uint32_t sentUs = readU32(payload + 5);
+    s.edgeTime = readU32(payload + 9);
+    s.edgeUs = readU32(payload + 13);
+    s.aging = payload[17];
+    s.lastSync = readU32(payload + 18);
+    s.delayUs = (int64_t) (t3 - t0) - (int32_t) (sentUs - s.receivedUs);
+    s.hostMid = (t0 + t3) / 2.0;
+    s.clockMid = s.receivedUs + (int32_t) (sentUs - s.receivedUs) / 2;
+    return true;
+  }
+  if (!failure) {
+    failure = fail("no sync answer", "ping %u", seq);
+  }
+  return false;
+}
+
+bool Soak::measure(SyncMeasure &m) {
+  SyncSample first = {};
+  m.fresh = false;
+  for (uint8_t seq = 0; seq < SYNC_MAX_PINGS && !(seq >= SYNC_PINGS && m.fresh); seq++) {
+    if (!ping(seq, m.last)) {
+      return false;
+    }
+    if (seq == 0) {
+      first = m.last;
+      m.best = m.last;
+    }
+    if (m.last.delayUs < m.best.delayUs) {
+      m.best = m.last;
+    }
+    m.fresh = (int32_t) (m.last.edgeUs - first.receivedUs) > 0;
+    spin(50000);
+  }
+  m.errorUs = m.last.edgeTime * 1e6 - m.best.toHost(m.last.edgeUs);
+  return true;
+}
+
+// Stand-in for timesync.js on simulated time, the host's clock being exact
+void Soak::sync() {
+  log("action sync");
+  timeChanging = true;
+  listening = true;
+  received.clear();
+  SyncMeasure before;
+  SyncMeasure after;
+  if (!measure(before)) {
+    return;
+  }
+  int8_t aging = before.last.aging;
+  bool corrected = false;
+  double elapsed = hostMicros() / 1e6 - before.last.lastSync;
+  if (before.last.lastSync != 0 && before.fresh && elapsed >= SYNC_MIN_DRIFT_TIME) {
+    double ppm = before.errorUs / elapsed;
+    aging = max(-128, min(127, aging + (int32_t) lround(ppm / 0.1)));
+    corrected = true;
+    log("sync drift %d ppb aging %d", (int32_t) lround(ppm * 1000), aging);
+  }
+  uint64_t target = ((hostMicros() + SYNC_MIN_LEAD) / 1000000 + 1) * 1000000;
+  uint8_t payload[LINK_MAX_PAYLOAD];
+  writeU32(payload, target / 1000000);
+  writeU32(payload + 4, before.best.toClock(target));
+  payload[8] = aging;
+  queue(FRAME_SYNC_TIME, payload, 9);
+  uint64_t until = sim.now + SYNC_PING_TIMEOUT;
+  bool acked = false;
+  while (!acked && sim.now < until && step(SYNC_LOOP_TIME)) {
+    acked = receive(FRAME_ACK, payload) && payload[0] == FRAME_SYNC_TIME;
+  }
+  if (!acked || payload[1] != ACK_OK) {
+    if (!failure) {
+      failure = fail("sync refused", "acked %d status %d", acked, payload[1]);
+    }
+    return;
+  }
+  spin(target - hostMicros() + SYNC_SETTLE_TIME);
+  if (!measure(after)) {
+    return;
+  }
+  listening = false;
+  received.clear();
+  timeChanging = false;
+
+  int64_t error = (int64_t) (sim.rtcMicros() - hostMicros());
+  double ppm = (sim.rtcRate() - 1) * 1e6;
+  log("sync error %d us measured %d us ppb %d", (int32_t) error, (int32_t) llround(after.errorUs),
+    (int32_t) llround(ppm * 1000));
+  if (after.last.lastSync != target / 1000000) {
+    failure = fail("sync not written", "last sync %u instead of %u", after.last.lastSync, (uint32_t) (target / 1000000));
+  }
+  else if (error > SYNC_MAX_ERROR || error < -SYNC_MAX_ERROR) {
+    failure = fail("sync off", "RTC %d us from the host", (int32_t) error);
+  }
+  else if (corrected && fabs(ppm) > SYNC_MAX_PPM) {
+    failure = fail("aging offset off", "RTC still %d ppb off with aging %d", (int32_t) llround(ppm * 1000), aging);
+  }
+  for (Expected &e : expected) {
+    e.restart(now());
+  }
+  syncs++;
+  agingCorrections += corrected;
+}
+
+// The card pulled, then put back the next time in either slot, with the same
+// tracks: rings meanwhile have the tone (rang()), the clock notices the card
+// when it next looks at the slot.
+void Soak::swapCard() {
+  if (sim.config.cardPresent) {
+    log("action card out");
+    sim.plugCard(false, sim.config.altCard);
+    return;
+  }
+  bool alt = below(2);
+  log("action card in %d", alt);
+  provision();
+  sim.plugCard(true, alt);
+  runFor(CARD_MOUNT_TIME * 1000000ULL);
+  if (!ClockProbe::cardReady(*alarmClock) && !failure) {
+    failure = fail("card not mounted", "slot %d, %u s after it was put back", alt, CARD_MOUNT_TIME);
+  }
+  // dark, the display gets it when it wakes
+  if ((ClockProbe::brightness(*alarmClock) != brightness || (sim.displayOn && sim.displayDimming != brightness)) &&
+      !failure) {
+    failure = fail("config file not applied", "brightness %d, display at %d instead of %d",
+      ClockProbe::brightness(*alarmClock), sim.displayDimming, brightness);
+  }
+  cardSwaps++;
+}
+
+// a config file with only what the soak doesn't check otherwise
+void Soak::provision() {
+  brightness = below(16);
+  char text[96];
+  snprintf(text, sizeof(text), "# provisioned\nbrightness = %d\r\nexit_volume_delay = %d\n", brightness, EXIT_VOLUME_DELAY);
+  sim.writeText(CONFIG_FILE, text);
+}
+
+// The ring records exported are the last rings seen here. Those pending at
+// a reset are lost, resets are away from rings.
+void Soak::checkHistory() {
+  while (ringLog.size() > HISTORY_RINGS_KEPT) {
+    ringLog.pop_front();
+  }
+  listening = true;
+  received.clear();
+  uint8_t none = 0;
+  queue(FRAME_GET_HISTORY, &none, 0);
+  std::vector<std::pair<uint32_t, State>> rings;
+  uint32_t records = 0;
+  uint64_t until = sim.now + 10000000;
+  bool done = false;
+  while (!done && sim.now < until && step(SYNC_LOOP_TIME)) {
+    uint8_t payload[LINK_MAX_PAYLOAD];
+    uint8_t length;
+    while (!done && receive(FRAME_HISTORY, payload, &length)) {
+      done = length == 0;
+      for (uint8_t i = 0; i + 8 <= length; i += 8) {
+        records++;
+        if (payload[i + 4] == HISTORY_RING) {
+          rings.push_back({ readU32(payload + i), (State) payload[i + 5] });
+        }
+      }
+    }
+  }
+  listening = false;
+  received.clear();
+  if (failure) {
+    return;
+  }
+  if (!done) {
+    failure = fail("history not exported", "%u records before the timeout", records);
+    return;
+  }
+  log("history %u records %u rings", records, (uint32_t) rings.size());
+  if (rings.size() > ringLog.size()) {
+    failure = fail("history has more rings", "%u instead of %u", (uint32_t) rings.size(), (uint32_t) ringLog.size());
+    return;
+  }
+  size_t offset = ringLog.size() - rings.size();
+  for (size_t i = 0; i < rings.size(); i++) {
+    const std::pair<uint32_t, State> &seen = ringLog[offset + i];
+    if (rings[i].second != seen.second || rings[i].first + HISTORY_SLACK < seen.first ||
+        rings[i].first > seen.first + HISTORY_SLACK) {
+      failure = fail("history ring mismatch", "record %u: %s at %u, seen %s at %u", (uint32_t) i,
+        STATE_NAMES[rings[i].second], rings[i].first, STATE_NAMES[seen.second], seen.first);
+      return;
+    }
+  }
+  // the flash holds that many at least
+  if (rings.size() < min(ringLog.size(), (size_t) 100)) {
+    failure = fail("history lost rings", "%u of the last %u", (uint32_t) rings.size(), (uint32_t) ringLog.size());
+  }
+}
+
+const char *Soak::run() {
+  wire();
+  step(0);
+  // the settings of a first boot, until the first change
+  expected[0].alarm.enabled = true;
+  expected[0].alarm.hour = 7;
+  expected[0].alarm.days = WORK_DAYS;
+  for (Expected &e : expected) {
+    e.restart(now());
+  }
+  planAction();
+  while (!failure && now() < end) {
+    step(gap());
+    planWrap();
+    if (sim.now >= nextAction && !failure) {
+      act();
+    }
+    DateTime t(now());
+    if (t.month() != lastMonth) {
+      lastMonth = t.month();
+      printf("progress %u %" PRIu64 " %u %u\n", now(), loops, expected[0].rings + expected[1].rings, millisWraps);
+      fflush(stdout);
+    }
+  }
+  if (!failure) {
+    checkHistory();
+  }
+  const PowerTime &p = sim.power;
+  uint64_t total = p.mcuActive + p.mcuIdle + p.mcuStandby;
+  printf("summary years %u loops %" PRIu64 " rings %u %u naps %u dates %u times %u resets %u syncs %u "
+    "(%u aging corrections) card swaps %u (%u tones) track loops %u millis wraps %u (%u pressed) micros wraps %u "
+    "i2c bytes per loop rtc %.1f (max %u) display %.1f (max %u) "
+    "power %.2f mA %.0f mAh a day (dark mode %.1f%% ringing %.2f%%, mcu asleep %.1f%% display standby %.1f%% "
+    "player low power %.1f%% playing %.2f%%)\n", years, loops,
+    expected[0].rings, expected[1].rings, naps, dateChecks, timeChanges, resets, syncs, agingCorrections, cardSwaps,
+    tones, trackLoops, millisWraps, wrapsPressed, microsWraps, (double) sim.rtcTraffic.bytes / loops, rtcLoopBytes,
+    (double) sim.displayTraffic.bytes / loops, displayLoopBytes, averageCurrent(p), averageCurrent(p) * 24,
+    percent(stateTime[DARK_MODE], total),
+    percent(stateTime[RINGING_ALARM_1] + stateTime[RINGING_ALARM_2] + stateTime[RINGING_NAP], total),
+    percent(p.mcuIdle + p.mcuStandby, total), percent(p.displayStandby, total), percent(p.playerLowPower, total),
+    percent(p.playerPlaying, total));
+  return failure;
+}
+
+int main(int argc, char **argv) {
+  uint32_t seed = 1;
+  uint16_t years = 10;
+  for (int i = 1; i < argc; i++) {
+    std::string arg = argv[i];
+    if (arg == "--years" && i + 1 < argc) {
+      years = min(atoi(argv[++i]), 99);
+    }
+    else if (arg == "--seed" && i + 1 < argc) {
+      seed = strtoul(argv[++i], nullptr, 0);
+    }
+    else if (arg == "--verbose") {
+      verbose = true;
+    }
+    else {
+      fprintf(stderr, "usage: soak [--years N] [--seed S] [--verbose]\n");
+      return 2;
+    }
+  }
+  Soak soak(seed, max(years, (uint16_t) 1));
+  const char *failure = soak.run();
+  if (failure) {
+    printf("FAIL %s\ndetail %s\n", failure, detail);
+    if (!verbose) {
+      soak.printEvents();
+    }
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,143 @@
+// Host side of the time sync (SYNC_PING / SYNC_TIME, see Clock::syncStep):
+// pings map the clock's micros() onto the host clock, NTP style, keeping the
+// round trip with the least delay. The RTC is then written on a host second
+// boundary and its drift since the last sync goes into the DS3231 aging
+// offset. sim/soak.cpp has a stand-in host doing the same on simulated time.
+const { FRAME, ACK_STATUS, encodeFrame, decodeTimeSync, encodeSyncTime } = require("./protocol");
+
+const PINGS = 8;
+const MAX_PINGS = 40; // waiting for a second edge seen awake
+const PING_TIMEOUT = 500; // ms
+const MAX_DELAY_US = 10000; // best round trip, half of it is the worst offset error
+const MIN_LEAD_US = 300000; // from the offset estimate to the second written
+const MIN_DRIFT_TIME = 86400; // s since the last sync for a drift estimate
+const AGING_PPM = 0.1; // per aging offset step, > 0 slows the RTC down
+const SETTLE_TIME = 1500; // ms before checking the result, a second edge is seen
+
+// Local time (the clock's), in us since 1970
+function hostMicros() {
+    const us = Math.round((performance.timeOrigin + performance.now()) * 1000);
+    return us - new Date().getTimezoneOffset() * 60000000;
+}
+
+function signed32(n) {
+    return n | 0;
+}
+
+// One round trip: host send and receive (t0, t3), clock receive and send
+// (t1, t2). The clock's reading times are mapped to the middle of the round
+// trip on both sides, micros() wraps.
+function sample(t0, t3, answer) {
+    const clockMid = (answer.receivedUs + signed32(answer.sentUs - answer.receivedUs) / 2) >>> 0;
+    return {
+        answer,
+        delayUs: (t3 - t0) - signed32(answer.sentUs - answer.receivedUs),
+        hostMid: (t0 + t3) / 2,
+        clockMid,
+    };
+}
+
+function toHost(s, clockUs) {
+    return s.hostMid + signed32(clockUs - s.clockMid);
+}
+
+function toClock(s, hostUs) {
+    return (s.clockMid + Math.round(hostUs - s.hostMid)) >>> 0;
+}
+
+// RTC error against the host at the last second edge, in us, > 0 ahead
+function edgeError(s, answer) {
+    return answer.edgeTime * 1e6 - toHost(s, answer.edgeUs);
+}
+
+// The aging offset correcting the drift measured since the last sync, and
+// that drift in ppm (null when it can't be measured)
+function correctAging(answer, errorUs, hostUs) {
+    const elapsed = hostUs / 1e6 - answer.lastSync;
+    if (answer.lastSync === 0 || errorUs === null || elapsed < MIN_DRIFT_TIME) {
+        return { aging: answer.aging, ppm: null };
+    }
+    const ppm = errorUs / elapsed;
+    const aging = Math.max(-128, Math.min(127, answer.aging + Math.round(ppm / AGING_PPM)));
+    return { aging, ppm };
+}
+
+// write(frame buffer) sends to the clock, onFrame() must see every frame
+// received. run() resolves to a report.
+function createTimeSync(write) {
+    let waiting = null;
+
+    function expect(predicate, timeout) {
+        return new Promise((resolve, reject) => {
+            const timer = setTimeout(() => { waiting = null; reject(new Error("No answer from the clock")); }, timeout);
+            waiting = { predicate, resolve: frame => { clearTimeout(timer); waiting = null; resolve(frame); } };
+        });
+    }
+
+    function onFrame(type, payload) {
+        if (waiting && waiting.predicate(type, payload)) {
+            waiting.resolve({ type, payload });
+            return true;
+        }
+        return false;
+    }
+
+    async function ping(seq) {
+        const answer = expect((t, p) => t === FRAME.TIME_SYNC && p[0] === seq, PING_TIMEOUT);
+        const t0 = hostMicros();
+        write(encodeFrame(FRAME.SYNC_PING, Buffer.from([seq])));
+        const { payload } = await answer;
+        return sample(t0, hostMicros(), decodeTimeSync(payload));
+    }
+
+    // The best round trip, and the error at the last second edge if one was
+    // seen after the first ping: asleep in dark mode, the clock doesn't read
+    // its RTC, and pings keep it awake
+    async function measure() {
+        let first = null;
+        let best = null;
+        let last = null;
+        let fresh = false;
+        for (let seq = 0; seq < MAX_PINGS && !(seq >= PINGS && fresh); seq++) {
+            last = await ping(seq);
+            first = first || last;
+            if (!best || last.delayUs < best.delayUs) {
+                best = last;
+            }
+            fresh = signed32(last.answer.edgeUs - first.answer.receivedUs) > 0;
+            await new Promise(resolve => setTimeout(resolve, 50));
+        }
+        if (best.delayUs > MAX_DELAY_US) {
+            throw new Error(`Round trips too slow to sync, best ${best.delayUs}us`);
+        }
+        return { best, errorUs: fresh ? edgeError(best, last.answer) : null, answer: last.answer };
+    }
+
+    async function run() {
+        const before = await measure();
+        const { aging, ppm } = correctAging(before.answer, before.errorUs, hostMicros());
+
+        const targetUs = (Math.floor((hostMicros() + MIN_LEAD_US) / 1e6) + 1) * 1e6;
+        const ack = expect((t, p) => t === FRAME.ACK && p[0] === FRAME.SYNC_TIME, PING_TIMEOUT);
+        write(encodeFrame(FRAME.SYNC_TIME, encodeSyncTime(targetUs / 1e6, toClock(before.best, targetUs), aging)));
+        const { payload } = await ack;
+        if (payload[1] !== 0) {
+            throw new Error(`Clock refused the sync: ${ACK_STATUS[payload[1]]}`);
+        }
+
+        await new Promise(resolve => setTimeout(resolve, targetUs / 1000 - hostMicros() / 1000 + SETTLE_TIME));
+        const after = await measure();
+        return {
+            errorBeforeUs: before.errorUs,
+            errorAfterUs: after.errorUs,
+            delayUs: after.best.delayUs,
+            drift: ppm,
+            aging: { before: before.answer.aging, after: after.answer.aging },
+            synced: after.answer.lastSync === targetUs / 1e6,
+        };
+    }
+
+    return { onFrame, run };
+}
+
+module.exports = { createTimeSync, hostMicros };